@@ -18,7 +18,7 @@ namespace simit {
 namespace backend {
 
 BackendImpl* getBackendImpl(const std::string &type) {
-  if (type == "cpu") {
+  if (type == "cpu" || type == "cpu-parallel") {
     return new backend::LLVMBackend();
   }
 #ifdef GPU
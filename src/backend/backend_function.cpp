@@ -11,11 +11,14 @@ using namespace std;
 #include "util/collections.h"
 
 namespace simit {
+extern unsigned kFieldBlockSize;
+
 namespace backend {
 
 // class Function
 Function::Function(const ir::Func& func)
-    : environment(new ir::Environment(func.getEnvironment())) {
+    : environment(new ir::Environment(func.getEnvironment())),
+      fieldBlockSize(kFieldBlockSize) {
   for (const ir::Var& arg : func.getArguments()) {
     string argName = arg.getName();
     arguments.push_back(argName);
@@ -104,6 +107,25 @@ const ir::Type& Function::getBindableType(std::string bindable) const {
   return (hasArg(bindable)) ? getArgType(bindable) : getGlobalType(bindable);
 }
 
+bool Function::isSpecializedFor(const std::string& name,
+                                const simit::Set* set) const {
+  return !util::contains(specializedSetSizes, name) ||
+         specializedSetSizes.at(name) == getSetSizes(set);
+}
+
+std::vector<int> Function::getSetSizes(const simit::Set* set) {
+  return (set->getKind() == simit::Set::Grid) ? set->getDimensions()
+                                              : vector<int>({set->getSize()});
+}
+
+void Function::printObject(std::ostream &os) const {
+  simit_uerror << "This backend cannot write object files";
+}
+
+void Function::printHeader(std::ostream &os) const {
+  simit_uerror << "This backend cannot write object files";
+}
+
 const ir::Environment& Function::getEnvironment() const {
   return *environment;
 }
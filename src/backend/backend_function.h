@@ -47,6 +47,15 @@ public:
   /// Query whether the function requires intialization.
   virtual bool isInitialized() = 0;
 
+  /// Compile a version of the function with the sizes of the bound sets and
+  /// the dimensions of bound grids as constants, and bind it to the same data.
+  /// Returns nullptr if the backend does not specialize functions.
+  virtual Function* specialize() {return nullptr;}
+
+  /// Returns false if the function was specialized for a set of another size
+  /// than the given set.
+  bool isSpecializedFor(const std::string& name, const simit::Set* set) const;
+
   // TODO Should these really be an extension to the bind interface?
   //      Per-argument updates/copies.
   //      Don't always write in a new pointer (requires re-JIT), just alert to
@@ -61,6 +70,15 @@ public:
   /// Print the function as machine assembly code to the stream.
   virtual void printMachine(std::ostream &os) const = 0;
 
+  /// Write the function, its initialization and deinitialization functions,
+  /// and C harnesses that call them, to the stream as a relocatable object
+  /// file that programs can link without Simit at runtime.
+  virtual void printObject(std::ostream &os) const;
+
+  /// Write a C header that declares the externs and harnesses of the object
+  /// file written by \ref printObject.
+  virtual void printHeader(std::ostream &os) const;
+
   bool hasArg(std::string arg) const;
   const std::vector<std::string>& getArgs() const;
   const ir::Type& getArgType(std::string arg) const;
@@ -74,8 +92,20 @@ public:
 
   const ir::Environment& getEnvironment() const;
 
+  /// The number of elements per block of blocked set fields that the function
+  /// was compiled to address.
+  int getFieldBlockSize() const {return fieldBlockSize;}
+
+protected:
+  /// The set sizes (one per dimension for grids) that the function was
+  /// specialized for, by bindable name
+  std::map<std::string, std::vector<int>> specializedSetSizes;
+
+  static std::vector<int> getSetSizes(const simit::Set* set);
+
 private:
   ir::Environment* environment;
+  int fieldBlockSize;
 
   std::vector<std::string> arguments;
   std::map<std::string, ir::Type> argumentTypes;
@@ -262,7 +262,7 @@ GPUFunction::SetData GPUFunction::pushSetData(Set* set, const ir::SetType* setTy
         << " to unstructured type.";
 
     // Endpoints index
-    int *endpoints = set->getEndpointsData();
+    const int *endpoints = set->getEndpointsData();
     CUdeviceptr *endpointBuffer = new CUdeviceptr();
     size_t size = set->getSize() * set->getCardinality() * sizeof(int);
     simit_iassert(size != 0)
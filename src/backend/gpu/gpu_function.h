@@ -29,6 +29,8 @@ class GPUFunction : public LLVMFunction {
 
   void print(std::ostream &os) const;
   void printMachine(std::ostream &os) const {}
+  void printObject(std::ostream &os) const {Function::printObject(os);}
+  void printHeader(std::ostream &os) const {Function::printHeader(os);}
 
   virtual void bind(const std::string& name, simit::Set* set);
   virtual void bind(const std::string& name, void* data);
@@ -38,6 +40,9 @@ class GPUFunction : public LLVMFunction {
 
   virtual FuncType init();
 
+  /// GPU functions are not specialized
+  virtual Function* specialize() {return nullptr;}
+
  private:
   // Struct for tracking arguments being pushed and pulled to/from GPU
   // TODO: Split tracking current function args from any data we own on the GPU
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <stack>
 #include <algorithm>
+#include <mutex>
 
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/LegacyPassManager.h"
@@ -12,6 +13,7 @@
 #include "llvm/IR/Value.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Verifier.h"
@@ -19,14 +21,19 @@
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Analysis/Passes.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 
+#include "llvm_context.h"
 #include "llvm_types.h"
 #include "llvm_codegen.h"
 #include "llvm_util.h"
 #include "llvm_data_layouts.h"
+#include "llvm_object_cache.h"
 
+#include "compile_profile.h"
 #include "macros.h"
 #include "types.h"
 #include "func.h"
@@ -42,37 +49,51 @@
 #include "macros.h"
 #include "path_expressions.h"
 #include "util/collections.h"
+#include "util/util.h"
 
 using namespace std;
 using namespace simit::ir;
 
 namespace simit {
+extern unsigned kFieldBlockSize;
+
 namespace backend {
 
 const std::string VAL_SUFFIX(".val");
 const std::string PTR_SUFFIX(".ptr");
 const std::string LEN_SUFFIX(".len");
+const std::string HANDLE_SUFFIX(".handle");
 
 // class LLVMBackend
-bool LLVMBackend::llvmInitialized = false;
+static std::once_flag llvmInitialized;
 
 shared_ptr<llvm::EngineBuilder> createEngineBuilder(llvm::Module *module) {
   shared_ptr<llvm::EngineBuilder> engineBuilder(
       new llvm::EngineBuilder(std::unique_ptr<llvm::Module>(module)));
+
+  // Generate code for the target CPU, so that instruction selection and the
+  // vectorizers use all of its vector extensions
+  engineBuilder->setMCPU(getTargetCPU());
+  engineBuilder->setMAttrs(getTargetFeatures());
   return engineBuilder;
 }
 
-LLVMBackend::LLVMBackend() : builder(new LLVMIRBuilder(LLVM_CTX)) {
-  if (!llvmInitialized) {
+LLVMBackend::LLVMBackend()
+    : parallelLoopID(nullptr), builder(new LLVMIRBuilder(LLVM_CTX)) {
+  std::call_once(llvmInitialized, []() {
     llvm::InitializeNativeTarget();
     llvm::InitializeNativeTargetAsmPrinter();
     llvm::InitializeNativeTargetAsmParser();
-    llvmInitialized = true;
-  }
+  });
 }
 
 LLVMBackend::~LLVMBackend() {}
 
+void LLVMBackend::setSetSizes(
+    const std::map<std::string, std::vector<int>>& setSizes) {
+  this->setSizes = setSizes;
+}
+
 // TODO: Remove this function, once the old init system has been removed
 Func LLVMBackend::makeSystemTensorsGlobal(Func func) {
   class MakeSystemTensorsGlobalRewriter : public ir::IRRewriter {
@@ -110,6 +131,14 @@ Func LLVMBackend::makeSystemTensorsGlobal(Func func) {
 }
 
 Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
+  // Every compilation generates code in a context of its own, since contexts
+  // are not thread-safe and functions may be compiled concurrently. The
+  // compiled function keeps the context alive.
+  LLVMContextScope contextScope(
+      std::shared_ptr<llvm::LLVMContext>(new llvm::LLVMContext()));
+  this->builder.reset(new LLVMIRBuilder(LLVM_CTX));
+
+  PassTimer irTimer("LLVM IR Generation");
   this->module = new llvm::Module("simit", LLVM_CTX);
 
   simit_iassert(func.getBody().defined())
@@ -120,6 +149,13 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
   this->symtable.clear();
   this->buffers.clear();
   this->globals.clear();
+  this->temporaries.clear();
+  this->temporaryPtrs.clear();
+  this->fieldScopes.clear();
+  this->temporaryScopes.clear();
+  this->aliasScopeNames.clear();
+  this->scopedAccesses.clear();
+  this->parallelLoopID = nullptr;
   this->storage = storage;
 
   // This backend stores dense tensors and sparse tensors with path expressions
@@ -129,6 +165,20 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
   this->environment = &func.getEnvironment();
   emitGlobals(*this->environment);
 
+  // Only the externs and the arguments of the compiled function refer to the
+  // bound sets, since internal functions may be called with other sets
+  this->constantSetSizes.clear();
+  for (const Var& var : this->environment->getExternVars()) {
+    if (util::contains(setSizes, var.getName())) {
+      constantSetSizes.insert({var, setSizes.at(var.getName())});
+    }
+  }
+  for (const Var& var : func.getArguments()) {
+    if (util::contains(setSizes, var.getName())) {
+      constantSetSizes.insert({var, setSizes.at(var.getName())});
+    }
+  }
+
   // Create compute functions
   vector<Func> callTree = getCallTree(func);
   std::reverse(callTree.begin(), callTree.end());
@@ -166,11 +216,15 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
   }
   simit_iassert(llvmFunc);
 
-  // Declare malloc and free if necessary
+  // Declare posix_memalign and free if necessary. Buffers are allocated the
+  // way util::alignedMalloc allocates them. The generated code cannot call
+  // util::alignedMalloc itself, since object files written by printObject do
+  // not link the Simit runtime.
   llvm::FunctionType *m =
-      llvm::FunctionType::get(LLVM_INT8_PTR, {LLVM_INT}, false);
-  llvm::Function *malloc =
-      llvm::cast<llvm::Function>(module->getOrInsertFunction("malloc", m));
+      llvm::FunctionType::get(LLVM_INT, {LLVM_INT8_PTR->getPointerTo(),
+                                         LLVM_INT64, LLVM_INT64}, false);
+  llvm::Function *posixMemalign = llvm::cast<llvm::Function>(
+      module->getOrInsertFunction("posix_memalign", m));
   llvm::FunctionType *f =
       llvm::FunctionType::get(LLVM_VOID, {LLVM_INT8_PTR}, false);
   llvm::Function *free =
@@ -191,7 +245,16 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
     llvm::Value *len= emitComputeLen(ttype,this->storage.getStorage(bufferVar));
     unsigned compSize = ttype->getComponentType().bytes();
     llvm::Value *size = builder->CreateMul(len, llvmInt(compSize));
-    llvm::Value *mem = builder->CreateCall(malloc, size);
+
+    // posix_memalign may return null for zero-sized buffers
+    size = builder->CreateZExt(size, LLVM_INT64);
+    size = builder->CreateSelect(
+        builder->CreateICmpEQ(size, llvmInt(0, 64)), llvmInt(1, 64), size);
+    llvm::Value *memPtr = builder->CreateAlloca(LLVM_INT8_PTR);
+    builder->CreateStore(llvm::ConstantPointerNull::get(LLVM_INT8_PTR), memPtr);
+    builder->CreateCall(posixMemalign,
+                        {memPtr, llvmInt(util::kBufferAlignment, 64), size});
+    llvm::Value *mem = builder->CreateLoad(memPtr);
 
     mem = builder->CreateCast(llvm::Instruction::CastOps::BitCast, mem, ltype);
     builder->CreateStore(mem, bufferVal);
@@ -215,40 +278,73 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
   builder->CreateRetVoid();
   symtable.clear();
 
+  emitAliasScopes();
+
   simit_iassert(!llvm::verifyModule(*module))
       << "LLVM module does not pass verification";
+  irTimer.stop([this]() {return countInstructions(*module);});
 
   auto engineBuilder = createEngineBuilder(module);
 
-#ifndef SIMIT_DEBUG
-  // Run LLVM optimization passes on the function
-  // We use the built-in PassManagerBuilder to build
-  // the set of passes that are similar to clang's -O3
-  llvm::legacy::FunctionPassManager fpm(module);
-  llvm::legacy::PassManager mpm;
-  llvm::PassManagerBuilder pmBuilder;
-  
-  pmBuilder.OptLevel = 3;
-
-  pmBuilder.BBVectorize = 1;
-  pmBuilder.LoopVectorize = 1;
-//  pmBuilder.LoadCombine = 1;
-  pmBuilder.SLPVectorize = 1;
-
-  llvm::DataLayout dataLayout(module);
-  module->setDataLayout(dataLayout);
+  // Tell the optimization passes which target machine the code is for
+  std::unique_ptr<llvm::TargetMachine> target(engineBuilder->selectTarget());
+  module->setTargetTriple(target->getTargetTriple().str());
+  module->setDataLayout(target->createDataLayout());
 
-  pmBuilder.populateFunctionPassManager(fpm);
-  pmBuilder.populateModulePassManager(mpm);
+  // Identify the module by its cache key, so that the execution engine loads
+  // its machine code if it was compiled before. Cached modules are not
+  // optimized again.
+  bool cached = false;
+  if (std::shared_ptr<LLVMObjectCache> objectCache = getObjectCache()) {
+    module->setModuleIdentifier(LLVMObjectCache::getKey(*module));
+    cached = objectCache->hasObject(*module);
+  }
 
-  fpm.doInitialization();
-  fpm.run(*llvmFunc);
-  fpm.doFinalization();
-  
-  mpm.run(*module);
+#ifndef SIMIT_DEBUG
+  if (!cached) {
+    // Run LLVM optimization passes on the function
+    // We use the built-in PassManagerBuilder to build
+    // the set of passes that are similar to clang's -O3
+    llvm::legacy::FunctionPassManager fpm(module);
+    llvm::legacy::PassManager mpm;
+    llvm::PassManagerBuilder pmBuilder;
+
+    pmBuilder.OptLevel = 3;
+
+    pmBuilder.BBVectorize = 1;
+    pmBuilder.LoopVectorize = 1;
+//    pmBuilder.LoadCombine = 1;
+    pmBuilder.SLPVectorize = 1;
+
+    // Let the vectorizers query the costs of the target's vector instructions
+    fpm.add(llvm::createTargetTransformInfoWrapperPass(
+        target->getTargetIRAnalysis()));
+    mpm.add(llvm::createTargetTransformInfoWrapperPass(
+        target->getTargetIRAnalysis()));
+
+    pmBuilder.populateFunctionPassManager(fpm);
+    pmBuilder.populateModulePassManager(mpm);
+
+    PassTimer fpmTimer("LLVM Function Passes");
+    fpm.doInitialization();
+    fpm.run(*llvmFunc);
+    fpm.doFinalization();
+    fpmTimer.stop([this]() {return countInstructions(*module);});
+
+    PassTimer mpmTimer("LLVM Module Passes");
+    mpm.run(*module);
+    mpmTimer.stop([this]() {return countInstructions(*module);});
+  }
 #endif
 
-  return new LLVMFunction(func, storage, llvmFunc, module, engineBuilder);
+  // The function generates machine code (or loads it from the cache) when it
+  // creates its execution engine
+  PassTimer codegenTimer(cached ? "LLVM Code Cache Load"
+                                : "LLVM Code Generation");
+  Function* function = new LLVMFunction(func, storage, llvmFunc, module,
+                                        engineBuilder);
+  codegenTimer.stop([this]() {return countInstructions(*module);});
+  return function;
 }
 
 void LLVMBackend::compile(const ir::Literal& literal) {
@@ -312,14 +408,12 @@ void LLVMBackend::compile(const ir::VarExpr& varExpr) {
   string valName = string(val->getName()) + VAL_SUFFIX;
 
   // Globals are stored as pointer-pointers so we must load them
-  if (util::contains(globals, varExpr.var)) {
-    val = builder->CreateLoad(val, ptrName);
-    // Cast non-generic address spaces into generic
-    if (val->getType()->isPointerTy() &&
-        val->getType()->getPointerAddressSpace() != 0) {
-      llvm::Type* eltTy = val->getType()->getPointerElementType();
-      val = builder->CreateAddrSpaceCast(val, eltTy->getPointerTo(0));
-    }
+  if (util::contains(temporaries, varExpr.var) &&
+      util::contains(globals, varExpr.var)) {
+    val = emitLoadTemporary(varExpr.var, val);
+  }
+  else if (util::contains(globals, varExpr.var)) {
+    val = emitLoadGlobal(val, ptrName);
   }
 
   // Special case: check if the symbol is a scalar and the llvm value is a ptr,
@@ -336,6 +430,39 @@ void LLVMBackend::compile(const ir::VarExpr& varExpr) {
   }
 }
 
+llvm::Value *LLVMBackend::emitLoadGlobal(llvm::Value *global,
+                                         const std::string &name) {
+  llvm::Value *ptr = builder->CreateLoad(global, name);
+  // Cast non-generic address spaces into generic
+  if (ptr->getType()->isPointerTy() &&
+      ptr->getType()->getPointerAddressSpace() != 0) {
+    llvm::Type* eltTy = ptr->getType()->getPointerElementType();
+    ptr = builder->CreateAddrSpaceCast(ptr, eltTy->getPointerTo(0));
+  }
+  return ptr;
+}
+
+llvm::Value *LLVMBackend::emitLoadTemporary(const ir::Var &var,
+                                            llvm::Value *global) {
+  // Temporaries are allocated before the function runs and are not
+  // reallocated by it, so each LLVM function loads a temporary and assumes
+  // its alignment once, in its entry block
+  llvm::Function *function = builder->GetInsertBlock()->getParent();
+  auto key = std::make_pair(function, var);
+  if (!util::contains(temporaryPtrs, key)) {
+    llvm::IRBuilderBase::InsertPointGuard guard(*builder);
+    llvm::BasicBlock &entry = function->getEntryBlock();
+    builder->SetInsertPoint(&entry, entry.getFirstInsertionPt());
+    llvm::Value *ptr = emitLoadGlobal(global, global->getName());
+    if (ptr->getType()->isPointerTy()) {
+      builder->CreateAlignmentAssumption(*dataLayout, ptr,
+                                         util::kBufferAlignment);
+    }
+    temporaryPtrs.insert({key, ptr});
+  }
+  return temporaryPtrs.at(key);
+}
+
 void LLVMBackend::compile(const ir::Load& load) {
   llvm::Value *buffer = compile(load.buffer);
   llvm::Value *index = compile(load.index);
@@ -345,7 +472,9 @@ void LLVMBackend::compile(const ir::Load& load) {
       builder.get(), buffer, index, locName);
 
   string valName = string(buffer->getName()) + VAL_SUFFIX;
-  val = builder->CreateLoad(bufferLoc, valName);
+  llvm::LoadInst *loadInst = builder->CreateLoad(bufferLoc, valName);
+  annotateAccess(loadInst, load.buffer);
+  val = loadInst;
 }
 
 void LLVMBackend::compile(const ir::FieldRead& fieldRead) {
@@ -365,10 +494,13 @@ void LLVMBackend::compile(const ir::IndexRead& indexRead) {
     case ir::IndexRead::Endpoints:
       val = layout->getEpsArray();
       break;
-    case ir::IndexRead::GridDim:
+    case ir::IndexRead::GridDim: {
       simit_iassert(indexRead.edgeSet.type().isGridSet());
-      val = layout->getSize(indexRead.index);
+      const vector<int>* sizes = getConstantSetSizes(indexRead.edgeSet);
+      val = (sizes != nullptr) ? llvmInt(sizes->at(indexRead.index))
+                               : layout->getSize(indexRead.index);
       break;
+    }
     default:
       simit_unreachable;
   }
@@ -500,9 +632,8 @@ void LLVMBackend::compile(const ir::Div& divExpr) {
 
   switch (divExpr.type.toTensor()->getComponentType().kind) {
     case ScalarType::Int:
-      // TODO: Figure out what's the deal with integer div. Cast to fp, div and
-      // truncate?
-      not_supported_yet;
+      // Use SDiv to match the truncated semantics of Rem
+      val = builder->CreateSDiv(a, b);
       break;
     case ScalarType::Float:
       val = builder->CreateFDiv(a, b);
@@ -957,6 +1088,9 @@ void LLVMBackend::emitIntrinsicCall(const ir::CallStmt& callStmt) {
   else if (callStmt.callee == ir::intrinsics::loc()) {
     call = emitCall("loc", args, LLVM_INT);
   }
+  else if (callStmt.callee == ir::intrinsics::locSorted()) {
+    call = emitCall("loc_sorted", args, LLVM_INT);
+  }
   else if (callStmt.callee == ir::intrinsics::free()) {
     auto arg = args[args.size()-1];
     arg = builder->CreateCast(llvm::Instruction::CastOps::BitCast,
@@ -1104,7 +1238,7 @@ void LLVMBackend::compile(const ir::Store& store) {
   string locName = string(buffer->getName()) + PTR_SUFFIX;
   llvm::Value *bufferLoc = llvmCreateInBoundsGEP(builder.get(),
                                                  buffer, index, locName);
-  builder->CreateStore(value, bufferLoc);
+  annotateAccess(builder->CreateStore(value, bufferLoc), store.buffer);
 }
 
 void LLVMBackend::compile(const ir::FieldWrite& fieldWrite) {
@@ -1128,10 +1262,7 @@ void LLVMBackend::compile(const ir::FieldWrite& fieldWrite) {
                                             fieldWrite.fieldName);
 
       const TensorType *tensorFieldType = fieldType.toTensor();
-
-      // For now we'll assume fields are always dense row major
-      llvm::Value *fieldLen =
-          emitComputeLen(tensorFieldType, TensorStorage::Dense);
+      llvm::Value *fieldLen = emitComputeFieldLen(tensorFieldType);
       unsigned compSize = tensorFieldType->getComponentType().bytes();
       llvm::Value *fieldSize = builder->CreateMul(fieldLen,llvmInt(compSize));
 
@@ -1167,6 +1298,9 @@ void LLVMBackend::compile(const ir::FieldWrite& fieldWrite) {
     simit_iassert(valuePtr != nullptr);
 
     const TensorType *tensorFieldType = fieldType.toTensor();
+    simit_tassert(kFieldBlockSize == 1 ||
+                  tensorFieldType->getBlockType().toTensor()->size() == 1)
+        << "Cannot copy tensors to fields stored in blocks";
 
     // For now we'll assume fields are always dense row major
     llvm::Value *fieldLen =
@@ -1355,6 +1489,268 @@ void LLVMBackend::compile(const ir::While& whileLoop) {
   builder->SetInsertPoint(exitBlock);
 }
 
+void LLVMBackend::compile(const ir::Kernel& kernel) {
+  std::string iName = kernel.var.getName();
+  llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
+  llvm::BasicBlock *callBlock = builder->GetInsertBlock();
+
+  // Capture the local values visible to the kernel body. Constants and
+  // globals are visible from the kernel function, so only function-local
+  // values are packed into the context struct passed to the kernel.
+  std::map<Var, llvm::Value*> visible;
+  for (auto &scope : symtable) {
+    for (auto &symbol : scope) {
+      if (!util::contains(visible, symbol.first)) {
+        visible.insert(symbol);
+      }
+    }
+  }
+  std::vector<std::pair<Var, llvm::Value*>> captures;
+  std::vector<llvm::Type*> captureTypes;
+  for (auto &symbol : visible) {
+    if (!llvm::isa<llvm::Constant>(symbol.second)) {
+      captures.push_back(symbol);
+      captureTypes.push_back(symbol.second->getType());
+    }
+  }
+  llvm::StructType *ctxType = llvm::StructType::get(LLVM_CTX, captureTypes);
+
+  // Emit the kernel function. Independent kernels iterate over a range of the
+  // domain: void kernel(int begin, int end, void *ctx). Colored kernels
+  // iterate over a range of the edges of one color:
+  // void kernel(int begin, int end, const int *edges, void *ctx).
+  // Privatized kernels also get the reduction buffers to add to, and iterate
+  // over a range of the domain when edges is null:
+  // void kernel(int begin, int end, const int *edges, void *ctx, void **reds).
+  bool colored = (kernel.schedule == ir::Kernel::Colored);
+  bool privatized = (kernel.schedule == ir::Kernel::Privatized ||
+                     kernel.schedule == ir::Kernel::Adaptive);
+  std::vector<std::string> kernelArgNames = {"begin", "end", "ctx"};
+  std::vector<llvm::Type*> kernelArgTypes = {LLVM_INT, LLVM_INT, LLVM_INT8_PTR};
+  if (colored || privatized) {
+    kernelArgNames.insert(kernelArgNames.begin()+2, "edges");
+    kernelArgTypes.insert(kernelArgTypes.begin()+2, LLVM_INT_PTR);
+  }
+  if (privatized) {
+    kernelArgNames.push_back("reductions");
+    kernelArgTypes.push_back(LLVM_INT8_PTR->getPointerTo());
+  }
+  llvm::Function *kernelFunc =
+      createPrototypeLLVM(llvmFunc->getName().str() + "_" + iName + "_kernel",
+                          kernelArgNames, kernelArgTypes, module, false);
+  llvm::BasicBlock *kernelEntry =
+      llvm::BasicBlock::Create(LLVM_CTX, "entry", kernelFunc);
+  builder->SetInsertPoint(kernelEntry);
+
+  auto llvmArgIt = kernelFunc->getArgumentList().begin();
+  llvm::Value *rangeStart = &(*llvmArgIt++);
+  llvm::Value *rangeEnd = &(*llvmArgIt++);
+  llvm::Value *edges = (colored || privatized) ? &(*llvmArgIt++) : nullptr;
+  llvm::Value *kernelCtx =
+      builder->CreateBitCast(&(*llvmArgIt++), ctxType->getPointerTo());
+  llvm::Value *reductions = privatized ? &(*llvmArgIt) : nullptr;
+
+  symtable.scope();
+  for (size_t c=0; c < captures.size(); ++c) {
+    llvm::Value *capturePtr = builder->CreateStructGEP(ctxType, kernelCtx, c);
+    symtable.insert(captures[c].first,
+                    builder->CreateLoad(capturePtr,
+                                        captures[c].second->getName()));
+  }
+  for (size_t r=0; r < kernel.reductions.size(); ++r) {
+    const Var& reduction = kernel.reductions[r].first;
+    llvm::Type *reductionType = llvmType(reduction.getType());
+    llvm::Value *reductionPtr = builder->CreateBitCast(
+        loadFromArray(reductions, llvmInt(r)), reductionType,
+        reduction.getName());
+    symtable.insert(reduction, reductionPtr);
+  }
+
+  // Declare the kernel's variables in its entry block. Dense tensors are
+  // allocated on the kernel's stack instead of in global buffers, so that
+  // every thread gets its own copy.
+  std::pair<Stmt,std::vector<Stmt>> bodyAndDecls = removeVarDecls(kernel.body);
+  for (auto &decl : bodyAndDecls.second) {
+    const Var& var = to<VarDecl>(decl)->var;
+    Type type = var.getType();
+    if (type.isTensor() && !isScalar(type) && storage.hasStorage(var) &&
+        storage.getStorage(var).getKind() == TensorStorage::Dense) {
+      const TensorType *ttype = type.toTensor();
+      llvm::Type *ctype = llvmType(ttype->getComponentType());
+      llvm::Value *len = emitComputeLen(ttype, storage.getStorage(var));
+      symtable.insert(var, builder->CreateAlloca(ctype, len, var.getName()));
+    }
+    else {
+      compile(decl);
+    }
+  }
+
+  // Loop Header
+  llvm::BasicBlock *entryBlock = builder->GetInsertBlock();
+  llvm::BasicBlock *loopBodyStart =
+      llvm::BasicBlock::Create(LLVM_CTX, iName+"_loop_body", kernelFunc);
+  llvm::BasicBlock *loopEnd = llvm::BasicBlock::Create(LLVM_CTX,
+                                                       iName+"_loop_end",
+                                                       kernelFunc);
+  llvm::Value *firstCmp = llvmCreateICmpSLT(builder.get(),
+                                            rangeStart, rangeEnd);
+  builder->CreateCondBr(firstCmp, loopBodyStart, loopEnd);
+  builder->SetInsertPoint(loopBodyStart);
+
+  llvm::PHINode *i = llvmCreatePHI(builder.get(), LLVM_INT32, 2, iName);
+  i->addIncoming(rangeStart, entryBlock);
+
+  // The iterations of independent and colored kernels do not access the same
+  // field locations, which we tell the vectorizer through a self-referential
+  // loop id that the field accesses refer to
+  if (kernel.schedule == ir::Kernel::Independent || colored) {
+    auto tmpNode = llvm::MDNode::getTemporary(LLVM_CTX, llvm::None);
+    parallelLoopID = llvm::MDNode::get(LLVM_CTX, {tmpNode.get()});
+    parallelLoopID->replaceOperandWith(0, parallelLoopID);
+  }
+
+  // Loop Body
+  if (colored) {
+    symtable.insert(kernel.var, loadFromArray(edges, i));
+  }
+  else if (kernel.schedule == ir::Kernel::Adaptive) {
+    // The edges are null when the runtime privatizes the reductions instead
+    // of coloring the edges. The check is loop invariant and gets unswitched.
+    llvm::BasicBlock *edgeBlock =
+        llvm::BasicBlock::Create(LLVM_CTX, iName+"_edge", kernelFunc);
+    llvm::BasicBlock *bodyBlock =
+        llvm::BasicBlock::Create(LLVM_CTX, iName+"_body", kernelFunc);
+    llvm::BasicBlock *indexBlock = builder->GetInsertBlock();
+    llvm::Value *hasEdges = builder->CreateIsNotNull(edges);
+    builder->CreateCondBr(hasEdges, edgeBlock, bodyBlock);
+    builder->SetInsertPoint(edgeBlock);
+    llvm::Value *edge = loadFromArray(edges, i);
+    builder->CreateBr(bodyBlock);
+    builder->SetInsertPoint(bodyBlock);
+    llvm::PHINode *elem = llvmCreatePHI(builder.get(), LLVM_INT32, 2,
+                                        iName+"_elem");
+    elem->addIncoming(i, indexBlock);
+    elem->addIncoming(edge, edgeBlock);
+    symtable.insert(kernel.var, elem);
+  }
+  else {
+    symtable.insert(kernel.var, i);
+  }
+  if (bodyAndDecls.first.defined()) {
+    compile(bodyAndDecls.first);
+  }
+
+  // Loop Footer
+  llvm::BasicBlock *loopBodyEnd = builder->GetInsertBlock();
+  llvm::Value *i_nxt = builder->CreateAdd(i, builder->getInt32(1),
+                                          iName+"_nxt", false, true);
+  i->addIncoming(i_nxt, loopBodyEnd);
+
+  llvm::Value *exitCond = llvmCreateICmpSLT(builder.get(), i_nxt, rangeEnd,
+                                            iName+"_cmp");
+  llvm::Instruction *latch =
+      builder->CreateCondBr(exitCond, loopBodyStart, loopEnd);
+  if (parallelLoopID != nullptr) {
+    latch->setMetadata("llvm.loop", parallelLoopID);
+    parallelLoopID = nullptr;
+  }
+  builder->SetInsertPoint(loopEnd);
+  builder->CreateRetVoid();
+  symtable.unscope();
+
+  // Pack the captured values and hand the kernel to the runtime thread pool.
+  // The context is allocated in the entry block so that kernels inside loops
+  // do not grow the stack.
+  llvm::BasicBlock &funcEntry = llvmFunc->getEntryBlock();
+  LLVMIRBuilder entryBuilder(&funcEntry, funcEntry.begin());
+  llvm::Value *ctx = entryBuilder.CreateAlloca(ctxType, nullptr,
+                                               iName+"_ctx");
+
+  builder->SetInsertPoint(callBlock);
+  for (size_t c=0; c < captures.size(); ++c) {
+    builder->CreateStore(captures[c].second,
+                         builder->CreateStructGEP(ctxType, ctx, c));
+  }
+  llvm::Value *iNum = emitComputeLen(kernel.domain);
+  llvm::Value *ctxPtr = builder->CreateBitCast(ctx, LLVM_INT8_PTR);
+  if (kernel.schedule == ir::Kernel::Independent) {
+    emitCall("simit_parallel_for", {iNum, kernelFunc, ctxPtr});
+    return;
+  }
+
+  // The runtime colors the edge set, using the coloring cached on the bound
+  // Set when the function binds the set through a handle.
+  llvm::Value *handle = llvm::ConstantPointerNull::get(LLVM_INT8_PTR);
+  llvm::Value *endpoints = llvm::ConstantPointerNull::get(LLVM_INT_PTR);
+  int cardinality = 0;
+  if (kernel.schedule != ir::Kernel::Privatized) {
+    simit_iassert(kernel.domain.getIndexSets().size() == 1);
+    const Expr& edgeSet = kernel.domain.getIndexSets()[0].getSet();
+    simit_iassert(isa<VarExpr>(edgeSet) &&
+                  edgeSet.type().isUnstructuredSet());
+    std::string handleName = to<VarExpr>(edgeSet)->var.getName()+HANDLE_SUFFIX;
+    llvm::GlobalVariable *handleGlobal = module->getNamedGlobal(handleName);
+    if (handleGlobal == nullptr) {
+      handleGlobal = new llvm::GlobalVariable(
+          *module, LLVM_INT8_PTR, false, llvm::GlobalValue::ExternalLinkage,
+          llvm::ConstantPointerNull::get(LLVM_INT8_PTR), handleName);
+    }
+    handle = builder->CreateLoad(handleGlobal);
+
+    llvm::Value *edgeSetValue = compile(edgeSet);
+    endpoints =
+        getSetLayout(edgeSet, edgeSetValue, builder.get())->getEpsArray();
+    cardinality = edgeSet.type().toUnstructuredSet()->getCardinality();
+  }
+
+  if (colored) {
+    emitCall("simit_parallel_for_colored",
+             {handle, iNum, endpoints, llvmInt(cardinality), kernelFunc,
+              ctxPtr});
+    return;
+  }
+
+  // Pass the reduction buffers, their lengths and component kinds, so that
+  // the runtime can allocate and merge the per-thread copies.
+  int numReductions = kernel.reductions.size();
+  llvm::Value *reductionPtrs =
+      entryBuilder.CreateAlloca(LLVM_INT8_PTR, llvmInt(numReductions),
+                                iName+"_reductions");
+  llvm::Value *reductionLens =
+      entryBuilder.CreateAlloca(LLVM_INT, llvmInt(numReductions),
+                                iName+"_reduction_lens");
+  llvm::Value *componentTypes =
+      entryBuilder.CreateAlloca(LLVM_INT, llvmInt(numReductions),
+                                iName+"_reduction_types");
+  for (int r=0; r < numReductions; ++r) {
+    const Expr& buffer = kernel.reductions[r].second;
+    const TensorType *type = buffer.type().toTensor();
+    TensorStorage bufferStorage = TensorStorage::Dense;
+    if (isa<VarExpr>(buffer) && storage.hasStorage(to<VarExpr>(buffer)->var)) {
+      bufferStorage = storage.getStorage(to<VarExpr>(buffer)->var);
+    }
+    ScalarType componentType = type->getComponentType();
+    simit_iassert(componentType.isNumeric())
+        << "Cannot reduce " << componentType;
+
+    llvm::Value *index = llvmInt(r);
+    builder->CreateStore(builder->CreateBitCast(compile(buffer), LLVM_INT8_PTR),
+                         llvmCreateInBoundsGEP(builder.get(), reductionPtrs,
+                                               index));
+    builder->CreateStore(emitComputeLen(type, bufferStorage),
+                         llvmCreateInBoundsGEP(builder.get(), reductionLens,
+                                               index));
+    builder->CreateStore(llvmInt((int)componentType.kind),
+                         llvmCreateInBoundsGEP(builder.get(), componentTypes,
+                                               index));
+  }
+  bool adaptive = (kernel.schedule == ir::Kernel::Adaptive);
+  emitCall("simit_parallel_for_privatized",
+           {llvmInt(adaptive), handle, iNum, endpoints, llvmInt(cardinality),
+            kernelFunc, ctxPtr, llvmInt(numReductions), reductionPtrs,
+            reductionLens, componentTypes});
+}
+
 void LLVMBackend::compile(const ir::Print& print) {
   std::vector<llvm::Value*> args;
   
@@ -1432,6 +1828,79 @@ llvm::Value *LLVMBackend::emitFieldRead(const Expr &elemOrSet,
                                 setOrElemValue->getName()+"."+fieldName);
 }
 
+void LLVMBackend::annotateAccess(llvm::Instruction *access,
+                                 const ir::Expr &buffer) {
+  // Distinct fields and temporaries never overlap. Fields are scoped by their
+  // element type, since sets of one element type may be passed to functions
+  // under other names.
+  std::string scopeName;
+  unsigned *scope = nullptr;
+  if (isa<FieldRead>(buffer)) {
+    const FieldRead *fieldRead = to<FieldRead>(buffer);
+    const Type& type = fieldRead->elementOrSet.type();
+    const ElementType *elemType = type.isSet()
+                                  ? type.toSet()->elementType.toElement()
+                                  : type.toElement();
+    scopeName = elemType->name + "." + fieldRead->fieldName;
+    if (!util::contains(fieldScopes, scopeName)) {
+      fieldScopes.insert({scopeName, aliasScopeNames.size()});
+      aliasScopeNames.push_back(scopeName);
+    }
+    scope = &fieldScopes.at(scopeName);
+
+    // Iterations of parallel loops do not access each other's fields
+    if (parallelLoopID != nullptr) {
+      access->setMetadata("llvm.mem.parallel_loop_access", parallelLoopID);
+    }
+  }
+  else if (isa<VarExpr>(buffer) &&
+           util::contains(temporaries, to<VarExpr>(buffer)->var)) {
+    const Var& var = to<VarExpr>(buffer)->var;
+    if (!util::contains(temporaryScopes, var)) {
+      temporaryScopes.insert({var, aliasScopeNames.size()});
+      aliasScopeNames.push_back(var.getName());
+    }
+    scope = &temporaryScopes.at(var);
+  }
+
+  if (scope != nullptr) {
+    scopedAccesses.push_back({access, *scope});
+  }
+}
+
+void LLVMBackend::emitAliasScopes() {
+  if (aliasScopeNames.size() < 2) {
+    return;
+  }
+
+  llvm::MDBuilder mdBuilder(LLVM_CTX);
+  llvm::MDNode *domain = mdBuilder.createAnonymousAliasScopeDomain("simit");
+  vector<llvm::Metadata*> scopes;
+  for (const std::string& name : aliasScopeNames) {
+    scopes.push_back(mdBuilder.createAnonymousAliasScope(domain, name));
+  }
+
+  vector<llvm::MDNode*> scopeLists;
+  vector<llvm::MDNode*> noaliasLists;
+  for (size_t i=0; i < scopes.size(); ++i) {
+    vector<llvm::Metadata*> otherScopes;
+    for (size_t j=0; j < scopes.size(); ++j) {
+      if (j != i) {
+        otherScopes.push_back(scopes[j]);
+      }
+    }
+    scopeLists.push_back(llvm::MDNode::get(LLVM_CTX, scopes[i]));
+    noaliasLists.push_back(llvm::MDNode::get(LLVM_CTX, otherScopes));
+  }
+
+  for (auto& access : scopedAccesses) {
+    access.first->setMetadata(llvm::LLVMContext::MD_alias_scope,
+                              scopeLists[access.second]);
+    access.first->setMetadata(llvm::LLVMContext::MD_noalias,
+                              noaliasLists[access.second]);
+  }
+}
+
 llvm::Value *LLVMBackend::emitComputeLen(const TensorType *tensorType,
                                          const TensorStorage &tensorStorage) {
   if (tensorType->order() == 0) {
@@ -1504,6 +1973,24 @@ llvm::Value *LLVMBackend::emitComputeLen(const TensorType *tensorType,
   return len;
 }
 
+llvm::Value *LLVMBackend::emitComputeFieldLen(const TensorType *fieldType) {
+  llvm::Value *len = emitComputeLen(fieldType, TensorStorage::Dense);
+  size_t blockLen = fieldType->getBlockType().toTensor()->size();
+  if (kFieldBlockSize == 1 || blockLen == 1) {
+    return len;
+  }
+
+  // Fields stored in blocks are allocated in whole blocks
+  llvm::Value *fieldBlockSize = llvmInt(kFieldBlockSize);
+  llvm::Value *numElements =
+      emitComputeLen(fieldType->getOuterDimensions()[0]);
+  llvm::Value *numBlocks = builder->CreateSDiv(
+      builder->CreateAdd(numElements, llvmInt(kFieldBlockSize-1)),
+      fieldBlockSize);
+  return builder->CreateMul(builder->CreateMul(numBlocks, fieldBlockSize),
+                            llvmInt(blockLen));
+}
+
 llvm::Value *LLVMBackend::emitComputeLen(const IndexDomain &dom) {
   assert(dom.getIndexSets().size() > 0);
 
@@ -1521,6 +2008,10 @@ llvm::Value *LLVMBackend::emitComputeLen(const IndexSet &is) {
       return llvmInt(is.getSize());
       break;
     case IndexSet::Set: {
+      const vector<int>* sizes = getConstantSetSizes(is.getSet());
+      if (sizes != nullptr && is.getSet().type().isUnstructuredSet()) {
+        return llvmInt(sizes->at(0));
+      }
       llvm::Value *setValue = compile(is.getSet());
       return llvmCreateExtractValue(builder.get(), setValue, {0},
                                     setValue->getName()+LEN_SUFFIX);
@@ -1535,6 +2026,14 @@ llvm::Value *LLVMBackend::emitComputeLen(const IndexSet &is) {
   return nullptr;
 }
 
+const vector<int>* LLVMBackend::getConstantSetSizes(const Expr& set) const {
+  if (!isa<VarExpr>(set) ||
+      !util::contains(constantSetSizes, to<VarExpr>(set)->var)) {
+    return nullptr;
+  }
+  return &constantSetSizes.at(to<VarExpr>(set)->var);
+}
+
 llvm::Value *LLVMBackend::loadFromArray(llvm::Value *array, llvm::Value *index) {
   llvm::Value *loc = llvmCreateInBoundsGEP(builder.get(), array, index);
   return builder->CreateLoad(loc);
@@ -1670,6 +2169,7 @@ void LLVMBackend::emitGlobals(const ir::Environment& env, bool packed) {
                                              globalAddrspace(), packed);
     this->symtable.insert(tmp, ptr);
     this->globals.insert(tmp);
+    this->temporaries.insert(tmp);
   }
 
   // Emit global tensor indices
@@ -1688,6 +2188,13 @@ void LLVMBackend::emitGlobals(const ir::Environment& env, bool packed) {
                        globalAddrspace(), packed);
       this->symtable.insert(colidx, colidxPtr);
       this->globals.insert(colidx);
+
+      const Var& locs = tensorIndex.getLocationTableArray();
+      llvm::GlobalVariable* locsPtr =
+          createGlobal(module, locs, llvm::GlobalValue::ExternalLinkage,
+                       globalAddrspace(), packed);
+      this->symtable.insert(locs, locsPtr);
+      this->globals.insert(locs);
     }
   }
 }
@@ -1790,9 +2297,13 @@ llvm::Value *LLVMBackend::makeGlobalTensor(ir::Var var) {
                                globalAddrspace());
   buffer->setAlignment(8);
   buffers.insert(pair<Var, llvm::Value*>(var, buffer));
+  temporaries.insert(var);
 
   // Add load to symtable
-  return builder->CreateLoad(buffer, buffer->getName());
+  llvm::Value *bufferPtr = builder->CreateLoad(buffer, buffer->getName());
+  builder->CreateAlignmentAssumption(*dataLayout, bufferPtr,
+                                     util::kBufferAlignment);
+  return bufferPtr;
 }
 
 }}
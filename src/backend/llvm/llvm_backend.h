@@ -26,6 +26,7 @@ class Value;
 class Instruction;
 class Function;
 class DataLayout;
+class MDNode;
 }
 
 namespace simit {
@@ -39,6 +40,7 @@ namespace backend {
 extern const std::string VAL_SUFFIX;
 extern const std::string PTR_SUFFIX;
 extern const std::string LEN_SUFFIX;
+extern const std::string HANDLE_SUFFIX;
 
 std::shared_ptr<llvm::EngineBuilder> createEngineBuilder(llvm::Module *module);
 
@@ -48,6 +50,10 @@ public:
   LLVMBackend();
   virtual ~LLVMBackend();
 
+  /// Compile functions for sets of the given sizes, keyed by the names of
+  /// their externs and arguments. Grid sets have one size per dimension.
+  void setSetSizes(const std::map<std::string, std::vector<int>>& setSizes);
+
 protected:
   virtual unsigned globalAddrspace() {return 0;}
 
@@ -57,6 +63,29 @@ protected:
   std::map<ir::Var, llvm::Value*> buffers;
 
   std::set<ir::Var> globals;
+
+  /// Buffers allocated by the compiled function, which are aligned to
+  /// util::kBufferAlignment and never overlap other buffers
+  std::set<ir::Var> temporaries;
+
+  /// The pointers to global temporaries that each LLVM function loads in its
+  /// entry block
+  std::map<std::pair<llvm::Function*,ir::Var>, llvm::Value*> temporaryPtrs;
+
+  /// Alias scopes of the fields and temporaries that loads and stores go
+  /// through, and the accesses to attach them to once all scopes are known
+  std::map<std::string, unsigned> fieldScopes;
+  std::map<ir::Var, unsigned> temporaryScopes;
+  std::vector<std::string> aliasScopeNames;
+  std::vector<std::pair<llvm::Instruction*, unsigned>> scopedAccesses;
+
+  /// The id of the loop whose iterations are being compiled, when the
+  /// iterations do not depend on each other's field accesses
+  llvm::MDNode *parallelLoopID;
+
+  /// Sizes of the sets that are compiled as constants
+  std::map<std::string, std::vector<int>> setSizes;
+  std::map<ir::Var, std::vector<int>> constantSetSizes;
   ir::Storage storage;
   const ir::Environment* environment;
 
@@ -104,20 +133,42 @@ protected:
   virtual void compile(const ir::ForRange&);
   virtual void compile(const ir::For&);
   virtual void compile(const ir::While&);
+  virtual void compile(const ir::Kernel&);
   virtual void compile(const ir::Print&);
 
   /// Get a pointer to the given field
   llvm::Value *emitFieldRead(const ir::Expr &elemOrSet, std::string fieldName);
 
+  /// Load the pointer stored in a global, in the generic address space
+  llvm::Value *emitLoadGlobal(llvm::Value *global, const std::string &name);
+
+  /// Get the pointer to a global temporary, which is loaded once per function
+  llvm::Value *emitLoadTemporary(const ir::Var &var, llvm::Value *global);
+
+  /// Attach alias and parallel loop information to a load or store through
+  /// `buffer`, if it is a field or a temporary
+  void annotateAccess(llvm::Instruction *access, const ir::Expr &buffer);
+
+  /// Emit the alias scopes of the annotated accesses. Each access is in the
+  /// scope of its field or temporary and does not alias the other scopes.
+  void emitAliasScopes();
+
   /// Get the number of components in the tensor
   llvm::Value *emitComputeLen(const ir::TensorType*, const ir::TensorStorage &);
 
+  /// Get the number of components allocated for a field, which includes the
+  /// padding of its last block when the field is stored in blocks
+  llvm::Value *emitComputeFieldLen(const ir::TensorType*);
+
   /// Get the number of elements in the index domain
   llvm::Value *emitComputeLen(const ir::IndexDomain&);
 
   /// Get the number of elements in the index sets
   llvm::Value *emitComputeLen(const ir::IndexSet&);
 
+  /// Get the sizes of a set that is compiled with constant sizes, or nullptr
+  const std::vector<int>* getConstantSetSizes(const ir::Expr& set) const;
+
   llvm::Value *loadFromArray(llvm::Value *array, llvm::Value *index);
 
   llvm::Value *emitCall(std::string name, std::vector<llvm::Value*> args);
@@ -194,9 +245,6 @@ protected:
 
   // TODO: Remove this function, once the old init system has been removed
   ir::Func makeSystemTensorsGlobal(ir::Func func);
-
-private:
-  static bool llvmInitialized;
 };
 
 }}
@@ -5,9 +5,28 @@
 namespace simit {
 namespace backend {
 
-llvm::LLVMContext& getGlobalContext() {
-  static llvm::LLVMContext ctx;
+static std::shared_ptr<llvm::LLVMContext>& processContext() {
+  static std::shared_ptr<llvm::LLVMContext> ctx(new llvm::LLVMContext());
   return ctx;
 }
 
+static thread_local std::shared_ptr<llvm::LLVMContext> currentContext;
+
+llvm::LLVMContext& getGlobalContext() {
+  return (currentContext != nullptr) ? *currentContext : *processContext();
+}
+
+std::shared_ptr<llvm::LLVMContext> getContextPtr() {
+  return (currentContext != nullptr) ? currentContext : processContext();
+}
+
+LLVMContextScope::LLVMContextScope(std::shared_ptr<llvm::LLVMContext> context)
+    : previous(currentContext) {
+  currentContext = context;
+}
+
+LLVMContextScope::~LLVMContextScope() {
+  currentContext = previous;
+}
+
 }}
@@ -1,13 +1,40 @@
 #ifndef SIMIT_LLVM_CONTEXT_H
 #define SIMIT_LLVM_CONTEXT_H
 
+#include <memory>
+
 namespace llvm {
 class LLVMContext;
 }
 
 namespace simit {
 namespace backend {
+
+/// Returns the LLVM context code is generated in on this thread. This is the
+/// context of the innermost LLVMContextScope, or a process-wide context if the
+/// thread has not entered one.
 llvm::LLVMContext& getGlobalContext();
+
+/// Returns a shared reference to the current context. Objects that outlive a
+/// compilation (e.g. JIT-compiled functions) hold on to it so that the types
+/// and modules they own stay valid.
+std::shared_ptr<llvm::LLVMContext> getContextPtr();
+
+/// Makes `context` the current LLVM context of this thread for the lifetime of
+/// the scope. LLVM contexts are not thread-safe, so compilations that run
+/// concurrently must each generate code in their own context.
+class LLVMContextScope {
+public:
+  explicit LLVMContextScope(std::shared_ptr<llvm::LLVMContext> context);
+  ~LLVMContextScope();
+
+private:
+  std::shared_ptr<llvm::LLVMContext> previous;
+
+  LLVMContextScope(const LLVMContextScope&) = delete;
+  LLVMContextScope& operator=(const LLVMContextScope&) = delete;
+};
+
 }}
 
 #define LLVM_CTX simit::backend::getGlobalContext()
@@ -108,8 +108,8 @@ void UnstructuredEdgeSetLayout::writeSet(Set *actual, ir::Type type,
   ((int*)externPtr)[0] = actual->getSize();
   int **externPtrCast = (int**)(((int*)externPtr)+1);
 
-  // Endpoints index
-  externPtrCast[0] = actual->getEndpointsData();
+  // Endpoints index (read-only in generated code)
+  externPtrCast[0] = const_cast<int*>(actual->getEndpointsData());
 
   // Fields
   void **externPtrFieldCast = (void**)(externPtrCast+3);
@@ -208,8 +208,8 @@ void GridSetLayout::writeSet(Set *actual, ir::Type type, void *externPtr) {
     externPtrCast[3] = NULL;
   }
   else {
-    // Endpoints index
-    externPtrCast[1] = actual->getEndpointsData();
+    // Endpoints index (read-only in generated code)
+    externPtrCast[1] = const_cast<int*>(actual->getEndpointsData());
   }
 
   void **externPtrFieldCast = (void**)(externPtrCast+4);
@@ -1,9 +1,13 @@
 #include "llvm_function.h"
 
+#include <algorithm>
+#include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Function.h"
@@ -11,15 +15,24 @@
 #include "llvm/IR/Verifier.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
+#include "llvm_context.h"
 #include "llvm_types.h"
 #include "llvm_codegen.h"
 #include "llvm_data_layouts.h"
+#include "llvm_backend.h"
+#include "llvm_object_cache.h"
 
 #include "backend/actual.h"
 #include "graph.h"
 #include "tensor_index.h"
 #include "path_indices.h"
+#include "runtime.h"
 #include "util/collections.h"
 #include "util/util.h"
 #include "llvm_util.h"
@@ -36,7 +49,9 @@ LLVMFunction::LLVMFunction(ir::Func func, const ir::Storage &storage,
                            llvm::Function* llvmFunc, llvm::Module* module,
                            std::shared_ptr<llvm::EngineBuilder> engineBuilder,
                            bool skipEEInit)
-    : Function(func), initialized(false), llvmFunc(llvmFunc), module(module),
+    : Function(func), context(getContextPtr()), initialized(false),
+      simitFunc(func), llvmFunc(llvmFunc),
+      module(module),
       harnessModule(new llvm::Module("simit_harness", LLVM_CTX)),
       storage(storage),
       engineBuilder(engineBuilder),
@@ -56,6 +71,10 @@ LLVMFunction::LLVMFunction(ir::Func func, const ir::Storage &storage,
   engineBuilder->setErrorStr(&errStr);
   this->executionEngine.reset(engineBuilder->create());
   simit_iassert((bool)this->executionEngine) << errStr;
+  this->objectCache = getObjectCache();
+  if (this->objectCache != nullptr) {
+    this->executionEngine->setObjectCache(this->objectCache.get());
+  }
   harnessEngineBuilder->setErrorStr(&errStr);
   this->harnessExecEngine.reset(harnessEngineBuilder->create());
   simit_iassert((bool)this->harnessExecEngine) << errStr;
@@ -82,6 +101,27 @@ LLVMFunction::LLVMFunction(ir::Func func, const ir::Storage &storage,
     this->externPtrs.insert({bindable.getName(), extPtrs});
   }
 
+  // Initialize the handles through which colored kernels find the edge
+  // colorings cached on the bound sets
+  auto initSetHandle = [this](const string& bindable, const string& setName) {
+    if (this->module->getNamedGlobal(setName + HANDLE_SUFFIX) == nullptr) {
+      return;
+    }
+    uint64_t addr =
+        executionEngine->getGlobalValueAddress(setName + HANDLE_SUFFIX);
+    void** handlePtr = (void**)addr;
+    *handlePtr = nullptr;
+    setHandlePtrs[bindable].push_back(handlePtr);
+  };
+  for (const string& arg : getArgs()) {
+    initSetHandle(arg, arg);
+  }
+  for (const VarMapping& externMapping : env.getExterns()) {
+    for (const Var& ext : externMapping.getMappings()) {
+      initSetHandle(externMapping.getVar().getName(), ext.getName());
+    }
+  }
+
   // Initialize temporary pointers
   for (const Var& tmp : env.getTemporaries()) {
     simit_iassert(tmp.getType().isTensor())
@@ -109,6 +149,12 @@ LLVMFunction::LLVMFunction(ir::Func func, const ir::Storage &storage,
 
       const pe::PathExpression& pexpr = tensorIndex.getPathExpression();
       tensorIndexPtrs.insert({pexpr, {rowptrPtr, colidxPtr}});
+
+      const Var& locs = tensorIndex.getLocationTableArray();
+      addr = executionEngine->getGlobalValueAddress(locs.getName());
+      const int** locsPtr = (const int**)addr;
+      *locsPtr = nullptr;
+      locationTablePtrs.insert({pexpr, locsPtr});
     }
     else if (tensorIndex.getKind() == TensorIndex::Sten) {
       // No need to build in-memory structures
@@ -123,7 +169,14 @@ LLVMFunction::~LLVMFunction() {
   if (deinit) {
     deinit();
   }
+  freeTemporaries();
+}
+
+void LLVMFunction::freeTemporaries() {
   for (auto& tmpPtr : temporaryPtrs) {
+    // Matrices multiplied through sellmv have a sliced copy that must not
+    // outlive them
+    freeSellCopy(*tmpPtr.second);
     free(*tmpPtr.second);
     *tmpPtr.second = nullptr;
   }
@@ -178,6 +231,12 @@ void LLVMFunction::bind(const std::string& name, simit::Set* set) {
     void *externPtr = externPtrs.at(name)[0];
     writeSet(set, globalType, externPtr);
   }
+
+  if (util::contains(setHandlePtrs, name)) {
+    for (void** handlePtr : setHandlePtrs.at(name)) {
+      *handlePtr = set;
+    }
+  }
 }
 
 void LLVMFunction::bind(const std::string& name, void* data) {
@@ -205,6 +264,8 @@ void LLVMFunction::bind(const std::string& name, TensorData& tensorData) {
         << "extern " << util::quote(name) << " has wrong size "
         << externPtrs.at(name).size();
 
+    sparseGlobals[name] = &tensorData;
+
     // Sparse matrix externs are ordered: data, rowPtr, colInd
     *externPtrs.at(name)[0] = tensorData.getData();
     *externPtrs.at(name)[1] = (void*)tensorData.getRowPtr();
@@ -212,6 +273,54 @@ void LLVMFunction::bind(const std::string& name, TensorData& tensorData) {
   }
 }
 
+Function* LLVMFunction::specialize() {
+  // The compiled code refers to externs by the names of their mappings
+  map<string, vector<int>> setSizes;
+  for (auto& argument : arguments) {
+    if (isa<SetActual>(argument.second.get())) {
+      const Set* set = to<SetActual>(argument.second.get())->getSet();
+      setSizes[argument.first] = getSetSizes(set);
+    }
+  }
+  for (auto& global : globals) {
+    if (isa<SetActual>(global.second.get())) {
+      const Set* set = to<SetActual>(global.second.get())->getSet();
+      for (const Var& ext : getEnvironment().getExtern(global.first)
+                                .getMappings()) {
+        setSizes[ext.getName()] = getSetSizes(set);
+      }
+    }
+  }
+  if (setSizes.empty()) {
+    return nullptr;
+  }
+
+  LLVMBackend backend;
+  backend.setSetSizes(setSizes);
+  BackendImpl& backendImpl = backend;
+  LLVMFunction* specialized =
+      static_cast<LLVMFunction*>(backendImpl.compile(simitFunc, storage));
+
+  // Bind the specialized function to the same data
+  for (auto& binding : {&arguments, &globals}) {
+    for (auto& actual : *binding) {
+      if (isa<SetActual>(actual.second.get())) {
+        Set* set = to<SetActual>(actual.second.get())->getSet();
+        specialized->bind(actual.first, set);
+        specialized->specializedSetSizes[actual.first] = getSetSizes(set);
+      }
+      else {
+        void* data = to<TensorActual>(actual.second.get())->getData();
+        specialized->bind(actual.first, data);
+      }
+    }
+  }
+  for (auto& sparseGlobal : sparseGlobals) {
+    specialized->bind(sparseGlobal.first, *sparseGlobal.second);
+  }
+  return specialized;
+}
+
 size_t LLVMFunction::size(const ir::IndexDomain& dimension) {
   size_t result = 1;
   for (const ir::IndexSet& indexSet : dimension.getIndexSets()) {
@@ -246,6 +355,8 @@ size_t LLVMFunction::size(const ir::IndexDomain& dimension) {
 }
 
 Function::FuncType LLVMFunction::init() {
+  // The harnesses are generated in the context the function was compiled in
+  LLVMContextScope contextScope(context);
   pe::PathIndexBuilder piBuilder;
 
   for (auto& pair : arguments) {
@@ -262,7 +373,8 @@ Function::FuncType LLVMFunction::init() {
   // Initialize indices
   initIndices(piBuilder, environment);
 
-  // Allocate memory for temporaries
+  // Allocate memory for temporaries, freeing those of a previous init
+  freeTemporaries();
   for (const Var& tmp : environment.getTemporaries()) {
     simit_iassert(util::contains(temporaryPtrs, tmp.getName()));
     const Type& type = tmp.getType();
@@ -279,7 +391,7 @@ Function::FuncType LLVMFunction::init() {
         size_t blockSize = blockType.toTensor()->size();
         size_t componentSize = tensorType->getComponentType().bytes();
         *temporaryPtrs.at(tmp.getName()) =
-            calloc(size(vecDimension) *blockSize, componentSize);
+            util::alignedCalloc(size(vecDimension)*blockSize, componentSize);
       }
       else if (order == 2) {
         Type blockType = tensorType->getBlockType();
@@ -294,7 +406,7 @@ Function::FuncType LLVMFunction::init() {
           simit_iassert(util::contains(pathIndices, pexpr));
           size_t matSize = pathIndices.at(pexpr).numNeighbors() *
               blockSize * componentSize;
-          *temporaryPtrs.at(tmp.getName()) = malloc(matSize);
+          *temporaryPtrs.at(tmp.getName()) = util::alignedMalloc(matSize);
         }
         else if (ti.getKind() == TensorIndex::Sten) {
           auto iss = tensorType->getOuterDimensions();
@@ -305,7 +417,7 @@ Function::FuncType LLVMFunction::init() {
           const StencilLayout& stencil = ti.getStencilLayout();
           size_t stensize = stencil.getLayout().size();
           size_t matSize = stensize * gridSize * blockSize * componentSize;
-          *temporaryPtrs.at(tmp.getName()) = malloc(matSize);
+          *temporaryPtrs.at(tmp.getName()) = util::alignedMalloc(matSize);
         }
         else {
           not_supported_yet;
@@ -427,6 +539,7 @@ void LLVMFunction::print(std::ostream &os) const {
 }
 
 void LLVMFunction::printMachine(std::ostream &os) const {
+  LLVMContextScope contextScope(context);
   // TODO: Make printMachine write to os, instead of stderr
   llvm::TargetMachine *target = engineBuilder->selectTarget();
   target->Options.PrintMachineCode = true;
@@ -435,6 +548,202 @@ void LLVMFunction::printMachine(std::ostream &os) const {
   target->Options.PrintMachineCode = false;
 }
 
+// C harnesses take every argument through a pointer, since C compilers and
+// LLVM do not agree on how to pass the structs that hold sets by value
+static void createCHarness(llvm::Function* func) {
+  llvm::Module* module = func->getParent();
+  std::vector<string> argNames;
+  std::vector<llvm::Type*> argTypes;
+  for (llvm::Argument &arg : func->getArgumentList()) {
+    argNames.push_back(arg.getName());
+    argTypes.push_back(arg.getType()->isPointerTy()
+                       ? arg.getType()
+                       : llvm::PointerType::get(arg.getType(), 0));
+  }
+  llvm::Function *harness = createPrototypeLLVM(
+      string(func->getName()) + "_harness", argNames, argTypes, module, true);
+  auto entry = llvm::BasicBlock::Create(module->getContext(), "entry", harness);
+
+  std::vector<llvm::Value*> args;
+  auto funcArgIt = func->getArgumentList().begin();
+  for (llvm::Argument &arg : harness->getArgumentList()) {
+    args.push_back(funcArgIt->getType()->isPointerTy()
+                   ? (llvm::Value*)&arg
+                   : new llvm::LoadInst(&arg, arg.getName(), entry));
+    ++funcArgIt;
+  }
+  llvm::CallInst *call = llvm::CallInst::Create(func, args, "", entry);
+  call->setCallingConv(func->getCallingConv());
+  llvm::ReturnInst::Create(module->getContext(), entry);
+}
+
+static string cType(llvm::Type* type) {
+  if (type->isIntegerTy(1)) {
+    return "bool";
+  }
+  else if (type->isIntegerTy(8)) {
+    return "char";
+  }
+  else if (type->isIntegerTy(32)) {
+    return "int32_t";
+  }
+  else if (type->isFloatTy()) {
+    return "float";
+  }
+  else if (type->isDoubleTy()) {
+    return "double";
+  }
+  else if (type->isPointerTy()) {
+    return cType(type->getPointerElementType()) + "*";
+  }
+  else if (type == llvmComplexType()) {
+    return cType(llvmFloatType()) + " _Complex";
+  }
+  simit_ierror << "No C type for " << *type;
+  return "";
+}
+
+// Sets are declared as structs whose members are named after the set fields
+static string cDecl(llvm::Type* type, const Type& simitType,
+                    const string& name) {
+  if (!simitType.isSet()) {
+    return cType(type) + " " + name;
+  }
+
+  llvm::StructType* structType = llvm::isa<llvm::PointerType>(type)
+      ? llvm::cast<llvm::StructType>(type->getPointerElementType())
+      : llvm::cast<llvm::StructType>(type);
+  vector<string> members;
+  if (simitType.isGridSet()) {
+    members = {"sizes", "endpoints"};
+  }
+  else {
+    members.push_back("size");
+    if (simitType.toUnstructuredSet()->endpointSets.size() > 0) {
+      members.push_back("endpoints");
+    }
+  }
+  for (const Field& field : simitType.toSet()->elementType.toElement()->fields){
+    members.push_back(field.name);
+  }
+  simit_iassert(members.size() == structType->getNumElements());
+
+  std::stringstream decl;
+  decl << "struct " << (structType->isPacked() ? "__attribute__((packed)) " : "")
+       << "{";
+  for (size_t i=0; i < members.size(); ++i) {
+    decl << " " << cType(structType->getElementType(i)) << " " << members[i]
+         << ";";
+  }
+  decl << " }" << (llvm::isa<llvm::PointerType>(type) ? "* " : " ") << name;
+  return decl.str();
+}
+
+void LLVMFunction::printObject(std::ostream &os) const {
+  // The C harnesses are generated in the context the function was compiled in
+  LLVMContextScope contextScope(context);
+  checkStandalone();
+
+  // MCJIT does not allow module modification after code generation, so we
+  // add the C harnesses to a copy of the module
+  std::unique_ptr<llvm::Module> object = llvm::CloneModule(module);
+  createCHarness(object->getFunction(getInitFunc()->getName()));
+  createCHarness(object->getFunction(llvmFunc->getName()));
+  createCHarness(object->getFunction(getDeinitFunc()->getName()));
+
+  // Emit position independent code, so that the object can be linked into
+  // shared libraries. The target is created here rather than selected by the
+  // engine builder, which the execution engine shares.
+  string triple = llvm::sys::getProcessTriple();
+  string error;
+  const llvm::Target* targetKind =
+      llvm::TargetRegistry::lookupTarget(triple, error);
+  simit_iassert(targetKind != nullptr) << error;
+  llvm::SubtargetFeatures features;
+  for (const string& feature : getTargetFeatures()) {
+    features.AddFeature(feature);
+  }
+  std::unique_ptr<llvm::TargetMachine> target(
+      targetKind->createTargetMachine(triple, getTargetCPU(),
+                                      features.getString(),
+                                      llvm::TargetOptions(),
+                                      llvm::Reloc::PIC_));
+  object->setTargetTriple(target->getTargetTriple().str());
+  object->setDataLayout(target->createDataLayout());
+
+  llvm::SmallVector<char, 0> buffer;
+  llvm::raw_svector_ostream bufferStream(buffer);
+  llvm::legacy::PassManager passes;
+  bool failed = target->addPassesToEmitFile(
+      passes, bufferStream, llvm::TargetMachine::CGFT_ObjectFile);
+  simit_iassert(!failed) << "The target cannot emit object files";
+  passes.run(*object);
+
+  llvm::StringRef data = bufferStream.str();
+  os.write(data.data(), data.size());
+}
+
+void LLVMFunction::printHeader(std::ostream &os) const {
+  LLVMContextScope contextScope(context);
+  string name = llvmFunc->getName();
+  string guard = "SIMIT_" + name + "_H";
+  std::transform(guard.begin(), guard.end(), guard.begin(), ::toupper);
+  os << "// Declarations of the Simit function " << name << "." << endl
+     << "//" << endl
+     << "// Bind externs by assigning them, call " << name << "_init_harness,"
+     << endl
+     << "// then call " << name << "_harness any number of times and finally "
+     << name << "_deinit_harness." << endl
+     << "// Set externs hold the set size (the sizes of grid sets), the "
+     << "endpoints of" << endl
+     << "// edge sets and pointers to the field data." << endl
+     << "#ifndef " << guard << endl
+     << "#define " << guard << endl << endl
+     << "#include <stdbool.h>" << endl
+     << "#include <stdint.h>" << endl << endl
+     << "#ifdef __cplusplus" << endl
+     << "extern \"C\" {" << endl
+     << "#endif" << endl << endl;
+
+  const Environment& env = getEnvironment();
+  for (const VarMapping& externMapping : env.getExterns()) {
+    for (const Var& ext : externMapping.getMappings()) {
+      llvm::GlobalVariable* global = module->getNamedGlobal(ext.getName());
+      simit_iassert(global != nullptr);
+      os << "extern "
+         << cDecl(global->getType()->getElementType(), ext.getType(),
+                  ext.getName())
+         << ";" << endl;
+    }
+  }
+  if (env.getExterns().size() > 0) {
+    os << endl;
+  }
+
+  for (llvm::Function* func : {getInitFunc(), llvmFunc, getDeinitFunc()}) {
+    os << "void " << string(func->getName()) << "_harness(";
+    string separator = "";
+    for (llvm::Argument &arg : func->getArgumentList()) {
+      llvm::Type* type = arg.getType()->isPointerTy()
+                         ? arg.getType()
+                         : llvm::PointerType::get(arg.getType(), 0);
+      os << separator << cDecl(type, getArgType(arg.getName()),
+                               arg.getName());
+      separator = ", ";
+    }
+    if (func->getArgumentList().empty()) {
+      os << "void";
+    }
+    os << ");" << endl;
+  }
+
+  os << endl
+     << "#ifdef __cplusplus" << endl
+     << "}" << endl
+     << "#endif" << endl << endl
+     << "#endif" << endl;
+}
+
 void LLVMFunction::initIndices(pe::PathIndexBuilder& piBuilder,
                                const Environment& environment) {
   // Initialize indices
@@ -454,6 +763,20 @@ void LLVMFunction::initIndices(pe::PathIndexBuilder& piBuilder,
       else {
         not_supported_yet<<"Doesn't know how to initialize this pathindex type";
       }
+
+      // Assemblies over the location table set look up their locations in the
+      // table, unless its first value is negative
+      vector<int> locationTable;
+      const Var& tableSet = tensorIndex.getLocationTableSet();
+      if (tableSet.defined() && piBuilder.isBound(tableSet)) {
+        locationTable = piBuilder.buildLocationTable(
+            pidx, *piBuilder.getBinding(tableSet));
+      }
+      if (locationTable.empty()) {
+        locationTable = {-1};
+      }
+      locationTables[pexpr] = std::move(locationTable);
+      *locationTablePtrs.at(pexpr) = locationTables.at(pexpr).data();
     }
     else if (tensorIndex.getKind() == TensorIndex::Sten) {
       // No index to initialize
@@ -499,4 +822,34 @@ llvm::Function *LLVMFunction::getDeinitFunc() const {
   return module->getFunction(string(llvmFunc->getName()) + "_deinit");
 }
 
+void LLVMFunction::checkStandalone() const {
+  simit_uassert(getEnvironment().getTemporaries().empty() &&
+                tensorIndexPtrs.empty())
+      << "Functions that assemble system matrices need the Simit runtime to "
+      << "build their indices, so they cannot be written to object files";
+  simit_uassert(setHandlePtrs.empty())
+      << "Functions that run colored kernels need the Simit runtime, so they "
+      << "cannot be written to object files";
+  simit_uassert(!refersToProcessMemory(*module))
+      << "Functions with tensor literals cannot be written to object files";
+
+  // Besides LLVM intrinsics, standalone code may only call the C library.
+  // Everything else (parallel loops, location lookups, solvers, sparse
+  // kernels and the math helpers) is defined in the Simit runtime.
+  static const std::set<string> libcFunctions = {
+    "malloc", "posix_memalign", "free", "printf",
+    "strcmp", "strlen", "strcpy", "strcat"
+  };
+  for (const llvm::Function& function : *module) {
+    if (function.isDeclaration() && !function.isIntrinsic() &&
+        !function.use_empty()) {
+      string name = function.getName();
+      simit_uassert(util::contains(libcFunctions, name))
+          << "Functions that call " << name
+          << " need the Simit runtime, so they cannot be written to object "
+          << "files";
+    }
+  }
+}
+
 }} // unnamed namespace
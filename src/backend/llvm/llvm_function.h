@@ -27,6 +27,7 @@ class PathIndexBuilder;
 }
 namespace backend {
 class Actual;
+class LLVMObjectCache;
 
 /// A Simit function that has been compiled with LLVM.
 class LLVMFunction : public backend::Function {
@@ -43,12 +44,16 @@ class LLVMFunction : public backend::Function {
 
   virtual FuncType init();
 
+  virtual Function* specialize();
+
   virtual bool isInitialized() {
     return initialized;
   }
 
   virtual void print(std::ostream &os) const;
   virtual void printMachine(std::ostream &os) const;
+  virtual void printObject(std::ostream &os) const;
+  virtual void printHeader(std::ostream &os) const;
 
  protected:
   /// Get the number of elements in the index domains.
@@ -57,8 +62,15 @@ class LLVMFunction : public backend::Function {
   void initIndices(pe::PathIndexBuilder& piBuilder,
                    const ir::Environment& environment);
 
+  /// The LLVM context the function was compiled in. It is declared first so
+  /// that it outlives the modules and execution engines that refer to it.
+  std::shared_ptr<llvm::LLVMContext> context;
+
   bool initialized;
 
+  /// The Simit function, which we recompile to specialize it
+  ir::Func simitFunc;
+
   llvm::Function*                        llvmFunc;
   llvm::Module*                          module;
   llvm::Module*                          harnessModule;
@@ -67,6 +79,7 @@ class LLVMFunction : public backend::Function {
   /// Function actual storage
   std::map<std::string, std::unique_ptr<Actual>> arguments;
   std::map<std::string, std::unique_ptr<Actual>> globals;
+  std::map<std::string, TensorData*>             sparseGlobals;
 
   /// Externs
   std::map<std::string, std::vector<void**>> externPtrs;
@@ -75,12 +88,20 @@ class LLVMFunction : public backend::Function {
   std::map<pe::PathExpression,
            std::pair<const uint32_t**,const uint32_t**>> tensorIndexPtrs;
   std::map<pe::PathExpression, pe::PathIndex>            pathIndices;
+  std::map<pe::PathExpression, const int**>              locationTablePtrs;
+  std::map<pe::PathExpression, std::vector<int>>         locationTables;
 
   /// Temporaries
   std::map<std::string, void**> temporaryPtrs;
 
+  /// Set handles of colored kernels
+  std::map<std::string, std::vector<void**>> setHandlePtrs;
+
  private:
   std::shared_ptr<llvm::EngineBuilder>   engineBuilder;
+  /// Declared before the execution engine, which refers to it until it is
+  /// destroyed
+  std::shared_ptr<LLVMObjectCache>       objectCache;
   std::shared_ptr<llvm::ExecutionEngine> executionEngine;
   std::unique_ptr<llvm::EngineBuilder>   harnessEngineBuilder;
   std::unique_ptr<llvm::ExecutionEngine> harnessExecEngine;
@@ -94,8 +115,15 @@ class LLVMFunction : public backend::Function {
                                 const llvm::SmallVector<llvm::Value*,8>& args,
                                 llvm::Function** harnessPrototype);
 
+  /// Free the temporaries allocated by init, with their sliced copies.
+  void freeTemporaries();
+
   llvm::Function* getInitFunc() const;
   llvm::Function* getDeinitFunc() const;
+
+  /// Check that the compiled code does not depend on state that only the
+  /// Simit runtime sets up, so that it can be written to an object file.
+  void checkStandalone() const;
 };
 
 }}
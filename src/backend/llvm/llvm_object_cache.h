@@ -0,0 +1,53 @@
+#ifndef SIMIT_LLVM_OBJECT_CACHE_H
+#define SIMIT_LLVM_OBJECT_CACHE_H
+
+#include <memory>
+#include <string>
+
+#include "llvm/ExecutionEngine/ObjectCache.h"
+
+namespace llvm {
+class Module;
+class MemoryBuffer;
+}
+
+namespace simit {
+namespace backend {
+
+/// An MCJIT object cache that stores the machine code of compiled modules in a
+/// directory, so that later processes that compile the same module can load
+/// it instead of optimizing and generating code again. Modules are looked up
+/// by their identifier, which must be set to the module's cache key (see
+/// \ref getKey) before code generation.
+class LLVMObjectCache : public llvm::ObjectCache {
+public:
+  LLVMObjectCache(const std::string& directory);
+
+  /// Returns a key that identifies the machine code of the module on this
+  /// host, or an empty string if the module cannot be cached because its code
+  /// refers to memory of the current process.
+  static std::string getKey(const llvm::Module& module);
+
+  /// Returns true if the cache holds machine code for the module.
+  bool hasObject(const llvm::Module& module) const;
+
+  void notifyObjectCompiled(const llvm::Module* module,
+                            llvm::MemoryBufferRef object) override;
+
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module* module)
+      override;
+
+private:
+  std::string directory;
+
+  std::string getPath(const llvm::Module& module) const;
+};
+
+/// Returns the object cache in the directory given by Settings::jitCacheDir,
+/// or nullptr if the cache is disabled. Execution engines keep a plain
+/// pointer to their cache, so functions must hold on to the returned cache
+/// for as long as their engine lives, even if the cache directory changes.
+std::shared_ptr<LLVMObjectCache> getObjectCache();
+
+}}
+#endif
@@ -0,0 +1,135 @@
+#include "llvm_object_cache.h"
+
+#include <mutex>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "llvm_util.h"
+#include "error.h"
+
+/**
+ * This file is compiled with -fno-rtti, since LLVMObjectCache derives from an
+ * LLVM class whose RTTI info is not available to link against.
+ */
+
+using namespace std;
+
+namespace simit {
+extern std::string kJITCacheDir;
+
+namespace backend {
+
+/// Changing the layout of generated code (e.g. the set ABI) without changing
+/// the LLVM IR it is generated from requires a new version.
+static const char* const CACHE_VERSION = "simit-object-cache-1";
+
+// class LLVMObjectCache
+LLVMObjectCache::LLVMObjectCache(const std::string& directory)
+    : directory(directory) {
+  std::error_code error = llvm::sys::fs::create_directories(directory);
+  simit_uassert(!error) << "Could not create the JIT cache directory "
+                        << directory << ": " << error.message();
+}
+
+std::string LLVMObjectCache::getKey(const llvm::Module& module) {
+  if (refersToProcessMemory(module)) {
+    return "";
+  }
+
+  std::string ir;
+  llvm::raw_string_ostream irStream(ir);
+  module.print(irStream, nullptr);
+  irStream.flush();
+
+  // The object code depends on the compiler and target CPU as well as the IR
+  llvm::MD5 hash;
+  hash.update(CACHE_VERSION);
+  hash.update(LLVM_VERSION_STRING);
+  hash.update(llvm::sys::getProcessTriple());
+  hash.update(getTargetCPU());
+  for (const std::string& feature : getTargetFeatures()) {
+    hash.update(feature);
+  }
+#ifdef SIMIT_DEBUG
+  // Debug builds do not optimize modules
+  hash.update("debug");
+#endif
+  hash.update(ir);
+
+  llvm::MD5::MD5Result result;
+  hash.final(result);
+  llvm::SmallString<32> key;
+  llvm::MD5::stringifyResult(result, key);
+  return key.str().str();
+}
+
+bool LLVMObjectCache::hasObject(const llvm::Module& module) const {
+  return !module.getModuleIdentifier().empty() &&
+         llvm::sys::fs::exists(getPath(module));
+}
+
+void LLVMObjectCache::notifyObjectCompiled(const llvm::Module* module,
+                                           llvm::MemoryBufferRef object) {
+  if (module->getModuleIdentifier().empty()) {
+    return;
+  }
+
+  // Write to a unique file and rename it, so that processes that compile the
+  // same module at the same time never read a partially written object
+  int fd;
+  llvm::SmallString<128> tmpPath;
+  if (llvm::sys::fs::createUniqueFile(getPath(*module) + ".%%%%%%", fd,
+                                      tmpPath)) {
+    return;
+  }
+  {
+    llvm::raw_fd_ostream out(fd, true);
+    out << object.getBuffer();
+  }
+  if (llvm::sys::fs::rename(tmpPath, getPath(*module))) {
+    llvm::sys::fs::remove(tmpPath);
+  }
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+LLVMObjectCache::getObject(const llvm::Module* module) {
+  if (module->getModuleIdentifier().empty()) {
+    return nullptr;
+  }
+  auto object = llvm::MemoryBuffer::getFile(getPath(*module));
+  if (!object) {
+    return nullptr;
+  }
+  return std::move(*object);
+}
+
+std::string LLVMObjectCache::getPath(const llvm::Module& module) const {
+  llvm::SmallString<128> path(directory);
+  llvm::sys::path::append(path, module.getModuleIdentifier() + ".o");
+  return path.str().str();
+}
+
+std::shared_ptr<LLVMObjectCache> getObjectCache() {
+  static std::mutex mutex;
+  static std::shared_ptr<LLVMObjectCache> cache;
+  static std::string cacheDir;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (kJITCacheDir.empty()) {
+    return nullptr;
+  }
+  if (cache == nullptr || cacheDir != kJITCacheDir) {
+    cache.reset(new LLVMObjectCache(kJITCacheDir));
+    cacheDir = kJITCacheDir;
+  }
+  return cache;
+}
+
+}}
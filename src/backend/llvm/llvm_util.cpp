@@ -5,11 +5,17 @@
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/Module.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Host.h"
 
+#include <algorithm>
 #include <fstream>
 
 namespace simit {
+extern std::string kTargetCPU;
+
 namespace backend {
 
 std::ostream &operator<<(std::ostream &os, const llvm::Type &type) {
@@ -62,4 +68,71 @@ void logModule(llvm::Module *module, std::string fileName) {
 #endif
 }
 
+static bool isAddressConstant(const llvm::Value *value) {
+  const llvm::ConstantExpr *expr = llvm::dyn_cast<llvm::ConstantExpr>(value);
+  if (expr == nullptr) {
+    return false;
+  }
+  if (expr->getOpcode() == llvm::Instruction::IntToPtr) {
+    return true;
+  }
+  for (const llvm::Use &operand : expr->operands()) {
+    if (isAddressConstant(operand.get())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool refersToProcessMemory(const llvm::Module &module) {
+  for (const llvm::GlobalVariable &global : module.globals()) {
+    if (global.hasInitializer() && isAddressConstant(global.getInitializer())) {
+      return true;
+    }
+  }
+  for (const llvm::Function &function : module) {
+    for (const llvm::BasicBlock &block : function) {
+      for (const llvm::Instruction &instruction : block) {
+        for (const llvm::Use &operand : instruction.operands()) {
+          if (isAddressConstant(operand.get())) {
+            return true;
+          }
+        }
+      }
+    }
+  }
+  return false;
+}
+
+size_t countInstructions(const llvm::Module &module) {
+  size_t count = 0;
+  for (const llvm::Function &function : module) {
+    for (const llvm::BasicBlock &block : function) {
+      count += block.size();
+    }
+  }
+  return count;
+}
+
+std::string getTargetCPU() {
+  if (kTargetCPU == "native") {
+    return llvm::sys::getHostCPUName().str();
+  }
+  return kTargetCPU;
+}
+
+std::vector<std::string> getTargetFeatures() {
+  // The host CPU name does not tell whether the OS supports all its features
+  // (e.g. AVX state saving), so we also pass the detected features
+  std::vector<std::string> features;
+  llvm::StringMap<bool> hostFeatures;
+  if (kTargetCPU == "native" && llvm::sys::getHostCPUFeatures(hostFeatures)) {
+    for (auto &feature : hostFeatures) {
+      features.push_back((feature.second ? "+" : "-") + feature.first().str());
+    }
+  }
+  std::sort(features.begin(), features.end());
+  return features;
+}
+
 }}
@@ -2,6 +2,8 @@
 #define SIMIT_LLVM_UTIL_H
 
 #include <ostream>
+#include <string>
+#include <vector>
 
 namespace llvm {
 class Function;
@@ -27,5 +29,20 @@ VoidFuncPtr getGlobalFunc(llvm::Function *func, llvm::ExecutionEngine *ee);
 
 void logModule(llvm::Module *module, std::string fileName);
 
+/// Returns true if the module's code refers to memory of the current process,
+/// which happens when constants such as tensor literals are emitted as
+/// pointers. Such code cannot be loaded by other processes.
+bool refersToProcessMemory(const llvm::Module &module);
+
+/// Returns the number of instructions in the module's functions.
+size_t countInstructions(const llvm::Module &module);
+
+/// Returns the name of the CPU that code is generated for (see
+/// Settings::targetCPU).
+std::string getTargetCPU();
+
+/// Returns the features (e.g. "+avx2") of the CPU that code is generated for.
+std::vector<std::string> getTargetFeatures();
+
 }}
 #endif
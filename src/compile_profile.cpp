@@ -0,0 +1,74 @@
+#include "compile_profile.h"
+
+#include <iomanip>
+
+using namespace std;
+
+namespace simit {
+
+// Passes on different threads compile different functions
+static thread_local CompileProfile* currentProfile = nullptr;
+
+// class CompileProfile
+void CompileProfile::addPass(const std::string& name, double seconds,
+                             size_t irSize) {
+  passes.push_back({name, seconds, irSize});
+}
+
+double CompileProfile::getTotalSeconds() const {
+  double total = 0.0;
+  for (const PassProfile& pass : passes) {
+    total += pass.seconds;
+  }
+  return total;
+}
+
+CompileProfile* CompileProfile::getCurrent() {
+  return currentProfile;
+}
+
+void CompileProfile::setCurrent(CompileProfile* profile) {
+  currentProfile = profile;
+}
+
+std::ostream& operator<<(std::ostream& os, const CompileProfile& profile) {
+  const size_t nameWidth = 48;
+  double total = profile.getTotalSeconds();
+  ios_base::fmtflags flags = os.flags();
+  streamsize precision = os.precision();
+
+  os << "Compile profile of " << profile.getFunctionName() << endl;
+  os << left << setw(nameWidth) << "Pass" << right
+     << setw(12) << "Time (ms)" << setw(9) << "%" << setw(12) << "IR size"
+     << endl;
+  os << fixed;
+  for (const PassProfile& pass : profile.getPasses()) {
+    double percentage = (total > 0.0) ? 100.0 * pass.seconds / total : 0.0;
+    os << left << setw(nameWidth) << pass.name.substr(0, nameWidth-1) << right
+       << setw(12) << setprecision(3) << pass.seconds * 1000.0
+       << setw(9) << setprecision(1) << percentage
+       << setw(12) << pass.irSize << endl;
+  }
+  os << left << setw(nameWidth) << "Total" << right
+     << setw(12) << setprecision(3) << total * 1000.0 << endl;
+  os.flags(flags);
+  os.precision(precision);
+  return os;
+}
+
+// class PassTimer
+PassTimer::PassTimer(const std::string& name)
+    : name(name), profile(CompileProfile::getCurrent()),
+      start(std::chrono::steady_clock::now()) {
+}
+
+void PassTimer::stop(const std::function<size_t()>& irSize) {
+  if (profile == nullptr) {
+    return;
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  profile->addPass(name, elapsed.count(), irSize());
+}
+
+}
@@ -0,0 +1,85 @@
+#ifndef SIMIT_COMPILE_PROFILE_H
+#define SIMIT_COMPILE_PROFILE_H
+
+#include <chrono>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace simit {
+
+/// The wall time and resulting IR size of one stage of compiling a function.
+struct PassProfile {
+  std::string name;
+  double seconds;
+
+  /// The number of Simit IR nodes after a lowering pass, or the number of
+  /// LLVM instructions after an LLVM pass group
+  size_t irSize;
+};
+
+/// The passes that compiled a function, in the order they ran. Functions are
+/// profiled when Simit is initialized with Settings::profileCompilation.
+class CompileProfile {
+public:
+  CompileProfile() {}
+  CompileProfile(const std::string& functionName)
+      : functionName(functionName) {}
+
+  const std::string& getFunctionName() const {return functionName;}
+
+  void addPass(const std::string& name, double seconds, size_t irSize);
+
+  const std::vector<PassProfile>& getPasses() const {return passes;}
+
+  /// The sum of the times of the passes.
+  double getTotalSeconds() const;
+
+  /// Returns the profile that the passes running on this thread record into,
+  /// or nullptr if they are not profiled.
+  static CompileProfile* getCurrent();
+
+  /// Set the profile that the passes running on this thread record into.
+  static void setCurrent(CompileProfile* profile);
+
+private:
+  std::string functionName;
+  std::vector<PassProfile> passes;
+};
+
+/// Makes a profile the current profile of this thread while in scope.
+class CompileProfileScope {
+public:
+  CompileProfileScope(CompileProfile* profile)
+      : previous(CompileProfile::getCurrent()) {
+    CompileProfile::setCurrent(profile);
+  }
+  ~CompileProfileScope() {CompileProfile::setCurrent(previous);}
+
+private:
+  CompileProfile* previous;
+};
+
+/// Write a table with the time, share of the total time and IR size of each
+/// pass.
+std::ostream& operator<<(std::ostream& os, const CompileProfile& profile);
+
+/// Times a pass from its construction until `stop` is called, and records it
+/// in the current profile. Does nothing when there is no current profile.
+class PassTimer {
+public:
+  PassTimer(const std::string& name);
+
+  /// Record the pass and the size of the IR it produced. The size is only
+  /// computed when the pass is recorded, and is not part of its time.
+  void stop(const std::function<size_t()>& irSize);
+
+private:
+  std::string name;
+  CompileProfile* profile;
+  std::chrono::steady_clock::time_point start;
+};
+
+}
+#endif
@@ -0,0 +1,86 @@
+#include "edge_coloring.h"
+
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+namespace simit {
+namespace internal {
+
+// class EdgeColoring
+EdgeColoring::EdgeColoring(int numEdges, int cardinality,
+                           const int* endpoints) {
+  vector<int> colors(numEdges, -1);
+
+  int numEndpoints = 0;
+  for (int i=0; i < numEdges*cardinality; ++i) {
+    numEndpoints = max(numEndpoints, endpoints[i]+1);
+  }
+
+  // Assign colors 64 at a time. Each pass records the colors used by the edges
+  // incident to every endpoint in a bit mask, and gives every uncolored edge
+  // the lowest color none of its endpoints use. Edges for which all 64 colors
+  // are taken are left for the next pass.
+  vector<uint64_t> usedColors(numEndpoints);
+  int numColors = 0;
+  int numColored = 0;
+  for (int firstColor=0; numColored < numEdges; firstColor += 64) {
+    fill(usedColors.begin(), usedColors.end(), 0);
+    for (int e=0; e < numEdges; ++e) {
+      if (colors[e] != -1) {
+        continue;
+      }
+
+      const int* eps = &endpoints[e*cardinality];
+      uint64_t used = 0;
+      for (int i=0; i < cardinality; ++i) {
+        used |= usedColors[eps[i]];
+      }
+      if (used == ~(uint64_t)0) {
+        continue;
+      }
+
+      int color = 0;
+      while (used & ((uint64_t)1 << color)) {
+        ++color;
+      }
+      for (int i=0; i < cardinality; ++i) {
+        usedColors[eps[i]] |= (uint64_t)1 << color;
+      }
+
+      colors[e] = firstColor + color;
+      numColors = max(numColors, colors[e]+1);
+      ++numColored;
+    }
+  }
+
+  // Bucket the edges by color
+  colorOffsets.resize(numColors+1, 0);
+  for (int e=0; e < numEdges; ++e) {
+    ++colorOffsets[colors[e]+1];
+  }
+  for (int c=0; c < numColors; ++c) {
+    colorOffsets[c+1] += colorOffsets[c];
+  }
+
+  edges.resize(numEdges);
+  vector<int> next(colorOffsets.begin(), colorOffsets.end()-1);
+  for (int e=0; e < numEdges; ++e) {
+    edges[next[colors[e]]++] = e;
+  }
+}
+
+std::ostream& operator<<(std::ostream& os, const EdgeColoring& coloring) {
+  os << "EdgeColoring:";
+  for (int c=0; c < coloring.getNumColors(); ++c) {
+    os << endl << "  " << c << ":";
+    const int* edges = coloring.getEdges(c);
+    for (int i=0; i < coloring.getNumEdges(c); ++i) {
+      os << " " << edges[i];
+    }
+  }
+  return os;
+}
+
+}}
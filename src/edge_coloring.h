@@ -0,0 +1,43 @@
+#ifndef SIMIT_EDGE_COLORING_H
+#define SIMIT_EDGE_COLORING_H
+
+#include <ostream>
+#include <vector>
+
+namespace simit {
+namespace internal {
+
+/// A partition of the edges of an edge set into colors, such that no two edges
+/// of the same color share an endpoint. Map assemblies that only write to
+/// locations owned by the mapped edge and its endpoints can therefore process
+/// all the edges of one color concurrently, without atomics.
+///
+/// The coloring is computed greedily (first fit) in edge order, so edges of the
+/// same color stay sorted and neighboring edges tend to have different colors.
+class EdgeColoring {
+public:
+  /// Color the `numEdges` edges whose `cardinality` endpoints each are stored
+  /// contiguously in `endpoints`.
+  EdgeColoring(int numEdges, int cardinality, const int* endpoints);
+
+  int getNumColors() const {return colorOffsets.size() - 1;}
+
+  /// The number of edges with the given color.
+  int getNumEdges(int color) const {
+    return colorOffsets[color+1] - colorOffsets[color];
+  }
+
+  /// The edges with the given color, in ascending order.
+  const int* getEdges(int color) const {
+    return edges.data() + colorOffsets[color];
+  }
+
+  friend std::ostream& operator<<(std::ostream&, const EdgeColoring&);
+
+private:
+  std::vector<int> colorOffsets;
+  std::vector<int> edges;
+};
+
+}}
+#endif
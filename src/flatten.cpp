@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <atomic>
 
 #include "ir.h"
 #include "intrinsics.h"
@@ -23,7 +24,7 @@ bool overlaps(const std::vector<IndexVar> &as, const std::vector<IndexVar> &bs);
 
 /// Static namegen (hacky: fix later)
 std::string tmpNameGen() {
-  static int i = 0;
+  static std::atomic<int> i(0);
   return INTERNAL_PREFIX("spilledTmp") + std::to_string(i++);
 }
 
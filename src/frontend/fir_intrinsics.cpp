@@ -286,6 +286,14 @@ std::vector<FuncDecl::Ptr> createIntrinsics() {
                {nmMatrixType, nVectorType},
                {mVectorType},
                {N, M});
+  addIntrinsic(&intrinsics,
+               ir::intrinsics::pcg().getName(),
+               {nnMatrixType, nVectorType, nVectorType,
+                makeTensorType(ScalarType::Type::FLOAT),
+                makeTensorType(ScalarType::Type::INT),
+                makeTensorType(ScalarType::Type::STRING)},
+               {nVectorType},
+               {N});
 
   // Complex numbers
   addScalarIntrinsic(&intrinsics,
@@ -1153,7 +1153,18 @@ void TypeChecker::visit(CallExpr::Ptr expr) {
     return;
   }
 
-  for (unsigned i = 0; i < expr->args.size(); ++i) {
+  // The matrix and vectors of pcg are checked like those of the other solvers,
+  // and its scalar parameters like the arguments of any other function.
+  unsigned firstCheckedArg = 0;
+  if (funcName == ir::intrinsics::pcg().getName()) {
+    simit_iassert(expr->args.size() == 6);
+    typeCheckOrder(expr->args[0], argTypes[0], 2);
+    typeCheckOrder(expr->args[1], argTypes[1], 1);
+    typeCheckOrder(expr->args[2], argTypes[2], 1);
+    firstCheckedArg = 3;
+  }
+
+  for (unsigned i = firstCheckedArg; i < expr->args.size(); ++i) {
     const Argument::Ptr funcArg = func->args[i];
     const Expr::Ptr arg = expr->args[i];
     const ExprType argType = argTypes[i];
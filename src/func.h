@@ -23,7 +23,7 @@ struct FuncContent {
   Storage storage;
 
   ~FuncContent();
-  mutable long ref = 0;
+  mutable std::atomic<long> ref{0};
   friend inline void aquire(FuncContent *c) {++c->ref;}
   friend inline void release(FuncContent *c) {if (--c->ref==0) delete c;}
 };
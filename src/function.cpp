@@ -15,13 +15,34 @@ Function::Function() : Function(nullptr) {
 Function::Function(backend::Function* func) : impl(func), funcPtr(nullptr) {
 }
 
+Function::Function(backend::Function* func,
+                   std::shared_ptr<CompileProfile> compileProfile)
+    : impl(func), funcPtr(nullptr), compileProfile(compileProfile) {
+}
+
 void Function::clear() {
   impl = nullptr;
+  generic = nullptr;
+  genericFuncPtr = nullptr;
+  boundSets.clear();
+  compileProfile = nullptr;
 }
 
 void Function::bind(const std::string& name, simit::Set *set) {
-#ifdef SIMIT_ASSERTS
   simit_uassert(defined()) << "undefined function";
+
+  // Compiled code addresses field components by the block size the function
+  // was compiled with, and sets are not known until they are bound, so a
+  // mismatch is caught here rather than while compiling.
+  for (const Set::FieldData *fieldData : set->fields) {
+    simit_uassert(fieldData->type->getSize() == 1 ||
+                  fieldData->blockSize == impl->getFieldBlockSize())
+        << name << "." << fieldData->name << " is stored in blocks of "
+        << fieldData->blockSize << " elements, but the function was compiled "
+        << "for blocks of " << impl->getFieldBlockSize();
+  }
+
+#ifdef SIMIT_ASSERTS
   simit_uassert(impl->hasBindable(name))
       << "no argument or global " << util::quote(name) << " in function";
   // Check that the set matches the argument type
@@ -85,6 +106,17 @@ void Function::bind(const std::string& name, simit::Set *set) {
   }
 #endif
 
+  boundSets[name] = set;
+  if (generic != nullptr) {
+    generic->bind(name, set);
+    if (!impl->isSpecializedFor(name, set)) {
+      impl = generic;
+      funcPtr = genericFuncPtr;
+      generic = nullptr;
+      genericFuncPtr = nullptr;
+      return;
+    }
+  }
   impl->bind(name, set);
 }
 
@@ -106,20 +138,43 @@ void Function::bind(const std::string& name, void* data) {
   simit_uassert(defined()) << "undefined function";
   simit_uassert(impl->hasBindable(name))
       << "no argument or global of this name in the function";
+  if (generic != nullptr) {
+    generic->bind(name, data);
+  }
   impl->bind(name, data);
 }
 
 void Function::bind(const string& name, TensorData& data) {
+  if (generic != nullptr) {
+    generic->bind(name, data);
+  }
   impl->bind(name, data);
 }
 
+void Function::specialize() {
+  simit_uassert(defined()) << "undefined function";
+  std::shared_ptr<backend::Function> base = (generic != nullptr) ? generic
+                                                                 : impl;
+  backend::Function* specialized = base->specialize();
+  if (specialized != nullptr) {
+    if (generic == nullptr) {
+      generic = impl;
+      genericFuncPtr = funcPtr;
+    }
+    impl = std::shared_ptr<backend::Function>(specialized);
+    funcPtr = nullptr;
+  }
+}
+
 void Function::init() {
   simit_uassert(defined()) << "undefined function";
+  checkSpecialization();
   funcPtr = impl->init();
 }
 
 void Function::runSafe() {
   simit_uassert(defined()) << "undefined function";
+  checkSpecialization();
   if (!impl->isInitialized()) {
     init();
   }
@@ -128,6 +183,24 @@ void Function::runSafe() {
   mapArgs();
 }
 
+void Function::checkSpecialization() {
+  if (generic == nullptr) {
+    return;
+  }
+  for (auto& boundSet : boundSets) {
+    if (!impl->isSpecializedFor(boundSet.first, boundSet.second)) {
+      impl = generic;
+      funcPtr = genericFuncPtr;
+      generic = nullptr;
+      genericFuncPtr = nullptr;
+
+      // Rebinding the resized set makes the generic code initialize again
+      impl->bind(boundSet.first, boundSet.second);
+      return;
+    }
+  }
+}
+
 void Function::mapArgs() {
   simit_uassert(defined()) << "undefined function";
   impl->mapArgs();
@@ -150,6 +223,16 @@ void Function::printMachine(std::ostream& os) const {
   }
 }
 
+void Function::printObject(std::ostream& os) const {
+  simit_uassert(defined()) << "undefined function";
+  impl->printObject(os);
+}
+
+void Function::printHeader(std::ostream& os) const {
+  simit_uassert(defined()) << "undefined function";
+  impl->printHeader(os);
+}
+
 std::ostream& operator<<(std::ostream& os, const Function& f) {
   f.print(os);
   return os;
@@ -3,11 +3,14 @@
 
 #include <string>
 #include <functional>
+#include <map>
+#include <memory>
 #include "tensor.h"
 
 namespace simit {
 class Set;
 class TensorData;
+class CompileProfile;
 
 namespace backend {
 class Function;
@@ -35,6 +38,11 @@ public:
   /// be created using the backend::Backend::compile methods.
   Function(backend::Function* function);
 
+  /// Create a function from a backend::Function, with the profile of the
+  /// passes that compiled it.
+  Function(backend::Function* function,
+           std::shared_ptr<CompileProfile> compileProfile);
+
   /// Clear Function of data (makes it undefined).
   void clear();
 
@@ -57,6 +65,15 @@ public:
   /// See e.g. \link https://en.wikipedia.org/wiki/Sparse_matrix
   void bind(const std::string& name, TensorData& data);
 
+  /// Recompile the function for the sizes of the bound sets and the dimensions
+  /// of bound grids, so that loops over them have constant trip counts. Call
+  /// it after binding the sets and before init. If a set of another size is
+  /// bound later, or a bound set is resized, then init and runSafe fall back
+  /// to the generic code, which is initialized again. `run` does not check
+  /// set sizes, so call init after resizing sets bound to a specialized
+  /// function.
+  void specialize();
+
   /// Initialize the function. This must be done between calls to bind arguments
   /// and calls to run. If runSafe is used, there init will be called
   /// automatically as needed.
@@ -87,11 +104,40 @@ public:
   /// Print the function to the stream as machine assembly code.
   void printMachine(std::ostream& os) const;
 
+  /// Write the function to the stream as a relocatable object file with C
+  /// harnesses, so that it can be linked into programs ahead of time.
+  void printObject(std::ostream& os) const;
+
+  /// Write a C header that declares the externs and harnesses of the object
+  /// file written by printObject.
+  void printHeader(std::ostream& os) const;
+
+  /// Returns the wall time and IR size of the passes that compiled the
+  /// function, or nullptr if Simit was not initialized with
+  /// Settings::profileCompilation.
+  const CompileProfile* getCompileProfile() const {
+    return compileProfile.get();
+  }
+
 private:
   std::shared_ptr<backend::Function> impl;
 
+  // The generic code of a specialized function, which is bound to the same
+  // data so that we can fall back to it.
+  std::shared_ptr<backend::Function> generic;
+  std::function<void()> genericFuncPtr;
+
+  // The bound sets, whose sizes are checked against the specialized code
+  std::map<std::string, Set*> boundSets;
+
   // To make the run method faster we store the function pointer here.
   std::function<void()> funcPtr;
+
+  std::shared_ptr<CompileProfile> compileProfile;
+
+  /// Replace the specialized code by the generic code if a bound set no
+  /// longer has the size the code was specialized for.
+  void checkSpecialization();
 };
 
 /// Write the function to the stream. The output depends on the backend,
@@ -1,31 +1,239 @@
 #include "graph.h"
 
+#include <atomic>
 #include <iostream>
 
+#include "edge_coloring.h"
+#include "path_indices.h"
+
 using namespace std;
 
 namespace simit {
+extern unsigned kFieldBlockSize;
 
 Set::~Set() {
   for (auto f: fields) {
     delete f;
   }
-  free(endpoints);
+  if (endpointsOwned) {
+    free(endpoints);
+  }
   free(gridPoints);
   free(gridEdges);
+  delete edgeColoring;
+  pe::PathIndexCache::getInstance().evict(this);
+}
+
+const internal::EdgeColoring& Set::getEdgeColoring() const {
+  simit_iassert(getCardinality() > 0) << "Only edge sets can be colored";
+  std::lock_guard<std::mutex> lock(edgeColoringMutex);
+  if (edgeColoring == nullptr) {
+    edgeColoring = new internal::EdgeColoring(numElements, getCardinality(),
+                                              endpoints);
+  }
+  return *edgeColoring;
+}
+
+int Set::defaultFieldBlockSize() {
+  return kFieldBlockSize;
+}
+
+uint64_t Set::nextVersion() {
+  static std::atomic<uint64_t> versions(0);
+  return ++versions;
+}
+
+bool Set::getChangesSince(uint64_t version,
+                          std::vector<Change>* changes) const {
+  changes->clear();
+  if (version == this->version) {
+    return true;
+  }
+  if (version == changesVersion) {
+    *changes = this->changes;
+    return true;
+  }
+  for (size_t i=this->changes.size(); i > 0; --i) {
+    if (this->changes[i-1].version == version) {
+      changes->assign(this->changes.begin()+i, this->changes.end());
+      return true;
+    }
+  }
+  return false;
+}
+
+void Set::recordChange(Change::Kind kind, int element, int from,
+                       int endpointsOf) {
+  // Updating derived data from many changes is no cheaper than rebuilding it,
+  // so we do not keep changes beyond a fraction of the set
+  if (changes.size() >= (size_t)numElements/4 + initialCapacity) {
+    clearChanges();
+    return;
+  }
+
+  Change change;
+  change.kind = kind;
+  change.element = element;
+  change.from = from;
+  change.version = version;
+  const int cardinality = getCardinality();
+  if (cardinality > 0) {
+    change.endpoints.assign(&endpoints[endpointsOf*cardinality],
+                            &endpoints[(endpointsOf+1)*cardinality]);
+  }
+  changes.push_back(change);
+}
+
+void Set::deleteEdgeColoring() {
+  std::lock_guard<std::mutex> lock(edgeColoringMutex);
+  delete edgeColoring;
+  edgeColoring = nullptr;
+}
+
+ElementRef Set::addN(int count) {
+  simit_uassert(getCardinality() == 0)
+      << "Must provide the endpoints of the edges added to " << getName();
+  return addN(nullptr, count);
+}
+
+ElementRef Set::addN(const int* endpoints, int count) {
+  simit_uassert(count >= 0) << "Cannot add a negative number of elements";
+  const int cardinality = getCardinality();
+  simit_uassert(cardinality == 0 || count == 0 || endpoints != nullptr)
+      << "Must provide the endpoints of the edges added to " << getName();
+  checkEndpoints(endpoints, count);
+  if (numElements + count > capacity) {
+    grow(numElements + count);
+  }
+
+  // Fields of new elements may hold the values of removed elements
+  for (auto f : fields) {
+    f->clearElements(numElements, count);
+  }
+  if (cardinality > 0 && count > 0) {
+    memcpy(&this->endpoints[numElements*cardinality], endpoints,
+           count*cardinality*sizeof(int));
+  }
+
+  int first = numElements;
+  numElements += count;
+  structureChanged();
+  recordAdds(first, count);
+  return ElementRef(first);
+}
+
+void Set::checkEndpoints(const int* endpoints, int count) const {
+  const int cardinality = getCardinality();
+  for (int i=0; i < cardinality; ++i) {
+    const int numEndpoints = endpointSets[i]->getSize();
+    for (int e=0; e < count; ++e) {
+      int endpoint = endpoints[e*cardinality+i];
+      simit_uassert(endpoint >= 0 && endpoint < numEndpoints)
+          << "Invalid member of set (" << endpointSets[i]->getName()
+          << ") in addN (" << endpoint << " < " << numEndpoints << ")";
+    }
+  }
 }
 
-void Set::increaseCapacity() {
+void Set::checkFieldOverlap(const std::string& name, const void* data,
+                            size_t sizeOfType, int capacity) const {
+  const char* begin = static_cast<const char*>(data);
+  const char* end = begin + capacity*sizeOfType;
+  for (const FieldData* field : fields) {
+    const char* fieldBegin = static_cast<const char*>(field->data);
+    const char* fieldEnd = fieldBegin + capacity*field->sizeOfType;
+    simit_uassert(end <= fieldBegin || fieldEnd <= begin)
+        << "The buffer of field " << name << " overlaps the data of field "
+        << field->name << " of " << getName();
+  }
+}
+
+void Set::recordAdds(int first, int count) {
+  if (changes.size() + count > (size_t)numElements/4 + initialCapacity) {
+    clearChanges();
+    return;
+  }
+  for (int elem=first; elem < first+count; ++elem) {
+    recordChange(Change::Add, elem, -1, elem);
+  }
+}
+
+void Set::setEndpoints(int *endpoints, int size) {
+  simit_uassert(getCardinality() > 0 && kind != Grid)
+      << "Only unstructured edge sets take external endpoints";
+  simit_uassert(numElements == 0)
+      << "Endpoints must be set on an empty edge set";
+  simit_uassert(endpoints != nullptr && (uintptr_t)endpoints%alignof(int) == 0)
+      << "The endpoints buffer of " << getName() << " is misaligned";
+  checkEndpoints(endpoints, size);
+  simit_uassert(size <= capacity || !hasExternalData)
+      << "The endpoints of " << getName() << " must be set before fields "
+      << "with caller-owned buffers are added";
+  if (size > capacity) {
+    setCapacity(size);
+  }
+  if (endpointsOwned) {
+    free(this->endpoints);
+  }
+  this->endpoints = endpoints;
+  endpointsOwned = false;
+  hasExternalData = true;
+  capacity = size;
+  numElements = size;
+  structureChanged();
+  clearChanges();
+}
+
+void Set::setCapacity(int n) {
+  simit_iassert(n >= numElements);
+  simit_uassert(!hasExternalData)
+      << "Cannot grow " << getName() << " past the size of the external "
+      << "buffers it was given (" << capacity << ")";
+  n = (n + fieldBlockSize-1) / fieldBlockSize * fieldBlockSize;
+  if (getCardinality() > 0) {
+    endpoints = (int*)realloc(endpoints, n*getCardinality()*sizeof(int));
+  }
   for (auto f : fields) {
-    int typeSize = f->sizeOfType;
-    f->data = realloc(f->data, (capacity+capacityIncrement) * typeSize);
-    memset((char*)(f->data)+capacity*typeSize, 0, capacityIncrement*typeSize);
+    size_t typeSize = f->sizeOfType;
+    f->data = util::alignedRealloc(f->data, capacity*typeSize, n*typeSize);
+    if (n > capacity) {
+      memset((char*)(f->data)+capacity*typeSize, 0, (n-capacity)*typeSize);
+    }
 
     for (FieldRefBase *fieldRef : f->fieldReferences) {
       fieldRef->data = f->data;
     }
   }
-  capacity += capacityIncrement;
+  capacity = n;
+}
+
+// class Set::FieldData
+void Set::FieldData::copyElement(int from, int to) {
+  const size_t componentSize = sizeOfType / type->getSize();
+  char* fromData = (char*)data + getOffset(from)*componentSize;
+  char* toData = (char*)data + getOffset(to)*componentSize;
+  if (blockSize == 1) {
+    memcpy(toData, fromData, sizeOfType);
+    return;
+  }
+  for (size_t i=0; i < type->getSize(); ++i) {
+    memcpy(toData + i*blockSize*componentSize,
+           fromData + i*blockSize*componentSize, componentSize);
+  }
+}
+
+void Set::FieldData::clearElements(int first, int count) {
+  if (blockSize == 1) {
+    memset((char*)data + first*sizeOfType, 0, count*sizeOfType);
+    return;
+  }
+  const size_t componentSize = sizeOfType / type->getSize();
+  for (int elem=first; elem < first+count; ++elem) {
+    char* elemData = (char*)data + getOffset(elem)*componentSize;
+    for (size_t i=0; i < type->getSize(); ++i) {
+      memset(elemData + i*blockSize*componentSize, 0, componentSize);
+    }
+  }
 }
 
 
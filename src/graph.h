@@ -1,17 +1,21 @@
 #ifndef SIMIT_GRAPH_H
 #define SIMIT_GRAPH_H
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <vector>
 #include <string>
 #include <map>
+#include <mutex>
 #include <set>
 #include <ostream>
 
 #include "tensor_type.h"
 #include "error.h"
 #include "types.h"
+#include "util/util.h"
 #include "util/variadic.h"
 #include "interfaces/comparable.h"
 
@@ -28,6 +32,7 @@ namespace internal {
 class VertexToEdgeEndpointIndex;
 class VertexToEdgeIndex;
 class NeighborIndex;
+class EdgeColoring;
 }
 
 namespace pe {
@@ -191,6 +196,34 @@ public:
   /// have cardinality 0.
   inline int getCardinality() const { return endpointSets.size(); }
 
+  /// Return a coloring of the edges of the set, such that edges of the same
+  /// color share no endpoint. The coloring is computed on first use and cached
+  /// until the set is modified. It may be requested from several threads.
+  const internal::EdgeColoring& getEdgeColoring() const;
+
+  /// Return the structural version of the set. The version changes whenever
+  /// elements are added or removed or the endpoints are exposed for writing,
+  /// and no two sets ever share a version. Caches of data derived from the
+  /// set's structure, such as path indices, are valid while it is unchanged.
+  inline uint64_t getVersion() const { return version; }
+
+  /// A structural change to the set, recorded so that data derived from the
+  /// set's structure can be updated instead of rebuilt (see getChangesSince).
+  struct Change {
+    enum Kind {Add, Remove, Move};
+    Kind kind;
+    int element;                 // the element added, removed or moved to
+    int from;                    // the element's previous ident, if moved
+    std::vector<int> endpoints;  // the endpoints of the element
+    uint64_t version;            // the version of the set after the change
+  };
+
+  /// Retrieve the changes made to the set since it had `version`, in order.
+  /// Removing an element moves the last element into its place, which is
+  /// recorded as a Remove followed by a Move. Returns false if `version` is not
+  /// a version of this set, or if the changes since were not all recorded.
+  bool getChangesSince(uint64_t version, std::vector<Change>* changes) const;
+
   /// Return the grid point at the given location.
   inline ElementRef getGridPoint(std::vector<int> coords) const {
     simit_uassert(kind == Grid)
@@ -251,16 +284,74 @@ public:
   /// component type and dimension sizes of the tensors.  For example, define a
   /// field of 2x3 matrices containing doubles as follows:
   /// Field<double,2,3> matrix = addField<double,2,3>("mat");
+  /// The field's storage is aligned to util::kBufferAlignment bytes.
   template <typename T, int... dimensions>
   FieldRef<T, dimensions...> addField(const std::string &name) {
     FieldData::TensorType *type =
         new FieldData::TensorType(typeOf<T>(), {dimensions...});
     FieldData *fieldData = new FieldData(name, type, this);
-    fieldData->data = calloc(capacity, fieldData->sizeOfType);
+    fieldData->data = util::alignedCalloc(capacity, fieldData->sizeOfType);
+    fields.push_back(fieldData);
+    fieldNames[name] = fields.size()-1;
+    return FieldRef<T, dimensions...>(fieldData);
+  }
+
+  /// Add a tensor field whose data lives in a caller-owned buffer with room
+  /// for `size` elements, laid out in the set's field blocks (see
+  /// getFieldBlockSize), and which the set uses without copying. The caller
+  /// keeps ownership: the buffer must outlive the set, which never frees or
+  /// reallocates it and so cannot grow past `size` elements. Compiled
+  /// functions read and write the buffer directly.
+  ///
+  /// On an edge set whose edges are also caller-owned, call setEndpoints
+  /// first: it must be called on an empty set, and the set cannot grow to the
+  /// number of edges once a caller-owned field fixes its capacity. Fields with
+  /// caller-owned buffers must then hold at least as many elements as there
+  /// are edges.
+  ///
+  /// Compiled functions assume that distinct fields never share memory, so the
+  /// buffer must not overlap the data of the set's other fields, nor the
+  /// buffers bound to the fields of other sets passed to the same function.
+  /// Overlap with the set's own fields is rejected.
+  template <typename T, int... dimensions>
+  FieldRef<T, dimensions...> addField(const std::string &name, T *data,
+                                      int size) {
+    simit_uassert(data != nullptr) << "Field " << name << " has no buffer";
+    simit_uassert((uintptr_t)data % alignof(T) == 0)
+        << "The buffer of field " << name << " is misaligned";
+    simit_uassert(size >= numElements)
+        << "The buffer of field " << name << " holds " << size
+        << " elements, but " << getName() << " has " << numElements;
+    simit_uassert(util::product<dimensions...>::value == 1 ||
+                  size % fieldBlockSize == 0)
+        << "The buffer of field " << name << " must hold whole blocks of "
+        << fieldBlockSize << " elements";
+    checkFieldOverlap(name, data,
+                      sizeof(T) * util::product<dimensions...>::value,
+                      std::min(capacity, size));
+    FieldData::TensorType *type =
+        new FieldData::TensorType(typeOf<T>(), {dimensions...});
+    FieldData *fieldData = new FieldData(name, type, this);
+    fieldData->data = data;
+    fieldData->owned = false;
     fields.push_back(fieldData);
     fieldNames[name] = fields.size()-1;
+    capacity = std::min(capacity, size);
+    hasExternalData = true;
     return FieldRef<T, dimensions...>(fieldData);
   }
+
+  /// Make the edges of an empty edge set those in a caller-owned array of
+  /// `size` edges, where the endpoints of edge `i` are at
+  /// `endpoints[i*getCardinality()]`. The set uses the array without copying
+  /// and under the same ownership contract as external field buffers, so it
+  /// cannot grow past `size` edges.
+  ///
+  /// Must be called on an empty set, before any field is added with a
+  /// caller-owned buffer (fields the set allocates may be added before or
+  /// after). Later changes to the endpoints must be written through
+  /// getEndpointsPtr, which discards the structure derived from them.
+  void setEndpoints(int *endpoints, int size);
  
   // Added for reordering
   void setSpatialField(const std::string& name) {
@@ -295,53 +386,57 @@ public:
   ElementRef add(Endpoints... endpoints) {
     simit_iassert(sizeof...(endpoints) == getCardinality())
         <<"Wrong number of endpoints.";
-    if (numElements > capacity-1) {
-      increaseEdgeCapacity();
+    if (numElements == capacity) {
+      grow(numElements+1);
     }
     addEndpoints(0, endpoints...);
+    structureChanged();
+    recordChange(Change::Add, numElements, -1, numElements);
+    return ElementRef(numElements++);
+  }
+
+  /// Add `count` elements with zeroed fields to a set without endpoints,
+  /// returning the handle of the first.
+  ElementRef addN(int count);
+
+  /// Add `count` edges with zeroed fields, returning the handle of the first.
+  /// The endpoints of edge `i` are at `endpoints[i*getCardinality()]` and
+  /// refer to the respective Sets they come from. `endpoints` may only be
+  /// null if `count` is zero or the set has no endpoints.
+  ElementRef addN(const int* endpoints, int count);
 
-    if (numElements > capacity-1) {
-      increaseCapacity();
+  /// Make room for at least `n` elements, so that adding up to `n` elements
+  /// does not reallocate the set's endpoints and fields.
+  void reserve(int n) {
+    if (n > capacity) {
+      setCapacity(n);
     }
-    return ElementRef(numElements++);
   }
 
+  /// Return the number of elements the set has room for.
+  inline int getCapacity() const { return capacity; }
+
+  /// Return the number of elements whose vector and matrix field components
+  /// are stored together (see Settings::fieldBlockSize).
+  inline int getFieldBlockSize() const { return fieldBlockSize; }
+
   /// Remove an element from the Set
   void remove(ElementRef element) {
     simit_uassert(kind != Grid)
         << "Element removal disallowed for grid edge sets";
-    for (auto f : fields){
-      switch (f->type->getComponentType()) {
-        case ComponentType::Float: {
-          float* data = (float*)f->data;
-          data[element.ident] = data[numElements-1];
-          break;
-        }
-        case ComponentType::Double: {
-          double* data = (double*)f->data;
-          data[element.ident] = data[numElements-1];
-          break;
-        }
-        case ComponentType::Int: {
-          int* data = (int*)f->data;
-          data[element.ident] = data[numElements-1];
-          break;
-        }
-        case ComponentType::Boolean: {
-          bool* data = (bool*)f->data;
-          data[element.ident] = data[numElements-1];
-          break;
-        }
-        case ComponentType::FloatComplex: {
-          float_complex* data = (float_complex*)f->data;
-          data[element.ident] = data[numElements-1];
-          break;
-        }
-        case ComponentType::DoubleComplex: {
-          double_complex* data = (double_complex*)f->data;
-          data[element.ident] = data[numElements-1];
-          break;
-        }
+    const int last = numElements-1;
+    structureChanged();
+    recordChange(Change::Remove, element.ident, -1, element.ident);
+    if (element.ident != last) {
+      recordChange(Change::Move, element.ident, last, last);
+    }
+    for (int i=0; i < getCardinality(); ++i) {
+      endpoints[element.ident*getCardinality()+i] =
+          endpoints[last*getCardinality()+i];
+    }
+    if (element.ident != last) {
+      for (auto f : fields) {
+        f->copyElement(last, element.ident);
       }
     }
     numElements--;
@@ -526,7 +621,8 @@ public:
   }
 
   /// Get an array containing, for each edge in a set, the elements it connects.
-  int *getEndpointsData() { return endpoints; }
+  /// Use getEndpointsPtr to write the endpoints.
+  const int *getEndpointsData() const { return endpoints; }
 
   void setName(const std::string &name) { this->name = name; }
   std::string getName() const { return name; }
@@ -536,7 +632,7 @@ public:
   }
 
   // A field on the members of the Set.
-  // Invariant: elements < capacity
+  // Invariant: elements <= capacity
   struct FieldData {
     // Replace with simit::TensorType
     class TensorType {
@@ -567,12 +663,15 @@ public:
     };
 
     FieldData(const std::string &name, const TensorType *type, Set *set)
-        : name(name), type(type), set(set), data(nullptr) {
+        : name(name), type(type), set(set), data(nullptr), owned(true) {
       sizeOfType = componentSize(type->getComponentType()) * type->getSize();
+      blockSize = (type->getSize() > 1) ? set->fieldBlockSize : 1;
     }
 
     ~FieldData() {
-      free(data);
+      if (owned) {
+        free(data);
+      }
       delete type;
     }
 
@@ -587,6 +686,27 @@ public:
     /// Buffer for the field data
     void* data;
 
+    /// Whether the set allocated the buffer, or it belongs to the caller
+    bool owned;
+
+    /// The number of elements whose tensors are stored together. The buffer
+    /// holds blocks of blockSize elements, where each block stores the first
+    /// component of every element, then the second, and so on. A block size of
+    /// one interleaves the components of each element.
+    int blockSize;
+
+    /// Offset, in components, of the first component of `element`. The
+    /// following components are blockSize apart.
+    inline size_t getOffset(int element) const {
+      return (element/blockSize)*blockSize*type->getSize() + element%blockSize;
+    }
+
+    /// Copy the tensor of element `from` to element `to`
+    void copyElement(int from, int to);
+
+    /// Zero the tensors of `count` elements from `first`
+    void clearElements(int first, int count);
+
     /// Field references so that we can update their data pointers if we realloc
     /// field data. Avoids two loads on field get/set.
     std::set<FieldRefBase*> fieldReferences;
@@ -598,7 +718,11 @@ public:
   };
 
   // Added getters for reordering
-  inline int* getEndpointsPtr() { return endpoints; }
+  inline int* getEndpointsPtr() {
+    structureChanged();
+    clearChanges();
+    return endpoints;
+  }
   inline int getFieldIndex(std::string name) { return fieldNames[name]; } inline 
     std::vector<FieldData*>& getFields() { return fields; } inline std::string 
     getSpatialFieldName() const { return spatialFieldName; }
@@ -610,7 +734,11 @@ private:
   Set(const std::string &name, Kind kind)
       : kind(kind), name(name), numElements(0), endpoints(nullptr),
         gridPoints(nullptr), gridEdges(nullptr),
-        capacity(capacityIncrement), neighbors(nullptr) {}
+        capacity(initialCapacity), fieldBlockSize(defaultFieldBlockSize()),
+        endpointsOwned(true),
+        hasExternalData(false), neighbors(nullptr),
+        edgeColoring(nullptr), version(nextVersion()),
+        changesVersion(version) {}
 
   // Set data
   Kind kind;
@@ -627,17 +755,73 @@ private:
   ElementRef* gridEdges;                     // ordered refs to grid edges
 
   int capacity;                              // current capacity of the set
-  static const int capacityIncrement = 1024; // increment for capacity increases
+  static const int initialCapacity = 1024;   // capacity of a new set
+  int fieldBlockSize;                        // elements per field block
+  bool endpointsOwned;                       // whether we allocated endpoints
+  bool hasExternalData;                      // caller-owned buffers bound
 
   mutable internal::NeighborIndex *neighbors;// neighbor index (lazily created)
+  mutable internal::EdgeColoring *edgeColoring; // edge coloring (lazily created)
+  mutable std::mutex edgeColoringMutex;      // guards edgeColoring
+  uint64_t version;                          // structural version of the set
+  std::vector<Change> changes;               // changes since changesVersion
+  uint64_t changesVersion;                   // first version in changes
   std::map<std::string, int> fieldNames;     // name to field lookups
   std::vector<FieldData*> fields;            // fields of elements in the set
 
   /// disable copy
   Set& operator=(const Set& s);
 
-  /// increase capacity of all fields
-  void increaseCapacity();
+  /// grow the capacity geometrically to hold at least `n` elements, so that
+  /// adding elements one at a time takes amortized constant time
+  void grow(int n) {
+    setCapacity(std::max(n, capacity + capacity/2));
+  }
+
+  /// reallocate the endpoints and fields with room for `n` elements, rounded
+  /// up to whole field blocks, and zero the fields of the new elements
+  void setCapacity(int n);
+
+  /// the field block size of new sets
+  static int defaultFieldBlockSize();
+
+  /// check that the endpoints of `count` edges refer to their sets' elements
+  void checkEndpoints(const int* endpoints, int count) const;
+
+  /// check that a field buffer of `capacity` elements of `sizeOfType` bytes
+  /// does not overlap the first `capacity` elements of the other fields
+  void checkFieldOverlap(const std::string& name, const void* data,
+                         size_t sizeOfType, int capacity) const;
+
+  /// record the `count` elements added from `first`
+  void recordAdds(int first, int count);
+
+  /// return a version that no set has had before
+  static uint64_t nextVersion();
+
+  /// bump the version and discard cached structure after the elements change
+  void structureChanged() {
+    version = nextVersion();
+    clearEdgeColoring();
+  }
+
+  /// record a change to the element `element`, whose endpoints are those of
+  /// `endpointsOf`, made at the current version
+  void recordChange(Change::Kind kind, int element, int from, int endpointsOf);
+
+  /// forget the recorded changes, e.g. when they are too many to be useful
+  void clearChanges() {
+    changes.clear();
+    changesVersion = version;
+  }
+
+  /// discard the cached edge coloring after the endpoints change
+  void clearEdgeColoring() {
+    if (edgeColoring != nullptr) {
+      deleteEdgeColoring();
+    }
+  }
+  void deleteEdgeColoring();
 
   /// helpers for constructing endpoint sets
   template <typename F, typename ...T> std::vector<const Set*>
@@ -653,11 +837,6 @@ private:
   std::vector<const Set*>
   epsMaker(std::vector<const Set*> sofar) {return sofar;}
 
-  void increaseEdgeCapacity() {
-    size_t newSize = (capacity+capacityIncrement)*getCardinality()*sizeof(int);
-    endpoints = (int*)realloc(endpoints, newSize);
-  }
-
   // helper for adding edges
   template <typename F, typename ...T>
   void addEndpoints(int which, F f, T ... eps) {
@@ -707,7 +886,7 @@ private:
       FieldData::TensorType *type =
           new FieldData::TensorType(ctype, dims);
       FieldData *fieldData = new FieldData(field.name, type, this);
-      fieldData->data = calloc(capacity, fieldData->sizeOfType);
+      fieldData->data = util::alignedCalloc(capacity, fieldData->sizeOfType);
       fields.push_back(fieldData);
       fieldNames[field.name] = fields.size()-1;
     }
@@ -792,8 +971,9 @@ public:
   }
 
   // Return the field's data.  The data is a contigues sequence containing the
-  // tensor of each element in no particular order.  The tensors are currently
-  // laid out in row-major order, but this may change in the future.
+  // tensor of each element in no particular order.  The tensors are laid out
+  // in row-major order, with the components of the elements of each field
+  // block interleaved (see Set::FieldData::blockSize).
   inline void *getData() {
     return static_cast<void*>(data);
   }
@@ -808,7 +988,8 @@ protected:
   template <typename T>
   inline T *getElemDataPtr(ElementRef element, size_t elementFieldSize) const {
     simit_iassert(sizeof(T) == componentSize(fieldData->type->getComponentType()));
-    return &static_cast<T*>(data)[element.ident * elementFieldSize];
+    simit_iassert(elementFieldSize == fieldData->type->getSize());
+    return &static_cast<T*>(data)[fieldData->getOffset(element.ident)];
   }
 
   Set::FieldData *fieldData;
@@ -823,11 +1004,13 @@ template <typename T, int... dimensions>
 class FieldRefBaseParameterized : public FieldRefBase {
  public:
   TensorRef<T, dimensions...> get(ElementRef element) {
-    return TensorRef<T, dimensions...>(getElemDataPtr(element));
+    return TensorRef<T, dimensions...>(getElemDataPtr(element),
+                                       this->fieldData->blockSize);
   }
 
   const TensorRef<T, dimensions...> get(ElementRef element) const {
-    return TensorRef<T, dimensions...>(getElemDataPtr(element));
+    return TensorRef<T, dimensions...>(getElemDataPtr(element),
+                                       this->fieldData->blockSize);
   }
 
   TensorRef<T, dimensions...> operator()(ElementRef element) {
@@ -844,7 +1027,8 @@ class FieldRefBaseParameterized : public FieldRefBase {
     T *elemData = this->getElemDataPtr(element);
     size_t i=0;
     for (T val : values) {
-      elemData[i++] = val;
+      elemData[i] = val;
+      i += this->fieldData->blockSize;
     }
   }
 
@@ -856,7 +1040,8 @@ class FieldRefBaseParameterized : public FieldRefBase {
     T *elemData = this->getElemDataPtr(element);
     size_t i=0;
     for (T val : values) {
-      elemData[i++] = val;
+      elemData[i] = val;
+      i += this->fieldData->blockSize;
     }
   }
 
@@ -953,7 +1138,8 @@ public:
     simit_iassert(vals.size() == util::product<Dimensions...>::value);
     size_t i=0;
     for (ComponentType val : vals) {
-      data[i++] = val;
+      data[i] = val;
+      i += stride;
     }
     return *this;
   }
@@ -962,14 +1148,16 @@ public:
   inline ComponentType& operator()(Indices... index) {
     static_assert(sizeof...(index) == sizeof...(Dimensions),
                   "Incorrect number of indices used to index tensor");
-    return data[util::computeOffset(util::seq<Dimensions...>(), index...)];
+    return data[util::computeOffset(util::seq<Dimensions...>(), index...) *
+                stride];
   }
 
   template <typename... Indices> inline
   const ComponentType& operator()(Indices... index) const {
     static_assert(sizeof...(index) == sizeof...(Dimensions),
                   "Incorrect number of indices used to index tensor");
-    return data[util::computeOffset(util::seq<Dimensions...>(), index...)];
+    return data[util::computeOffset(util::seq<Dimensions...>(), index...) *
+                stride];
   }
 
   friend bool operator==(const TensorRef& l, const TensorRef& r){
@@ -981,8 +1169,11 @@ public:
   }
 
 private:
-  inline TensorRef(ComponentType *data) : data(data) {}
+  /// `stride` is the distance between consecutive components in `data`
+  inline TensorRef(ComponentType *data, size_t stride)
+      : data(data), stride(stride) {}
   ComponentType *data;
+  size_t stride;
 
   friend class FieldRefBaseParameterized<ComponentType, Dimensions...>;
 };
@@ -1019,7 +1210,7 @@ public:
   }
 
 private:
-  inline TensorRef(ComponentType *data) : data(data) {}
+  inline TensorRef(ComponentType *data, size_t) : data(data) {}
   ComponentType* data;
 
   friend class FieldRefBaseParameterized<ComponentType>;
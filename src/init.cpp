@@ -2,4 +2,17 @@
 
 namespace simit {
 bool kIndexlessStencils;
+unsigned kNumThreads = 0;
+const std::vector<std::string> VALID_PARALLEL_ASSEMBLIES = {"auto", "coloring",
+                                                           "privatization"};
+std::string kParallelAssembly = "auto";
+std::map<std::string,std::string> kFunctionParallelAssembly;
+unsigned kFieldBlockSize = 1;
+const std::vector<std::string> VALID_MATRIX_STORAGES = {"csr", "sell"};
+std::string kMatrixStorage = "csr";
+unsigned kSellSliceHeight = 8;
+unsigned kSellSortWindow = 64;
+std::string kJITCacheDir;
+std::string kTargetCPU = "native";
+bool kProfileCompilation = false;
 }
@@ -2,23 +2,83 @@
 #define INIT_H
 
 #include <algorithm>
+#include <map>
 #include <string>
 
 #include "error.h"
 #include "ir.h"
 #include "program.h"
+#include "thread_pool.h"
 
 namespace simit {
 
 extern const std::vector<std::string> VALID_BACKENDS;
 extern std::string kBackend;
 extern bool kIndexlessStencils;
+extern unsigned kNumThreads;
+extern const std::vector<std::string> VALID_PARALLEL_ASSEMBLIES;
+extern std::string kParallelAssembly;
+extern std::map<std::string,std::string> kFunctionParallelAssembly;
+extern unsigned kFieldBlockSize;
+extern const std::vector<std::string> VALID_MATRIX_STORAGES;
+extern std::string kMatrixStorage;
+extern unsigned kSellSliceHeight;
+extern unsigned kSellSortWindow;
+extern std::string kJITCacheDir;
+extern std::string kTargetCPU;
+extern bool kProfileCompilation;
 
 // Settings struct with default values
 struct Settings {
   std::string backend="cpu";
   int floatSize = 8;
   bool indexlessStencils = false;
+  /// Number of threads used by the cpu-parallel backend (0 means one thread
+  /// per hardware thread)
+  int numThreads = 0;
+  /// How the cpu-parallel backend avoids races between map iterations that add
+  /// to the same result locations: "coloring" runs the edges of a set color by
+  /// color, "privatization" gives every thread its own copy of the results,
+  /// and "auto" picks one at runtime from the result size and thread count.
+  std::string parallelAssembly = "auto";
+  /// Per-function overrides of parallelAssembly, keyed by function name
+  std::map<std::string,std::string> functionParallelAssembly;
+  /// Number of elements whose vector and matrix field components are stored
+  /// together. With 1 the components of each element are interleaved (xyzxyz),
+  /// while with 4 or 8 sets store blocks of that many elements component by
+  /// component (xxxxyyyyzzzz), so that loops over a set load and store each
+  /// component with vector instructions. Sets take the block size in effect
+  /// when they are created. Only the cpu backend supports blocks.
+  int fieldBlockSize = 1;
+  /// Storage of the indexed matrices that are assembled by maps and multiplied
+  /// by vectors. With "csr" the products read their blocked CSR values. With
+  /// "sell" every assembly also packs the values into a sliced ELLPACK
+  /// (SELL-C-sigma) layout, which the products read instead: the rows are
+  /// sorted by length within windows of sellSortWindow rows and stored in
+  /// slices of sellSliceHeight rows, padded to the longest row of the slice,
+  /// so that products process the rows of a slice with vector instructions.
+  /// This pays off for matrices whose rows have similar lengths, such as those
+  /// of meshes, that are multiplied several times per assembly. Only the cpu
+  /// backends support "sell".
+  std::string matrixStorage = "csr";
+  /// Rows per slice of "sell" matrices (4, 8 or 16)
+  int sellSliceHeight = 8;
+  /// Rows per sorting window of "sell" matrices (a multiple of the slice
+  /// height). Larger windows pad less but scatter the results further.
+  int sellSortWindow = 64;
+  /// Directory where the cpu backends store the machine code of compiled
+  /// functions. Later compilations of the same function, in this or another
+  /// process, load the machine code instead of optimizing and generating it
+  /// again. An empty string disables the cache.
+  std::string jitCacheDir = "";
+  /// CPU that the cpu backends generate code for. "native" detects the host
+  /// CPU and its features (e.g. AVX2 or AVX-512), so that loops are vectorized
+  /// with its widest vector instructions. An LLVM CPU name such as "haswell" or
+  /// "generic" generates code that also runs on other machines of that kind.
+  std::string targetCPU = "native";
+  /// Record the wall time and IR size of every lowering pass and LLVM pass
+  /// group when compiling functions (see Function::getCompileProfile).
+  bool profileCompilation = false;
 };
 
 inline void init(const Settings& settings) {
@@ -36,6 +96,85 @@ inline void init(const Settings& settings) {
 
   // indexlessStencils
   kIndexlessStencils = settings.indexlessStencils;
+
+  // numThreads
+  simit_uassert(settings.numThreads >= 0)
+      << "Invalid number of threads: " << settings.numThreads;
+  kNumThreads = settings.numThreads;
+  ThreadPool::getInstance().setNumThreads(kNumThreads);
+
+  // parallelAssembly
+  simit_uassert(std::find(VALID_PARALLEL_ASSEMBLIES.begin(),
+                          VALID_PARALLEL_ASSEMBLIES.end(),
+                          settings.parallelAssembly) !=
+                VALID_PARALLEL_ASSEMBLIES.end())
+      << "Invalid parallel assembly: " << settings.parallelAssembly;
+  for (auto& function : settings.functionParallelAssembly) {
+    simit_uassert(std::find(VALID_PARALLEL_ASSEMBLIES.begin(),
+                            VALID_PARALLEL_ASSEMBLIES.end(),
+                            function.second) !=
+                  VALID_PARALLEL_ASSEMBLIES.end())
+        << "Invalid parallel assembly for " << function.first << ": "
+        << function.second;
+  }
+  kParallelAssembly = settings.parallelAssembly;
+  kFunctionParallelAssembly = settings.functionParallelAssembly;
+
+  // fieldBlockSize
+  simit_uassert(settings.fieldBlockSize > 0 && settings.fieldBlockSize <= 16 &&
+                (settings.fieldBlockSize & (settings.fieldBlockSize-1)) == 0)
+      << "Invalid field block size: " << settings.fieldBlockSize;
+  simit_uassert(settings.fieldBlockSize == 1 || settings.backend == "cpu")
+      << "The " << settings.backend << " backend does not support field blocks";
+  kFieldBlockSize = settings.fieldBlockSize;
+
+  // matrixStorage
+  simit_uassert(std::find(VALID_MATRIX_STORAGES.begin(),
+                          VALID_MATRIX_STORAGES.end(),
+                          settings.matrixStorage) !=
+                VALID_MATRIX_STORAGES.end())
+      << "Invalid matrix storage: " << settings.matrixStorage;
+  simit_uassert(settings.matrixStorage == "csr" || settings.backend != "gpu")
+      << "The gpu backend does not support " << settings.matrixStorage
+      << " matrix storage";
+  simit_uassert(settings.sellSliceHeight == 4 || settings.sellSliceHeight == 8 ||
+                settings.sellSliceHeight == 16)
+      << "Invalid sell slice height: " << settings.sellSliceHeight;
+  simit_uassert(settings.sellSortWindow > 0 &&
+                settings.sellSortWindow % settings.sellSliceHeight == 0)
+      << "Invalid sell sort window: " << settings.sellSortWindow;
+  kMatrixStorage = settings.matrixStorage;
+  kSellSliceHeight = settings.sellSliceHeight;
+  kSellSortWindow = settings.sellSortWindow;
+
+  // jitCacheDir
+  kJITCacheDir = settings.jitCacheDir;
+
+  // targetCPU
+  simit_uassert(settings.targetCPU != "") << "Invalid target CPU";
+  kTargetCPU = settings.targetCPU;
+
+  // profileCompilation
+  kProfileCompilation = settings.profileCompilation;
+}
+
+/// Returns the settings that Simit was last initialized with.
+inline Settings getSettings() {
+  Settings settings;
+  settings.backend = kBackend;
+  settings.floatSize = ir::ScalarType::floatBytes;
+  settings.indexlessStencils = kIndexlessStencils;
+  settings.numThreads = kNumThreads;
+  settings.parallelAssembly = kParallelAssembly;
+  settings.functionParallelAssembly = kFunctionParallelAssembly;
+  settings.fieldBlockSize = kFieldBlockSize;
+  settings.matrixStorage = kMatrixStorage;
+  settings.sellSliceHeight = kSellSliceHeight;
+  settings.sellSortWindow = kSellSortWindow;
+  settings.jitCacheDir = kJITCacheDir;
+  settings.targetCPU = kTargetCPU;
+  settings.profileCompilation = kProfileCompilation;
+  return settings;
 }
 
 inline void init(std::string backend="cpu", int floatSize=8) {
@@ -116,7 +116,7 @@ void CallRewriter::visit(const CallStmt *op) {
   }
 
   IRBuilder builder;
-  static util::NameGenerator names;
+  static thread_local util::NameGenerator names;
 
   const std::set<Var> referencedVars = getReferencedVars(op->actuals);
 
@@ -512,17 +512,29 @@ static bool isHomogeneous(const std::vector<Expr*>& endpointSets) {
 /// ~~~~~~~~~~~~~~~
 ///   % Gather locs from As_index
 ///   var .As_index_locs : tensor[0:2,0:2](int);
-///   for i in 0:2
-///     for j in 0:2
-///       var .locVar : int;
-///       .locVar = __loc(.eps[i], .eps[j], As_index.coords, As_index.sinks);
-///       .As_index_locs(i,j) = .locVar;
+///   if (As_index.locs[0] >= 0)
+///     for i in 0:2
+///       for j in 0:2
+///         .As_index_locs(i,j) = As_index.locs[(e * 4) + (i * 2) + j];
+///       end
+///     end
+///   else
+///     for i in 0:2
+///       for j in 0:2
+///         var .locVar : int;
+///         .locVar = __locSorted(.eps[i], .eps[j], As_index.coords,
+///                               As_index.sinks);
+///         .As_index_locs(i,j) = .locVar;
+///       end
 ///     end
 ///   end
 /// ~~~~~~~~~~~~~~~
+/// The location table is precomputed when the function is initialized, unless
+/// it would be too large. Heterogeneous edge sets search the index.
 /// (Locations for matrices with the same index are only computed once.)
 static Stmt gatherVVLocs(TensorIndex index, const std::vector<Expr*> &endpoints,
-                         const std::vector<IndexSet> &dims, Var eps,
+                         const std::vector<IndexSet> &dims, Expr target,
+                         Var eps, Var lv,
                          std::map<TensorIndex,Var>* indexToLocs) {
   const int cardinality = endpoints.size();
 
@@ -541,14 +553,27 @@ static Stmt gatherVVLocs(TensorIndex index, const std::vector<Expr*> &endpoints,
   Var j("j", Int);
 
   Var locVar(INTERNAL_PREFIX("locVar"), Int);
-  Stmt locStmt = CallStmt::make({locVar}, intrinsics::loc(),
+  Stmt locStmt = CallStmt::make({locVar}, intrinsics::locSorted(),
                                 {Load::make(eps,i),Load::make(eps,j),ptr, idx});
   Stmt locsInit = Block::make({locStmt, TensorWrite::make(locs,{i,j}, locVar)});
 
   if (isHomogeneous(endpoints)) {
     Stmt locsInitLoop = ForRange::make(j, 0, cardinality, locsInit);
     locsInitLoop      = ForRange::make(i, 0, cardinality, locsInitLoop);
-    
+
+    // The GPU backend does not build location tables
+    if (kBackend != "gpu" && isa<VarExpr>(target)) {
+      index.setLocationTableSet(to<VarExpr>(target)->var);
+      Expr table = index.getLocationTableArray();
+      Expr tableLoc = lv*(cardinality*cardinality) + i*cardinality + j;
+      Stmt tableInit = TensorWrite::make(locs, {i,j},
+                                         Load::make(table, tableLoc));
+      Stmt tableLoop = ForRange::make(j, 0, cardinality, tableInit);
+      tableLoop      = ForRange::make(i, 0, cardinality, tableLoop);
+      locsInitLoop = IfThenElse::make(Ge::make(Load::make(table, 0), 0),
+                                      tableLoop, locsInitLoop);
+    }
+
     return Block::make(locsDecl, locsInitLoop);
   }
  
@@ -584,7 +609,7 @@ static Stmt gatherVVLocs(TensorIndex index, const std::vector<Expr*> &endpoints,
 ///     var .As_index_locs : tensor[0:2](int);
 ///     for i in 0:2
 ///       var .locVar : int;
-///       .locVar = __loc(.eps[i], e, As_index.coords, As_index.sinks);
+///       .locVar = __locSorted(.eps[i], e, As_index.coords, As_index.sinks);
 ///       .As_index_locs(i) = .locVar;
 ///     end
 ///     ...
@@ -608,7 +633,7 @@ static Stmt gatherVELocs(TensorIndex index, const std::vector<Expr*> &endpoints,
   Var i("i", Int);
 
   Var locVar(INTERNAL_PREFIX("locVar"), Int);
-  Stmt locStmt = CallStmt::make({locVar}, intrinsics::loc(),
+  Stmt locStmt = CallStmt::make({locVar}, intrinsics::locSorted(),
                                 {Load::make(eps,i), lv, ptr, idx});
   Stmt locsInit = Block::make({locStmt, TensorWrite::make(locs,{i}, locVar)});
 
@@ -749,7 +774,8 @@ Stmt inlineMapFunction(const Map *map, Var lv, vector<Var> ivs,
         Stmt gatherLocs;
         if (dims[0] != target && dims[1] != target) {
           // vv matrix
-          gatherLocs = gatherVVLocs(index, endpoints, dims, eps, &indexToLocs);
+          gatherLocs = gatherVVLocs(index, endpoints, dims, target, eps, lv,
+                                    &indexToLocs);
         }
         else if (dims[0] != target && dims[1] == target) {
           // ve matrix
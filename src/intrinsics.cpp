@@ -567,6 +567,22 @@ const Func& lltmatsolve() {
   return lltmatsolveVar;
 }
 
+static Func pcgVar;
+void pcgInit() {
+  pcgVar = Func("pcg",
+                {Var("A", Type()), Var("b", Type()), Var("x0", Type()),
+                 Var("tol", Float), Var("maxiters", Int),
+                 Var("precond", String)},
+                {Var("x", Type())},
+                Func::External);
+}
+const Func& pcg() {
+  if (!pcgVar.defined()) {
+    pcgInit();
+  }
+  return pcgVar;
+}
+
 static Func strcmpVar;
 void strcmpInit() {
   strcmpVar = Func("strcmp",
@@ -693,6 +709,20 @@ const Func& loc() {
   return locVar;
 }
 
+static Func locSortedVar;
+void locSortedInit() {
+  locSortedVar = Func("__locSorted",
+                      {},
+                      {Var("r", Int)},
+                      Func::Intrinsic);
+}
+const Func& locSorted() {
+  if (!locSortedVar.defined()) {
+    locSortedInit();
+  }
+  return locSortedVar;
+}
+
 
 const std::map<std::string,Func> &byNames() {
   static std::map<std::string,Func> byNameMap;
@@ -736,6 +766,7 @@ const std::map<std::string,Func> &byNames() {
     cholfreeInit();
     lltsolveInit();
     lltmatsolveInit();
+    pcgInit();
     strcmpInit();
     strlenInit();
     strcpyInit();
@@ -745,6 +776,7 @@ const std::map<std::string,Func> &byNames() {
     mallocInit();
     freeInit();
     locInit();
+    locSortedInit();
     byNameMap.insert({{"mod",modVar},
                       {"sin",sinVar},
                       {"cos",cosVar},
@@ -784,6 +816,7 @@ const std::map<std::string,Func> &byNames() {
                       {"cholfree", cholfreeVar},
                       {"lltsolve", lltsolveVar},
                       {"lltmatsolve", lltmatsolveVar},
+                      {"pcg", pcgVar},
                       {"strcmp", strcmpVar},
                       {"strlen", strlenVar},
                       {"strcpy", strcpyVar},
@@ -792,7 +825,8 @@ const std::map<std::string,Func> &byNames() {
                       {"storeTime",storeTimeVar},
                       {"malloc", mallocVar},
                       {"free", freeVar},
-                      {"__loc", locVar}});
+                      {"__loc", locVar},
+                      {"__locSorted", locSortedVar}});
   }
   return byNameMap;
 }
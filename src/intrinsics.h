@@ -62,6 +62,7 @@ const Func& cholfree();
 const Func& lltsolve();
 const Func& lltmatsolve();
 const Func& triangularSolve();
+const Func& pcg();
 
 // String manipulation
 const Func& strcmp();
@@ -77,6 +78,7 @@ const Func& storeTime();
 const Func& malloc();
 const Func& free();
 const Func& loc();
+const Func& locSorted();
 
 const std::map<std::string,Func> &byNames();
 
@@ -1,6 +1,8 @@
 #ifndef SIMIT_INTRUSIVE_PTR_H
 #define SIMIT_INTRUSIVE_PTR_H
 
+#include <atomic>
+
 namespace simit {
 namespace util {
 
@@ -13,11 +15,12 @@ template<typename T> void release(const T *);
 /// This class provides an intrusive pointer, which is a pointer that stores its
 /// reference count in the managed class.  The managed class must therefore have
 /// a reference count field and provide two functions 'aquire' and 'release'
-/// to aquire and release a reference on itself.
+/// to aquire and release a reference on itself. The count is atomic, so objects
+/// may be shared by threads that compile functions concurrently.
 ///
 /// For example:
 /// struct X {
-///   mutable long ref = 0;
+///   mutable std::atomic<long> ref{0};
 ///   friend void aquire(const X *x) { ++x->ref; }
 ///   friend void release(const X *x) { if (--x->ref ==0) delete x; }
 /// };
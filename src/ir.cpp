@@ -821,11 +821,16 @@ Stmt While::make(Expr condition, Stmt body) {
 }
 
 // struct Kernel
-Stmt Kernel::make(Var var, IndexDomain domain, Stmt body) {
+Stmt Kernel::make(Var var, IndexDomain domain, Stmt body, Schedule schedule,
+                  std::vector<std::pair<Var,Expr>> reductions) {
+  simit_iassert(reductions.empty() ||
+                schedule == Privatized || schedule == Adaptive);
   Kernel *node = new Kernel;
   node->var = var;
   node->domain = domain;
   node->body = body;
+  node->schedule = schedule;
+  node->reductions = reductions;
   return node;
 }
 
@@ -24,7 +24,7 @@ public:
   virtual void accept(IRVisitorStrict *visitor) const = 0;
 
 private:
-  mutable long ref = 0;
+  mutable std::atomic<long> ref{0};
   friend void aquire(const IRNode *node) {++node->ref;}
   friend void release(const IRNode *node) {if (--node->ref == 0) delete node;}
 };
@@ -431,10 +431,28 @@ struct While : public StmtNode {
 };
 
 struct Kernel : public StmtNode {
+  /// How the iterations of a kernel are divided among threads. Independent
+  /// kernels split the domain into contiguous ranges. Colored kernels run the
+  /// edges of one color at a time, so that concurrent iterations never share
+  /// an endpoint. Privatized kernels split the domain into contiguous ranges
+  /// that add to per-thread copies of the reduction buffers, which are summed
+  /// at the end. Adaptive kernels are colored or privatized, as picked by the
+  /// runtime from the size of the reduction buffers and the number of threads.
+  enum Schedule {Independent, Colored, Privatized, Adaptive};
+
   Var var;
   IndexDomain domain;
   Stmt body;
-  static Stmt make(Var var, IndexDomain domain, Stmt body);
+  Schedule schedule;
+
+  /// The shared buffers that privatized kernels add to. The body adds to the
+  /// first var of each pair, which is bound to a thread's zero-initialized copy
+  /// of the buffer.
+  std::vector<std::pair<Var,Expr>> reductions;
+
+  static Stmt make(Var var, IndexDomain domain, Stmt body,
+                   Schedule schedule=Independent,
+                   std::vector<std::pair<Var,Expr>> reductions={});
   void accept(IRVisitorStrict *v) const {v->visit((const Kernel*)this);}
 };
 
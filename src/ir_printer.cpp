@@ -459,7 +459,29 @@ void IRPrinter::visit(const While *op) {
 
 void IRPrinter::visit(const Kernel *op) {
   indent();
-  os << "kernel for " << op->var << " in " << op->domain << endl;
+  os << "kernel for " << op->var << " in " << op->domain;
+  switch (op->schedule) {
+    case Kernel::Independent:
+      break;
+    case Kernel::Colored:
+      os << " colored";
+      break;
+    case Kernel::Privatized:
+      os << " privatized";
+      break;
+    case Kernel::Adaptive:
+      os << " adaptive";
+      break;
+  }
+  if (!op->reductions.empty()) {
+    os << " (";
+    for (size_t i=0; i < op->reductions.size(); ++i) {
+      if (i > 0) os << ", ";
+      os << op->reductions[i].first << " += " << op->reductions[i].second;
+    }
+    os << ")";
+  }
+  os << endl;
   ++indentation;
   print(op->body);
   --indentation;
@@ -149,6 +149,69 @@ private:
   }
 };
 
+size_t countNodes(Func func) {
+  class CountNodesVisitor : public IRVisitorCallGraph {
+  public:
+    using IRVisitorCallGraph::visit;
+    size_t count = 0;
+
+#define COUNT_NODE(Node)                 \
+    void visit(const Node *op) {         \
+      ++count;                           \
+      IRVisitorCallGraph::visit(op);     \
+    }
+    COUNT_NODE(Literal)
+    COUNT_NODE(VarExpr)
+    COUNT_NODE(Load)
+    COUNT_NODE(FieldRead)
+    COUNT_NODE(Length)
+    COUNT_NODE(IndexRead)
+    COUNT_NODE(Neg)
+    COUNT_NODE(Add)
+    COUNT_NODE(Sub)
+    COUNT_NODE(Mul)
+    COUNT_NODE(Div)
+    COUNT_NODE(Rem)
+    COUNT_NODE(Not)
+    COUNT_NODE(Eq)
+    COUNT_NODE(Ne)
+    COUNT_NODE(Gt)
+    COUNT_NODE(Lt)
+    COUNT_NODE(Ge)
+    COUNT_NODE(Le)
+    COUNT_NODE(And)
+    COUNT_NODE(Or)
+    COUNT_NODE(Xor)
+    COUNT_NODE(VarDecl)
+    COUNT_NODE(AssignStmt)
+    COUNT_NODE(CallStmt)
+    COUNT_NODE(Store)
+    COUNT_NODE(FieldWrite)
+    COUNT_NODE(Scope)
+    COUNT_NODE(IfThenElse)
+    COUNT_NODE(ForRange)
+    COUNT_NODE(For)
+    COUNT_NODE(While)
+    COUNT_NODE(Kernel)
+    COUNT_NODE(Block)
+    COUNT_NODE(Print)
+    COUNT_NODE(Comment)
+    COUNT_NODE(Pass)
+    COUNT_NODE(UnnamedTupleRead)
+    COUNT_NODE(NamedTupleRead)
+    COUNT_NODE(SetRead)
+    COUNT_NODE(TensorRead)
+    COUNT_NODE(TensorWrite)
+    COUNT_NODE(IndexedTensor)
+    COUNT_NODE(IndexExpr)
+    COUNT_NODE(Map)
+#undef COUNT_NODE
+  };
+  CountNodesVisitor visitor;
+  func.accept(&visitor);
+  return visitor.count;
+}
+
 size_t countIndexVars(Expr expr) {
   class CountIndexVarsVisitor : public IRVisitor {
   public:
@@ -21,6 +21,10 @@ bool containsIndexedTensor(Expr expr);
 
 size_t countIndexVars(Expr expr);
 
+/// Returns the number of expression and statement nodes in `func` and in the
+/// functions it (transitively) calls.
+size_t countNodes(Func func);
+
 /// Returns true if the statement has been flattened (only contains one index
 /// expression), and false otherwise.
 bool isFlattened(Stmt stmt);
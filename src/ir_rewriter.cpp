@@ -327,12 +327,18 @@ void IRRewriter::visit(const While *op) {
 }
 
 void IRRewriter::visit(const Kernel *op) {
+  std::vector<std::pair<Var,Expr>> reductions;
+  bool reductionsChanged = false;
+  for (auto& reduction : op->reductions) {
+    reductions.push_back({reduction.first, rewrite(reduction.second)});
+    reductionsChanged |= (reductions.back().second != reduction.second);
+  }
   Stmt body = rewrite(op->body);
-  if (body == op->body) {
+  if (body == op->body && !reductionsChanged) {
     stmt = op;
   }
   else {
-    stmt = Kernel::make(op->var, op->domain, body);
+    stmt = Kernel::make(op->var, op->domain, body, op->schedule, reductions);
   }
 }
 
@@ -83,6 +83,12 @@ std::pair<Stmt,std::vector<Stmt>> removeVarDecls(Stmt stmt) {
       varDecls.push_back(op);
       stmt = Stmt();
     }
+
+    // Kernel bodies are outlined by the backends, so their declarations are
+    // private to the kernel and must stay with it.
+    void visit(const Kernel *op) {
+      stmt = op;
+    }
   };
   RemoveVarDeclsRewriter rewriter;
 
@@ -164,6 +164,9 @@ void IRVisitor::visit(const While *op) {
 }
 
 void IRVisitor::visit(const Kernel *op) {
+  for (auto& reduction : op->reductions) {
+    reduction.second.accept(this);
+  }
   op->body.accept(this);
 }
 
@@ -0,0 +1,388 @@
+#include "fuse_loops.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ir_rewriter.h"
+#include "ir_visitor.h"
+#include "intrinsics.h"
+#include "var_replace_rewriter.h"
+#include "util/collections.h"
+#include "util/util.h"
+
+using namespace std;
+
+namespace simit {
+namespace ir {
+
+/// Collects the accesses of a loop over a set to buffers that are not declared
+/// in its body (shared buffers). An access is owned by the iteration if its
+/// location is `lv*stride + offset` with `0 <= offset < stride`, where `lv` is
+/// the loop variable; its stride is then recorded, and otherwise it is 0.
+class LoopAccessAnalysis : public IRVisitor {
+public:
+  struct Access {
+    bool write;
+    int stride;
+  };
+
+  LoopAccessAnalysis(const For* loop) : loopVar(loop->var), fusible(true) {
+    privateVars.insert(loopVar);
+    loop->body.accept(this);
+  }
+
+  /// Whether the loop has no side effects other than its buffer accesses.
+  bool isFusible() const {return fusible;}
+
+  const map<string,vector<Access>>& getAccesses() const {return accesses;}
+
+private:
+  Var loopVar;
+  bool fusible;
+
+  /// Variables declared inside the loop body (including the loop variables)
+  set<Var> privateVars;
+
+  /// Literal bounds of the ForRange variables in the loop body
+  map<Var, pair<int,int>> ranges;
+
+  map<string,vector<Access>> accesses;
+
+  using IRVisitor::visit;
+
+  bool isPrivate(const Expr& expr) const {
+    return isa<VarExpr>(expr) &&
+           util::contains(privateVars, to<VarExpr>(expr)->var);
+  }
+
+  void addAccess(const Expr& buffer, const Expr& index, bool write) {
+    accesses[util::toString(buffer)].push_back({write, getStride(index)});
+  }
+
+  /// Returns the closed interval of values `expr` can take, if it is a
+  /// non-negative affine combination of integer literals and bounded
+  /// ForRange variables.
+  bool getInterval(const Expr& expr, int* lo, int* hi) const {
+    if (isa<Literal>(expr) && isInt(expr.type())) {
+      *lo = *hi = to<Literal>(expr)->getIntVal(0);
+      return true;
+    }
+    if (isa<VarExpr>(expr)) {
+      const Var& var = to<VarExpr>(expr)->var;
+      if (!util::contains(ranges, var)) {
+        return false;
+      }
+      *lo = ranges.at(var).first;
+      *hi = ranges.at(var).second - 1;
+      return *lo <= *hi;
+    }
+    int alo, ahi, blo, bhi;
+    if (isa<Add>(expr)) {
+      if (!getInterval(to<Add>(expr)->a, &alo, &ahi) ||
+          !getInterval(to<Add>(expr)->b, &blo, &bhi)) {
+        return false;
+      }
+      *lo = alo + blo;
+      *hi = ahi + bhi;
+      return true;
+    }
+    if (isa<Mul>(expr)) {
+      if (!getInterval(to<Mul>(expr)->a, &alo, &ahi) ||
+          !getInterval(to<Mul>(expr)->b, &blo, &bhi) ||
+          alo < 0 || blo < 0) {
+        return false;
+      }
+      *lo = alo * blo;
+      *hi = ahi * bhi;
+      return true;
+    }
+    return false;
+  }
+
+  /// Returns the stride of `index` if it is `lv*stride + offset`, with a
+  /// literal stride and `0 <= offset < stride`, and 0 otherwise.
+  int getStride(const Expr& index) const {
+    if (!index.defined()) {
+      return 0;
+    }
+    vector<Expr> terms;
+    vector<Expr> worklist = {index};
+    while (!worklist.empty()) {
+      Expr term = worklist.back();
+      worklist.pop_back();
+      if (isa<Add>(term)) {
+        worklist.push_back(to<Add>(term)->a);
+        worklist.push_back(to<Add>(term)->b);
+      }
+      else {
+        terms.push_back(term);
+      }
+    }
+
+    bool hasBase = false;
+    int stride = 0;
+    int lo = 0;
+    int hi = 0;
+    for (auto& term : terms) {
+      int termLo, termHi;
+      if (getInterval(term, &termLo, &termHi)) {
+        lo += termLo;
+        hi += termHi;
+        continue;
+      }
+      if (hasBase) {
+        return 0;
+      }
+      hasBase = true;
+      Expr base = term;
+      stride = 1;
+      if (isa<Mul>(term) && isa<Literal>(to<Mul>(term)->b) &&
+          isInt(to<Mul>(term)->b.type())) {
+        base = to<Mul>(term)->a;
+        stride = to<Literal>(to<Mul>(term)->b)->getIntVal(0);
+      }
+      else if (isa<Mul>(term) && isa<Literal>(to<Mul>(term)->a) &&
+               isInt(to<Mul>(term)->a.type())) {
+        base = to<Mul>(term)->b;
+        stride = to<Literal>(to<Mul>(term)->a)->getIntVal(0);
+      }
+      if (!isa<VarExpr>(base) || to<VarExpr>(base)->var != loopVar) {
+        return 0;
+      }
+    }
+    return (hasBase && lo >= 0 && hi < stride) ? stride : 0;
+  }
+
+  void visit(const VarDecl* op) {
+    privateVars.insert(op->var);
+  }
+
+  void visit(const VarExpr* op) {
+    if (!util::contains(privateVars, op->var)) {
+      addAccess(op, Expr(), false);
+    }
+  }
+
+  void visit(const AssignStmt* op) {
+    if (!util::contains(privateVars, op->var)) {
+      Expr var = VarExpr::make(op->var);
+      addAccess(var, Expr(), true);
+      if (op->cop != CompoundOperator::None) {
+        addAccess(var, Expr(), false);
+      }
+    }
+    op->value.accept(this);
+  }
+
+  void visit(const CallStmt* op) {
+    if (op->callee.getKind() != Func::Intrinsic ||
+        op->callee == intrinsics::clock() ||
+        op->callee == intrinsics::storeTime() ||
+        op->callee == intrinsics::malloc() ||
+        op->callee == intrinsics::free()) {
+      fusible = false;
+    }
+    for (auto& result : op->results) {
+      if (!util::contains(privateVars, result)) {
+        addAccess(VarExpr::make(result), Expr(), true);
+      }
+    }
+    for (auto& arg : op->actuals) {
+      arg.accept(this);
+    }
+  }
+
+  void visit(const Load* op) {
+    if (!isPrivate(op->buffer)) {
+      addAccess(op->buffer, op->index, false);
+    }
+    op->index.accept(this);
+  }
+
+  void visit(const Store* op) {
+    if (!isPrivate(op->buffer)) {
+      addAccess(op->buffer, op->index, true);
+      if (op->cop != CompoundOperator::None) {
+        addAccess(op->buffer, op->index, false);
+      }
+    }
+    op->index.accept(this);
+    op->value.accept(this);
+  }
+
+  void visit(const ForRange* op) {
+    privateVars.insert(op->var);
+    if (isa<Literal>(op->start) && isa<Literal>(op->end) &&
+        isInt(op->start.type()) && isInt(op->end.type())) {
+      ranges[op->var] = {to<Literal>(op->start)->getIntVal(0),
+                         to<Literal>(op->end)->getIntVal(0)};
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const For* op) {
+    privateVars.insert(op->var);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const FieldWrite* op) {
+    fusible = false;
+  }
+
+  void visit(const TensorWrite* op) {
+    fusible = false;
+  }
+
+  void visit(const Map* op) {
+    fusible = false;
+  }
+
+  void visit(const Kernel* op) {
+    fusible = false;
+  }
+
+  void visit(const Print* op) {
+    fusible = false;
+  }
+};
+
+/// Whether fusing the loop `a` with the loop `b` that follows it preserves
+/// the dependences between them. Buffers that are written by one loop and
+/// accessed by the other must be owned by the iteration with the same stride
+/// in both, so that an iteration of `b` only depends on the same iteration
+/// of `a`.
+static bool canFuse(const LoopAccessAnalysis& a, const LoopAccessAnalysis& b) {
+  if (!a.isFusible() || !b.isFusible()) {
+    return false;
+  }
+  for (auto& buffer : a.getAccesses()) {
+    if (!util::contains(b.getAccesses(), buffer.first)) {
+      continue;
+    }
+    vector<LoopAccessAnalysis::Access> shared = buffer.second;
+    const vector<LoopAccessAnalysis::Access>& other =
+        b.getAccesses().at(buffer.first);
+    shared.insert(shared.end(), other.begin(), other.end());
+
+    bool written = false;
+    for (auto& access : shared) {
+      written |= access.write;
+    }
+    if (!written) {
+      continue;
+    }
+    for (auto& access : shared) {
+      if (access.stride == 0 || access.stride != shared[0].stride) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+class FuseLoops : public IRRewriter {
+private:
+  using IRRewriter::visit;
+
+  void visit(const Block* op) {
+    vector<Stmt> stmts;
+    flatten(op, &stmts);
+    if (stmts.empty()) {
+      stmt = Stmt();
+      return;
+    }
+
+    vector<Stmt> fused;
+    for (auto& s : stmts) {
+      Stmt fusedLoop = fused.empty() ? Stmt() : fuse(fused.back(), s);
+      if (fusedLoop.defined()) {
+        fused.back() = fusedLoop;
+      }
+      else {
+        fused.push_back(s);
+      }
+    }
+    stmt = Block::make(fused);
+  }
+
+  /// Appends the rewritten statements of a nest of blocks to `stmts`.
+  void flatten(const Stmt& s, vector<Stmt>* stmts) {
+    if (!s.defined()) {
+      return;
+    }
+    if (isa<Block>(s)) {
+      flatten(to<Block>(s)->first, stmts);
+      flatten(to<Block>(s)->rest, stmts);
+      return;
+    }
+    Stmt rewritten = rewrite(s);
+    if (rewritten.defined()) {
+      stmts->push_back(rewritten);
+    }
+  }
+
+  /// Returns the loop over a set in `s`, which lowering wraps in a scope and
+  /// possibly in a comment with the statement it was lowered from.
+  static const For* getSetLoop(const Stmt& s, string* comment) {
+    Stmt loop = s;
+    if (isa<Comment>(loop)) {
+      *comment = to<Comment>(loop)->comment;
+      loop = to<Comment>(loop)->commentedStmt;
+    }
+    if (loop.defined() && isa<Scope>(loop)) {
+      loop = to<Scope>(loop)->scopedStmt;
+    }
+    if (!loop.defined() || !isa<For>(loop)) {
+      return nullptr;
+    }
+    const ForDomain& domain = to<For>(loop)->domain;
+    if (domain.kind != ForDomain::IndexSet ||
+        domain.indexSet.getKind() != IndexSet::Set) {
+      return nullptr;
+    }
+    return to<For>(loop);
+  }
+
+  static bool isSameSet(const Expr& a, const Expr& b) {
+    if (isa<VarExpr>(a) && isa<VarExpr>(b)) {
+      return to<VarExpr>(a)->var == to<VarExpr>(b)->var;
+    }
+    return a == b;
+  }
+
+  /// Returns the body of a loop, commented with the statement the loop was
+  /// lowered from.
+  static Stmt getBody(const Stmt& body, const string& comment) {
+    if (comment.empty()) {
+      return isa<Scope>(body) ? to<Scope>(body)->scopedStmt : body;
+    }
+    return Comment::make(comment, body);
+  }
+
+  /// Returns the fusion of two consecutive loops, or an undefined Stmt if they
+  /// cannot be fused.
+  static Stmt fuse(const Stmt& a, const Stmt& b) {
+    string commentA, commentB;
+    const For* loopA = getSetLoop(a, &commentA);
+    const For* loopB = getSetLoop(b, &commentB);
+    if (loopA == nullptr || loopB == nullptr ||
+        !isSameSet(loopA->domain.indexSet.getSet(),
+                   loopB->domain.indexSet.getSet()) ||
+        !canFuse(LoopAccessAnalysis(loopA), LoopAccessAnalysis(loopB))) {
+      return Stmt();
+    }
+
+    Stmt bodyB = replaceVar(loopB->body, loopB->var, loopA->var);
+    return For::make(loopA->var, loopA->domain,
+                     Block::make(getBody(loopA->body, commentA),
+                                 getBody(bodyB, commentB)));
+  }
+};
+
+Func fuseLoops(Func func) {
+  return FuseLoops().rewrite(func);
+}
+
+}}
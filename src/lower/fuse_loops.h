@@ -0,0 +1,20 @@
+#ifndef SIMIT_FUSE_LOOPS_H
+#define SIMIT_FUSE_LOOPS_H
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// Fuse consecutive loops over the same set into one loop, so that statements
+/// like `points.v = points.v + h*a; points.x = points.x + points.v;` make one
+/// pass over memory instead of one per statement. Loops are only fused if every
+/// buffer one of them writes and the other accesses is addressed through the
+/// loop variable (`i*stride + offset`, `0 <= offset < stride`) with the same
+/// stride in both, so that the dependences between them stay within one
+/// iteration.
+Func fuseLoops(Func func);
+
+}}
+
+#endif
@@ -0,0 +1,300 @@
+#include "fuse_map_gemv.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ir_builder.h"
+#include "ir_rewriter.h"
+#include "ir_visitor.h"
+#include "util/collections.h"
+
+using namespace std;
+
+namespace simit {
+namespace ir {
+
+/// Counts the expressions that refer to each variable, and whether a statement
+/// writes element fields.
+class VarUses : public IRVisitor {
+public:
+  map<Var,int> uses;
+  bool writesFields = false;
+
+  int getUses(const Var& var) const {
+    return util::contains(uses, var) ? uses.at(var) : 0;
+  }
+
+private:
+  using IRVisitor::visit;
+
+  void visit(const VarExpr* op) {
+    ++uses[op->var];
+  }
+
+  void visit(const AssignStmt* op) {
+    ++uses[op->var];
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt* op) {
+    for (auto& result : op->results) {
+      ++uses[result];
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Map* op) {
+    for (auto& var : op->vars) {
+      ++uses[var];
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const FieldWrite* op) {
+    writesFields = true;
+    IRVisitor::visit(op);
+  }
+};
+
+/// Rewrites the writes of a map function to the matrix result `A(r,c) = v` to
+/// writes of the vector result `y(r) = v * c.field`.
+class MatrixFreeWrites : public IRRewriter {
+public:
+  MatrixFreeWrites(const Var& matrix, const Var& vector, const string& field)
+      : matrix(matrix), vector(vector), field(field), supported(true) {}
+
+  /// Whether every write to the matrix could be rewritten.
+  bool isSupported() const {return supported;}
+
+private:
+  Var matrix;
+  Var vector;
+  string field;
+  bool supported;
+  IRBuilder builder;
+
+  using IRRewriter::visit;
+
+  void visit(const TensorWrite* op) {
+    if (!isa<VarExpr>(op->tensor) || to<VarExpr>(op->tensor)->var != matrix) {
+      IRRewriter::visit(op);
+      return;
+    }
+
+    const Expr& row = op->indices.size() == 2 ? op->indices[0] : Expr();
+    const Expr& col = op->indices.size() == 2 ? op->indices[1] : Expr();
+    if (!row.defined() || !row.type().isElement() ||
+        !col.type().isElement() ||
+        !col.type().toElement()->hasField(field)) {
+      supported = false;
+      IRRewriter::visit(op);
+      return;
+    }
+
+    Expr value = rewrite(op->value);
+    Expr x = FieldRead::make(col, field);
+    if (isScalar(value.type()) && isScalar(x.type())) {
+      stmt = TensorWrite::make(VarExpr::make(vector), {row},
+                               Mul::make(value, x), op->cop);
+    }
+    else if (value.type().isTensor() && x.type().isTensor() &&
+             value.type().toTensor()->order() == 2 &&
+             x.type().toTensor()->order() == 1 &&
+             value.type().toTensor()->getDimensions()[1] ==
+                 x.type().toTensor()->getDimensions()[0]) {
+      // Multiply the block through a temporary, since index expressions may
+      // not be nested
+      Var block = builder.temporary(value.type());
+      stmt = Block::make({VarDecl::make(block),
+                          AssignStmt::make(block, value),
+                          TensorWrite::make(VarExpr::make(vector), {row},
+                                            builder.gemv(block, x), op->cop)});
+    }
+    else {
+      supported = false;
+      IRRewriter::visit(op);
+    }
+  }
+};
+
+class FuseMapGemv : public IRRewriter {
+public:
+  FuseMapGemv(const Func& func) : func(func) {
+    func.getBody().accept(&uses);
+  }
+
+private:
+  Func func;
+  VarUses uses;
+  IRBuilder builder;
+
+  using IRRewriter::visit;
+
+  void visit(const Block* op) {
+    vector<Stmt> stmts;
+    flatten(op, &stmts);
+    if (stmts.empty()) {
+      stmt = Stmt();
+      return;
+    }
+
+    for (size_t i = 0; i+1 < stmts.size(); ++i) {
+      if (!isa<Map>(stmts[i])) {
+        continue;
+      }
+      const Map* map = to<Map>(stmts[i]);
+      if (map->vars.size() != 1) {
+        continue;
+      }
+
+      // The matrix must be declared in this block, so that the declaration can
+      // be removed along with the matrix
+      size_t decl = i;
+      for (size_t j = 0; j < i; ++j) {
+        if (isa<VarDecl>(stmts[j]) && to<VarDecl>(stmts[j])->var==map->vars[0]) {
+          decl = j;
+        }
+      }
+      if (decl == i) {
+        continue;
+      }
+
+      vector<Stmt> fused = fuse(map, stmts[i+1]);
+      if (fused.empty()) {
+        continue;
+      }
+      stmts.erase(stmts.begin()+i, stmts.begin()+i+2);
+      stmts.insert(stmts.begin()+i, fused.begin(), fused.end());
+      stmts.erase(stmts.begin()+decl);
+    }
+    stmt = Block::make(stmts);
+  }
+
+  /// Appends the rewritten statements of a nest of blocks to `stmts`.
+  void flatten(const Stmt& s, vector<Stmt>* stmts) {
+    if (!s.defined()) {
+      return;
+    }
+    if (isa<Block>(s)) {
+      flatten(to<Block>(s)->first, stmts);
+      flatten(to<Block>(s)->rest, stmts);
+      return;
+    }
+    Stmt rewritten = rewrite(s);
+    if (rewritten.defined()) {
+      stmts->push_back(rewritten);
+    }
+  }
+
+  /// Returns the statements that compute `product` without assembling the
+  /// matrix of `map`, or no statements if they cannot be fused.
+  vector<Stmt> fuse(const Map* map, const Stmt& product) {
+    Var matrix = map->vars[0];
+    if (map->through.defined() ||
+        map->reduction.getKind() != ReductionOperator::Sum ||
+        map->function.getResults().size() != 1 ||
+        !matrix.getType().isTensor() ||
+        matrix.getType().toTensor()->order() != 2 ||
+        uses.getUses(matrix) != 2 ||  // The map and the product
+        util::contains(func.getArguments(), matrix) ||
+        util::contains(func.getResults(), matrix)) {
+      return {};
+    }
+
+    // Match `y = A * x` and `S.y = A * x`
+    Expr value;
+    if (isa<AssignStmt>(product) &&
+        to<AssignStmt>(product)->cop == CompoundOperator::None) {
+      value = to<AssignStmt>(product)->value;
+    }
+    else if (isa<FieldWrite>(product) &&
+             to<FieldWrite>(product)->cop == CompoundOperator::None) {
+      value = to<FieldWrite>(product)->value;
+    }
+    if (!value.defined() || !isa<IndexExpr>(value)) {
+      return {};
+    }
+    const IndexExpr* gemv = to<IndexExpr>(value);
+    if (gemv->resultVars.size() != 1 || !isa<Mul>(gemv->value) ||
+        !isa<IndexedTensor>(to<Mul>(gemv->value)->a) ||
+        !isa<IndexedTensor>(to<Mul>(gemv->value)->b)) {
+      return {};
+    }
+    const IndexedTensor* a = to<IndexedTensor>(to<Mul>(gemv->value)->a);
+    const IndexedTensor* x = to<IndexedTensor>(to<Mul>(gemv->value)->b);
+    if (!isa<VarExpr>(a->tensor) || to<VarExpr>(a->tensor)->var != matrix ||
+        a->indexVars.size() != 2 || x->indexVars.size() != 1 ||
+        a->indexVars[0] != gemv->resultVars[0] ||
+        a->indexVars[1] != x->indexVars[0] ||
+        !isa<FieldRead>(x->tensor)) {
+      return {};
+    }
+
+    // The vector must be a field of the matrix's column set
+    const FieldRead* field = to<FieldRead>(x->tensor);
+    vector<IndexSet> dims = matrix.getType().toTensor()->getOuterDimensions();
+    if (!isa<VarExpr>(field->elementOrSet) ||
+        dims[1].getKind() != IndexSet::Set ||
+        !isa<VarExpr>(dims[1].getSet()) ||
+        to<VarExpr>(dims[1].getSet())->var !=
+            to<VarExpr>(field->elementOrSet)->var) {
+      return {};
+    }
+
+    // A field written with the product must belong to the matrix's row set,
+    // since the fused map adds to the vector by the row elements
+    if (isa<FieldWrite>(product)) {
+      const Expr& target = to<FieldWrite>(product)->elementOrSet;
+      if (!isa<VarExpr>(target) ||
+          dims[0].getKind() != IndexSet::Set ||
+          !isa<VarExpr>(dims[0].getSet()) ||
+          to<VarExpr>(dims[0].getSet())->var != to<VarExpr>(target)->var) {
+        return {};
+      }
+    }
+
+    // Rewrite the map function to multiply instead of store its matrix blocks
+    Func f = map->function;
+    VarUses fUses;
+    f.getBody().accept(&fUses);
+    if (fUses.writesFields) {
+      return {};
+    }
+    Var fMatrix = f.getResults()[0];
+    Var fVector(fMatrix.getName(), value.type());
+    MatrixFreeWrites rewriter(fMatrix, fVector, field->fieldName);
+    Stmt body = rewriter.rewrite(f.getBody());
+    VarUses bodyUses;
+    body.accept(&bodyUses);
+    if (!rewriter.isSupported() || bodyUses.getUses(fMatrix) > 0) {
+      return {};
+    }
+    Func g(f.getName() + "_gemv", f.getArguments(), {fVector}, body,
+           f.getEnvironment());
+
+    vector<Stmt> stmts;
+    if (isa<AssignStmt>(product)) {
+      Var result = to<AssignStmt>(product)->var;
+      stmts.push_back(Map::make({result}, g, map->partial_actuals, map->target,
+                                map->neighbors, map->through, map->reduction));
+    }
+    else {
+      const FieldWrite* fieldWrite = to<FieldWrite>(product);
+      Var result = builder.temporary(value.type());
+      Expr copy = builder.unaryElwiseExpr(IRBuilder::Copy, result);
+      stmts.push_back(VarDecl::make(result));
+      stmts.push_back(Map::make({result}, g, map->partial_actuals, map->target,
+                                map->neighbors, map->through, map->reduction));
+      stmts.push_back(FieldWrite::make(fieldWrite->elementOrSet,
+                                       fieldWrite->fieldName, copy));
+    }
+    return stmts;
+  }
+};
+
+Func fuseMapGemv(Func func) {
+  return FuseMapGemv(func).rewrite(func);
+}
+
+}}
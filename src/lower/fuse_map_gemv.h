@@ -0,0 +1,24 @@
+#ifndef SIMIT_FUSE_MAP_GEMV_H
+#define SIMIT_FUSE_MAP_GEMV_H
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// Rewrite matrices that are assembled by a map and only used by the
+/// matrix-vector product that follows it to matrix-free form. That is,
+/// ~~~~~~~~~~~~~~~
+///   A = map f to E reduce +;
+///   V.b = A * V.a;
+/// ~~~~~~~~~~~~~~~
+/// becomes a map of a copy of `f` that multiplies every block it would have
+/// stored at `A(r,c)` by `c.a` and adds the result to `b(r)`. This saves the
+/// storage of the matrix and the index lookups that assemble and multiply it.
+/// The vector must be a field of the matrix's column set that `f` does not
+/// write.
+Func fuseMapGemv(Func func);
+
+}}
+
+#endif
@@ -8,7 +8,9 @@
 #include "lower_scatter_workspace.h"
 #include "lower_transpose.h"
 #include "lower_matrix_multiply.h"
+#include "lower_spmv.h"
 
+#include "init.h"
 #include "path_expressions.h"
 
 namespace simit {
@@ -217,7 +219,7 @@ Func lowerIndexExpressions(Func func) {
       const IndexExpr* iexpr = to<IndexExpr>(op->value);
 
       // Dispatch the index expression lowering to the correct lowering pass.
-      enum Kind {Unknown, DenseResult, MatrixScale,
+      enum Kind {Unknown, SpMV, DenseResult, MatrixScale,
                  MatrixElwiseWithSameStructureOrDiagonal, MatrixElwise,
                  MatrixTranspose, MatrixMultiply};
       Kind kind = Unknown;
@@ -226,7 +228,13 @@ Func lowerIndexExpressions(Func func) {
       const Var& var = op->var;
       const TensorType* type = iexpr->type.toTensor();
 
-      if (type->order()==0 || type->order()==1 ||
+      // Sparse matrix-vector products call the runtime's blocked kernels, which
+      // are not available to the GPU backend
+      if (type->order() == 1 && op->cop == CompoundOperator::None &&
+          kBackend != "gpu" && isSpMV(var, iexpr, *storage)) {
+        kind = SpMV;
+      }
+      else if (type->order()==0 || type->order()==1 ||
           storage->getStorage(var).getKind() == TensorStorage::Dense) {
         kind = DenseResult;
       }
@@ -250,6 +258,9 @@ Func lowerIndexExpressions(Func func) {
           << Stmt(op);
 
       switch (kind) {
+        case SpMV:
+          stmt = lowerSpMV(op->var, iexpr, &environment, storage);
+          break;
         case DenseResult:
         case MatrixScale:
         case MatrixElwiseWithSameStructureOrDiagonal:
@@ -0,0 +1,209 @@
+#include "lower_spmv.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "init.h"
+#include "ir_visitor.h"
+#include "storage.h"
+#include "tensor_index.h"
+#include "util/collections.h"
+
+namespace simit {
+namespace ir {
+
+/// The matrix and vector of a matrix-vector product index expression.
+struct SpMVOperands {
+  Expr matrix;
+  Expr vector;
+  bool transposed;
+};
+
+/// Matches `(i) A(i,+j)*x(+j)` and `(j) A(+i,j)*x(+i)`, with the operands in
+/// either order.
+static bool getOperands(const IndexExpr* iexpr, SpMVOperands* operands) {
+  if (iexpr->resultVars.size() != 1 || !isa<Mul>(iexpr->value)) {
+    return false;
+  }
+  const Mul* mul = to<Mul>(iexpr->value);
+  if (!isa<IndexedTensor>(mul->a) || !isa<IndexedTensor>(mul->b)) {
+    return false;
+  }
+  const IndexedTensor* A = to<IndexedTensor>(mul->a);
+  const IndexedTensor* x = to<IndexedTensor>(mul->b);
+  if (A->indexVars.size() == 1) {
+    std::swap(A, x);
+  }
+  if (A->indexVars.size() != 2 || x->indexVars.size() != 1) {
+    return false;
+  }
+
+  const IndexVar& sumVar = x->indexVars[0];
+  if (!sumVar.isReductionVar() ||
+      sumVar.getOperator() != ReductionOperator::Sum) {
+    return false;
+  }
+  const IndexVar& resultVar = iexpr->resultVars[0];
+  if (A->indexVars[0] == resultVar && A->indexVars[1] == sumVar) {
+    operands->transposed = false;
+  }
+  else if (A->indexVars[0] == sumVar && A->indexVars[1] == resultVar) {
+    operands->transposed = true;
+  }
+  else {
+    return false;
+  }
+  operands->matrix = A->tensor;
+  operands->vector = x->tensor;
+  return true;
+}
+
+/// The size of the square blocks of a matrix, or 0 if they are not square or
+/// are themselves blocked.
+static int getBlockSize(const TensorType* type) {
+  Type blockType = type->getBlockType();
+  if (isScalar(blockType)) {
+    return 1;
+  }
+  const TensorType* block = blockType.toTensor();
+  if (block->order() != 2 || !isScalar(block->getBlockType())) {
+    return 0;
+  }
+  std::vector<IndexDomain> dims = block->getDimensions();
+  return (dims[0].getSize() == dims[1].getSize()) ? dims[0].getSize() : 0;
+}
+
+bool isSpMV(Var target, const IndexExpr* iexpr, const Storage& storage) {
+  SpMVOperands operands;
+  if (!getOperands(iexpr, &operands) ||
+      !isa<VarExpr>(operands.matrix)) {
+    return false;
+  }
+
+  const Var& A = to<VarExpr>(operands.matrix)->var;
+  const TensorType* type = A.getType().toTensor();
+  if (!type->hasSystemDimensions() ||
+      type->getComponentType() != ScalarType::Float ||
+      !storage.hasStorage(A) ||
+      storage.getStorage(A).getKind() != TensorStorage::Indexed) {
+    return false;
+  }
+  int blockSize = getBlockSize(type);
+  if (blockSize != 1 && blockSize != 2 && blockSize != 3 && blockSize != 4 &&
+      blockSize != 6) {
+    return false;
+  }
+
+  // The kernels read x while they write y, so they must not alias
+  const Expr& x = operands.vector;
+  if (x.type().toTensor()->getComponentType() != ScalarType::Float) {
+    return false;
+  }
+  if (isa<VarExpr>(x)) {
+    return to<VarExpr>(x)->var != target;
+  }
+  return isa<FieldRead>(x);
+}
+
+Stmt lowerSpMV(Var target, const IndexExpr* iexpr,
+               Environment* env, Storage* storage) {
+  SpMVOperands operands;
+  if (!getOperands(iexpr, &operands)) {
+    simit_ierror << "not a matrix-vector product: " << Expr(iexpr);
+  }
+
+  std::string name = operands.transposed ? "spmvt" : "spmv";
+  const Var& A = to<VarExpr>(operands.matrix)->var;
+  if (!operands.transposed && storage->getStorage(A).isSliced()) {
+    name = "sellmv";
+  }
+  Func spmv = Func(name, {Var(), Var()}, {Var()}, Stmt(), Func::External);
+  return CallStmt::make({target}, spmv, {operands.matrix, operands.vector});
+}
+
+/// Finds the matrices that are multiplied by vectors, and whether each
+/// variable is only ever defined by maps.
+class SlicedMatrixCandidates : public IRVisitor {
+public:
+  std::map<Var,bool> mapDefined;
+  std::set<Var> multiplied;
+
+  SlicedMatrixCandidates(const Storage& storage) : storage(storage) {}
+
+private:
+  const Storage& storage;
+
+  using IRVisitor::visit;
+
+  void define(const Var& var, bool byMap) {
+    mapDefined[var] = byMap && (!util::contains(mapDefined, var) ||
+                                mapDefined.at(var));
+  }
+
+  void visit(const Map* op) {
+    for (auto& var : op->vars) {
+      define(var, true);
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const AssignStmt* op) {
+    define(op->var, false);
+    SpMVOperands operands;
+    if (isa<IndexExpr>(op->value) && op->cop == CompoundOperator::None &&
+        isSpMV(op->var, to<IndexExpr>(op->value), storage) &&
+        getOperands(to<IndexExpr>(op->value), &operands) &&
+        !operands.transposed) {
+      multiplied.insert(to<VarExpr>(operands.matrix)->var);
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt* op) {
+    for (auto& result : op->results) {
+      define(result, false);
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const TensorWrite* op) {
+    Expr tensor = op->tensor;
+    while (isa<TensorRead>(tensor)) {
+      tensor = to<TensorRead>(tensor)->tensor;
+    }
+    if (isa<VarExpr>(tensor)) {
+      define(to<VarExpr>(tensor)->var, false);
+    }
+    IRVisitor::visit(op);
+  }
+};
+
+Func selectSlicedMatrices(Func func) {
+  Storage& storage = func.getStorage();
+  SlicedMatrixCandidates candidates(storage);
+  func.getBody().accept(&candidates);
+
+  // The values of arguments and externs are defined outside the function, so
+  // their sliced copies could not be kept current
+  std::vector<Var> externs = func.getEnvironment().getExternVars();
+  for (auto& matrix : candidates.multiplied) {
+    if (util::contains(candidates.mapDefined, matrix) &&
+        candidates.mapDefined.at(matrix) &&
+        !util::contains(func.getArguments(), matrix) &&
+        !util::contains(externs, matrix)) {
+      storage.getStorage(matrix).setSliced(true);
+    }
+  }
+  return func;
+}
+
+Stmt packSlicedMatrix(const Var& matrix) {
+  Func sellpack = Func("sellpack", {Var(), Var(), Var()}, {}, Stmt(),
+                       Func::External);
+  return CallStmt::make({}, sellpack,
+                        {matrix, Literal::make((int)kSellSliceHeight),
+                         Literal::make((int)kSellSortWindow)});
+}
+
+}}
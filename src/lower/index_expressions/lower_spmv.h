@@ -0,0 +1,33 @@
+#ifndef SIMIT_LOWER_SPMV_H
+#define SIMIT_LOWER_SPMV_H
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// True if `target = iexpr` is `y = A*x` or `y = x'*A`, where `A` is an indexed
+/// system matrix with square blocks of a size the runtime has specialized
+/// kernels for (1, 2, 3, 4 or 6) and `x` is a dense vector other than `y`.
+/// Flattening turns `A'*x` into a product with a transposed copy of `A`, so
+/// only `x'*A` selects the transposed kernel.
+bool isSpMV(Var target, const IndexExpr* iexpr, const Storage& storage);
+
+/// Lowers a matrix-vector product recognized by `isSpMV` to a call to the
+/// runtime's blocked SpMV kernel for its block size, or to its sliced ELLPACK
+/// kernel if the matrix is sliced.
+Stmt lowerSpMV(Var target, const IndexExpr* iexpr,
+               Environment* env, Storage* storage);
+
+/// Marks the storage of the matrices that should keep a sliced ELLPACK copy of
+/// their values as sliced (see Settings::matrixStorage). These are the local
+/// indexed matrices that are only ever defined by maps and that are multiplied
+/// by vectors, so that packing the copy after each map keeps it current.
+Func selectSlicedMatrices(Func func);
+
+/// Returns the statement that packs the values of a sliced matrix into its
+/// sliced ELLPACK copy.
+Stmt packSlicedMatrix(const Var& matrix);
+
+}}
+#endif
@@ -5,13 +5,18 @@
 
 #include "lower_maps.h"
 #include "index_expressions/lower_index_expressions.h"
+#include "index_expressions/lower_spmv.h"
 
 #include "lower_accesses.h"
 #include "lower_prints.h"
 #include "lower_string_ops.h"
 #include "lower_stencil_assemblies.h"
 #include "lower_unroll.h"
+#include "fuse_loops.h"
+#include "fuse_map_gemv.h"
+#include "lower_parallel_loops.h"
 
+#include "compile_profile.h"
 #include "inline.h"
 #include "storage.h"
 #include "timers.h"
@@ -21,7 +26,9 @@
 #include "ir_rewriter.h"
 #include "ir_transforms.h"
 #include "ir_printer.h"
+#include "ir_queries.h"
 #include "path_expressions.h"
+#include "util/collections.h"
 
 #ifdef GPU
 #include "backend/gpu/gpu_backend.h"
@@ -31,6 +38,9 @@ using namespace std;
 
 namespace simit {
 extern std::string kBackend;
+extern std::string kMatrixStorage;
+extern std::string kParallelAssembly;
+extern std::map<std::string,std::string> kFunctionParallelAssembly;
 
 namespace ir {
 
@@ -73,6 +83,17 @@ void visitCallGraph(Func func, const function<void(Func)>& visitRule) {
   func.accept(&visitor);
 }
 
+/// Rewrite the call graph with a lowering pass, and record the pass in the
+/// current compile profile
+static
+Func runPass(const string& name, const Func& func,
+             const function<Func(Func)>& rewriter) {
+  PassTimer timer(name);
+  Func result = rewriteCallGraph(func, rewriter);
+  timer.stop([&result]() {return countNodes(result);});
+  return result;
+}
+
 static inline
 void printTimedCallGraph(string headerText, Func func, ostream* os) {
   stringstream ss;
@@ -96,25 +117,36 @@ Func lower(Func func, std::ostream* os, bool time) {
 #ifdef GPU
   // Rewrite system assignments
   if (kBackend == "gpu") {
-    func = rewriteCallGraph(func, rewriteSystemAssigns);
+    func = runPass("Rewrite System Assigns (GPU)", func, rewriteSystemAssigns);
     printCallGraph("Rewrite System Assigns (GPU)", func, os);
   }
 #endif
 
   // Inline function calls
-  func = rewriteCallGraph(func, inlineCalls);
+  func = runPass("Inline Function Calls", func, inlineCalls);
   printCallGraph("Inline Function Calls", func, os);
 
+  // Multiply matrices that are only used once as they are assembled
+  func = runPass("Fuse Map Gemv", func, fuseMapGemv);
+  printCallGraph("Fuse Map Gemv", func, os);
+
   // Flatten index expressions and insert temporaries
-  func = rewriteCallGraph(func, (Func(*)(Func))flattenIndexExpressions);
-  func = rewriteCallGraph(func, insertTemporaries);
+  func = runPass("Flatten Index Expressions", func,
+                 (Func(*)(Func))flattenIndexExpressions);
+  func = runPass("Insert Temporaries", func, insertTemporaries);
   printCallGraph("Insert Temporaries and Flatten Index Expressions", func, os);
 
   // Determine Storage
-  func = rewriteCallGraph(func, [](Func func) -> Func {
+  func = runPass("Determine Storage", func, [](Func func) -> Func {
     updateStorage(func, &func.getStorage(), &func.getEnvironment());
     return func;
   });
+
+  // Keep sliced ELLPACK copies of the matrices that are multiplied by vectors
+  if (kMatrixStorage == "sell" && kBackend != "gpu") {
+    func = runPass("Select Sliced Matrices", func, selectSlicedMatrices);
+  }
+
   if (os) {
     *os << "%% Tensor storage" << endl;
     visitCallGraph(func, [os](Func func) {
@@ -127,70 +159,88 @@ Func lower(Func func, std::ostream* os, bool time) {
     *os << endl;
   }
 
-  func = rewriteCallGraph(func, insertFrees);
+  func = runPass("Insert Frees", func, insertFrees);
   printCallGraph("Insert Frees", func, os);
 
-  func = rewriteCallGraph(func, lowerStringOps);
-  func = rewriteCallGraph(func, lowerPrints);
+  func = runPass("Lower String Operations", func, lowerStringOps);
+  func = runPass("Lower Prints", func, lowerPrints);
   printCallGraph("Lower String Operations and Prints", func, os);
 
   // Lower field accesses
-  func = rewriteCallGraph(func, lowerFieldAccesses);
+  func = runPass("Lower Field Accesses", func, lowerFieldAccesses);
   printCallGraph("Lower Field Accesses", func, os);
 
   // Lower stencil assemblies
-  func = rewriteCallGraph(func, lowerStencilAssemblies);
+  func = runPass("Lower Stencil Assemblies", func, lowerStencilAssemblies);
   printCallGraph("Normalize Row Indices", func, os);
 
   // Lower maps
-  func = rewriteCallGraph(func, lowerMaps);
+  func = runPass("Lower Maps", func, lowerMaps);
   printCallGraph("Lower Maps", func, os);
 
 #ifdef GPU
   // GPU backend wants memsets as loops over set domains
   if (kBackend == "gpu") {
-    func = rewriteCallGraph(func, rewriteMemsets);
+    func = runPass("Rewrite Memsets (GPU)", func, rewriteMemsets);
     printCallGraph("Rewrite Memsets (GPU)", func, os);
   }
 #endif
 
   // Lower Index Expressions
-  func = rewriteCallGraph(func, lowerIndexExpressions);
+  func = runPass("Lower Index Expressions", func, lowerIndexExpressions);
   printCallGraph("Lower Index Expressions", func, os);
 
   // Lower Tensor Reads and Writes
-  func = rewriteCallGraph(func, lowerTensorAccesses);
+  func = runPass("Lower Tensor Reads and Writes", func, lowerTensorAccesses);
   printCallGraph("Lower Tensor Reads and Writes", func, os);
 
   // Insert timers
   if (time) {
     printTimedCallGraph("Insert Timers", func, os);
-    func = rewriteCallGraph(func, insertTimers);
+    func = runPass("Insert Timers", func, insertTimers);
     printCallGraph("Insert Timers", func, os);
   }
 
   // Unroll Loops
-  func = rewriteCallGraph(func, lowerUnroll);
+  func = runPass("Unroll Loops", func, lowerUnroll);
   printCallGraph("Loops Unrolling", func, os);
-  func = rewriteCallGraph(func, lowerUnroll);
+  func = runPass("Unroll Loops", func, lowerUnroll);
   printCallGraph("Loops Unrolling", func, os);
-  func = rewriteCallGraph(func, lowerUnroll);
+  func = runPass("Unroll Loops", func, lowerUnroll);
   printCallGraph("Loops Unrolling", func, os);
 
+  // Fuse consecutive loops over the same set, so that element-wise statements
+  // make one pass over memory (the GPU backend fuses kernels instead)
+  if (kBackend != "gpu") {
+    func = runPass("Fuse Loops", func, fuseLoops);
+    printCallGraph("Fuse Loops", func, os);
+  }
+
+  // Split loops over sets across threads
+  if (kBackend == "cpu-parallel") {
+    func = runPass("Lower Parallel Loops", func, [](Func func) {
+      string assembly = util::contains(kFunctionParallelAssembly, func.getName())
+                        ? kFunctionParallelAssembly.at(func.getName())
+                        : kParallelAssembly;
+      return lowerParallelLoops(func, assembly);
+    });
+    printCallGraph("Lower Parallel Loops", func, os);
+  }
+
   // Lower to GPU Kernels
 #if GPU
   if (kBackend == "gpu") {
-    func = rewriteCallGraph(func, rewriteCompoundOps);
+    func = runPass("Rewrite Compound Ops (GPU)", func, rewriteCompoundOps);
     printCallGraph("Rewrite Compound Ops (GPU)", func, os);
-    func = rewriteCallGraph(func, shardLoops);
+    func = runPass("Shard Loops (GPU)", func, shardLoops);
     printCallGraph("Shard Loops", func, os);
-    func = rewriteCallGraph(func, rewriteVarDecls);
+    func = runPass("Rewrite Var Decls (GPU)", func, rewriteVarDecls);
     printCallGraph("Rewritten Var Decls", func, os);
-    func = rewriteCallGraph(func, localizeTemps);
+    func = runPass("Localize Temps (GPU)", func, localizeTemps);
     printCallGraph("Localize Temps", func, os);
-    func = rewriteCallGraph(func, kernelRWAnalysis);
+    func = runPass("Kernel RW Analysis (GPU)", func, kernelRWAnalysis);
     printCallGraph("Kernel RW Analysis", func, os);
-    func = rewriteCallGraph(func, fuseKernels);
+    func = runPass("Fuse Kernels (GPU)", func, fuseKernels);
     printCallGraph("Fuse Kernels", func, os);
   }
 #endif
@@ -14,6 +14,8 @@ using namespace std;
 using simit::util::quote;
 
 namespace simit {
+extern unsigned kFieldBlockSize;
+
 namespace ir {
 
 // lowerTensorAccesses
@@ -83,6 +85,17 @@ static Stmt createStoreStmt(Expr tensor, Expr index, Expr value,
   }
 }
 
+/// Returns the number of elements whose components are stored together in
+/// `tensor`, which is greater than one for vector and matrix fields when sets
+/// store fields in blocks (see Set::FieldData::blockSize).
+static int getFieldBlockSize(const Expr& tensor) {
+  if (kFieldBlockSize == 1 || !isa<FieldRead>(tensor)) {
+    return 1;
+  }
+  Type blockType = tensor.type().toTensor()->getBlockType();
+  return (blockType.toTensor()->size() > 1) ? kFieldBlockSize : 1;
+}
+
 class LowerTensorAccesses : public IRRewriter {
 public:
   LowerTensorAccesses(const Storage &storage) : storage(storage) {}
@@ -90,6 +103,10 @@ public:
 private:
   Storage storage;
   Environment environment;
+
+  /// The block and lane variables of the strip-mined loops over full field
+  /// blocks, keyed by the loop variable they replace
+  map<Var,pair<Var,Var>> blockedLoopVars;
   
   using IRRewriter::visit;
 
@@ -231,19 +248,109 @@ private:
     }
     simit_iassert(index.defined());
 
+    // The components of a field block's elements are a block apart
+    if (isa<TensorRead>(tensor)) {
+      int fieldBlockSize = getFieldBlockSize(to<TensorRead>(tensor)->tensor);
+      if (fieldBlockSize > 1) {
+        index = Mul::make(index, fieldBlockSize);
+      }
+    }
+
     // Multiply in inner block size
     Type blockType = tensor.type().toTensor()->getBlockType();
     Expr blockSize = Literal::make(1);
     if (blockType.toTensor()->getDimensions().size() > 0) {
       blockSize = createLengthComputation(
           blockType.toTensor()->getDimensions());
-      index = Mul::make(index, blockSize);
+      int fieldBlockSize = getFieldBlockSize(tensor);
+      if (fieldBlockSize > 1) {
+        index = getFieldBlockIndex(index, blockSize, fieldBlockSize);
+      }
+      else {
+        index = Mul::make(index, blockSize);
+      }
     }
 
     simit_iassert(index.defined());
     return index;
   }
 
+  /// Returns the location of the first component of `element` in a field
+  /// whose blocks hold `fieldBlockSize` elements with `blockSize` components.
+  Expr getFieldBlockIndex(Expr element, Expr blockSize, int fieldBlockSize) {
+    Expr fieldBlockLen = Mul::make(blockSize, fieldBlockSize);
+    if (isa<VarExpr>(element) &&
+        util::contains(blockedLoopVars, to<VarExpr>(element)->var)) {
+      const pair<Var,Var>& blockVars =
+          blockedLoopVars.at(to<VarExpr>(element)->var);
+      return Add::make(Mul::make(blockVars.first, fieldBlockLen),
+                       blockVars.second);
+    }
+    return Add::make(Mul::make(Div::make(element, fieldBlockSize),
+                               fieldBlockLen),
+                     Rem::make(element, fieldBlockSize));
+  }
+
+  /// Returns true if `stmt` reads or writes the vector or matrix fields of
+  /// `var`'s element
+  static bool accessesFieldBlocks(Stmt stmt, const Var& var) {
+    bool result = false;
+    auto isFieldBlockAccess = [&](Expr tensor, const vector<Expr>& indices) {
+      if (getFieldBlockSize(tensor) > 1 && indices.size() == 1 &&
+          isa<VarExpr>(indices[0]) && to<VarExpr>(indices[0])->var == var) {
+        result = true;
+      }
+    };
+    match(stmt,
+      std::function<void(const TensorRead*)>([&](const TensorRead* op) {
+        isFieldBlockAccess(op->tensor, op->indices);
+      }),
+      std::function<void(const TensorWrite*)>([&](const TensorWrite* op) {
+        isFieldBlockAccess(op->tensor, op->indices);
+      })
+    );
+    return result;
+  }
+
+  /// Strip-mine loops over sets whose fields are stored in blocks, so that
+  /// the loop over the elements of each full block accesses consecutive
+  /// locations of every component and can be vectorized:
+  ///   for pb in 0:length(S)/B
+  ///     for pl in 0:B
+  ///       p = pb*B + pl;
+  ///       body
+  ///   for p in length(S)/B*B:length(S)
+  ///     body
+  void visit(const For *op) {
+    if (kFieldBlockSize == 1 || op->domain.kind != ForDomain::IndexSet ||
+        op->domain.indexSet.getKind() != IndexSet::Set ||
+        !accessesFieldBlocks(op->body, op->var)) {
+      IRRewriter::visit(op);
+      return;
+    }
+
+    Var blockVar(op->var.getName() + "_block", Int);
+    Var laneVar(op->var.getName() + "_lane", Int);
+    Expr len = Length::make(op->domain.indexSet);
+    Expr numBlocks = Div::make(len, (int)kFieldBlockSize);
+    Expr blocksEnd = Mul::make(numBlocks, (int)kFieldBlockSize);
+
+    blockedLoopVars.insert({op->var, {blockVar, laneVar}});
+    Stmt laneBody = rewrite(op->body);
+    blockedLoopVars.erase(op->var);
+    Stmt elemDef = AssignStmt::make(op->var,
+                                    Add::make(Mul::make(blockVar,
+                                                        (int)kFieldBlockSize),
+                                              laneVar));
+    laneBody = Block::make({VarDecl::make(op->var), elemDef, laneBody});
+    Stmt blocksLoop = ForRange::make(blockVar, 0, numBlocks,
+                                     ForRange::make(laneVar, 0,
+                                                    (int)kFieldBlockSize,
+                                                    laneBody));
+    Stmt restLoop = ForRange::make(op->var, blocksEnd, len, rewrite(op->body));
+    stmt = Block::make(blocksLoop, restLoop);
+  }
+
   void visit(const TensorRead *op) {
     simit_iassert(op->type.isTensor() && op->tensor.type().toTensor());
     Expr tensor = rewrite(op->tensor);
@@ -6,6 +6,7 @@
 #include "ir_transforms.h"
 #include "inline.h"
 #include "path_expressions.h"
+#include "index_expressions/lower_spmv.h"
 #include "tensor_index.h"
 #include "util/collections.h"
 
@@ -150,6 +151,13 @@ private:
     // Add comment
     stmt = Comment::make(util::toString(*op), stmt, true);
 
+    // Pack the assembled values of sliced matrices into their sliced copies
+    for (auto result : op->vars) {
+      if (storage->getStorage(result).isSliced()) {
+        stmt = Block::make(stmt, packSlicedMatrix(result));
+      }
+    }
+
     // Add storage descriptor for the new tensors in the inlined map
     updateStorage(stmt, storage, env);
 
@@ -0,0 +1,581 @@
+#include "lower_parallel_loops.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ir_rewriter.h"
+#include "ir_visitor.h"
+#include "intrinsics.h"
+#include "tensor_index.h"
+#include "util/collections.h"
+#include "util/util.h"
+
+using namespace std;
+
+namespace simit {
+namespace ir {
+
+/// Intrinsics with side effects beyond their results, or that operate on whole
+/// system tensors. Loops that call them are not parallelized.
+static bool isParallelUnsafeIntrinsic(const Func& func) {
+  static const set<Func> unsafe = {
+    intrinsics::clock(), intrinsics::storeTime(),
+    intrinsics::malloc(), intrinsics::free(),
+    intrinsics::strcpy(), intrinsics::strcat(),
+    intrinsics::solve(),
+    intrinsics::lu(), intrinsics::lufree(),
+    intrinsics::lusolve(), intrinsics::lumatsolve(),
+    intrinsics::chol(), intrinsics::cholfree(),
+    intrinsics::lltsolve(), intrinsics::lltmatsolve(),
+    intrinsics::triangularSolve(), intrinsics::pcg()
+  };
+  return util::contains(unsafe, func);
+}
+
+/// Determines how the iterations of a loop over `loopVar` may be executed
+/// concurrently. Conservative: anything it does not understand makes the loop
+/// serial.
+///
+/// Every location of a buffer that is not declared in the loop body (a shared
+/// buffer) is classified by who owns it:
+///  - Iteration: `lv*stride + offset` with `0 <= offset < stride`, which no
+///    other iteration can address.
+///  - Endpoint: `ep*stride + offset`, where `ep` is an endpoint of `lv`.
+///  - Row: `loc*stride + offset`, where `loc` is a location in a matrix row
+///    owned by `lv` or one of its endpoints (e.g. computed by `loc`, or read
+///    from the location table of an index over the loop's edge set).
+/// A loop whose shared accesses are all owned by the iteration is independent.
+/// Otherwise the loop is a reduction. If every shared buffer is consistently
+/// addressed through the iteration, its endpoints or their rows, then
+/// iterations that share no endpoints do not conflict, and the loop can run
+/// color by color over an edge coloring. If every shared buffer that is not
+/// owned by the iteration is only added to, the loop can be privatized.
+class ParallelLoopAnalysis : public IRVisitor {
+public:
+  ParallelLoopAnalysis(const Var& loopVar, const Expr& loopSet,
+                       const map<Var,Var>& locationTables)
+      : loopVar(loopVar), loopSet(loopSet), locationTables(locationTables) {
+    privateVars.insert(loopVar);
+  }
+
+  /// Ownership of values and locations. Top is the optimistic initial value of
+  /// the fixed point and Unknown is bottom.
+  enum Owner {Top, Iteration, Endpoint, Row, Unknown};
+
+  enum Result {Serial, Independent, Reduction};
+
+  Result analyze(Stmt body) {
+    safe = true;
+    body.accept(this);
+    if (!safe) {
+      return Serial;
+    }
+
+    // Compute what the private variables hold as a fixed point over their
+    // definitions.
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto& def : defs) {
+        Owner valueOwner = getValueOwner(def.value);
+        if (def.isLoc && valueOwner != Top) {
+          valueOwner = (valueOwner == Iteration || valueOwner == Endpoint)
+                       ? Row : Unknown;
+        }
+        Owner owner = meet(getOwner(def.var), valueOwner);
+        if (owner != getOwner(def.var)) {
+          owners[def.var] = owner;
+          changed = true;
+        }
+      }
+    }
+
+    // Only buffers that are written need to be checked. Buffers addressed by
+    // different kinds of owners are owned by no one.
+    map<string,Owner> bufferOwners;
+    for (auto& access : accesses) {
+      if (!util::contains(writtenBuffers, access.buffer)) {
+        continue;
+      }
+      Owner owner = getIndexOwner(access.index);
+      bufferOwners[access.buffer] = util::contains(bufferOwners, access.buffer)
+          ? meet(bufferOwners[access.buffer], owner) : owner;
+    }
+
+    Result result = Independent;
+    colorable = true;
+    privatizable = true;
+    reductions.clear();
+    for (auto& bufferOwner : bufferOwners) {
+      const string& buffer = bufferOwner.first;
+      if (bufferOwner.second == Iteration) {
+        continue;
+      }
+      result = Reduction;
+      if (bufferOwner.second != Endpoint && bufferOwner.second != Row) {
+        colorable = false;
+      }
+      if (util::contains(nonReductionBuffers, buffer) ||
+          !bufferExprs.at(buffer).type().isTensor()) {
+        privatizable = false;
+      }
+      else {
+        reductions.push_back(bufferExprs.at(buffer));
+      }
+    }
+    return (result == Reduction && !colorable && !privatizable)
+           ? Serial : result;
+  }
+
+  /// Whether a reduction loop can run color by color over an edge coloring.
+  bool isColorable() const {return colorable;}
+
+  /// Whether a reduction loop can add to per-thread copies of its reductions.
+  bool isPrivatizable() const {return privatizable;}
+
+  /// The shared buffers that a privatizable reduction loop adds to.
+  const vector<Expr>& getReductions() const {return reductions;}
+
+private:
+  Var loopVar;
+  Expr loopSet;
+  bool safe;
+
+  /// The location table arrays of the function's tensor indices, and the edge
+  /// sets they are built over
+  const map<Var,Var>& locationTables;
+  bool colorable;
+  bool privatizable;
+  vector<Expr> reductions;
+
+  /// Variables declared inside the loop body (including the loop variables)
+  set<Var> privateVars;
+
+  /// Literal bounds of the ForRange variables in the loop body
+  map<Var, pair<int,int>> ranges;
+
+  /// Values assigned to private variables and stored to private buffers. An
+  /// undefined value is assigned by compound operators and calls, except for
+  /// loc, whose definitions hold loc's first argument (the row).
+  struct Def {
+    Var var;
+    Expr value;
+    bool isLoc;
+  };
+  vector<Def> defs;
+  map<Var,Owner> owners;
+
+  /// Accesses to shared buffers, and the shared buffers that are written
+  struct Access {
+    string buffer;
+    Expr index;
+  };
+  vector<Access> accesses;
+  set<string> writtenBuffers;
+  map<string,Expr> bufferExprs;
+
+  /// Shared buffers that are read, or written by other than compound adds and
+  /// subtracts, which cannot be privatized
+  set<string> nonReductionBuffers;
+
+  using IRVisitor::visit;
+
+  static string bufferKey(const Expr& buffer) {
+    return util::toString(buffer);
+  }
+
+  static Owner meet(Owner a, Owner b) {
+    if (a == Top) return b;
+    if (b == Top) return a;
+    return (a == b) ? a : Unknown;
+  }
+
+  bool isPrivate(const Expr& expr) const {
+    return isa<VarExpr>(expr) &&
+           util::contains(privateVars, to<VarExpr>(expr)->var);
+  }
+
+  bool isLoopVar(const Expr& expr) const {
+    return isa<VarExpr>(expr) && to<VarExpr>(expr)->var == loopVar;
+  }
+
+  bool isLoopSet(const Expr& expr) const {
+    if (isa<VarExpr>(expr) && isa<VarExpr>(loopSet)) {
+      return to<VarExpr>(expr)->var == to<VarExpr>(loopSet)->var;
+    }
+    return expr == loopSet;
+  }
+
+  /// Whether `buffer` is a location table over the loop's edge set, which
+  /// holds locations in the rows of each edge's endpoints.
+  bool isLocationTable(const Expr& buffer) const {
+    if (!isa<VarExpr>(buffer) ||
+        !util::contains(locationTables, to<VarExpr>(buffer)->var)) {
+      return false;
+    }
+    const Var& tableSet = locationTables.at(to<VarExpr>(buffer)->var);
+    return isa<VarExpr>(loopSet) && to<VarExpr>(loopSet)->var == tableSet;
+  }
+
+  Owner getOwner(const Var& var) const {
+    return util::contains(owners, var) ? owners.at(var) : Top;
+  }
+
+  /// Returns the closed interval of values `expr` can take, if it is a
+  /// non-negative affine combination of integer literals and bounded
+  /// ForRange variables.
+  bool getInterval(const Expr& expr, int* lo, int* hi) const {
+    if (isa<Literal>(expr) && isInt(expr.type())) {
+      *lo = *hi = to<Literal>(expr)->getIntVal(0);
+      return true;
+    }
+    if (isa<VarExpr>(expr)) {
+      const Var& var = to<VarExpr>(expr)->var;
+      if (!util::contains(ranges, var)) {
+        return false;
+      }
+      *lo = ranges.at(var).first;
+      *hi = ranges.at(var).second - 1;
+      return *lo <= *hi;
+    }
+    if (isa<Add>(expr)) {
+      int alo, ahi, blo, bhi;
+      if (!getInterval(to<Add>(expr)->a, &alo, &ahi) ||
+          !getInterval(to<Add>(expr)->b, &blo, &bhi)) {
+        return false;
+      }
+      *lo = alo + blo;
+      *hi = ahi + bhi;
+      return true;
+    }
+    if (isa<Mul>(expr)) {
+      int alo, ahi, blo, bhi;
+      if (!getInterval(to<Mul>(expr)->a, &alo, &ahi) ||
+          !getInterval(to<Mul>(expr)->b, &blo, &bhi) ||
+          alo < 0 || blo < 0) {
+        return false;
+      }
+      *lo = alo * blo;
+      *hi = ahi * bhi;
+      return true;
+    }
+    return false;
+  }
+
+  /// Matches `index` against `base*stride + offset`, with `0 <= offset <
+  /// stride` and a literal stride, and returns the base. Returns an undefined
+  /// Expr if `index` does not have that form.
+  Expr getBase(const Expr& index) const {
+    vector<Expr> terms;
+    vector<Expr> worklist = {index};
+    while (!worklist.empty()) {
+      Expr term = worklist.back();
+      worklist.pop_back();
+      if (isa<Add>(term)) {
+        worklist.push_back(to<Add>(term)->a);
+        worklist.push_back(to<Add>(term)->b);
+      }
+      else {
+        terms.push_back(term);
+      }
+    }
+
+    Expr base;
+    int stride = 0;
+    int lo = 0;
+    int hi = 0;
+    for (auto& term : terms) {
+      int termLo, termHi;
+      if (getInterval(term, &termLo, &termHi)) {
+        lo += termLo;
+        hi += termHi;
+      }
+      else if (base.defined()) {
+        return Expr();
+      }
+      else if (isa<Mul>(term) && isa<Literal>(to<Mul>(term)->b) &&
+               isInt(to<Mul>(term)->b.type())) {
+        base = to<Mul>(term)->a;
+        stride = to<Literal>(to<Mul>(term)->b)->getIntVal(0);
+      }
+      else if (isa<Mul>(term) && isa<Literal>(to<Mul>(term)->a) &&
+               isInt(to<Mul>(term)->a.type())) {
+        base = to<Mul>(term)->b;
+        stride = to<Literal>(to<Mul>(term)->a)->getIntVal(0);
+      }
+      else {
+        base = term;
+        stride = 1;
+      }
+    }
+    return (base.defined() && lo >= 0 && hi < stride) ? base : Expr();
+  }
+
+  /// Returns the owner of the location `index`.
+  Owner getIndexOwner(const Expr& index) const {
+    Expr base = getBase(index);
+    if (!base.defined()) {
+      return Unknown;
+    }
+    if (isLoopVar(base)) {
+      return Iteration;
+    }
+    return getValueOwner(base);
+  }
+
+  /// Returns what `value` holds: the loop variable, an endpoint of the loop
+  /// variable or a location owned by either.
+  Owner getValueOwner(const Expr& value) const {
+    if (!value.defined()) {
+      return Unknown;
+    }
+    if (isLoopVar(value)) {
+      return Iteration;
+    }
+    if (isPrivate(value)) {
+      return getOwner(to<VarExpr>(value)->var);
+    }
+    if (isa<Load>(value)) {
+      const Load* load = to<Load>(value);
+      if (isPrivate(load->buffer)) {
+        return getOwner(to<VarExpr>(load->buffer)->var);
+      }
+      if (isa<IndexRead>(load->buffer)) {
+        const IndexRead* indexRead = to<IndexRead>(load->buffer);
+        if (indexRead->kind == IndexRead::Endpoints &&
+            isLoopSet(indexRead->edgeSet) &&
+            isLoopVar(getBase(load->index))) {
+          return Endpoint;
+        }
+      }
+      if (isLocationTable(load->buffer) && isLoopVar(getBase(load->index))) {
+        return Row;
+      }
+      return Unknown;
+    }
+    // A location owned by the loop variable, such as ev matrix locations
+    Expr base = getBase(value);
+    if (base.defined() && isLoopVar(base)) {
+      return Row;
+    }
+    return Unknown;
+  }
+
+  void visit(const VarDecl* op) {
+    Type type = op->var.getType();
+    if (type.isTensor() && isSystemTensorType(type)) {
+      safe = false;
+    }
+    privateVars.insert(op->var);
+  }
+
+  void visit(const AssignStmt* op) {
+    if (!util::contains(privateVars, op->var)) {
+      safe = false;
+    }
+    defs.push_back({op->var, (op->cop == CompoundOperator::None) ? op->value
+                                                                 : Expr(),
+                    false});
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt* op) {
+    if (op->callee.getKind() != Func::Intrinsic ||
+        isParallelUnsafeIntrinsic(op->callee)) {
+      safe = false;
+    }
+    for (auto& result : op->results) {
+      if (!util::contains(privateVars, result)) {
+        safe = false;
+      }
+      // loc returns a location in the row of its first argument
+      bool isLoc = (op->callee == intrinsics::loc() ||
+                    op->callee == intrinsics::locSorted()) &&
+                   op->results.size() == 1;
+      defs.push_back({result, isLoc ? op->actuals[0] : Expr(), isLoc});
+    }
+    for (auto& arg : op->actuals) {
+      arg.accept(this);
+    }
+  }
+
+  void visit(const Load* op) {
+    if (!isPrivate(op->buffer)) {
+      string buffer = bufferKey(op->buffer);
+      accesses.push_back({buffer, op->index});
+      nonReductionBuffers.insert(buffer);
+    }
+    op->index.accept(this);
+  }
+
+  void visit(const Store* op) {
+    if (isPrivate(op->buffer)) {
+      defs.push_back({to<VarExpr>(op->buffer)->var,
+                      (op->cop == CompoundOperator::None) ? op->value
+                                                          : Expr(),
+                      false});
+    }
+    else {
+      string buffer = bufferKey(op->buffer);
+      accesses.push_back({buffer, op->index});
+      writtenBuffers.insert(buffer);
+      bufferExprs.insert({buffer, op->buffer});
+      if (op->cop == CompoundOperator::None) {
+        nonReductionBuffers.insert(buffer);
+      }
+    }
+    op->index.accept(this);
+    op->value.accept(this);
+  }
+
+  void visit(const ForRange* op) {
+    privateVars.insert(op->var);
+    if (isa<Literal>(op->start) && isa<Literal>(op->end) &&
+        isInt(op->start.type()) && isInt(op->end.type())) {
+      ranges[op->var] = {to<Literal>(op->start)->getIntVal(0),
+                         to<Literal>(op->end)->getIntVal(0)};
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const For* op) {
+    privateVars.insert(op->var);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const FieldWrite* op) {
+    safe = false;
+  }
+
+  void visit(const TensorWrite* op) {
+    safe = false;
+  }
+
+  void visit(const Map* op) {
+    safe = false;
+  }
+
+  void visit(const Kernel* op) {
+    safe = false;
+  }
+
+  void visit(const Print* op) {
+    safe = false;
+  }
+};
+
+/// Redirects the stores to the given shared buffers to the vars that hold the
+/// thread's copies of them.
+class PrivatizeReductions : public IRRewriter {
+public:
+  PrivatizeReductions(const vector<pair<Var,Expr>>& reductions) {
+    for (auto& reduction : reductions) {
+      privateCopies.insert({util::toString(reduction.second),
+                            reduction.first});
+    }
+  }
+
+private:
+  map<string,Var> privateCopies;
+
+  using IRRewriter::visit;
+
+  void visit(const Store* op) {
+    string buffer = util::toString(op->buffer);
+    if (!util::contains(privateCopies, buffer)) {
+      IRRewriter::visit(op);
+      return;
+    }
+    stmt = Store::make(privateCopies.at(buffer), rewrite(op->index),
+                       rewrite(op->value), op->cop);
+  }
+};
+
+class LowerParallelLoops : public IRRewriter {
+public:
+  LowerParallelLoops(const Func& func, const string& assembly)
+      : assembly(assembly) {
+    for (const TensorIndex& index : func.getEnvironment().getTensorIndices()) {
+      if (index.getKind() == TensorIndex::PExpr &&
+          index.getLocationTableSet().defined()) {
+        locationTables.insert({index.getLocationTableArray(),
+                               index.getLocationTableSet()});
+      }
+    }
+  }
+
+private:
+  string assembly;
+  map<Var,Var> locationTables;
+
+  using IRRewriter::visit;
+
+  void visit(const For* op) {
+    const ForDomain& domain = op->domain;
+    if (domain.kind != ForDomain::IndexSet ||
+        domain.indexSet.getKind() != IndexSet::Set) {
+      IRRewriter::visit(op);
+      return;
+    }
+
+    const Expr& set = domain.indexSet.getSet();
+    bool isEdgeSet = set.type().isUnstructuredSet() &&
+        set.type().toUnstructuredSet()->getCardinality() > 0;
+
+    ParallelLoopAnalysis analysis(op->var, set, locationTables);
+    switch (analysis.analyze(op->body)) {
+      case ParallelLoopAnalysis::Independent:
+        stmt = Kernel::make(op->var, IndexDomain(domain.indexSet), op->body);
+        break;
+      case ParallelLoopAnalysis::Reduction: {
+        bool colorable = isEdgeSet && analysis.isColorable();
+        bool privatizable = analysis.isPrivatizable();
+        Kernel::Schedule schedule;
+        if (colorable && privatizable) {
+          schedule = (assembly == "coloring")      ? Kernel::Colored
+                   : (assembly == "privatization") ? Kernel::Privatized
+                   : Kernel::Adaptive;
+        }
+        else if (colorable) {
+          schedule = Kernel::Colored;
+        }
+        else if (privatizable) {
+          schedule = Kernel::Privatized;
+        }
+        else {
+          IRRewriter::visit(op);
+          break;
+        }
+        if (schedule == Kernel::Colored) {
+          stmt = Kernel::make(op->var, IndexDomain(domain.indexSet), op->body,
+                              schedule);
+          break;
+        }
+
+        vector<pair<Var,Expr>> reductions;
+        for (auto& buffer : analysis.getReductions()) {
+          string name = isa<FieldRead>(buffer)
+                        ? to<FieldRead>(buffer)->fieldName
+                        : isa<VarExpr>(buffer) ? to<VarExpr>(buffer)->var.getName()
+                                               : "reduction";
+          reductions.push_back({Var(name + "_private", buffer.type()), buffer});
+        }
+        Stmt body = PrivatizeReductions(reductions).rewrite(op->body);
+        stmt = Kernel::make(op->var, IndexDomain(domain.indexSet), body,
+                            schedule, reductions);
+        break;
+      }
+      case ParallelLoopAnalysis::Serial:
+        IRRewriter::visit(op);
+        break;
+    }
+  }
+};
+
+Func lowerParallelLoops(Func func, const std::string& assembly) {
+  return LowerParallelLoops(func, assembly).rewrite(func);
+}
+
+}}
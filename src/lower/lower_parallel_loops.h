@@ -0,0 +1,23 @@
+#ifndef SIMIT_LOWER_PARALLEL_LOOPS_H
+#define SIMIT_LOWER_PARALLEL_LOOPS_H
+
+#include <string>
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// Rewrite outermost loops over set index domains whose iterations can run
+/// concurrently to Kernels, which the CPU backend splits across the runtime
+/// thread pool. Loops whose iterations only write locations owned by the loop
+/// variable (`i*stride + offset`, `0 <= offset < stride`) become independent
+/// kernels. Loops that add to locations shared between iterations, like map
+/// assemblies, are colored over their edge set or privatized, following the
+/// `assembly` strategy ("auto", "coloring" or "privatization"). The other
+/// strategy is used where the preferred one does not apply.
+Func lowerParallelLoops(Func func, const std::string& assembly="auto");
+
+}}
+
+#endif
@@ -1,12 +1,15 @@
 #include "path_indices.h"
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
 #include <stack>
 #include <map>
 #include <vector>
 
 #include "path_expressions.h"
 #include "graph.h"
+#include "thread_pool.h"
 #include "util/collections.h"
 
 using namespace std;
@@ -144,7 +147,181 @@ void SegmentedPathIndex::print(std::ostream &os) const {
 }
 
 
+// class PathIndexCache
+PathIndexCache& PathIndexCache::getInstance() {
+  // Never destroyed, since sets that outlive static destruction evict from it
+  static PathIndexCache* cache = new PathIndexCache();
+  return *cache;
+}
+
+bool PathIndexCache::get(const PathExpression &pe, unsigned sourceEndpoint,
+                         const vector<const simit::Set*> &sets,
+                         VersionedPathIndex *pi) const {
+  lock_guard<std::mutex> lock(mutex);
+  auto it = entries.find(Key(pe, sourceEndpoint, sets));
+  if (it == entries.end()) {
+    return false;
+  }
+  *pi = it->second;
+  return true;
+}
+
+void PathIndexCache::insert(const PathExpression &pe, unsigned sourceEndpoint,
+                            const vector<const simit::Set*> &sets,
+                            const VersionedPathIndex &pi) {
+  // Set versions are never reused, so an index over an earlier version of the
+  // sets is only useful as the starting point of an update, and is replaced.
+  // Indices over destroyed sets are evicted, so entries do not accumulate.
+  lock_guard<std::mutex> lock(mutex);
+  entries[Key(pe, sourceEndpoint, sets)] = pi;
+}
+
+void PathIndexCache::evict(const simit::Set* set) {
+  lock_guard<std::mutex> lock(mutex);
+  for (auto it = entries.begin(); it != entries.end();) {
+    if (util::contains(std::get<2>(it->first), set)) {
+      it = entries.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+void PathIndexCache::clear() {
+  lock_guard<std::mutex> lock(mutex);
+  entries.clear();
+}
+
+size_t PathIndexCache::size() const {
+  lock_guard<std::mutex> lock(mutex);
+  return entries.size();
+}
+
+/// Run `body(begin, end)` over the rows [0, n) on the runtime thread pool.
+template <typename Body>
+static void parallelForRows(size_t n, const Body& body) {
+  ThreadPool::getInstance().parallelFor(n, [](int begin, int end, void* ctx) {
+    (*static_cast<const Body*>(ctx))(begin, end);
+  }, const_cast<Body*>(&body));
+}
+
+/// Sort `nbrs[begin:]` and remove duplicates.
+static void sortUnique(vector<unsigned>* nbrs, size_t begin=0) {
+  sort(nbrs->begin()+begin, nbrs->end());
+  nbrs->erase(unique(nbrs->begin()+begin, nbrs->end()), nbrs->end());
+}
+
+static void appendRow(const SegmentedPathIndex* pi, unsigned elem,
+                      vector<unsigned>* nbrs) {
+  const unsigned* coords = pi->getCoordData();
+  const unsigned* sinks = pi->getSinkData();
+  nbrs->insert(nbrs->end(), &sinks[coords[elem]], &sinks[coords[elem+1]]);
+}
+
 // class PathIndexBuilder
+// The rows are built in two passes: the first counts the neighbors of every
+// element and the second writes them to their segment. Rows are computed
+// twice, from several threads, so that the only memory needed beyond the index
+// is one row per thread.
+template <typename RowFunc>
+PathIndex PathIndexBuilder::buildRows(size_t numElements,
+                                      const RowFunc& getRow) {
+  uint32_t* coordsData= (uint32_t*)malloc((numElements+1)*sizeof(uint32_t));
+  coordsData[0] = 0;
+  parallelForRows(numElements, [&](int begin, int end) {
+    vector<unsigned> nbrs;
+    for (int elem=begin; elem < end; ++elem) {
+      nbrs.clear();
+      getRow(elem, &nbrs);
+      coordsData[elem+1] = nbrs.size();
+    }
+  });
+  for (size_t elem=0; elem < numElements; ++elem) {
+    coordsData[elem+1] += coordsData[elem];
+  }
+
+  size_t numNeighbors = coordsData[numElements];
+  uint32_t* sinksData = (uint32_t*)malloc(numNeighbors*sizeof(uint32_t));
+  parallelForRows(numElements, [&](int begin, int end) {
+    vector<unsigned> nbrs;
+    for (int elem=begin; elem < end; ++elem) {
+      nbrs.clear();
+      getRow(elem, &nbrs);
+      simit_iassert(nbrs.size() == coordsData[elem+1] - coordsData[elem]);
+      copy(nbrs.begin(), nbrs.end(), &sinksData[coordsData[elem]]);
+    }
+  });
+  return new SegmentedPathIndex(numElements, coordsData, sinksData);
+}
+
+// Only the dirty rows are recomputed. The other rows are copied from the old
+// index, which is shared with the cache and the functions bound to it and so
+// cannot be changed in place. An update therefore still costs a copy of the
+// whole index, but avoids evaluating the path expression for the clean rows,
+// which dominates the cost of a build.
+template <typename RowFunc>
+PathIndex PathIndexBuilder::updateRows(const PathIndex& old,
+                                       vector<unsigned>* dirty,
+                                       size_t numElements,
+                                       const RowFunc& getRow) {
+  const SegmentedPathIndex* oldIndex = to<SegmentedPathIndex>(old);
+  vector<unsigned>& dirtyRows = *dirty;
+  for (size_t elem=oldIndex->numElements(); elem < numElements; ++elem) {
+    dirtyRows.push_back(elem);
+  }
+  sortUnique(&dirtyRows);
+  while (!dirtyRows.empty() && dirtyRows.back() >= numElements) {
+    dirtyRows.pop_back();
+  }
+  if (dirtyRows.empty() && numElements == oldIndex->numElements()) {
+    return old;
+  }
+
+  vector<vector<unsigned>> rows(dirtyRows.size());
+  parallelForRows(dirtyRows.size(), [&](int begin, int end) {
+    for (int i=begin; i < end; ++i) {
+      getRow(dirtyRows[i], &rows[i]);
+    }
+  });
+
+  const unsigned* oldCoords = oldIndex->getCoordData();
+  const unsigned* oldSinks = oldIndex->getSinkData();
+  uint32_t* coordsData= (uint32_t*)malloc((numElements+1)*sizeof(uint32_t));
+  coordsData[0] = 0;
+  for (size_t elem=0, i=0; elem < numElements; ++elem) {
+    size_t numNeighbors;
+    if (i < dirtyRows.size() && dirtyRows[i] == elem) {
+      numNeighbors = rows[i++].size();
+    }
+    else {
+      simit_iassert(elem < oldIndex->numElements());
+      numNeighbors = oldCoords[elem+1] - oldCoords[elem];
+    }
+    coordsData[elem+1] = coordsData[elem] + numNeighbors;
+  }
+
+  // Copy the clean rows before each dirty row, and the dirty row
+  uint32_t* sinksData =
+      (uint32_t*)malloc(coordsData[numElements]*sizeof(uint32_t));
+  parallelForRows(dirtyRows.size()+1, [&](int begin, int end) {
+    for (int i=begin; i < end; ++i) {
+      size_t cleanBegin = (i == 0) ? 0 : dirtyRows[i-1]+1;
+      size_t cleanEnd = ((size_t)i < dirtyRows.size()) ? dirtyRows[i]
+                                                        : numElements;
+      if (cleanBegin < cleanEnd) {
+        copy(&oldSinks[oldCoords[cleanBegin]], &oldSinks[oldCoords[cleanEnd]],
+             &sinksData[coordsData[cleanBegin]]);
+      }
+      if ((size_t)i < dirtyRows.size()) {
+        copy(rows[i].begin(), rows[i].end(),
+             &sinksData[coordsData[dirtyRows[i]]]);
+      }
+    }
+  });
+  return new SegmentedPathIndex(numElements, coordsData, sinksData);
+}
+
 PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
                                            unsigned sourceEndpoint){
   /// Interpret the path expression, starting at sourceEndpoint, over the graph.
@@ -160,6 +337,12 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
 
     PathNeighborVisitor(PathIndexBuilder *builder) : builder(builder) {}
 
+    /// Construct a visitor that updates `oldIndex`, which was built when the
+    /// sets had `oldVersions`.
+    PathNeighborVisitor(PathIndexBuilder *builder, const PathIndex &oldIndex,
+                        const map<const simit::Set*,uint64_t> &oldVersions)
+        : oldIndex(oldIndex), oldVersions(oldVersions), builder(builder) {}
+
     PathIndex build(const PathExpression &pe) {
       pe.accept(this);
       PathIndex pit = pi;
@@ -167,42 +350,26 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
       return pit;
     }
 
-  private:
-    /// Pack neighbor vectors into a segmented vector (contiguous array).
-    PathIndex pack(const map<unsigned, vector<unsigned>> &pathNeighbors,
-                   bool sorted=true) {
-      unsigned numNeighbors = 0;
-      for (auto &p : pathNeighbors) {
-        numNeighbors += p.second.size();
-      }
-
-      size_t numElements = pathNeighbors.size();
-      uint32_t* coordsData= (uint32_t*)malloc((numElements+1)*sizeof(uint32_t));
-      uint32_t* sinksData = (uint32_t*)malloc(numNeighbors*sizeof(uint32_t));
-
-      int currNbrsStart = 0;
-      for (auto& p : pathNeighbors) {
-        unsigned elem = p.first;
-        coordsData[elem] = currNbrsStart;
-
-        unsigned pNeighborSize = p.second.size();
-        if (pNeighborSize > 0) {
-          vector<unsigned> pNeighbors(p.second.begin(), p.second.end());
-          if (sorted) {
-            sort(pNeighbors.begin(), pNeighbors.end());
-          }
-
-          memcpy(&sinksData[currNbrsStart], pNeighbors.data(),
-                 pNeighbors.size() * sizeof(uint32_t));
-
-          currNbrsStart += pNeighborSize;
-        }
-      }
-      coordsData[numElements] = currNbrsStart;
-      return new SegmentedPathIndex(numElements, coordsData, sinksData);;
+    /// Update the old index to the current sets, by recomputing only the rows
+    /// that changed, which are stored in `dirtyRows`, and copying the others
+    /// from the old index. Returns an undefined index if the changes to the
+    /// sets cannot be applied to the index.
+    PathIndex update(const PathExpression &pe, vector<unsigned> *dirtyRows) {
+      simit_iassert(oldIndex.defined());
+      pe.accept(this);
+      *dirtyRows = this->dirtyRows;
+      PathIndex pit = pi;
+      pi = nullptr;
+      return pit;
     }
 
+  private:
     void visit(const Link *link) {
+      if (oldIndex.defined()) {
+        updateLink(link);
+        return;
+      }
+
       switch (link->getType()) {
         case Link::ev: {
           const simit::Set& edgeSet = *builder->getBinding(link->getEdgeSet());
@@ -247,66 +414,222 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
         }
         case Link::ve: {
           const simit::Set& edgeSet = *builder->getBinding(link->getEdgeSet());
-          simit_iassert(edgeSet.getCardinality() > 0)
+          const int cardinality = edgeSet.getCardinality();
+          simit_iassert(cardinality > 0)
               << "not an edge set" << edgeSet.getName();
-          
-          // add each edge to the neighbor vectors of its endpoints
-          map<unsigned, vector<unsigned>> pathNeighbors;
 
-          // create neighbor lists
           const simit::Set& vertexSet =
               *builder->getBinding(link->getVertexSet());
-          for (auto &v : vertexSet) {
-            pathNeighbors.insert({v.getIdent(), vector<unsigned>()});
+          vector<bool> isVertexEndpoint(cardinality);
+          for (int i=0; i < cardinality; ++i) {
+            isVertexEndpoint[i] = (&vertexSet == edgeSet.getEndpointSet(i));
+          }
+
+          // Count the edges of each vertex
+          size_t n = vertexSet.getSize();
+          const int* endpoints = edgeSet.getEndpointsData();
+          uint32_t* ptr = (uint32_t*)calloc(n+1, sizeof(uint32_t));
+          for (int e=0; e < edgeSet.getSize(); ++e) {
+            for (int i=0; i < cardinality; ++i) {
+              if (isVertexEndpoint[i]) {
+                simit_iassert(endpoints[e*cardinality+i] >= 0);
+                ++ptr[endpoints[e*cardinality+i]+1];
+              }
+            }
+          }
+          for (size_t v=0; v < n; ++v) {
+            ptr[v+1] += ptr[v];
           }
 
-          // populate neighbor lists
-          for (auto &e : edgeSet) {
-            simit_iassert(e.getIdent() >= 0);
-            int i = 0;
-            for (auto &ep : edgeSet.getEndpoints(e)) {
-              simit_iassert(ep.getIdent() >= 0);
-              if (&vertexSet == edgeSet.getEndpointSet(i++)) {
-                pathNeighbors.at(ep.getIdent()).push_back(e.getIdent());
+          // Add each edge to the segments of its endpoints. Edges are added in
+          // order, so the segments are sorted. Filling a segment advances its
+          // start to the next segment's, so shift them back afterwards.
+          uint32_t* idx = (uint32_t*)malloc(ptr[n]*sizeof(uint32_t));
+          for (int e=0; e < edgeSet.getSize(); ++e) {
+            for (int i=0; i < cardinality; ++i) {
+              if (isVertexEndpoint[i]) {
+                idx[ptr[endpoints[e*cardinality+i]]++] = e;
               }
             }
           }
-          pi = pack(pathNeighbors);
+          for (size_t v=n; v > 0; --v) {
+            ptr[v] = ptr[v-1];
+          }
+          ptr[0] = 0;
+
+          pi = new SegmentedPathIndex(n, ptr, idx);
           break;
         }
         case Link::vv: {
           const ir::StencilLayout& stencil = link->getStencil();
           const simit::Set& throughSet =
               *builder->getBinding(stencil.getGridSet());
-          
-          map<unsigned, vector<unsigned>> pathNeighbors;
 
-          // create neighbor lists
           const simit::Set& sourceSet =
               *builder->getBinding(link->getVertexSet(0));
           simit_iassert(sourceSet.getName() ==
                   builder->getBinding(link->getVertexSet(1))->getName());
-          for (auto &v : sourceSet) {
-            pathNeighbors.insert({v.getIdent(), vector<unsigned>()});
-            for (auto &kv : stencil.getLayoutReversed()) {
+
+          // Stencil neighbors are kept in stencil order
+          const auto& layout = stencil.getLayoutReversed();
+          pi = buildRows(sourceSet.getSize(),
+                         [&](unsigned v, vector<unsigned>* nbrs) {
+            vector<int> coords;
+            for (int dimSize : throughSet.getDimensions()) {
+              coords.push_back(v % dimSize);
+              v /= dimSize;
+            }
+            for (auto &kv : layout) {
               const vector<int> &offsets = kv.second;
-              vector<int> base = throughSet.getGridPointCoords(v);
+              vector<int> base = coords;
               simit_iassert(offsets.size() == base.size());
               for (unsigned i = 0; i < base.size(); ++i) {
                 base[i] += offsets[i] + throughSet.getDimensions()[i];
                 base[i] = base[i] % throughSet.getDimensions()[i];
               }
-              pathNeighbors.at(v.getIdent()).push_back(
-                  throughSet.getGridPoint(base).getIdent());
+              nbrs->push_back(throughSet.getGridPoint(base).getIdent());
             }
+          });
+          break;
+        }
+        default: simit_unreachable;
+      }
+    }
+
+    void updateLink(const Link *link) {
+      if (link->getType() == Link::vv) {
+        // Grid sets do not change structure after they are created
+        return;
+      }
+
+      const simit::Set* edgeSet = builder->getBinding(link->getEdgeSet());
+      const simit::Set* vertexSet = builder->getBinding(link->getVertexSet());
+      const int cardinality = edgeSet->getCardinality();
+      simit_iassert(cardinality > 0) << "not an edge set" << edgeSet->getName();
+
+      // Removing vertices renumbers them, which changes every row with a
+      // moved vertex in it, so we only update indices when vertices are added
+      vector<simit::Set::Change> edgeChanges, vertexChanges;
+      if (!getChanges(edgeSet, &edgeChanges) ||
+          !getChanges(vertexSet, &vertexChanges)) {
+        return;
+      }
+      for (const simit::Set::Change& change : vertexChanges) {
+        if (change.kind != simit::Set::Change::Add) {
+          return;
+        }
+      }
+
+      vector<bool> isVertexEndpoint(cardinality);
+      for (int i=0; i < cardinality; ++i) {
+        isVertexEndpoint[i] = (vertexSet == edgeSet->getEndpointSet(i));
+      }
+
+      switch (link->getType()) {
+        case Link::ev: {
+          // The rows of added, removed and moved edges changed
+          for (const simit::Set::Change& change : edgeChanges) {
+            dirtyRows.push_back(change.element);
           }
-          pi = pack(pathNeighbors, false);
+          const int* endpoints = edgeSet->getEndpointsData();
+          pi = updateRows(oldIndex, &dirtyRows, edgeSet->getSize(),
+                          [&](unsigned e, vector<unsigned>* nbrs) {
+            for (int i=0; i < cardinality; ++i) {
+              if (isVertexEndpoint[i]) {
+                nbrs->push_back(endpoints[e*cardinality+i]);
+              }
+            }
+          });
+          break;
+        }
+        case Link::ve: {
+          // The rows of the endpoints of added, removed and moved edges
+          // changed, and are updated by replaying the changes that touch them
+          map<unsigned,vector<const simit::Set::Change*>> vertexEdgeChanges;
+          for (const simit::Set::Change& change : edgeChanges) {
+            for (int i=0; i < cardinality; ++i) {
+              if (isVertexEndpoint[i]) {
+                auto& changes = vertexEdgeChanges[change.endpoints[i]];
+                if (changes.empty() || changes.back() != &change) {
+                  changes.push_back(&change);
+                }
+              }
+            }
+          }
+          for (auto& vertexChanges : vertexEdgeChanges) {
+            dirtyRows.push_back(vertexChanges.first);
+          }
+
+          const SegmentedPathIndex* old = to<SegmentedPathIndex>(oldIndex);
+          pi = updateRows(oldIndex, &dirtyRows, vertexSet->getSize(),
+                          [&](unsigned v, vector<unsigned>* nbrs) {
+            if (v < old->numElements()) {
+              appendRow(old, v, nbrs);
+            }
+            if (!util::contains(vertexEdgeChanges, v)) {
+              return;
+            }
+            for (const simit::Set::Change* change : vertexEdgeChanges.at(v)) {
+              if (change->kind != simit::Set::Change::Add) {
+                int removed = (change->kind == simit::Set::Change::Remove)
+                              ? change->element : change->from;
+                nbrs->erase(remove(nbrs->begin(), nbrs->end(), removed),
+                            nbrs->end());
+              }
+              if (change->kind != simit::Set::Change::Remove) {
+                for (int i=0; i < cardinality; ++i) {
+                  if (isVertexEndpoint[i] && change->endpoints[i] == (int)v) {
+                    nbrs->push_back(change->element);
+                  }
+                }
+              }
+            }
+            sort(nbrs->begin(), nbrs->end());
+          });
           break;
         }
         default: simit_unreachable;
       }
     }
 
+    /// Retrieve the changes to `set` since the old index was built.
+    bool getChanges(const simit::Set *set,
+                    vector<simit::Set::Change> *changes) const {
+      return util::contains(oldVersions, set) &&
+             set->getChangesSince(oldVersions.at(set), changes);
+    }
+
+    /// Retrieve the rows of the i'th operand index that changed since the old
+    /// index was built. Returns false if the operand was rebuilt, or was
+    /// updated from other versions of the sets than the old index.
+    bool getOperandDirtyRows(size_t i, vector<unsigned> *rows) const {
+      simit_iassert(i < operands.size());
+      const VersionedPathIndex& operand = builder->versions.at(operands[i]);
+      vector<const simit::Set*> sets = builder->getBoundSets(operands[i].first);
+
+      bool unchanged = true;
+      bool updatedFromOld = !operand.updatedFrom.empty();
+      for (size_t j=0; j < sets.size(); ++j) {
+        if (sets[j] == nullptr) {
+          continue;
+        }
+        uint64_t oldVersion = util::contains(oldVersions, sets[j])
+                              ? oldVersions.at(sets[j]) : 0;
+        unchanged &= (operand.versions[j] == oldVersion);
+        updatedFromOld = updatedFromOld &&
+                         operand.updatedFrom[j] == oldVersion;
+      }
+      if (unchanged) {
+        return true;
+      }
+      if (!updatedFromOld) {
+        return false;
+      }
+      rows->insert(rows->end(), operand.updatedRows.begin(),
+                   operand.updatedRows.end());
+      return true;
+    }
+
     static VarToLocationsMap
     getVarToLocationsMap(const vector<PathExpression>& pexprs) {
       VarToLocationsMap varToLocationsMap;
@@ -328,8 +651,9 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
           << "source variable is not in the path expression";
       simit_iassert(util::contains(locs, sink))
           << "sink variable is not in the path expression";
-      return builder->buildSegmented(locs.at(source)[0].pathExpr,
-                                     locs.at(source)[0].endpoint);
+      const Location& loc = locs.at(source)[0];
+      operands.push_back({loc.pathExpr, loc.endpoint});
+      return builder->buildSegmented(loc.pathExpr, loc.endpoint);
     }
 
     tuple<PathIndex,PathIndex> buildIndices(const PathExpression &lhs,
@@ -344,12 +668,14 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
           << "quantified binary expr only uses quantified variable once";
 
       Location sourceLoc = varToLocations[source][0];
+      operands.push_back({sourceLoc.pathExpr, sourceLoc.endpoint});
       PathIndex sourceToQuantified =
           builder->buildSegmented(sourceLoc.pathExpr, sourceLoc.endpoint);
       PathIndex sourceToQuantified2, quantifiedToSink2;
 
       Location sinkLoc = varToLocations[sink][0];
       unsigned quantifiedLoc = ((sinkLoc.endpoint) == 0) ? 1 : 0;
+      operands.push_back({sinkLoc.pathExpr, quantifiedLoc});
       PathIndex quantifiedToSink =
           builder->buildSegmented(sinkLoc.pathExpr, quantifiedLoc);
 
@@ -364,30 +690,46 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
       PathExpression lhs = f->getLhs();
       PathExpression rhs = f->getRhs();
 
-      map<unsigned, set<unsigned>> pathNeighbors;
       if (!f->isQuantified()) {
         // Build indices from first to second free variable through lhs and rhs
-        PathIndex lhsIndex = buildIndex(lhs, freeVars[0], freeVars[1]);
-        PathIndex rhsIndex = buildIndex(rhs, freeVars[0], freeVars[1]);
-
-        // Build a path index that is the intersection of lhsIndex and rhsIndex.
-        // OPT: If path indices supported efficient lookups we could instead:
-        //      for each (elem,nbr) pair in lhs, if it exist in rhs then emit.
-        map<unsigned, set<unsigned>> lhsPathNeighbors;
-        for (unsigned elem : lhsIndex) {
-          lhsPathNeighbors.insert({elem, set<unsigned>()});
-          for (unsigned nbr : lhsIndex.neighbors(elem)) {
-            lhsPathNeighbors.at(elem).insert(nbr);
-          }
-        }
-        for (unsigned elem : rhsIndex) {
-          pathNeighbors.insert({elem, set<unsigned>()});
-          for (unsigned nbr : rhsIndex.neighbors(elem)) {
-            auto &elemNbrs = lhsPathNeighbors.at(elem);
-            if (elemNbrs.find(nbr) != elemNbrs.end()) {
-              pathNeighbors.at(elem).insert(nbr);
+        const SegmentedPathIndex* lhsIndex =
+            to<SegmentedPathIndex>(buildIndex(lhs, freeVars[0], freeVars[1]));
+        const SegmentedPathIndex* rhsIndex =
+            to<SegmentedPathIndex>(buildIndex(rhs, freeVars[0], freeVars[1]));
+        simit_iassert(lhsIndex->numElements() == rhsIndex->numElements());
+
+        // Build a path index that is the intersection of lhsIndex and rhsIndex,
+        // by merging their sorted neighbors in place.
+        auto intersection = [&](unsigned elem, vector<unsigned>* nbrs) {
+          appendRow(lhsIndex, elem, nbrs);
+          sortUnique(nbrs);
+          size_t lhsEnd = nbrs->size();
+          appendRow(rhsIndex, elem, nbrs);
+          sortUnique(nbrs, lhsEnd);
+
+          size_t numCommon = 0;
+          for (size_t i=0, j=lhsEnd; i < lhsEnd && j < nbrs->size();) {
+            if ((*nbrs)[i] < (*nbrs)[j]) {
+              ++i;
+            }
+            else if ((*nbrs)[j] < (*nbrs)[i]) {
+              ++j;
+            }
+            else {
+              (*nbrs)[numCommon++] = (*nbrs)[i];
+              ++i;
+              ++j;
             }
           }
+          nbrs->resize(numCommon);
+        };
+        if (!oldIndex.defined()) {
+          pi = buildRows(rhsIndex->numElements(), intersection);
+        }
+        else if (getOperandDirtyRows(0, &dirtyRows) &&
+                 getOperandDirtyRows(1, &dirtyRows)) {
+          pi = updateRows(oldIndex, &dirtyRows, rhsIndex->numElements(),
+                          intersection);
         }
       }
       else {
@@ -407,25 +749,47 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
 
         tie(sourceToQuantified, quantifiedToSink) =
             buildIndices(lhs, rhs, freeVars[0], qvar.getVar(), freeVars[1]);
+        const SegmentedPathIndex* sourceToQuantifiedIndex =
+            to<SegmentedPathIndex>(sourceToQuantified);
+        const SegmentedPathIndex* quantifiedToSinkIndex =
+            to<SegmentedPathIndex>(quantifiedToSink);
 
         // Build a path index from the first free variable to the second free
         // variable, through the quantified variable.
-        for (unsigned source : sourceToQuantified) {
-          pathNeighbors.insert({source, set<unsigned>()});
-          for (unsigned q : sourceToQuantified.neighbors(source)) {
-            for (unsigned sink : quantifiedToSink.neighbors(q)) {
-              pathNeighbors.at(source).insert(sink);
+        const unsigned* coords = sourceToQuantifiedIndex->getCoordData();
+        const unsigned* sinks = sourceToQuantifiedIndex->getSinkData();
+        auto join = [&](unsigned source, vector<unsigned>* nbrs) {
+          for (unsigned i=coords[source]; i < coords[source+1]; ++i) {
+            appendRow(quantifiedToSinkIndex, sinks[i], nbrs);
+          }
+          sortUnique(nbrs);
+        };
+
+        size_t numSources = sourceToQuantifiedIndex->numElements();
+        vector<unsigned> quantifiedDirtyRows;
+        if (!oldIndex.defined()) {
+          pi = buildRows(numSources, join);
+        }
+        else if (getOperandDirtyRows(0, &dirtyRows) &&
+                 getOperandDirtyRows(1, &quantifiedDirtyRows)) {
+          // Sources that reach a changed quantified element changed as well
+          if (!quantifiedDirtyRows.empty()) {
+            vector<bool> isDirty(quantifiedToSinkIndex->numElements());
+            for (unsigned q : quantifiedDirtyRows) {
+              isDirty[q] = true;
+            }
+            for (unsigned source=0; source < numSources; ++source) {
+              for (unsigned i=coords[source]; i < coords[source+1]; ++i) {
+                if (isDirty[sinks[i]]) {
+                  dirtyRows.push_back(source);
+                  break;
+                }
+              }
             }
           }
+          pi = updateRows(oldIndex, &dirtyRows, numSources, join);
         }
       }
-      // Convert path neighbors to vector values
-      map<unsigned, vector<unsigned>> pathNeighborsVec;
-      for (auto &kv : pathNeighbors) {
-        pathNeighborsVec[kv.first] =
-            vector<unsigned>(kv.second.begin(), kv.second.end());
-      }
-      pi = pack(pathNeighborsVec);
     }
 
     void visit(const Or *f) {
@@ -436,24 +800,27 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
       PathExpression lhs = f->getLhs();
       PathExpression rhs = f->getRhs();
 
-      map<unsigned, set<unsigned>> pathNeighbors;
       if (!f->isQuantified()) {
         // Build indices from first to second free variable through lhs and rhs
-        PathIndex lhsIndex = buildIndex(lhs, freeVars[0], freeVars[1]);
-        PathIndex rhsIndex = buildIndex(rhs, freeVars[0], freeVars[1]);
+        const SegmentedPathIndex* lhsIndex =
+            to<SegmentedPathIndex>(buildIndex(lhs, freeVars[0], freeVars[1]));
+        const SegmentedPathIndex* rhsIndex =
+            to<SegmentedPathIndex>(buildIndex(rhs, freeVars[0], freeVars[1]));
+        simit_iassert(lhsIndex->numElements() == rhsIndex->numElements());
 
         // Build a path index that is the union of lhsIndex and rhsIndex
-        for (unsigned elem : lhsIndex) {
-          pathNeighbors.insert({elem, set<unsigned>()});
-          for (unsigned nbr : lhsIndex.neighbors(elem)) {
-            pathNeighbors.at(elem).insert(nbr);
-          }
+        auto setUnion = [&](unsigned elem, vector<unsigned>* nbrs) {
+          appendRow(lhsIndex, elem, nbrs);
+          appendRow(rhsIndex, elem, nbrs);
+          sortUnique(nbrs);
+        };
+        if (!oldIndex.defined()) {
+          pi = buildRows(lhsIndex->numElements(), setUnion);
         }
-        for (unsigned elem : rhsIndex) {
-          simit_iassert(pathNeighbors.find(elem) != pathNeighbors.end());
-          for (unsigned nbr : rhsIndex.neighbors(elem)) {
-            pathNeighbors.at(elem).insert(nbr);
-          }
+        else if (getOperandDirtyRows(0, &dirtyRows) &&
+                 getOperandDirtyRows(1, &dirtyRows)) {
+          pi = updateRows(oldIndex, &dirtyRows, lhsIndex->numElements(),
+                          setUnion);
         }
       }
       else {
@@ -478,41 +845,51 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
         tie(sourceToQuantified, quantifiedToSink) =
             buildIndices(lhs, rhs, freeVars[0], qvar.getVar(), freeVars[1]);
 
+        // Every row depends on every quantified element, so the index is
+        // rebuilt rather than updated
+        if (oldIndex.defined()) {
+          return;
+        }
+        const SegmentedPathIndex* sourceToQuantifiedIndex =
+            to<SegmentedPathIndex>(sourceToQuantified);
+        const SegmentedPathIndex* quantifiedToSinkIndex =
+            to<SegmentedPathIndex>(quantifiedToSink);
+
         // Build a path index that from the first free variable to the
         // quantified variable. Every free variable that can reach any
         // quantified variable gets links to every element of the second
         // variable. Vice versa for the second variable, but jump from the
-        // quantified var.
-        auto sinkSet = builder->getBinding(f->getSet(freeVars[1]));
+        // quantified var, so every source links to every sink that any
+        // quantified var reaches.
+        const unsigned* sinks = quantifiedToSinkIndex->getSinkData();
+        size_t numQuantifiedNeighbors = quantifiedToSinkIndex->numNeighbors();
+        vector<unsigned> reachedSinks(sinks, sinks+numQuantifiedNeighbors);
+        sortUnique(&reachedSinks);
 
-        for (unsigned source : sourceToQuantified) {
-          pathNeighbors.insert({source, set<unsigned>()});
-          if (sourceToQuantified.numNeighbors(source) > 0) {
-            for (auto &sinkElem : *sinkSet) {
-              unsigned sink = sinkElem.getIdent();
-              pathNeighbors.at(source).insert(sink);
+        auto sinkSet = builder->getBinding(f->getSet(freeVars[1]));
+        unsigned numSinks = sinkSet->getSize();
+        pi = buildRows(sourceToQuantifiedIndex->numElements(),
+                       [&](unsigned source, vector<unsigned>* nbrs) {
+          if (sourceToQuantifiedIndex->numNeighbors(source) > 0) {
+            for (unsigned sink=0; sink < numSinks; ++sink) {
+              nbrs->push_back(sink);
             }
           }
-        }
-
-        for (unsigned quantified : quantifiedToSink) {
-          for (unsigned sink: quantifiedToSink.neighbors(quantified)) {
-            for (unsigned source : sourceToQuantified) {
-              pathNeighbors.at(source).insert(sink);
-            }
+          else {
+            nbrs->insert(nbrs->end(), reachedSinks.begin(), reachedSinks.end());
           }
-        }
-      }
-      // Convert path neighbors to vector values
-      map<unsigned, vector<unsigned>> pathNeighborsVec;
-      for (auto &kv : pathNeighbors) {
-        pathNeighborsVec[kv.first] =
-            vector<unsigned>(kv.second.begin(), kv.second.end());
+        });
       }
-      pi = pack(pathNeighborsVec);
     }
 
     PathIndex pi;  // Path index returned from cases
+
+    // When updating, the index built over `oldVersions` of the sets, the rows
+    // that changed since, and the (expression, endpoint) of operand indices
+    PathIndex oldIndex;
+    map<const simit::Set*,uint64_t> oldVersions;
+    vector<unsigned> dirtyRows;
+    vector<pair<PathExpression,unsigned>> operands;
     PathIndexBuilder *builder;
   };
 
@@ -525,9 +902,116 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
     return pathIndices.at({pe,sourceEndpoint});
   }
 
-  PathIndex pi = PathNeighborVisitor(this).build(pe);
-  pathIndices.insert({{pe,sourceEndpoint}, pi});
-  return pi;
+  // Check if another builder has built it over the same sets. If they changed
+  // since, then update the rows the changes affect instead of rebuilding it.
+  PathIndexCache& cache = PathIndexCache::getInstance();
+  vector<const simit::Set*> sets = getBoundSets(pe);
+  vector<uint64_t> currentVersions;
+  for (const simit::Set* set : sets) {
+    currentVersions.push_back((set != nullptr) ? set->getVersion() : 0);
+  }
+
+  VersionedPathIndex vpi;
+  if (cache.get(pe, sourceEndpoint, sets, &vpi) &&
+      vpi.versions != currentVersions) {
+    map<const simit::Set*,uint64_t> oldVersions;
+    for (size_t i=0; i < sets.size(); ++i) {
+      if (sets[i] != nullptr) {
+        oldVersions[sets[i]] = vpi.versions[i];
+      }
+    }
+    vpi.updatedFrom = vpi.versions;
+    vpi.versions = currentVersions;
+    vpi.pathIndex = PathNeighborVisitor(this, vpi.pathIndex, oldVersions)
+        .update(pe, &vpi.updatedRows);
+    if (vpi.pathIndex.defined()) {
+      cache.insert(pe, sourceEndpoint, sets, vpi);
+    }
+  }
+  if (!vpi.pathIndex.defined()) {
+    vpi = VersionedPathIndex();
+    vpi.pathIndex = PathNeighborVisitor(this).build(pe);
+    vpi.versions = currentVersions;
+    cache.insert(pe, sourceEndpoint, sets, vpi);
+  }
+  versions[{pe,sourceEndpoint}] = vpi;
+  pathIndices.insert({{pe,sourceEndpoint}, vpi.pathIndex});
+  return vpi.pathIndex;
+}
+
+vector<const simit::Set*>
+PathIndexBuilder::getBoundSets(const PathExpression &pe) const {
+  class GetSetNames : public PathExpressionVisitor {
+  public:
+    vector<string> names;
+
+    void visit(const Link *link) {
+      if (link->getType() == Link::vv) {
+        names.push_back(link->getVertexSet(0).getName());
+        names.push_back(link->getVertexSet(1).getName());
+        names.push_back(link->getStencil().getGridSet().getName());
+      }
+      else {
+        names.push_back(link->getVertexSet().getName());
+        names.push_back(link->getEdgeSet().getName());
+      }
+    }
+  };
+  GetSetNames getSetNames;
+  pe.accept(&getSetNames);
+
+  vector<const simit::Set*> sets;
+  for (const string& name : getSetNames.names) {
+    sets.push_back(util::contains(bindings, name) ? bindings.at(name)
+                                                  : nullptr);
+  }
+  return sets;
+}
+
+std::vector<int> PathIndexBuilder::buildLocationTable(const PathIndex &pi,
+                                                      const simit::Set &edgeSet){
+  const int cardinality = edgeSet.getCardinality();
+  if (!isa<SegmentedPathIndex>(pi) || cardinality == 0 ||
+      !edgeSet.isHomogeneous()) {
+    return vector<int>();
+  }
+
+  // Fall back to searching the index when the table would be too large
+  int64_t tableSize = (int64_t)edgeSet.getSize() * cardinality * cardinality;
+  if (tableSize > (int64_t)maxLocationTableRatio * pi.numNeighbors() ||
+      tableSize > numeric_limits<int>::max()) {
+    return vector<int>();
+  }
+
+  const SegmentedPathIndex* spi = to<SegmentedPathIndex>(pi);
+  const unsigned* coords = spi->getCoordData();
+  const unsigned* sinks = spi->getSinkData();
+  const int* endpoints = edgeSet.getEndpointsData();
+
+  vector<int> table(tableSize);
+  for (int e=0; e < edgeSet.getSize(); ++e) {
+    const int* eps = &endpoints[e*cardinality];
+    int* locs = &table[(int64_t)e*cardinality*cardinality];
+    for (int i=0; i < cardinality; ++i) {
+      if ((unsigned)eps[i] >= spi->numElements()) {
+        return vector<int>();
+      }
+      const unsigned* rowBegin = &sinks[coords[eps[i]]];
+      const unsigned* rowEnd = &sinks[coords[eps[i]+1]];
+      for (int j=0; j < cardinality; ++j) {
+        // Neighbor lists are sorted, except for ev and stencil indices
+        const unsigned* loc = lower_bound(rowBegin, rowEnd, (unsigned)eps[j]);
+        if (loc == rowEnd || *loc != (unsigned)eps[j]) {
+          loc = find(rowBegin, rowEnd, (unsigned)eps[j]);
+          if (loc == rowEnd) {
+            return vector<int>();
+          }
+        }
+        locs[i*cardinality + j] = loc - sinks;
+      }
+    }
+  }
+  return table;
 }
 
 void PathIndexBuilder::bind(std::string name, const simit::Set* set) {
@@ -544,4 +1028,9 @@ const simit::Set* PathIndexBuilder::getBinding(ir::Var var) const {
   return bindings.at(var.getName());
 }
 
+bool PathIndexBuilder::isBound(ir::Var var) const {
+  simit_iassert(var.defined());
+  return util::contains(bindings, var.getName());
+}
+
 }}
@@ -4,7 +4,10 @@
 #include <ostream>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <tuple>
 #include <typeinfo>
+#include <vector>
 
 #include "graph.h"
 #include "path_expressions.h"
@@ -107,7 +110,7 @@ public:
   virtual Neighbors neighbors(unsigned elemID) const = 0;
 
 private:
-  mutable long ref = 0;
+  mutable std::atomic<long> ref{0};
   friend inline void aquire(PathIndexImpl *p) {++p->ref;}
   friend inline void release(PathIndexImpl *p) {if (--p->ref==0) delete p;}
 };
@@ -224,6 +227,58 @@ inline const PI* to(PathIndex pi) {
 }
 
 
+/// A path index and the versions of the sets it was built over. If the index
+/// was updated from an index over earlier versions of the sets, rather than
+/// built from scratch, then those versions are in `updatedFrom` and the rows
+/// that changed are in `updatedRows`.
+struct VersionedPathIndex {
+  PathIndex pathIndex;
+  std::vector<uint64_t> versions;
+  std::vector<uint64_t> updatedFrom;
+  std::vector<unsigned> updatedRows;
+};
+
+/// A process-wide cache of path indices that is shared by all path index
+/// builders, so that functions compiled over the same sets share indices. An
+/// index is cached by its path expression, source endpoint and the sets bound
+/// to the path expression's sets, together with the structural versions of
+/// those sets when it was built (see simit::Set::getVersion). Sets evict the
+/// indices built over them when they are destroyed.
+class PathIndexCache {
+public:
+  static PathIndexCache& getInstance();
+
+  /// Retrieve the cached index of `pe` over `sets`. Returns false if it is not
+  /// cached.
+  bool get(const PathExpression &pe, unsigned sourceEndpoint,
+           const std::vector<const simit::Set*> &sets,
+           VersionedPathIndex *pi) const;
+
+  /// Cache the index of `pe` over `sets`, replacing any index built over
+  /// earlier versions of the sets.
+  void insert(const PathExpression &pe, unsigned sourceEndpoint,
+              const std::vector<const simit::Set*> &sets,
+              const VersionedPathIndex &pi);
+
+  /// Remove the cached path indices over `set`.
+  void evict(const simit::Set* set);
+
+  /// Remove all cached path indices.
+  void clear();
+
+  /// Return the number of cached path indices.
+  size_t size() const;
+
+private:
+  typedef std::tuple<PathExpression,unsigned,std::vector<const simit::Set*>>
+      Key;
+
+  std::map<Key, VersionedPathIndex> entries;
+  mutable std::mutex mutex;
+
+  PathIndexCache() {}
+};
+
 /// A builder that builds path indices by evaluating path expressions on graphs.
 /// The builder memoizes previously computed path indices, and uses these to
 /// accelerate subsequent path index construction (since path expressions can be
@@ -235,9 +290,29 @@ public:
       : bindings(bindings) {}
 
   // Build a Segmented path index by evaluating the `pe` over the given graph.
+  // Indices of path expressions over sets that are unchanged since they were
+  // last built, by this or another builder, are retrieved from PathIndexCache.
+  // If the sets were changed by adding or removing elements, then the cached
+  // index is rebuilt by recomputing only the rows the changes affect and
+  // copying the others, so a rebuild is linear in the size of the index but
+  // evaluates the path expression only for the changed rows.
   PathIndex buildSegmented(const PathExpression &pe, unsigned sourceEndpoint);
 
+  /// Build a table with the location in `pi` of every pair of endpoints of
+  /// every edge in `edgeSet`, such that the location of `(eps[i],eps[j])` of
+  /// edge `e` is at `e*cardinality*cardinality + i*cardinality + j`. Returns an
+  /// empty table if the edge set is heterogeneous, if some endpoint pair is not
+  /// in `pi`, or if the table would have more than `maxLocationTableRatio`
+  /// times as many locations as `pi` has neighbors.
+  std::vector<int> buildLocationTable(const PathIndex &pi,
+                                      const simit::Set &edgeSet);
+
+  /// The largest ratio of location table size to path index size that we build
+  /// location tables for
+  static const int maxLocationTableRatio = 16;
+
   void bind(std::string name, const simit::Set* set);
+  bool isBound(ir::Var var) const;
 
   const simit::Set* getBinding(pe::Set pset) const;
   const simit::Set* getBinding(ir::Var var) const;
@@ -245,6 +320,26 @@ public:
 private:
   std::map<std::pair<PathExpression,unsigned>, PathIndex> pathIndices;
   std::map<std::string, const simit::Set*> bindings;
+
+  /// The versions of the path indices built by this builder, which tell
+  /// whether indices built from them can be updated.
+  std::map<std::pair<PathExpression,unsigned>, VersionedPathIndex> versions;
+
+  /// Build a segmented path index over `numElements` elements, where
+  /// `getRow(elem, &nbrs)` appends the neighbors of `elem` to `nbrs`.
+  template <typename RowFunc>
+  static PathIndex buildRows(size_t numElements, const RowFunc& getRow);
+
+  /// Update `oldIndex` to `numElements` elements, by rebuilding the rows in
+  /// `dirtyRows` and elements added since with `getRow`, and copying the
+  /// others. On return `dirtyRows` holds the sorted rows that were rebuilt.
+  template <typename RowFunc>
+  static PathIndex updateRows(const PathIndex& oldIndex,
+                              std::vector<unsigned>* dirtyRows,
+                              size_t numElements, const RowFunc& getRow);
+
+  /// Return the sets bound to the sets of `pe`, in the order `pe` uses them.
+  std::vector<const simit::Set*> getBoundSets(const PathExpression &pe) const;
 };
 
 }}
@@ -1,9 +1,14 @@
 #include "program.h"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <set>
+#include <thread>
 #include <vector>
 
 #include "ir.h"
+#include "intrinsics.h"
 #include "frontend/frontend.h"
 #include "util/util.h"
 #include "error.h"
@@ -11,6 +16,7 @@
 #include "storage.h"
 #include "lower/lower.h"
 #include "timers.h"
+#include "compile_profile.h"
 
 #include "backend/backend.h"
 
@@ -20,6 +26,7 @@ namespace simit {
 
 const std::vector<std::string> VALID_BACKENDS = {
   "cpu",
+  "cpu-parallel",
 #ifdef GPU
   "gpu",
 #endif
@@ -28,12 +35,18 @@ std::string kBackend;
 
 static
 Function compile(ir::Func func, backend::Backend *backend, bool addTimers) {
+  std::shared_ptr<CompileProfile> profile;
+  if (kProfileCompilation) {
+    profile.reset(new CompileProfile(func.getName()));
+  }
+  CompileProfileScope profileScope(profile.get());
+
   ir::Storage storage;
   // Fill in storage path expressions, etc.
   /// map<Var,pe::PathExpressions> pes = assignPathExpressions(func);
   /// storage.addPathExpressions(pes);
   func = lower(func, nullptr, addTimers);
-  return Function(backend->compile(func, storage));
+  return Function(backend->compile(func, storage), profile);
 }
 
 static Function compile(ir::Func func, backend::Backend *backend) {
@@ -114,6 +127,59 @@ Function Program::compileWithTimers(const std::string &function) {
   return simit::compile(simitFunc, content->backend, true);
 }
 
+std::vector<Function>
+Program::compileAll(const std::vector<std::string> &functions) {
+  vector<ir::Func> simitFuncs;
+  for (const string &function : functions) {
+    ir::Func simitFunc = content->ctx.getFunction(function);
+    simit_uassert(simitFunc.defined())
+        << "Attempting to compile an unknown function "
+        << "(" << function << ")";
+    simitFuncs.push_back(simitFunc);
+  }
+
+  // The intrinsics are created on first use, so create them before the
+  // compiler threads look them up
+  ir::intrinsics::byNames();
+
+  vector<Function> compiled(simitFuncs.size());
+  vector<std::exception_ptr> errors(simitFuncs.size());
+  std::atomic<size_t> next(0);
+  auto compileFuncs = [&]() {
+    // Backends hold the state of the function they compile, so each thread
+    // needs its own
+    backend::Backend backend(kBackend);
+    for (size_t i = next++; i < simitFuncs.size(); i = next++) {
+      try {
+        compiled[i] = simit::compile(simitFuncs[i], &backend);
+      }
+      catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }
+  };
+
+  // The GPU backend generates code in the process-wide LLVM context
+  size_t numThreads = (kBackend == "gpu")
+      ? 1 : std::max(1u, std::thread::hardware_concurrency());
+  numThreads = std::min(numThreads, simitFuncs.size());
+  vector<std::thread> threads;
+  for (size_t i = 1; i < numThreads; ++i) {
+    threads.push_back(std::thread(compileFuncs));
+  }
+  compileFuncs();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  for (const std::exception_ptr &error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  return compiled;
+}
+
 int Program::verify() {
   // For each test look up the called function. Grab the actual arguments and
   // run the function with them as input.  Then compare the result to the
@@ -48,6 +48,11 @@ public:
   Function compile(const std::string &function);
   Function compileWithTimers(const std::string &function);
 
+  /// Compile the given functions concurrently, on up to one thread per
+  /// hardware thread, and return them in the same order. The first error that
+  /// occurs is rethrown once all compilations have finished.
+  std::vector<Function> compileAll(const std::vector<std::string> &functions);
+
   /// Verify the program by executing in-code comment tests.
   int verify();
 
@@ -90,12 +90,15 @@ namespace simit {
       
       auto& fields = vertexSet.getFields();
       int fieldIndex = vertexSet.getFieldIndex(vertexSet.getSpatialFieldName());
-      double * spatialData = static_cast<double*>(fields[fieldIndex]->data);  
+      const Set::FieldData* spatialField = fields[fieldIndex];
+      double * spatialData = static_cast<double*>(spatialField->data);  
+      const int blockSize = spatialField->blockSize;
      
       for (int i = 0; i < numNodes; ++i) {
-        nodes[i].id = i; nodes[i].x = spatialData[i*3+0];
-        nodes[i].y = spatialData[i*3+1];
-        nodes[i].z = spatialData[i*3+2];
+        const double* coords = &spatialData[spatialField->getOffset(i)];
+        nodes[i].id = i; nodes[i].x = coords[0*blockSize];
+        nodes[i].y = coords[1*blockSize];
+        nodes[i].z = coords[2*blockSize];
       }
       
       *outNodes = nodes;
@@ -171,32 +174,32 @@ namespace simit {
       switch (f->type->getComponentType()) {
         case ComponentType::Float: {
           float* data = static_cast<float *>(f->data);
-          reorderFieldData(data, ordering, f->sizeOfType);
+          reorderFieldData(data, ordering, f->sizeOfType, f->blockSize);
           break;
         }
         case ComponentType::Double: {
           double* data = static_cast<double *>(f->data);
-          reorderFieldData(data, ordering, f->sizeOfType);
+          reorderFieldData(data, ordering, f->sizeOfType, f->blockSize);
           break;
         }
         case ComponentType::Int: {
           int* data = static_cast<int *>(f->data);
-          reorderFieldData(data, ordering, f->sizeOfType);
+          reorderFieldData(data, ordering, f->sizeOfType, f->blockSize);
           break;
         }
         case ComponentType::Boolean: {
           bool* data = static_cast<bool *>(f->data);
-          reorderFieldData(data, ordering, f->sizeOfType);
+          reorderFieldData(data, ordering, f->sizeOfType, f->blockSize);
           break;
         }
         case ComponentType::DoubleComplex: {
           double_complex* data = static_cast<double_complex *>(f->data);
-          reorderFieldData(data, ordering, f->sizeOfType);
+          reorderFieldData(data, ordering, f->sizeOfType, f->blockSize);
           break;
         }
         case ComponentType::FloatComplex: {
           float_complex* data = static_cast<float_complex *>(f->data);
-          reorderFieldData(data, ordering, f->sizeOfType);
+          reorderFieldData(data, ordering, f->sizeOfType, f->blockSize);
           break;
         }
       }
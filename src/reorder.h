@@ -32,21 +32,30 @@ namespace simit {
       vertexOrdering);
 
  
+  /// Reorders field data stored in blocks of `blockSize` elements (see
+  /// Set::FieldData::blockSize).
   template<typename T>
   void reorderFieldData(T* data, const std::vector<int>& vertexOrdering, const 
-      int typeSize) {
-    const int capacity = vertexOrdering.size(); T* newData = 
-      static_cast<T*>(malloc(capacity * typeSize));
+      int typeSize, const int blockSize=1) {
+    const int capacity = vertexOrdering.size();
+    const int blocks = (capacity + blockSize-1) / blockSize;
+    const size_t dataSize = (size_t)blocks * blockSize * typeSize;
+    T* newData = static_cast<T*>(malloc(dataSize));
+    memcpy(newData, data, dataSize);
     int dim = typeSize/sizeof(T);
     assert(dim > 0);
+    auto offset = [=](int elem) {
+      return (elem/blockSize)*blockSize*dim + elem%blockSize;
+    };
     for (int i=0; i < capacity; ++i) {
       for (int x=0; x < dim; ++x) {
-        assert(vertexOrdering[i]*dim + x < capacity * dim);
-        newData[vertexOrdering[i]*dim+x] = data[i*dim+x];
+        assert(vertexOrdering[i] < capacity);
+        newData[offset(vertexOrdering[i]) + x*blockSize] =
+            data[offset(i) + x*blockSize];
       }
     }
 
-    memcpy(data, newData, capacity * typeSize); free(newData);
+    memcpy(data, newData, dataSize); free(newData);
   }
 
   namespace hilbert {
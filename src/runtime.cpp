@@ -1,11 +1,23 @@
 #include "runtime.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
 #include <time.h>
 #include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 #include "timers.h"
+#include "thread_pool.h"
+#include "graph.h"
+#include "edge_coloring.h"
+#include "types.h"
 #include "stdio.h"
 
 #ifdef EIGEN
@@ -15,6 +27,109 @@
 using namespace Eigen;
 #endif
 
+namespace {
+typedef void (*ColoredKernelBody)(int,int,const int*,void*);
+typedef void (*PrivatizedKernelBody)(int,int,const int*,void*,void**);
+
+/// Returns the coloring cached on the bound set, unless the edges passed in
+/// are not the set's (e.g. the function was bound to a different set since),
+/// in which case a temporary coloring is computed into `tmpColoring`.
+const simit::internal::EdgeColoring& getColoring(
+    void* setHandle, int n, const int* endpoints, int cardinality,
+    std::unique_ptr<simit::internal::EdgeColoring>* tmpColoring) {
+  const simit::Set* set = static_cast<const simit::Set*>(setHandle);
+  if (set != nullptr && set->getSize() == n &&
+      set->getEndpointsData() == endpoints) {
+    return set->getEdgeColoring();
+  }
+  tmpColoring->reset(new simit::internal::EdgeColoring(n, cardinality,
+                                                       endpoints));
+  return **tmpColoring;
+}
+
+struct ColoredKernel {
+  ColoredKernelBody body;
+  PrivatizedKernelBody privatizedBody;
+  const int* edges;
+  void* ctx;
+  void** reductions;
+};
+
+void runColoredKernel(int begin, int end, void* kernel) {
+  ColoredKernel* k = static_cast<ColoredKernel*>(kernel);
+  if (k->body != nullptr) {
+    k->body(begin, end, k->edges, k->ctx);
+  }
+  else {
+    k->privatizedBody(begin, end, k->edges, k->ctx, k->reductions);
+  }
+}
+
+/// Runs the edges of one color at a time. Edges of one color share no
+/// endpoints, so each color runs in parallel.
+void runColored(const simit::internal::EdgeColoring& coloring,
+                ColoredKernel kernel) {
+  simit::ThreadPool& threadPool = simit::ThreadPool::getInstance();
+  for (int c=0; c < coloring.getNumColors(); ++c) {
+    kernel.edges = coloring.getEdges(c);
+    threadPool.parallelFor(coloring.getNumEdges(c), runColoredKernel, &kernel);
+  }
+}
+
+struct PrivatizedKernel {
+  PrivatizedKernelBody body;
+  int n;
+  unsigned numChunks;
+  void* ctx;
+  /// The reduction buffers of each chunk. Chunk 0 adds to the shared buffers.
+  std::vector<std::vector<void*>> reductions;
+};
+
+void runPrivatizedChunks(int begin, int end, void* kernel) {
+  PrivatizedKernel* k = static_cast<PrivatizedKernel*>(kernel);
+  for (int chunk=begin; chunk < end; ++chunk) {
+    int chunkBegin = (int)(((int64_t)k->n * chunk) / k->numChunks);
+    int chunkEnd   = (int)(((int64_t)k->n * (chunk+1)) / k->numChunks);
+    k->body(chunkBegin, chunkEnd, nullptr, k->ctx,
+            k->reductions[chunk].data());
+  }
+}
+
+template <typename T>
+struct MergeReduction {
+  T* shared;
+  std::vector<T*> copies;
+};
+
+template <typename T>
+void runMergeReduction(int begin, int end, void* merge) {
+  MergeReduction<T>* m = static_cast<MergeReduction<T>*>(merge);
+  for (T* copy : m->copies) {
+    for (int i=begin; i < end; ++i) {
+      m->shared[i] += copy[i];
+    }
+  }
+}
+
+/// Adds the private copies of a buffer to the shared buffer, splitting the
+/// buffer across threads.
+template <typename T>
+void mergeReduction(void* shared, const std::vector<void*>& copies, int len) {
+  MergeReduction<T> merge;
+  merge.shared = static_cast<T*>(shared);
+  for (void* copy : copies) {
+    merge.copies.push_back(static_cast<T*>(copy));
+  }
+  simit::ThreadPool::getInstance().parallelFor(len, runMergeReduction<T>,
+                                               &merge);
+}
+
+/// Privatization is preferred over coloring when zeroing and merging the
+/// private copies costs at most this many element operations per iteration
+/// and endpoint of the loop.
+const int kPrivatizationCostPerEndpoint = 4;
+}
+
 extern "C" {
 int loc(int v0, int v1, int *neighbors_start, int *neighbors) {
   int l = neighbors_start[v0];
@@ -22,6 +137,123 @@ int loc(int v0, int v1, int *neighbors_start, int *neighbors) {
   return l;
 }
 
+// Like loc, but binary searches neighbor lists, which are sorted for the
+// indices it is emitted for. If the search misses, the list was not sorted
+// after all, and we fall back to scanning it.
+int loc_sorted(int v0, int v1, int *neighbors_start, int *neighbors) {
+  int lo = neighbors_start[v0];
+  int hi = neighbors_start[v0+1];
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (neighbors[mid] < v1) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  if (lo < neighbors_start[v0+1] && neighbors[lo] == v1) {
+    return lo;
+  }
+  return loc(v0, v1, neighbors_start, neighbors);
+}
+
+void simit_parallel_for(int n, void (*body)(int,int,void*), void* ctx) {
+  simit::ThreadPool::getInstance().parallelFor(n, body, ctx);
+}
+
+void simit_parallel_for_colored(void* setHandle, int n, const int* endpoints,
+                                int cardinality, ColoredKernelBody body,
+                                void* ctx) {
+  if (n <= 0) {
+    return;
+  }
+  std::unique_ptr<simit::internal::EdgeColoring> tmpColoring;
+  runColored(getColoring(setHandle, n, endpoints, cardinality, &tmpColoring),
+             {body, nullptr, nullptr, ctx, nullptr});
+}
+
+void simit_parallel_for_privatized(int adaptive, void* setHandle, int n,
+                                   const int* endpoints, int cardinality,
+                                   PrivatizedKernelBody body, void* ctx,
+                                   int numReductions, void** reductions,
+                                   const int* reductionLens,
+                                   const int* componentKinds) {
+  if (n <= 0) {
+    return;
+  }
+
+  simit::ThreadPool& threadPool = simit::ThreadPool::getInstance();
+  unsigned numChunks = threadPool.getNumChunks(n);
+  if (numChunks <= 1) {
+    body(0, n, nullptr, ctx, reductions);
+    return;
+  }
+
+  // Adaptive kernels are colored when the private copies would cost more than
+  // the loop itself.
+  int64_t reductionElements = 0;
+  for (int r=0; r < numReductions; ++r) {
+    reductionElements += reductionLens[r];
+  }
+  if (adaptive && (numChunks-1) * reductionElements >
+      (int64_t)kPrivatizationCostPerEndpoint * n * cardinality) {
+    std::unique_ptr<simit::internal::EdgeColoring> tmpColoring;
+    runColored(getColoring(setHandle, n, endpoints, cardinality, &tmpColoring),
+               {nullptr, body, nullptr, ctx, reductions});
+    return;
+  }
+
+  // Every chunk but the first adds to zero-initialized copies of the
+  // reduction buffers, which are added to the shared buffers at the end.
+  PrivatizedKernel kernel;
+  kernel.body = body;
+  kernel.n = n;
+  kernel.numChunks = numChunks;
+  kernel.ctx = ctx;
+  kernel.reductions.resize(numChunks);
+  kernel.reductions[0].assign(reductions, reductions + numReductions);
+  for (unsigned chunk=1; chunk < numChunks; ++chunk) {
+    for (int r=0; r < numReductions; ++r) {
+      simit::ir::ScalarType type((simit::ir::ScalarType::Kind)componentKinds[r]);
+      kernel.reductions[chunk].push_back(calloc(reductionLens[r],
+                                                type.bytes()));
+    }
+  }
+  threadPool.parallelFor(numChunks, runPrivatizedChunks, &kernel, 1);
+
+  for (int r=0; r < numReductions; ++r) {
+    std::vector<void*> copies;
+    for (unsigned chunk=1; chunk < numChunks; ++chunk) {
+      copies.push_back(kernel.reductions[chunk][r]);
+    }
+    // Complex components are added as pairs of floats
+    int len = reductionLens[r];
+    switch ((simit::ir::ScalarType::Kind)componentKinds[r]) {
+      case simit::ir::ScalarType::Int:
+        mergeReduction<int>(reductions[r], copies, len);
+        break;
+      case simit::ir::ScalarType::Complex:
+        len *= 2;
+        // fall through
+      case simit::ir::ScalarType::Float:
+        if (simit::ir::ScalarType::singleFloat()) {
+          mergeReduction<float>(reductions[r], copies, len);
+        }
+        else {
+          mergeReduction<double>(reductions[r], copies, len);
+        }
+        break;
+      default:
+        simit_ierror << "Cannot reduce non-numeric components";
+        break;
+    }
+    for (void* copy : copies) {
+      free(copy);
+    }
+  }
+}
+
 double atan2_f64(double y, double x) {
   return atan2(y, x);
 }
@@ -307,8 +539,141 @@ double simitClock() {
 } // extern "C"
 
 
-/// Temporary external spmm implementation until Simit supports assembling
-/// matrix indices during computation.
+namespace {
+/// The block sparsity pattern of the product A = B*C of two blocked CSR
+/// matrices, together with the operand patterns it was computed from.
+struct SpGEMMPattern {
+  int Ccols;
+  std::vector<int> Browptr, Bcolidx;
+  std::vector<int> Crowptr, Ccolidx;
+  std::vector<int> Arowptr, Acolidx;
+};
+
+/// Patterns of recent products, most recently used first. Multigrid cycles
+/// multiply matrices with the same patterns over and over (e.g. R*A*P), so
+/// the symbolic phase is only run the first time.
+std::mutex spgemmCacheMutex;
+std::list<std::shared_ptr<const SpGEMMPattern>> spgemmCache;
+const size_t kSpGEMMCacheSize = 16;
+
+bool equals(const std::vector<int>& cached, const int* values, int len) {
+  return cached.size() == (size_t)len &&
+         std::equal(cached.begin(), cached.end(), values);
+}
+
+bool matches(const SpGEMMPattern& pattern,
+             int Brows, const int* Browptr, const int* Bcolidx,
+             int Crows, const int* Crowptr, const int* Ccolidx, int Ccols) {
+  return pattern.Ccols == Ccols &&
+         equals(pattern.Browptr, Browptr, Brows+1) &&
+         equals(pattern.Crowptr, Crowptr, Crows+1) &&
+         equals(pattern.Bcolidx, Bcolidx, Browptr[Brows]) &&
+         equals(pattern.Ccolidx, Ccolidx, Crowptr[Crows]);
+}
+
+/// Returns the pattern of B*C, with sorted column indices, computing it if it
+/// is not cached.
+std::shared_ptr<const SpGEMMPattern>
+getSpGEMMPattern(int Brows, const int* Browptr, const int* Bcolidx,
+                 int Crows, const int* Crowptr, const int* Ccolidx,
+                 int Ccols) {
+  std::lock_guard<std::mutex> lock(spgemmCacheMutex);
+  for (auto it = spgemmCache.begin(); it != spgemmCache.end(); ++it) {
+    if (matches(**it, Brows, Browptr, Bcolidx,
+                Crows, Crowptr, Ccolidx, Ccols)) {
+      spgemmCache.splice(spgemmCache.begin(), spgemmCache, it);
+      return spgemmCache.front();
+    }
+  }
+
+  std::shared_ptr<SpGEMMPattern> pattern(new SpGEMMPattern);
+  pattern->Ccols = Ccols;
+  pattern->Browptr.assign(Browptr, Browptr + Brows+1);
+  pattern->Bcolidx.assign(Bcolidx, Bcolidx + Browptr[Brows]);
+  pattern->Crowptr.assign(Crowptr, Crowptr + Crows+1);
+  pattern->Ccolidx.assign(Ccolidx, Ccolidx + Crowptr[Crows]);
+
+  // The columns of row i of A are the union of the columns of the rows of C
+  // that are columns of row i of B
+  std::vector<int> marker(Ccols, -1);
+  pattern->Arowptr.resize(Brows+1);
+  pattern->Arowptr[0] = 0;
+  for (int i=0; i < Brows; ++i) {
+    size_t rowStart = pattern->Acolidx.size();
+    for (int ik=Browptr[i]; ik < Browptr[i+1]; ++ik) {
+      int k = Bcolidx[ik];
+      for (int kj=Crowptr[k]; kj < Crowptr[k+1]; ++kj) {
+        int j = Ccolidx[kj];
+        if (marker[j] != i) {
+          marker[j] = i;
+          pattern->Acolidx.push_back(j);
+        }
+      }
+    }
+    std::sort(pattern->Acolidx.begin() + rowStart, pattern->Acolidx.end());
+    pattern->Arowptr[i+1] = pattern->Acolidx.size();
+  }
+
+  spgemmCache.push_front(pattern);
+  if (spgemmCache.size() > kSpGEMMCacheSize) {
+    spgemmCache.pop_back();
+  }
+  return pattern;
+}
+
+/// The numeric phase of A = B*C, where B has bn x bk blocks and C has bk x bm
+/// blocks. Blocks are stored row-major.
+template <typename Float>
+struct SpGEMM {
+  const SpGEMMPattern* pattern;
+  const int *Browptr, *Bcolidx, *Crowptr, *Ccolidx;
+  const Float *Bvals, *Cvals;
+  Float* Avals;
+  int bn, bk, bm;
+};
+
+template <typename Float>
+void runSpGEMMRows(int begin, int end, void* spgemm) {
+  const SpGEMM<Float>* k = static_cast<const SpGEMM<Float>*>(spgemm);
+  const std::vector<int>& Arowptr = k->pattern->Arowptr;
+  const std::vector<int>& Acolidx = k->pattern->Acolidx;
+  const int Bsize = k->bn * k->bk;
+  const int Csize = k->bk * k->bm;
+  const int Asize = k->bn * k->bm;
+
+  // The location in A of each column of the current row
+  std::vector<int> locs(k->pattern->Ccols);
+  for (int i=begin; i < end; ++i) {
+    for (int ij=Arowptr[i]; ij < Arowptr[i+1]; ++ij) {
+      locs[Acolidx[ij]] = ij;
+    }
+    std::fill(k->Avals + Arowptr[i]*Asize, k->Avals + Arowptr[i+1]*Asize,
+              Float(0));
+
+    for (int ik=k->Browptr[i]; ik < k->Browptr[i+1]; ++ik) {
+      const Float* Bblock = k->Bvals + ik*Bsize;
+      int kk = k->Bcolidx[ik];
+      for (int kj=k->Crowptr[kk]; kj < k->Crowptr[kk+1]; ++kj) {
+        const Float* Cblock = k->Cvals + kj*Csize;
+        Float* Ablock = k->Avals + locs[k->Ccolidx[kj]]*Asize;
+        for (int bi=0; bi < k->bn; ++bi) {
+          for (int bx=0; bx < k->bk; ++bx) {
+            Float b = Bblock[bi*k->bk + bx];
+            for (int bj=0; bj < k->bm; ++bj) {
+              Ablock[bi*k->bm + bj] += b * Cblock[bx*k->bm + bj];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+}
+
+/// External spmm implementation until Simit supports assembling matrix indices
+/// during computation. Computes A = B*C on blocked CSR matrices. The pattern
+/// of A is cached per operand pattern, so repeated products only pay for the
+/// numeric phase, which runs in parallel over the block rows of A.
 template <typename Float>
 int spmm(int Bn,  int Bm,  int* Browptr, int* Bcolidx,
          int Bnn, int Bmm, Float* Bvals,
@@ -316,16 +681,40 @@ int spmm(int Bn,  int Bm,  int* Browptr, int* Bcolidx,
          int Cnn, int Cmm, Float* Cvals,
          int An,  int Am,  int** Arowptr, int** Acolidx,
          int Ann, int Amm, Float** Avals) {
-#ifdef EIGEN
-  auto B = csr2eigen<Float,RowMajor>(Bn, Bm, Browptr, Bcolidx, Bnn, Bmm, Bvals);
-  auto C = csr2eigen<Float,RowMajor>(Cn, Cm, Crowptr, Ccolidx, Cnn, Cmm, Cvals);
-
-  SparseMatrix<Float,RowMajor> A(An, Am);
-  A = B*C;
-  eigen2csr(A, An, Am, Arowptr, Acolidx, Ann, Amm, Avals);
-#else
-  simit_ierror << "extern spmm requires Eigen";
-#endif
+  simit_iassert(Bm == Cn && Bmm == Cnn && An == Bn && Am == Cm &&
+                Ann == Bnn && Amm == Cmm)
+      << "incompatible spmm operands";
+  int Brows = Bn/Bnn;
+  int Crows = Cn/Cnn;
+  int Ccols = Cm/Cmm;
+
+  std::shared_ptr<const SpGEMMPattern> pattern =
+      getSpGEMMPattern(Brows, Browptr, Bcolidx, Crows, Crowptr, Ccolidx, Ccols);
+  int nnz = pattern->Arowptr[Brows];
+
+  // The caller owns (and frees) the result arrays
+  *Arowptr = static_cast<int*>(simit::ffi::simit_malloc((Brows+1)*sizeof(int)));
+  *Acolidx = static_cast<int*>(simit::ffi::simit_malloc(nnz*sizeof(int)));
+  *Avals = static_cast<Float*>(
+      simit::ffi::simit_malloc(nnz*Ann*Amm*sizeof(Float)));
+  std::copy(pattern->Arowptr.begin(), pattern->Arowptr.end(), *Arowptr);
+  std::copy(pattern->Acolidx.begin(), pattern->Acolidx.end(), *Acolidx);
+
+  SpGEMM<Float> spgemm;
+  spgemm.pattern = pattern.get();
+  spgemm.Browptr = Browptr;
+  spgemm.Bcolidx = Bcolidx;
+  spgemm.Crowptr = Crowptr;
+  spgemm.Ccolidx = Ccolidx;
+  spgemm.Bvals = Bvals;
+  spgemm.Cvals = Cvals;
+  spgemm.Avals = *Avals;
+  spgemm.bn = Bnn;
+  spgemm.bk = Bmm;
+  spgemm.bm = Cmm;
+
+  simit::ThreadPool& threadPool = simit::ThreadPool::getInstance();
+  threadPool.parallelFor(Brows, runSpGEMMRows<Float>, &spgemm);
   return 0;
 }
 extern "C" int sspmm(int Bn,  int Bm,  int* Browptr, int* Bcolidx,
@@ -349,6 +738,463 @@ extern "C" int dspmm(int Bn,  int Bm,  int* Browptr, int* Bcolidx,
               An, Am, Arowptr, Acolidx, Ann, Amm, Avals);
 }
 
+namespace {
+/// The operands of y = A*x or y = A'*x, where A is a blocked CSR matrix.
+template <typename Float>
+struct BlockedSpMV {
+  const int *rowptr, *colidx;
+  const Float *vals, *x;
+  Float* y;
+};
+
+/// How many blocks ahead of the current block the SpMV kernels prefetch the
+/// vector blocks they gather from or scatter to.
+const int kSpMVPrefetchDistance = 8;
+
+inline void prefetch(const void* addr) {
+#ifdef __GNUC__
+  __builtin_prefetch(addr);
+#endif
+}
+
+/// Computes the block rows [begin,end) of y = A*x, for N x M blocks. The block
+/// size is a template parameter so the block products are fully unrolled and
+/// vectorized, and the rows are accumulated in registers.
+template <typename Float, int N, int M>
+void runSpMVRows(int begin, int end, void* spmv) {
+  const BlockedSpMV<Float>* k = static_cast<const BlockedSpMV<Float>*>(spmv);
+  const int last = k->rowptr[end];
+  for (int i=begin; i < end; ++i) {
+    Float yi[N] = {};
+    for (int ij=k->rowptr[i]; ij < k->rowptr[i+1]; ++ij) {
+      if (ij + kSpMVPrefetchDistance < last) {
+        prefetch(k->x + k->colidx[ij + kSpMVPrefetchDistance]*M);
+      }
+      const Float* block = k->vals + ij*N*M;
+      const Float* xj = k->x + k->colidx[ij]*M;
+      for (int bi=0; bi < N; ++bi) {
+        for (int bj=0; bj < M; ++bj) {
+          yi[bi] += block[bi*M + bj] * xj[bj];
+        }
+      }
+    }
+    std::copy(yi, yi+N, k->y + i*N);
+  }
+}
+
+/// Computes y = A'*x, for N x M blocks, by scattering the transposed blocks of
+/// every block row into y. The scatters to a column may come from any row, so
+/// this kernel runs serially.
+template <typename Float, int N, int M>
+void spmvTransposed(int rows, int cols, const BlockedSpMV<Float>& k) {
+  std::fill(k.y, k.y + cols*M, Float(0));
+  const int last = k.rowptr[rows];
+  for (int i=0; i < rows; ++i) {
+    Float xi[N];
+    std::copy(k.x + i*N, k.x + (i+1)*N, xi);
+    for (int ij=k.rowptr[i]; ij < k.rowptr[i+1]; ++ij) {
+      if (ij + kSpMVPrefetchDistance < last) {
+        prefetch(k.y + k.colidx[ij + kSpMVPrefetchDistance]*M);
+      }
+      const Float* block = k.vals + ij*N*M;
+      Float* yj = k.y + k.colidx[ij]*M;
+      for (int bi=0; bi < N; ++bi) {
+        for (int bj=0; bj < M; ++bj) {
+          yj[bj] += block[bi*M + bj] * xi[bi];
+        }
+      }
+    }
+  }
+}
+
+template <typename Float, int N>
+void spmvBlocked(bool transposed, int rows, int cols,
+                 BlockedSpMV<Float>* spmv) {
+  if (transposed) {
+    spmvTransposed<Float,N,N>(rows, cols, *spmv);
+  }
+  else {
+    simit::ThreadPool& threadPool = simit::ThreadPool::getInstance();
+      threadPool.parallelFor(rows, runSpMVRows<Float,N,N>, spmv);
+  }
+}
+}
+
+/// Computes y = A*x, or y = A'*x if `transposed`, on a blocked CSR matrix with
+/// square blocks of size 1, 2, 3, 4 or 6, which are the sizes the lowering
+/// selects these kernels for.
+template <typename Float>
+int spmv(bool transposed,
+         int An,  int Am,  int* Arowptr, int* Acolidx,
+         int Ann, int Amm, Float* Avals,
+         int nx, Float* xvals, int ny, Float* yvals) {
+  simit_iassert(Ann == Amm) << "spmv requires square blocks";
+  simit_iassert(transposed ? (nx == An && ny == Am) : (nx == Am && ny == An))
+      << "incompatible spmv operands";
+  int rows = An/Ann;
+  int cols = Am/Amm;
+
+  BlockedSpMV<Float> kernel;
+  kernel.rowptr = Arowptr;
+  kernel.colidx = Acolidx;
+  kernel.vals = Avals;
+  kernel.x = xvals;
+  kernel.y = yvals;
+  switch (Ann) {
+    case 1:
+      spmvBlocked<Float,1>(transposed, rows, cols, &kernel);
+      break;
+    case 2:
+      spmvBlocked<Float,2>(transposed, rows, cols, &kernel);
+      break;
+    case 3:
+      spmvBlocked<Float,3>(transposed, rows, cols, &kernel);
+      break;
+    case 4:
+      spmvBlocked<Float,4>(transposed, rows, cols, &kernel);
+      break;
+    case 6:
+      spmvBlocked<Float,6>(transposed, rows, cols, &kernel);
+      break;
+    default:
+      simit_ierror << "no spmv kernel for " << Ann << "x" << Amm << " blocks";
+  }
+  return 0;
+}
+extern "C" int sspmv(int An,  int Am,  int* Arowptr, int* Acolidx,
+                     int Ann, int Amm, float* Avals,
+                     int nx, float* xvals, int ny, float* yvals) {
+  return spmv(false, An, Am, Arowptr, Acolidx, Ann, Amm, Avals,
+              nx, xvals, ny, yvals);
+}
+extern "C" int dspmv(int An,  int Am,  int* Arowptr, int* Acolidx,
+                     int Ann, int Amm, double* Avals,
+                     int nx, double* xvals, int ny, double* yvals) {
+  return spmv(false, An, Am, Arowptr, Acolidx, Ann, Amm, Avals,
+              nx, xvals, ny, yvals);
+}
+extern "C" int sspmvt(int An,  int Am,  int* Arowptr, int* Acolidx,
+                      int Ann, int Amm, float* Avals,
+                      int nx, float* xvals, int ny, float* yvals) {
+  return spmv(true, An, Am, Arowptr, Acolidx, Ann, Amm, Avals,
+              nx, xvals, ny, yvals);
+}
+extern "C" int dspmvt(int An,  int Am,  int* Arowptr, int* Acolidx,
+                      int Ann, int Amm, double* Avals,
+                      int nx, double* xvals, int ny, double* yvals) {
+  return spmv(true, An, Am, Arowptr, Acolidx, Ann, Amm, Avals,
+              nx, xvals, ny, yvals);
+}
+namespace {
+/// A sliced ELLPACK (SELL-C-sigma) layout of a blocked CSR pattern. The rows
+/// are sorted by decreasing length within windows of `sigma` rows and grouped
+/// into slices of C consecutive sorted rows. Slice s has `sliceptr[s+1] -
+/// sliceptr[s]` slots: the k'th block of its r'th row is in slot `sliceptr[s] +
+/// k*C + r`, and slots past the end of a row are padding.
+struct SellPattern {
+  int C, sigma;
+  std::vector<int> rowptr, colidx;   // The CSR pattern
+
+  std::vector<int> rows;       // The row of every lane of every slice, or -1
+  std::vector<int> sliceptr;   // The first slot of every slice
+  std::vector<int> sellcolidx; // The column of every slot (0 for padding)
+  std::vector<int> locs;       // The CSR location of every slot, or -1
+};
+
+/// A sliced copy of the values of a matrix, packed for the matrix values at
+/// `vals`. The values of the blocks of the k'th column of a slice are stored
+/// block component by block component, with the C lanes of each component
+/// together.
+template <typename Float>
+struct SellMatrix {
+  const void* vals;
+  const int *rowptr, *colidx;
+  int rows, blockSize;
+  std::shared_ptr<const SellPattern> pattern;
+  std::vector<Float> values;
+};
+
+const size_t kSellPatternCacheSize = 16;
+std::list<std::shared_ptr<const SellPattern>> sellPatternCache;
+std::mutex sellPatternCacheMutex;
+
+/// Returns the SELL-C-sigma layout of a CSR pattern, computing it if it is not
+/// cached.
+std::shared_ptr<const SellPattern>
+getSellPattern(int rows, const int* rowptr, const int* colidx,
+               int C, int sigma) {
+  std::lock_guard<std::mutex> lock(sellPatternCacheMutex);
+  for (auto it = sellPatternCache.begin(); it != sellPatternCache.end(); ++it) {
+    if ((*it)->C == C && (*it)->sigma == sigma &&
+        equals((*it)->rowptr, rowptr, rows+1) &&
+        equals((*it)->colidx, colidx, rowptr[rows])) {
+      sellPatternCache.splice(sellPatternCache.begin(), sellPatternCache, it);
+      return sellPatternCache.front();
+    }
+  }
+
+  std::shared_ptr<SellPattern> pattern(new SellPattern);
+  pattern->C = C;
+  pattern->sigma = sigma;
+  pattern->rowptr.assign(rowptr, rowptr + rows+1);
+  pattern->colidx.assign(colidx, colidx + rowptr[rows]);
+
+  std::vector<int> sorted(rows);
+  for (int i=0; i < rows; ++i) {
+    sorted[i] = i;
+  }
+  for (int begin=0; begin < rows; begin += sigma) {
+    int end = std::min(begin + sigma, rows);
+    std::stable_sort(sorted.begin() + begin, sorted.begin() + end,
+                     [rowptr](int a, int b) {
+      return rowptr[a+1]-rowptr[a] > rowptr[b+1]-rowptr[b];
+    });
+  }
+
+  int slices = (rows + C-1) / C;
+  pattern->rows.assign(slices*C, -1);
+  std::copy(sorted.begin(), sorted.end(), pattern->rows.begin());
+  pattern->sliceptr.resize(slices+1);
+  pattern->sliceptr[0] = 0;
+  for (int s=0; s < slices; ++s) {
+    int len = 0;
+    for (int r=0; r < C; ++r) {
+      int i = pattern->rows[s*C + r];
+      if (i >= 0) {
+        len = std::max(len, rowptr[i+1]-rowptr[i]);
+      }
+    }
+    pattern->sliceptr[s+1] = pattern->sliceptr[s] + len*C;
+  }
+
+  int slots = pattern->sliceptr[slices];
+  pattern->sellcolidx.assign(slots, 0);
+  pattern->locs.assign(slots, -1);
+  for (int s=0; s < slices; ++s) {
+    for (int r=0; r < C; ++r) {
+      int i = pattern->rows[s*C + r];
+      if (i < 0) {
+        continue;
+      }
+      for (int ij=rowptr[i]; ij < rowptr[i+1]; ++ij) {
+        int slot = pattern->sliceptr[s] + (ij-rowptr[i])*C + r;
+        pattern->sellcolidx[slot] = colidx[ij];
+        pattern->locs[slot] = ij;
+      }
+    }
+  }
+
+  sellPatternCache.push_front(pattern);
+  if (sellPatternCache.size() > kSellPatternCacheSize) {
+    sellPatternCache.pop_back();
+  }
+  return pattern;
+}
+
+/// The sliced copies of the packed matrices, by the matrices' values. A copy
+/// lives until its matrix is freed (see simit::freeSellCopy), and a matrix
+/// without a copy is multiplied in CSR form.
+template <typename Float>
+struct SellMatrices {
+  std::map<const void*,std::shared_ptr<const SellMatrix<Float>>> matrices;
+  std::mutex mutex;
+
+  static SellMatrices& getInstance() {
+    static SellMatrices instance;
+    return instance;
+  }
+
+  void insert(std::shared_ptr<const SellMatrix<Float>> matrix) {
+    std::lock_guard<std::mutex> lock(mutex);
+    matrices[matrix->vals] = matrix;
+  }
+
+  void erase(const void* vals) {
+    std::lock_guard<std::mutex> lock(mutex);
+    matrices.erase(vals);
+  }
+
+  std::shared_ptr<const SellMatrix<Float>> find(const void* vals,
+                                                const int* rowptr,
+                                                const int* colidx, int rows,
+                                                int blockSize) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = matrices.find(vals);
+    if (it == matrices.end()) {
+      return nullptr;
+    }
+    const SellMatrix<Float>& matrix = *it->second;
+    if (matrix.rowptr != rowptr || matrix.colidx != colidx ||
+        matrix.rows != rows || matrix.blockSize != blockSize) {
+      return nullptr;
+    }
+    return it->second;
+  }
+};
+
+/// The operands of y = A*x, where A is a sliced matrix.
+template <typename Float>
+struct SellSpMV {
+  const SellMatrix<Float>* A;
+  const Float* x;
+  Float* y;
+};
+
+/// Computes the slices [begin,end) of y = A*x, for N x N blocks and C rows per
+/// slice. The innermost loops run over the C rows of a slice, whose values are
+/// contiguous, so they are vectorized across rows.
+template <typename Float, int N, int C>
+void runSellMVSlices(int begin, int end, void* spmv) {
+  const SellSpMV<Float>* k = static_cast<const SellSpMV<Float>*>(spmv);
+  const SellPattern& pattern = *k->A->pattern;
+  const Float* values = k->A->values.data();
+  for (int s=begin; s < end; ++s) {
+    Float acc[N][C] = {};
+    for (int slot=pattern.sliceptr[s]; slot < pattern.sliceptr[s+1];
+         slot += C) {
+      const int* cols = &pattern.sellcolidx[slot];
+      const Float* block = values + slot*N*N;
+      for (int bi=0; bi < N; ++bi) {
+        for (int bj=0; bj < N; ++bj) {
+          const Float* component = block + (bi*N + bj)*C;
+          for (int r=0; r < C; ++r) {
+            acc[bi][r] += component[r] * k->x[cols[r]*N + bj];
+          }
+        }
+      }
+    }
+    for (int r=0; r < C; ++r) {
+      int i = pattern.rows[s*C + r];
+      if (i >= 0) {
+        for (int bi=0; bi < N; ++bi) {
+          k->y[i*N + bi] = acc[bi][r];
+        }
+      }
+    }
+  }
+}
+
+template <typename Float, int N>
+void sellmvBlocked(SellSpMV<Float>* spmv) {
+  const SellPattern& pattern = *spmv->A->pattern;
+  int slices = pattern.sliceptr.size()-1;
+  simit::ThreadPool& threadPool = simit::ThreadPool::getInstance();
+  switch (pattern.C) {
+    case 4:
+      threadPool.parallelFor(slices, runSellMVSlices<Float,N,4>, spmv);
+      break;
+    case 8:
+      threadPool.parallelFor(slices, runSellMVSlices<Float,N,8>, spmv);
+      break;
+    case 16:
+      threadPool.parallelFor(slices, runSellMVSlices<Float,N,16>, spmv);
+      break;
+    default:
+      simit_ierror << "unsupported sell slice height " << pattern.C;
+  }
+}
+}
+
+/// Packs the values of a blocked CSR matrix into its sliced ELLPACK copy, with
+/// C rows per slice and rows sorted within windows of sigma rows. Compiled
+/// code calls this after every assembly of a sliced matrix.
+template <typename Float>
+int sellpack(int An,  int Am,  int* Arowptr, int* Acolidx,
+             int Ann, int Amm, Float* Avals, int C, int sigma) {
+  simit_iassert(Ann == Amm) << "sellpack requires square blocks";
+  int rows = An/Ann;
+  int blockSize = Ann*Amm;
+
+  std::shared_ptr<SellMatrix<Float>> matrix(new SellMatrix<Float>);
+  matrix->vals = Avals;
+  matrix->rowptr = Arowptr;
+  matrix->colidx = Acolidx;
+  matrix->rows = rows;
+  matrix->blockSize = Ann;
+  matrix->pattern = getSellPattern(rows, Arowptr, Acolidx, C, sigma);
+
+  const SellPattern& pattern = *matrix->pattern;
+  matrix->values.resize(pattern.locs.size()*blockSize);
+  for (size_t slot0=0; slot0 < pattern.locs.size(); slot0 += C) {
+    Float* block = &matrix->values[slot0*blockSize];
+    for (int r=0; r < C; ++r) {
+      int ij = pattern.locs[slot0 + r];
+      for (int b=0; b < blockSize; ++b) {
+        block[b*C + r] = (ij >= 0) ? Avals[ij*blockSize + b] : Float(0);
+      }
+    }
+  }
+  SellMatrices<Float>::getInstance().insert(matrix);
+  return 0;
+}
+extern "C" int ssellpack(int An,  int Am,  int* Arowptr, int* Acolidx,
+                         int Ann, int Amm, float* Avals, int C, int sigma) {
+  return sellpack(An, Am, Arowptr, Acolidx, Ann, Amm, Avals, C, sigma);
+}
+extern "C" int dsellpack(int An,  int Am,  int* Arowptr, int* Acolidx,
+                         int Ann, int Amm, double* Avals, int C, int sigma) {
+  return sellpack(An, Am, Arowptr, Acolidx, Ann, Amm, Avals, C, sigma);
+}
+
+/// Computes y = A*x from the sliced copy of A, or from its CSR values if A has
+/// no sliced copy.
+template <typename Float>
+int sellmv(int An,  int Am,  int* Arowptr, int* Acolidx,
+           int Ann, int Amm, Float* Avals,
+           int nx, Float* xvals, int ny, Float* yvals) {
+  std::shared_ptr<const SellMatrix<Float>> matrix =
+      SellMatrices<Float>::getInstance().find(Avals, Arowptr, Acolidx,
+                                              An/Ann, Ann);
+  if (matrix == nullptr) {
+    return spmv(false, An, Am, Arowptr, Acolidx, Ann, Amm, Avals,
+                nx, xvals, ny, yvals);
+  }
+  simit_iassert(nx == Am && ny == An) << "incompatible sellmv operands";
+
+  SellSpMV<Float> kernel;
+  kernel.A = matrix.get();
+  kernel.x = xvals;
+  kernel.y = yvals;
+  switch (Ann) {
+    case 1:
+      sellmvBlocked<Float,1>(&kernel);
+      break;
+    case 2:
+      sellmvBlocked<Float,2>(&kernel);
+      break;
+    case 3:
+      sellmvBlocked<Float,3>(&kernel);
+      break;
+    case 4:
+      sellmvBlocked<Float,4>(&kernel);
+      break;
+    case 6:
+      sellmvBlocked<Float,6>(&kernel);
+      break;
+    default:
+      simit_ierror << "no sellmv kernel for " << Ann << "x" << Amm << " blocks";
+  }
+  return 0;
+}
+extern "C" int ssellmv(int An,  int Am,  int* Arowptr, int* Acolidx,
+                       int Ann, int Amm, float* Avals,
+                       int nx, float* xvals, int ny, float* yvals) {
+  return sellmv(An, Am, Arowptr, Acolidx, Ann, Amm, Avals,
+                nx, xvals, ny, yvals);
+}
+extern "C" int dsellmv(int An,  int Am,  int* Arowptr, int* Acolidx,
+                       int Ann, int Amm, double* Avals,
+                       int nx, double* xvals, int ny, double* yvals) {
+  return sellmv(An, Am, Arowptr, Acolidx, Ann, Amm, Avals,
+                nx, xvals, ny, yvals);
+}
+
+namespace simit {
+void freeSellCopy(const void* vals) {
+  SellMatrices<float>::getInstance().erase(vals);
+  SellMatrices<double>::getInstance().erase(vals);
+}
+}
 
 // Solvers
 #define SOLVER_ERROR                                            \
@@ -356,17 +1202,123 @@ do {                                                            \
   simit_ierror << "Solvers require that Simit was built with Eigen."; \
 } while (false)
 
+#ifdef EIGEN
+namespace {
+/// A sparse factorization together with the blocked CSR pattern it was
+/// analyzed for. The matrix is kept in the solver's column-major format, and
+/// `locs` maps every CSR value to its location in it, so refactorizing a matrix
+/// with the same pattern only scatters the values and reruns `factorize`.
+template <typename Float, typename Solver>
+struct Factorization {
+  int n, m, nn, mm;
+  std::vector<int> rowptr, colidx;
+  SparseMatrix<Float,ColMajor> A;
+  std::vector<int> locs;
+  Solver solver;
+
+  Factorization(int n, int m, const int* rowptr, const int* colidx,
+                int nn, int mm)
+      : n(n), m(m), nn(nn), mm(mm),
+        rowptr(rowptr, rowptr + n/nn+1),
+        colidx(colidx, colidx + rowptr[n/nn]) {
+    int nnz = rowptr[n/nn] * nn*mm;
+    A.resize(n, m);
+    A.resizeNonZeros(nnz);
+    locs.resize(nnz);
+    csr2cscPattern(n, m, rowptr, colidx, nn, mm,
+                   A.outerIndexPtr(), A.innerIndexPtr(), locs.data());
+  }
+
+  bool hasPattern(int n, int m, const int* rowptr, const int* colidx,
+                  int nn, int mm) const {
+    return this->n == n && this->m == m && this->nn == nn && this->mm == mm &&
+           std::equal(this->rowptr.begin(), this->rowptr.end(), rowptr) &&
+           std::equal(this->colidx.begin(), this->colidx.end(), colidx);
+  }
+
+  void factorize(const Float* vals) {
+    Float* values = A.valuePtr();
+    for (size_t k=0; k < locs.size(); ++k) {
+      values[locs[k]] = vals[k];
+    }
+    solver.factorize(A);
+  }
+};
+
+/// Factorizations that have been freed, kept for the next factorization of a
+/// matrix with the same pattern (e.g. the next timestep of an implicit
+/// integrator), which can then skip the ordering and symbolic analysis.
+template <typename Float, typename Solver>
+class FactorizationPool {
+public:
+  typedef Factorization<Float,Solver> Entry;
+
+  static FactorizationPool& getInstance() {
+    static FactorizationPool instance;
+    return instance;
+  }
+
+  /// Returns a factorization of the matrix, reusing the analysis of a freed
+  /// factorization with the same pattern if there is one.
+  Entry* factorize(int n, int m, const int* rowptr, const int* colidx,
+                   int nn, int mm, const Float* vals) {
+    std::unique_ptr<Entry> entry;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if ((*it)->hasPattern(n, m, rowptr, colidx, nn, mm)) {
+          entry = std::move(*it);
+          entries.erase(it);
+          break;
+        }
+      }
+    }
+    if (!entry) {
+      entry.reset(new Entry(n, m, rowptr, colidx, nn, mm));
+      entry->solver.analyzePattern(entry->A);
+    }
+    entry->factorize(vals);
+    return entry.release();
+  }
+
+  void free(Entry* entry) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.push_front(std::unique_ptr<Entry>(entry));
+    if (entries.size() > maxEntries) {
+      entries.pop_back();
+    }
+  }
+
+private:
+  static const size_t maxEntries = 8;
+  std::mutex mutex;
+  std::list<std::unique_ptr<Entry>> entries;
+};
+
+template <typename Float>
+using LU = Factorization<Float,SparseLU<SparseMatrix<Float,ColMajor>>>;
+template <typename Float>
+using LUPool = FactorizationPool<Float,SparseLU<SparseMatrix<Float,ColMajor>>>;
+
+template <typename Float>
+using Chol = Factorization<Float,SimplicialCholesky<SparseMatrix<Float>>>;
+template <typename Float>
+using CholPool =
+    FactorizationPool<Float,SimplicialCholesky<SparseMatrix<Float>>>;
+}
+#endif
+
 template <typename Float>
 void solve(int n,  int m,  int* rowptr, int* colidx,
            int nn, int mm, Float* Avals, Float* bvals, Float* xvals) {
 #ifdef EIGEN
-  auto A = csr2eigen<Float,ColMajor>(n, m, rowptr, colidx, nn, mm, Avals);
-  auto x = new Map<Matrix<Float,Dynamic,1>>(xvals, m);
-  auto b = new Map<Matrix<Float,Dynamic,1>>(bvals, n);
+  auto x = dense2eigen(m, xvals);
+  auto b = dense2eigen(n, bvals);
 
-  SparseLU<SparseMatrix<Float, ColMajor>> solver;
-  solver.compute(A);
-  *x = solver.solve(*b);
+  LUPool<Float>& pool = LUPool<Float>::getInstance();
+  LU<Float>* lu = pool.factorize(n, m, rowptr, colidx, nn, mm, Avals);
+  x = lu->solver.solve(b);
+  pool.free(lu);
 #else
   SOLVER_ERROR;
 #endif
@@ -388,11 +1340,9 @@ int lu(int An,  int Am,  int* Arowptr, int* Acolidx,
        int Ann, int Amm, Float* Avals,
        void** solverPtr) {
 #ifdef EIGEN
-  auto A = csr2eigen<Float,Eigen::ColMajor>(An, Am, Arowptr, Acolidx,
-                                            Ann, Amm, Avals);
-  auto solver = new SparseLU<SparseMatrix<Float,ColMajor>>();
-  solver->compute(A);
-  *solverPtr = static_cast<void*>(solver);
+  auto lu = LUPool<Float>::getInstance().factorize(An, Am, Arowptr, Acolidx,
+                                                    Ann, Amm, Avals);
+  *solverPtr = static_cast<void*>(lu);
 #else
   SOLVER_ERROR;
 #endif
@@ -414,8 +1364,7 @@ extern "C" int dlu(int An,  int Am,  int* Arowptr, int* Acolidx,
 template <typename Float>
 int lufree(void** solverPtr) {
 #ifdef EIGEN
-  auto solver=static_cast<SparseLU<SparseMatrix<Float,ColMajor>>*>(*solverPtr);
-  delete solver;
+  LUPool<Float>::getInstance().free(static_cast<LU<Float>*>(*solverPtr));
 #else
   SOLVER_ERROR;
 #endif
@@ -433,13 +1382,10 @@ extern "C" int dlufree(void** solverPtr){
 template <typename Float>
 int lusolve(void** solverPtr, int nb, Float *bvals, int nx, Float *xvals) {
 #ifdef EIGEN
-  auto solver=static_cast<SparseLU<SparseMatrix<Float,ColMajor>>*>(*solverPtr);
+  auto solver = &static_cast<LU<Float>*>(*solverPtr)->solver;
   auto b = dense2eigen(nb, bvals);
-  auto x = Eigen::Matrix<Float,Eigen::Dynamic,1>(nx);
+  auto x = dense2eigen(nx, xvals);
   x = solver->solve(b);
-  for (int i=0; i<nx; ++i) {
-    xvals[i] = x(i);
-  }
 #else
   SOLVER_ERROR;
 #endif
@@ -463,7 +1409,7 @@ int lumatsolve(void** solverPtr,
                 int Xn,  int Xm,  int** Xrowptr, int** Xcolidx,
                 int Xnn, int Xmm, Float** Xvals){
 #ifdef EIGEN
-  auto solver=static_cast<SparseLU<SparseMatrix<Float,ColMajor>>*>(*solverPtr);
+  auto solver = &static_cast<LU<Float>*>(*solverPtr)->solver;
   auto B = csr2eigen<Float,ColMajor>(Bn, Bm, Browptr, Bcolidx, Bnn, Bmm, Bvals);
   SparseMatrix<Float> X(Xn, Xm);
   X = solver->solve(B);
@@ -502,11 +1448,10 @@ int chol(int An,  int Am,  int* Arowptr, int* Acolidx,
          int Ann, int Amm, Float* Avals,
          void** solverPtr) {
 #ifdef EIGEN
-  auto A = csr2eigen<Float,Eigen::ColMajor>(An, Am, Arowptr, Acolidx,
-                                            Ann, Amm, Avals);
-  auto solver = new SimplicialCholesky<SparseMatrix<Float>>();
-  solver->compute(A);
-  *solverPtr = static_cast<void*>(solver);
+  auto chol = CholPool<Float>::getInstance().factorize(An, Am, Arowptr,
+                                                       Acolidx, Ann, Amm,
+                                                       Avals);
+  *solverPtr = static_cast<void*>(chol);
 #else
   SOLVER_ERROR;
 #endif
@@ -527,8 +1472,7 @@ extern "C" int dchol(int An,  int Am,  int* Arowptr, int* Acolidx,
 template <typename Float>
 int cholfree(void** solverPtr) {
 #ifdef EIGEN
-  auto solver=static_cast<SimplicialCholesky<SparseMatrix<Float>>*>(*solverPtr);
-  delete solver;
+  CholPool<Float>::getInstance().free(static_cast<Chol<Float>*>(*solverPtr));
 #else
   SOLVER_ERROR;
 #endif
@@ -546,13 +1490,10 @@ extern "C" int dcholfree(void** solverPtr){
 template <typename Float>
 int lltsolve(void** solverPtr, int nb, Float *bvals, int nx, Float *xvals) {
 #ifdef EIGEN
-  auto solver=static_cast<SimplicialCholesky<SparseMatrix<Float>>*>(*solverPtr);
+  auto solver = &static_cast<Chol<Float>*>(*solverPtr)->solver;
   auto b = dense2eigen(nb, bvals);
-  auto x = Eigen::Matrix<Float,Eigen::Dynamic,1>(nx);
+  auto x = dense2eigen(nx, xvals);
   x = solver->solve(b);
-  for (int i=0; i<nx; ++i) {
-    xvals[i] = x(i);
-  }
 #else
   SOLVER_ERROR;
 #endif
@@ -576,7 +1517,7 @@ int lltmatsolve(void** solverPtr,
                  int Xn,  int Xm,  int** Xrowptr, int** Xcolidx,
                  int Xnn, int Xmm, Float** Xvals){
 #ifdef EIGEN
-  auto solver=static_cast<SimplicialCholesky<SparseMatrix<Float,ColMajor>>*>(*solverPtr);
+  auto solver = &static_cast<Chol<Float>*>(*solverPtr)->solver;
   auto B = csr2eigen<Float,ColMajor>(Bn, Bm, Browptr, Bcolidx, Bnn, Bmm, Bvals);
   SparseMatrix<Float> X(Xn, Xm);
   X = solver->solve(B);
@@ -626,13 +1567,16 @@ int triangularSolve(int An,  int Am,  int* Arowptr, int* Acolidx,
 			     int Ann, int Amm, Float* Avals,
 				 int nb, Float *bvals, int nx, Float *xvals) {
 #ifdef EIGEN
-  auto A = csr2eigen<Float,Eigen::ColMajor>(An, Am, Arowptr, Acolidx,
-                                            Ann, Amm, Avals);
   auto b = dense2eigen(nb, bvals);
-  auto x = Eigen::Matrix<Float,Eigen::Dynamic,1>(nx);
-  x = TriangularView<SparseMatrix<Float,ColMajor>,Lower>(A).solve(b);
-  for (int i=0; i<nx; ++i) {
-    xvals[i] = x(i);
+  auto x = dense2eigen(nx, xvals);
+  if (Ann == 1 && Amm == 1 && hasSortedRows(An, Arowptr, Acolidx)) {
+    auto A = csrView(An, Am, Arowptr, Acolidx, Avals);
+    x = A.template triangularView<Lower>().solve(b);
+  }
+  else {
+    auto A = csr2eigen<Float,RowMajor>(An, Am, Arowptr, Acolidx,
+                                       Ann, Amm, Avals);
+    x = A.template triangularView<Lower>().solve(b);
   }
 #else
   SOLVER_ERROR;
@@ -653,3 +1597,442 @@ extern "C" int dtriangularSolve(int An,  int Am,  int* Arowptr, int* Acolidx,
 }
 
 
+
+namespace {
+enum class Preconditioner {None, Jacobi, BlockJacobi, IC0};
+
+/// State of a preconditioned conjugate gradient solve of `Ax=b`, where `A` is
+/// a symmetric positive definite blocked CSR matrix with bs x bs blocks. The
+/// iterations run in three passes over the vectors, split into the thread
+/// pool's chunks of block rows: `q=Ap` with `p'q`; the updates of `x` and `r`
+/// with `z=M^{-1}r`, `r'r` and `r'z`; and the update of `p`.
+template <typename Float>
+struct PCG {
+  int rows, bs;
+  const int *rowptr, *colidx;
+  const Float* vals;
+  Float* x;
+  std::vector<Float> r, z, p, q;
+
+  Preconditioner precond;
+  /// Inverse diagonal (Jacobi) or inverse diagonal blocks (block-Jacobi)
+  std::vector<Float> inverse;
+  /// Incomplete Cholesky factor (IC(0)), a scalar lower triangular CSR matrix
+  std::vector<int> Lrowptr, Lcolidx;
+  std::vector<Float> Lvals;
+
+  unsigned numChunks;
+  Float alpha, beta;
+  std::vector<Float> pq, rr, rz;  // Per-chunk partial dot products
+
+  int chunkBegin(unsigned chunk) const {
+    return (int)(((int64_t)rows * chunk) / numChunks);
+  }
+};
+
+/// Computes `inv = a^{-1}` for an n x n block with Gauss-Jordan elimination
+/// and partial pivoting. Returns false if the block is singular.
+template <typename Float>
+bool invertBlock(const Float* a, int n, Float* inv) {
+  std::vector<Float> m(a, a + n*n);
+  std::fill(inv, inv + n*n, Float(0));
+  for (int i=0; i < n; ++i) {
+    inv[i*n + i] = 1;
+  }
+  for (int c=0; c < n; ++c) {
+    int pivot = c;
+    for (int i=c+1; i < n; ++i) {
+      if (std::abs(m[i*n + c]) > std::abs(m[pivot*n + c])) {
+        pivot = i;
+      }
+    }
+    if (m[pivot*n + c] == Float(0)) {
+      return false;
+    }
+    for (int j=0; j < n; ++j) {
+      std::swap(m[c*n + j], m[pivot*n + j]);
+      std::swap(inv[c*n + j], inv[pivot*n + j]);
+    }
+    Float scale = 1 / m[c*n + c];
+    for (int j=0; j < n; ++j) {
+      m[c*n + j] *= scale;
+      inv[c*n + j] *= scale;
+    }
+    for (int i=0; i < n; ++i) {
+      Float f = m[i*n + c];
+      if (i == c || f == Float(0)) {
+        continue;
+      }
+      for (int j=0; j < n; ++j) {
+        m[i*n + j] -= f * m[c*n + j];
+        inv[i*n + j] -= f * inv[c*n + j];
+      }
+    }
+  }
+  return true;
+}
+
+/// Returns the location of the diagonal block of block row i, or -1.
+inline int findDiagonal(const int* rowptr, const int* colidx, int i) {
+  for (int ij=rowptr[i]; ij < rowptr[i+1]; ++ij) {
+    if (colidx[ij] == i) {
+      return ij;
+    }
+  }
+  return -1;
+}
+
+template <typename Float>
+void initJacobi(PCG<Float>* s) {
+  int bs = s->bs;
+  s->inverse.assign(s->rows*bs, Float(1));
+  for (int i=0; i < s->rows; ++i) {
+    int ii = findDiagonal(s->rowptr, s->colidx, i);
+    for (int b=0; ii >= 0 && b < bs; ++b) {
+      Float d = s->vals[ii*bs*bs + b*bs + b];
+      if (d != Float(0)) {
+        s->inverse[i*bs + b] = 1 / d;
+      }
+    }
+  }
+}
+
+template <typename Float>
+void initBlockJacobi(PCG<Float>* s) {
+  int bs = s->bs;
+  s->inverse.assign(s->rows*bs*bs, Float(0));
+  for (int i=0; i < s->rows; ++i) {
+    Float* inv = &s->inverse[i*bs*bs];
+    int ii = findDiagonal(s->rowptr, s->colidx, i);
+    if (ii < 0 || !invertBlock(s->vals + ii*bs*bs, bs, inv)) {
+      // Fall back to the identity for missing or singular blocks
+      std::fill(inv, inv + bs*bs, Float(0));
+      for (int b=0; b < bs; ++b) {
+        inv[b*bs + b] = 1;
+      }
+    }
+  }
+}
+
+/// Computes the IC(0) factor of A, which has the lower triangle of A's scalar
+/// pattern. Every diagonal entry of A must be stored. IC(0) can break down
+/// with a non-positive pivot even when A is symmetric positive definite; such
+/// a pivot is replaced by the magnitude of A's diagonal entry (or by one if
+/// that is zero), which keeps the preconditioner positive definite at the cost
+/// of a poorer approximation of A.
+template <typename Float>
+void initIC0(PCG<Float>* s) {
+  int bs = s->bs;
+  int n = s->rows * bs;
+
+  // Extract the lower triangle of A, with sorted columns
+  s->Lrowptr.assign(n+1, 0);
+  s->Lcolidx.clear();
+  s->Lvals.clear();
+  std::vector<std::pair<int,Float>> row;
+  for (int i=0; i < s->rows; ++i) {
+    for (int bi=0; bi < bs; ++bi) {
+      int r = i*bs + bi;
+      row.clear();
+      for (int ij=s->rowptr[i]; ij < s->rowptr[i+1]; ++ij) {
+        for (int bj=0; bj < bs; ++bj) {
+          int c = s->colidx[ij]*bs + bj;
+          if (c <= r) {
+            row.push_back({c, s->vals[ij*bs*bs + bi*bs + bj]});
+          }
+        }
+      }
+      std::sort(row.begin(), row.end(),
+                [](const std::pair<int,Float>& a, const std::pair<int,Float>& b) {
+                  return a.first < b.first;
+                });
+      if (row.empty() || row.back().first != r) {
+        simit_uerror << "pcg: the ic0 preconditioner requires every diagonal "
+                     << "entry of the matrix to be stored (row " << r
+                     << " has none)";
+      }
+      for (auto& entry : row) {
+        s->Lcolidx.push_back(entry.first);
+        s->Lvals.push_back(entry.second);
+      }
+      s->Lrowptr[r+1] = s->Lcolidx.size();
+    }
+  }
+
+  const std::vector<int>& Lrowptr = s->Lrowptr;
+  const std::vector<int>& Lcolidx = s->Lcolidx;
+  std::vector<Float>& L = s->Lvals;
+  for (int i=0; i < n; ++i) {
+    for (int ik=Lrowptr[i]; ik < Lrowptr[i+1]; ++ik) {
+      int k = Lcolidx[ik];
+
+      // L(i,k) -= sum_{j<k} L(i,j)*L(k,j)
+      Float sum = 0;
+      int ij = Lrowptr[i];
+      int kj = Lrowptr[k];
+      while (ij < ik && kj < Lrowptr[k+1] && Lcolidx[kj] < k) {
+        if (Lcolidx[ij] < Lcolidx[kj]) {
+          ++ij;
+        }
+        else if (Lcolidx[kj] < Lcolidx[ij]) {
+          ++kj;
+        }
+        else {
+          sum += L[ij++] * L[kj++];
+        }
+      }
+
+      if (k < i) {
+        Float diag = L[Lrowptr[k+1]-1];
+        L[ik] = (L[ik] - sum) / diag;
+      }
+      else {
+        Float pivot = L[ik] - sum;
+        L[ik] = std::sqrt(pivot > 0 ? pivot : std::abs(L[ik]));
+        if (L[ik] == Float(0)) {
+          L[ik] = 1;
+        }
+      }
+    }
+  }
+}
+
+/// Solves `LL'z = r` with the IC(0) factor, and returns `r'z`.
+template <typename Float>
+Float applyIC0(PCG<Float>* s) {
+  const std::vector<int>& Lrowptr = s->Lrowptr;
+  const std::vector<int>& Lcolidx = s->Lcolidx;
+  const std::vector<Float>& L = s->Lvals;
+  int n = s->rows * s->bs;
+  std::vector<Float>& z = s->z;
+
+  for (int i=0; i < n; ++i) {
+    Float sum = s->r[i];
+    int diag = Lrowptr[i+1]-1;
+    for (int ij=Lrowptr[i]; ij < diag; ++ij) {
+      sum -= L[ij] * z[Lcolidx[ij]];
+    }
+    z[i] = sum / L[diag];
+  }
+  Float rz = 0;
+  for (int i=n-1; i >= 0; --i) {
+    int diag = Lrowptr[i+1]-1;
+    z[i] /= L[diag];
+    for (int ij=Lrowptr[i]; ij < diag; ++ij) {
+      z[Lcolidx[ij]] -= L[ij] * z[i];
+    }
+    rz += s->r[i] * z[i];
+  }
+  return rz;
+}
+
+/// z = M^{-1}r for the rows [begin,end) with the diagonal preconditioners.
+/// Returns the partial `r'z`.
+template <typename Float>
+Float applyDiagonal(PCG<Float>* s, int begin, int end) {
+  int bs = s->bs;
+  Float rz = 0;
+  for (int i=begin; i < end; ++i) {
+    for (int bi=0; bi < bs; ++bi) {
+      int row = i*bs + bi;
+      Float zi;
+      switch (s->precond) {
+        case Preconditioner::Jacobi:
+          zi = s->inverse[row] * s->r[row];
+          break;
+        case Preconditioner::BlockJacobi: {
+          const Float* inv = &s->inverse[(i*bs + bi)*bs];
+          zi = 0;
+          for (int bj=0; bj < bs; ++bj) {
+            zi += inv[bj] * s->r[i*bs + bj];
+          }
+          break;
+        }
+        default:
+          zi = s->r[row];
+          break;
+      }
+      s->z[row] = zi;
+      rz += s->r[row] * zi;
+    }
+  }
+  return rz;
+}
+
+/// q = Ap and the partial `p'q` of each chunk.
+template <typename Float>
+void runPCGMultiply(int begin, int end, void* pcg) {
+  PCG<Float>* s = static_cast<PCG<Float>*>(pcg);
+  int bs = s->bs;
+  for (unsigned chunk=begin; chunk < (unsigned)end; ++chunk) {
+    Float pq = 0;
+    for (int i=s->chunkBegin(chunk); i < s->chunkBegin(chunk+1); ++i) {
+      Float* qi = &s->q[i*bs];
+      std::fill(qi, qi + bs, Float(0));
+      for (int ij=s->rowptr[i]; ij < s->rowptr[i+1]; ++ij) {
+        const Float* block = s->vals + ij*bs*bs;
+        const Float* pj = &s->p[s->colidx[ij]*bs];
+        for (int bi=0; bi < bs; ++bi) {
+          for (int bj=0; bj < bs; ++bj) {
+            qi[bi] += block[bi*bs + bj] * pj[bj];
+          }
+        }
+      }
+      for (int bi=0; bi < bs; ++bi) {
+        pq += s->p[i*bs + bi] * qi[bi];
+      }
+    }
+    s->pq[chunk] = pq;
+  }
+}
+
+/// x += alpha*p, r -= alpha*q, and unless the preconditioner is IC(0) (which
+/// is sequential), z = M^{-1}r; with the partial `r'r` and `r'z` of each chunk.
+template <typename Float>
+void runPCGUpdate(int begin, int end, void* pcg) {
+  PCG<Float>* s = static_cast<PCG<Float>*>(pcg);
+  int bs = s->bs;
+  for (unsigned chunk=begin; chunk < (unsigned)end; ++chunk) {
+    int rowsBegin = s->chunkBegin(chunk);
+    int rowsEnd = s->chunkBegin(chunk+1);
+    Float rr = 0;
+    for (int k=rowsBegin*bs; k < rowsEnd*bs; ++k) {
+      s->x[k] += s->alpha * s->p[k];
+      s->r[k] -= s->alpha * s->q[k];
+      rr += s->r[k] * s->r[k];
+    }
+    s->rr[chunk] = rr;
+    if (s->precond != Preconditioner::IC0) {
+      s->rz[chunk] = applyDiagonal(s, rowsBegin, rowsEnd);
+    }
+  }
+}
+
+/// p = z + beta*p
+template <typename Float>
+void runPCGDirection(int begin, int end, void* pcg) {
+  PCG<Float>* s = static_cast<PCG<Float>*>(pcg);
+  int bs = s->bs;
+  for (unsigned chunk=begin; chunk < (unsigned)end; ++chunk) {
+    for (int k=s->chunkBegin(chunk)*bs; k < s->chunkBegin(chunk+1)*bs; ++k) {
+      s->p[k] = s->z[k] + s->beta * s->p[k];
+    }
+  }
+}
+
+template <typename Float>
+Float sum(const std::vector<Float>& partials) {
+  Float result = 0;
+  for (Float partial : partials) {
+    result += partial;
+  }
+  return result;
+}
+}
+
+/// Preconditioned conjugate gradient solve of `Ax=b` for a symmetric positive
+/// definite matrix `A`, starting from `x0`. Iterates until the squared norm of
+/// the residual is at most `tol` or `maxiters` iterations have run. The
+/// preconditioner is one of "none", "jacobi", "blockjacobi" (inverts the
+/// diagonal blocks of `A`) and "ic0" (zero fill-in incomplete Cholesky, which
+/// requires the diagonal of `A` to be stored and shifts pivots that break down;
+/// see initIC0).
+template <typename Float>
+int pcg(int An,  int Am,  int* Arowptr, int* Acolidx,
+        int Ann, int Amm, Float* Avals,
+        int nb, Float* bvals, int nx0, Float* x0vals,
+        Float tol, int maxiters, const char* precond,
+        int nx, Float* xvals) {
+  simit_iassert(An == Am && Ann == Amm && nb == An && nx0 == An && nx == An)
+      << "pcg requires a square matrix with square blocks";
+
+  PCG<Float> s;
+  s.rows = An/Ann;
+  s.bs = Ann;
+  s.rowptr = Arowptr;
+  s.colidx = Acolidx;
+  s.vals = Avals;
+  s.x = xvals;
+
+  std::string name(precond);
+  if (name == "none") {
+    s.precond = Preconditioner::None;
+  }
+  else if (name == "jacobi") {
+    s.precond = Preconditioner::Jacobi;
+    initJacobi(&s);
+  }
+  else if (name == "blockjacobi") {
+    s.precond = Preconditioner::BlockJacobi;
+    initBlockJacobi(&s);
+  }
+  else if (name == "ic0") {
+    s.precond = Preconditioner::IC0;
+    initIC0(&s);
+  }
+  else {
+    simit_uerror << "unknown pcg preconditioner '" << name << "' (expected "
+                 << "none, jacobi, blockjacobi or ic0)";
+  }
+
+  simit::ThreadPool& threadPool = simit::ThreadPool::getInstance();
+  s.numChunks = std::max(1u, threadPool.getNumChunks(s.rows));
+  s.pq.resize(s.numChunks);
+  s.rr.resize(s.numChunks);
+  s.rz.resize(s.numChunks);
+
+  // r = b - A*x0
+  s.r.assign(bvals, bvals + nb);
+  s.z.resize(nb);
+  s.p.assign(x0vals, x0vals + nx0);
+  s.q.resize(nb);
+  threadPool.parallelFor(s.numChunks, runPCGMultiply<Float>, &s, 1);
+  for (int k=0; k < nb; ++k) {
+    s.r[k] -= s.q[k];
+  }
+  if (xvals != x0vals) {
+    std::copy(x0vals, x0vals + nx0, xvals);
+  }
+
+  Float rr = 0;
+  for (int k=0; k < nb; ++k) {
+    rr += s.r[k] * s.r[k];
+  }
+  Float rz = (s.precond == Preconditioner::IC0)
+      ? applyIC0(&s) : applyDiagonal(&s, 0, s.rows);
+  s.p = s.z;
+
+  for (int iter=0; rr > tol && iter < maxiters; ++iter) {
+    threadPool.parallelFor(s.numChunks, runPCGMultiply<Float>, &s, 1);
+    Float pq = sum(s.pq);
+    if (pq == Float(0)) {
+      break;
+    }
+    s.alpha = rz / pq;
+
+    threadPool.parallelFor(s.numChunks, runPCGUpdate<Float>, &s, 1);
+    rr = sum(s.rr);
+    Float rzOld = rz;
+    rz = (s.precond == Preconditioner::IC0) ? applyIC0(&s) : sum(s.rz);
+
+    s.beta = rz / rzOld;
+    threadPool.parallelFor(s.numChunks, runPCGDirection<Float>, &s, 1);
+  }
+  return 0;
+}
+extern "C" int spcg(int An,  int Am,  int* Arowptr, int* Acolidx,
+                    int Ann, int Amm, float* Avals,
+                    int nb, float* bvals, int nx0, float* x0vals,
+                    float tol, int maxiters, const char* precond,
+                    int nx, float* xvals) {
+  return pcg(An, Am, Arowptr, Acolidx, Ann, Amm, Avals,
+             nb, bvals, nx0, x0vals, tol, maxiters, precond, nx, xvals);
+}
+extern "C" int dpcg(int An,  int Am,  int* Arowptr, int* Acolidx,
+                    int Ann, int Amm, double* Avals,
+                    int nb, double* bvals, int nx0, double* x0vals,
+                    double tol, int maxiters, const char* precond,
+                    int nx, double* xvals) {
+  return pcg(An, Am, Arowptr, Acolidx, Ann, Amm, Avals,
+             nb, bvals, nx0, x0vals, tol, maxiters, precond, nx, xvals);
+}
@@ -3,6 +3,8 @@
 
 #include "ffi.h"
 #include <iostream>
+#include <vector>
+#include <algorithm>
 
 template <typename Float>
 void mallocMatrix(int n,  int m,  int** rowptr, int** colidx,
@@ -13,33 +15,127 @@ void mallocMatrix(int n,  int m,  int** rowptr, int** colidx,
   *vals = static_cast<Float*>(simit::ffi::simit_malloc(nnz * sizeof(Float)));
 }
 
+namespace simit {
+/// Releases the sliced ELLPACK copy that sellpack made of the matrix with the
+/// given values, if any. Must be called before the values are freed, since a
+/// later matrix allocated at the same address would otherwise match the copy.
+void freeSellCopy(const void* vals);
+}
+
 #ifdef EIGEN
 #include <Eigen/Core>
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
 
+/// Returns true if the column indices of every row of a CSR matrix are sorted.
+inline bool hasSortedRows(int rows, const int* rowptr, const int* colidx) {
+  for (int i=0; i<rows; ++i) {
+    for (int ij=rowptr[i]+1; ij<rowptr[i+1]; ++ij) {
+      if (colidx[ij-1] > colidx[ij]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/// Returns a view of a CSR matrix with scalar blocks that shares its arrays.
+/// Eigen requires sorted inner indices, so the column indices of every row
+/// must be sorted (see hasSortedRows); otherwise use csr2eigen.
+template <typename Float>
+Eigen::Map<const Eigen::SparseMatrix<Float,Eigen::RowMajor>>
+csrView(int n, int m, const int* rowptr, const int* colidx, const Float* vals) {
+  return Eigen::Map<const Eigen::SparseMatrix<Float,Eigen::RowMajor>>(
+      n, m, rowptr[n], rowptr, colidx, vals);
+}
+
+/// Computes the compressed column-major pattern (`outer`, `inner`) of a blocked
+/// CSR matrix, and the location in it of each of the matrix's values (`locs`).
+/// Blocks are stored row-major.
+inline void csr2cscPattern(int n, int m, const int* rowptr, const int* colidx,
+                           int nn, int mm, int* outer, int* inner, int* locs) {
+  const int rows = n/nn;
+  const int blockSize = nn*mm;
+
+  // Count the entries in each column
+  std::vector<int> colptr(m+1, 0);
+  for (int ij=0; ij<rowptr[rows]; ++ij) {
+    for (int bj=0; bj<mm; ++bj) {
+      colptr[colidx[ij]*mm + bj + 1] += nn;
+    }
+  }
+  for (int j=0; j<m; ++j) {
+    colptr[j+1] += colptr[j];
+  }
+  std::copy(colptr.begin(), colptr.end(), outer);
+
+  // Visit the entries in row order so that every column's rows are sorted
+  for (int i=0; i<rows; ++i) {
+    for (int bi=0; bi<nn; ++bi) {
+      for (int ij=rowptr[i]; ij<rowptr[i+1]; ++ij) {
+        for (int bj=0; bj<mm; ++bj) {
+          int loc = colptr[colidx[ij]*mm + bj]++;
+          inner[loc] = i*nn + bi;
+          locs[ij*blockSize + bi*mm + bj] = loc;
+        }
+      }
+    }
+  }
+}
+
+/// Converts a blocked CSR matrix to an Eigen matrix, by building its
+/// compressed storage directly (in one pass for row-major matrices and with a
+/// counting sort for column-major ones). The column indices of a row need not
+/// be sorted.
 template <typename Float, int Major=Eigen::RowMajor>
 Eigen::SparseMatrix<Float,Major>
 csr2eigen(int n, int m, int* rowptr, int* colidx, int nn, int mm, Float* vals) {
-  int nnz = rowptr[n/nn];
-
-  std::vector<Eigen::Triplet<Float>> tripletList;
-  tripletList.reserve(nnz*nn*mm);
-  for (int i=0; i<n/(nn); ++i) {
-    for (int ij=rowptr[i]; ij<rowptr[i+1]; ++ij) {
-      int j = colidx[ij];
-      for (int bi=0; bi<nn; bi++) {
-        for (int bj=0; bj<mm; bj++) {
-          tripletList.push_back(Eigen::Triplet<Float>(i*nn+bi, j*mm+bj,
-                                                      vals[ij*nn*mm+bi*nn+bj]));
+  const int rows = n/nn;
+  const int blockSize = nn*mm;
+  const int nnz = rowptr[rows] * blockSize;
+
+  Eigen::SparseMatrix<Float,Major> mat(n, m);
+  mat.resizeNonZeros(nnz);
+  int* outer = mat.outerIndexPtr();
+  int* inner = mat.innerIndexPtr();
+  Float* values = mat.valuePtr();
+
+  if (Major == Eigen::RowMajor) {
+    // Row i*nn+bi holds the bi'th rows of the blocks of block row i. Eigen
+    // requires sorted inner indices, so visit each block row's blocks in
+    // column order.
+    std::vector<int> order;
+    outer[0] = 0;
+    int loc = 0;
+    for (int i=0; i<rows; ++i) {
+      order.resize(rowptr[i+1] - rowptr[i]);
+      for (size_t k=0; k<order.size(); ++k) {
+        order[k] = rowptr[i] + k;
+      }
+      if (!hasSortedRows(1, &rowptr[i], colidx)) {
+        std::sort(order.begin(), order.end(), [colidx](int a, int b) {
+          return colidx[a] < colidx[b];
+        });
+      }
+      for (int bi=0; bi<nn; ++bi) {
+        for (int ij : order) {
+          for (int bj=0; bj<mm; ++bj) {
+            inner[loc] = colidx[ij]*mm + bj;
+            values[loc] = vals[ij*blockSize + bi*mm + bj];
+            ++loc;
+          }
         }
+        outer[i*nn+bi+1] = loc;
       }
     }
   }
-  
-  Eigen::SparseMatrix<Float> mat(n, m);
-  mat.setFromTriplets(tripletList.begin(), tripletList.end());
-  mat.makeCompressed();
+  else {
+    std::vector<int> locs(nnz);
+    csr2cscPattern(n, m, rowptr, colidx, nn, mm, outer, inner, locs.data());
+    for (int k=0; k<nnz; ++k) {
+      values[locs[k]] = vals[k];
+    }
+  }
   return mat;
 }
 
@@ -67,13 +163,10 @@ void eigen2csr(Eigen::SparseMatrix<Float,Major> mat,
   }
 }
 
-template<typename Float> Eigen::Matrix<Float,Eigen::Dynamic,1>
+/// Returns a view of a dense vector that shares its array.
+template<typename Float> Eigen::Map<Eigen::Matrix<Float,Eigen::Dynamic,1>>
 dense2eigen(int n, Float* vals) {
-  auto result = Eigen::Matrix<Float,Eigen::Dynamic,1>(n);
-  for (int i=0; i<n; ++i) {
-    result(i) = vals[i];
-  }
-  return result;
+  return Eigen::Map<Eigen::Matrix<Float,Eigen::Dynamic,1>>(vals, n);
 }
 
 #endif
@@ -25,7 +25,7 @@ struct StencilContent {
   std::string assemblyFunc;
   std::string targetVar;
 
-  mutable long ref = 0;
+  mutable std::atomic<long> ref{0};
   friend inline void aquire(const StencilContent *v) {++v->ref;}
   friend inline void release(const StencilContent *v)
     {if (--v->ref==0) delete v;}
@@ -19,6 +19,7 @@ namespace ir {
 struct TensorStorage::Content {
   Kind        kind;
   TensorIndex index;
+  bool        sliced;
 };
 
 TensorStorage::TensorStorage() : TensorStorage(Kind::Undefined) {
@@ -26,12 +27,14 @@ TensorStorage::TensorStorage() : TensorStorage(Kind::Undefined) {
 
 TensorStorage::TensorStorage(Kind kind) : content(new Content) {
   content->kind = kind;
+  content->sliced = false;
 }
 
 TensorStorage::TensorStorage(Kind kind, const TensorIndex& index)
     : content(new Content) {
   content->kind = kind;
   content->index = index;
+  content->sliced = false;
 }
 
 TensorStorage::Kind TensorStorage::getKind() const {
@@ -66,6 +69,16 @@ void TensorStorage::setTensorIndex(Var tensor) {
   content->index = TensorIndex(tensor.getName()+"_index", pe::PathExpression());
 }
 
+bool TensorStorage::isSliced() const {
+  return content->sliced;
+}
+
+void TensorStorage::setSliced(bool sliced) {
+  simit_iassert(!sliced || getKind() == TensorStorage::Indexed)
+      << "Only indexed matrices can be sliced";
+  content->sliced = sliced;
+}
+
 std::ostream &operator<<(std::ostream &os, const TensorStorage &ts) {
   switch (ts.getKind()) {
     case TensorStorage::Undefined:
@@ -79,6 +92,9 @@ std::ostream &operator<<(std::ostream &os, const TensorStorage &ts) {
       if (ts.hasTensorIndex()) {
         os << " (" << ts.getTensorIndex().getPathExpression() << ")";
       }
+      if (ts.isSliced()) {
+        os << " sliced";
+      }
       break;
     case TensorStorage::Stencil:
       os << "Stencil";
@@ -71,6 +71,16 @@ public:
   /// Set the storage descriptor's tensor index.
   void setTensorIndex(Var tensor);
 
+  /// True if an indexed matrix also keeps its values in a sliced ELLPACK
+  /// (SELL-C-sigma) layout, which is packed after every assembly of the
+  /// matrix and read by its products with vectors (see
+  /// Settings::matrixStorage). The tensor index and the CSR values stay
+  /// authoritative for every other use of the matrix.
+  bool isSliced() const;
+
+  /// Keep (or stop keeping) a sliced copy of an indexed matrix's values.
+  void setSliced(bool sliced);
+
 private:
   struct Content;
   std::shared_ptr<Content> content;
@@ -19,6 +19,8 @@ struct TensorIndex::Content {
   StencilLayout stencil;
   Var coordArray;
   Var sinkArray;
+  Var locationTable;
+  Var locationTableSet;
 };
 
 TensorIndex::TensorIndex(std::string name, pe::PathExpression pexpr)
@@ -32,6 +34,8 @@ TensorIndex::TensorIndex(std::string name, pe::PathExpression pexpr)
                             ArrayType::make(ScalarType::Int));
   content->sinkArray  = Var(prefix + "sinks",
                             ArrayType::make(ScalarType::Int));
+  content->locationTable = Var(prefix + "locs",
+                               ArrayType::make(ScalarType::Int));
 }
 
 TensorIndex::TensorIndex(std::string name, StencilLayout stencil)
@@ -82,6 +86,23 @@ const Var& TensorIndex::getColidxArray() const {
   return content->sinkArray;
 }
 
+const Var& TensorIndex::getLocationTableArray() const {
+  simit_iassert(!isComputed());
+  return content->locationTable;
+}
+
+const Var& TensorIndex::getLocationTableSet() const {
+  simit_iassert(!isComputed());
+  return content->locationTableSet;
+}
+
+void TensorIndex::setLocationTableSet(Var edgeSet) {
+  simit_iassert(!isComputed());
+  simit_iassert(!content->locationTableSet.defined() ||
+                content->locationTableSet == edgeSet);
+  content->locationTableSet = edgeSet;
+}
+
 const Expr TensorIndex::computeRowptr(Expr source) const {
   simit_iassert(isComputed());
   if (getKind() == Sten) {
@@ -113,6 +134,11 @@ ostream &operator<<(ostream& os, const TensorIndex& ti) {
        << endl;
     os << "  " << rowptr << " : " << rowptr.getType() << endl;
     os << "  " << colidx << " : " << colidx.getType();
+    if (ti.getLocationTableSet().defined()) {
+      auto locs = ti.getLocationTableArray();
+      os << endl << "  " << locs << " : " << locs.getType() << " (over "
+         << ti.getLocationTableSet() << ")";
+    }
   }
   else if (ti.getKind() == TensorIndex::Sten) {
     os << "tensor-index " << ti.getName() << ": " << ti.getStencilLayout()
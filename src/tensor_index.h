@@ -69,6 +69,21 @@ public:
   /// Note: only sparse matrix CSR indices are supported for now.
   const Var& getColidxArray() const;
 
+  /// Return the tensor index's location table array.  A location table holds,
+  /// for every edge `e` of the location table set and every pair of its
+  /// endpoints `(i,j)`, the location of `(eps[i],eps[j])` in the colidx array at
+  /// `e*cardinality*cardinality + i*cardinality + j`.  Its first value is
+  /// negative if the table was not built (e.g. because it would be too large).
+  const Var& getLocationTableArray() const;
+
+  /// Return the edge set that the location table is built over, or an
+  /// undefined Var if no assembly uses the location table.
+  const Var& getLocationTableSet() const;
+
+  /// Request a location table over the edges of `edgeSet`, whose endpoints
+  /// must all be in the set of the tensor index's rows and columns.
+  void setLocationTableSet(Var edgeSet);
+
   /// Compute the tensor index's rowptr value for a given source.
   const Expr computeRowptr(Expr base) const;
 
@@ -1,5 +1,5 @@
-#ifndef SIMIT_TEST_H
-#define SIMIT_TEST_H
+#ifndef SIMIT_INTERNAL_TEST_H
+#define SIMIT_INTERNAL_TEST_H
 
 #include <string>
 #include <vector>
@@ -0,0 +1,149 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace simit {
+
+/// Set on pool threads, and on application threads while they run a chunk, so
+/// that a nested parallelFor does not wait on the workers it is running on.
+static thread_local bool inParallelRegion = false;
+
+static unsigned defaultNumThreads() {
+  unsigned hardwareThreads = std::thread::hardware_concurrency();
+  return (hardwareThreads > 0) ? hardwareThreads : 1;
+}
+
+ThreadPool::ThreadPool()
+    : requestedThreads(0), numThreads(1), generation(0), stopping(false),
+      pending(0), jobSize(0), numChunks(0), jobBody(nullptr), jobCtx(nullptr) {
+  startWorkers(defaultNumThreads());
+}
+
+ThreadPool::~ThreadPool() {
+  stopWorkers();
+}
+
+void ThreadPool::setNumThreads(unsigned numThreads) {
+  std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+  if (numThreads == requestedThreads) {
+    return;
+  }
+  requestedThreads = numThreads;
+  stopWorkers();
+  startWorkers((numThreads > 0) ? numThreads : defaultNumThreads());
+}
+
+unsigned ThreadPool::getNumChunks(int n, int grainSize) const {
+  if (n <= 0) {
+    return 0;
+  }
+  return std::min<int64_t>(getNumThreads(), (n + grainSize - 1) / grainSize);
+}
+
+void ThreadPool::parallelFor(int n, ParallelForBody body, void* ctx,
+                             int grainSize) {
+  if (n <= 0) {
+    return;
+  }
+
+  unsigned chunks = getNumChunks(n, grainSize);
+  if (chunks <= 1 || inParallelRegion) {
+    body(0, n, ctx);
+    return;
+  }
+
+  std::unique_lock<std::mutex> dispatchLock(dispatchMutex, std::try_to_lock);
+  if (!dispatchLock.owns_lock()) {
+    body(0, n, ctx);
+    return;
+  }
+  chunks = std::min<unsigned>(chunks, getNumThreads());
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobSize = n;
+    numChunks = chunks;
+    jobBody = body;
+    jobCtx = ctx;
+    pending = chunks - 1;
+    ++generation;
+  }
+  jobReady.notify_all();
+
+  inParallelRegion = true;
+  runChunk(0, n, chunks, body, ctx);
+  inParallelRegion = false;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  jobDone.wait(lock, [this]() {return pending == 0;});
+}
+
+void ThreadPool::startWorkers(unsigned numThreads) {
+  // Workers start from the current generation, rather than reading it when
+  // they are first scheduled, which may be after the next job was published
+  unsigned long start;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = false;
+    start = generation;
+  }
+  for (unsigned id = 0; id + 1 < numThreads; ++id) {
+    workers.push_back(std::thread(&ThreadPool::workerLoop, this, id, start));
+  }
+  this->numThreads = numThreads;
+}
+
+void ThreadPool::stopWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  jobReady.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+  numThreads = 1;
+}
+
+void ThreadPool::runChunk(unsigned chunk, int n, unsigned chunks,
+                          ParallelForBody body, void* ctx) {
+  int begin = (int)(((int64_t)n * chunk) / chunks);
+  int end   = (int)(((int64_t)n * (chunk+1)) / chunks);
+  if (begin < end) {
+    body(begin, end, ctx);
+  }
+}
+
+void ThreadPool::workerLoop(unsigned id, unsigned long seen) {
+  inParallelRegion = true;
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex);
+    jobReady.wait(lock, [&]() {return stopping || generation != seen;});
+    if (stopping) {
+      return;
+    }
+    seen = generation;
+
+    // Worker `id` runs chunk `id+1`; the dispatching thread runs chunk 0
+    unsigned chunk = id + 1;
+    if (chunk >= numChunks) {
+      continue;
+    }
+    int n = jobSize;
+    unsigned chunks = numChunks;
+    ParallelForBody body = jobBody;
+    void* ctx = jobCtx;
+    lock.unlock();
+
+    runChunk(chunk, n, chunks, body, ctx);
+
+    lock.lock();
+    if (--pending == 0) {
+      jobDone.notify_one();
+    }
+  }
+}
+
+}
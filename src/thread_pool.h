@@ -0,0 +1,83 @@
+#ifndef SIMIT_THREAD_POOL_H
+#define SIMIT_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace simit {
+
+/// Signature of the loop bodies executed by the thread pool. The body is
+/// called with a half-open iteration range [begin, end) and an opaque pointer
+/// to the values it captures.
+typedef void (*ParallelForBody)(int begin, int end, void* ctx);
+
+// Singleton
+/// Pool of worker threads that run the parallel loops emitted by the
+/// cpu-parallel backend. Loops are split into one contiguous chunk per thread,
+/// and the calling thread executes the first chunk.
+class ThreadPool {
+public:
+  static ThreadPool& getInstance() {
+    static ThreadPool instance;
+    return instance;
+  }
+
+  /// Execute `body` over the iterations [0, n) and wait for it to finish.
+  /// Nested and concurrent calls run serially on the calling thread. Threads
+  /// are given at least `grainSize` iterations.
+  void parallelFor(int n, ParallelForBody body, void* ctx,
+                   int grainSize=minChunkSize);
+
+  /// The number of chunks parallelFor splits `n` iterations into.
+  unsigned getNumChunks(int n, int grainSize=minChunkSize) const;
+
+  /// Set the number of threads, including the calling thread. Zero means one
+  /// thread per hardware thread. init() applies Settings::numThreads, so the
+  /// loops themselves never resize the pool.
+  void setNumThreads(unsigned numThreads);
+
+  unsigned getNumThreads() const {return numThreads;}
+
+  /// The smallest number of iterations worth giving a thread
+  static const int minChunkSize = 16;
+
+private:
+  ThreadPool();
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /// Serializes parallelFor and setNumThreads calls from different
+  /// application threads, and protects `requestedThreads` and `workers`
+  std::mutex dispatchMutex;
+  unsigned requestedThreads;
+  std::vector<std::thread> workers;
+
+  /// The number of workers plus the calling thread, which may be read
+  /// without holding `dispatchMutex`
+  std::atomic<unsigned> numThreads;
+
+  // Current job, protected by `mutex`
+  std::mutex mutex;
+  std::condition_variable jobReady;
+  std::condition_variable jobDone;
+  unsigned long generation;
+  bool stopping;
+  unsigned pending;
+  int jobSize;
+  unsigned numChunks;
+  ParallelForBody jobBody;
+  void* jobCtx;
+
+  void startWorkers(unsigned numThreads);
+  void stopWorkers();
+  void runChunk(unsigned chunk, int n, unsigned chunks, ParallelForBody body,
+                void* ctx);
+  void workerLoop(unsigned id, unsigned long seen);
+};
+
+}
+#endif
@@ -1,6 +1,8 @@
 #include "util.h"
 
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <functional>
 #include <string>
@@ -132,4 +134,33 @@ void variableLoop(std::vector<int>::const_iterator rangesBegin,
   }
 }
 
+void* alignedMalloc(size_t size) {
+  void* ptr = nullptr;
+  // posix_memalign may return null for zero-sized buffers
+  if (posix_memalign(&ptr, kBufferAlignment, std::max(size, (size_t)1)) != 0) {
+    return nullptr;
+  }
+  return ptr;
+}
+
+void* alignedCalloc(size_t num, size_t size) {
+  void* ptr = alignedMalloc(num*size);
+  if (ptr != nullptr) {
+    memset(ptr, 0, num*size);
+  }
+  return ptr;
+}
+
+void* alignedRealloc(void* ptr, size_t oldSize, size_t newSize) {
+  void* newPtr = alignedMalloc(newSize);
+  if (newPtr == nullptr) {
+    return nullptr;
+  }
+  if (ptr != nullptr) {
+    memcpy(newPtr, ptr, std::min(oldSize, newSize));
+    free(ptr);
+  }
+  return newPtr;
+}
+
 }} // namespace simit::util
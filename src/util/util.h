@@ -89,5 +89,20 @@ void variableLoop(std::vector<int>::const_iterator rangesBegin,
                   std::vector<int>::iterator indicesEnd,
                   std::function<void()> inner);
 
+/// The alignment, in bytes, of the field and temporary buffers that Simit
+/// allocates. Compiled code assumes that temporaries are aligned to it.
+const size_t kBufferAlignment = 64;
+
+/// Allocate `size` bytes aligned to kBufferAlignment. The memory is released
+/// with `free`.
+void* alignedMalloc(size_t size);
+
+/// Allocate `num*size` zeroed bytes aligned to kBufferAlignment.
+void* alignedCalloc(size_t num, size_t size);
+
+/// Resize a buffer allocated by alignedMalloc or alignedCalloc, keeping its
+/// first `min(oldSize, newSize)` bytes. The added bytes are not initialized.
+void* alignedRealloc(void* ptr, size_t oldSize, size_t newSize);
+
 }}
 #endif
@@ -78,3 +78,54 @@ TEST(apply, edges_binary_gather) {
   ASSERT_EQ(3.0, (int)b(e0));
   ASSERT_EQ(5.0, (int)b(e1));
 }
+
+TEST(apply, field_blocks) {
+  if (kBackend != "cpu") {
+    return;
+  }
+  RestoreSettings restoreSettings;
+  Settings settings = getSettings();
+  settings.fieldBlockSize = 4;
+  init(settings);
+
+  // Five points, so that the last field block is partially filled
+  Set points;
+  FieldRef<simit_float,3> x = points.addField<simit_float,3>("x");
+  FieldRef<simit_float,3> v = points.addField<simit_float,3>("v");
+  vector<ElementRef> p;
+  for (int i=0; i < 5; ++i) {
+    p.push_back(points.add());
+    x.set(p[i], {(simit_float)i, 0.0, 0.0});
+    v.set(p[i], {1.0, 2.0, (simit_float)i});
+  }
+  Set springs(points,points);
+  FieldRef<simit_float,3> d = springs.addField<simit_float,3>("d");
+  ElementRef s0 = springs.add(p[0], p[4]);
+  ElementRef s1 = springs.add(p[3], p[2]);
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+  func.runSafe();
+
+  settings.fieldBlockSize = 1;
+  init(settings);
+
+  for (int i=0; i < 5; ++i) {
+    SIMIT_ASSERT_FLOAT_EQ(i+1.0, x(p[i])(0));
+    SIMIT_ASSERT_FLOAT_EQ(2.0,   x(p[i])(1));
+    SIMIT_ASSERT_FLOAT_EQ((simit_float)i, x(p[i])(2));
+  }
+  SIMIT_ASSERT_FLOAT_EQ(4.0,  d(s0)(0));
+  SIMIT_ASSERT_FLOAT_EQ(4.0,  d(s0)(2));
+  SIMIT_ASSERT_FLOAT_EQ(-1.0, d(s1)(0));
+  SIMIT_ASSERT_FLOAT_EQ(0.0,  d(s1)(1));
+
+  // The function addresses fields in blocks of four elements
+  Set unblocked;
+  unblocked.addField<simit_float,3>("x");
+  unblocked.addField<simit_float,3>("v");
+  unblocked.add();
+  ASSERT_THROW(func.bind("points", &unblocked), SimitException);
+}
@@ -1,5 +1,13 @@
 #include "simit-test.h"
 
+#include <dirent.h>
+#include <set>
+#include <sstream>
+#include <unistd.h>
+
+#include "compile_profile.h"
+#include "init.h"
+#include "program.h"
 #include "tensor.h"
 #include "tensor_data.h"
 #include "graph.h"
@@ -137,3 +145,263 @@ TEST(Function, bindSparseTensor) {
   ASSERT_EQ(-3, A_vals[2]);
   ASSERT_EQ(-4, A_vals[3]);
 }
+
+/// Tests of a program whose main function doubles the a field of the
+/// vertices in V
+class VertexFunction : public ::testing::Test {
+protected:
+  static const std::string source;
+};
+
+const std::string VertexFunction::source =
+    "element Vertex\n"
+    "  a : int;\n"
+    "end\n"
+    "extern V : set{Vertex};\n"
+    "func f(inout v : Vertex)\n"
+    "  v.a = 2 * v.a;\n"
+    "end\n"
+    "export func main()\n"
+    "  apply f to V;\n"
+    "end\n";
+
+TEST_F(VertexFunction, jitCache) {
+  if (simit::kBackend != "cpu") {
+    return;
+  }
+  char cacheDir[] = "/tmp/simit-jit-cache-XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(cacheDir));
+
+  RestoreSettings restoreSettings;
+  simit::Settings settings = simit::getSettings();
+  settings.jitCacheDir = cacheDir;
+  simit::init(settings);
+
+  simit::Set V;
+  auto a = V.addField<int>("a");
+  simit::ElementRef v0 = V.add();
+  a(v0) = 3;
+
+  // The second compilation loads the machine code stored by the first
+  for (int i=0; i < 2; ++i) {
+    simit::Program program;
+    ASSERT_EQ(0, program.loadString(source));
+    simit::Function function = program.compile("main");
+    function.bind("V", &V);
+    function.runSafe();
+  }
+
+  std::vector<std::string> objects;
+  DIR* dir = opendir(cacheDir);
+  ASSERT_NE(nullptr, dir);
+  while (struct dirent* entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name != "." && name != "..") {
+      objects.push_back(name);
+    }
+  }
+  closedir(dir);
+  for (auto& object : objects) {
+    unlink((std::string(cacheDir) + "/" + object).c_str());
+  }
+  rmdir(cacheDir);
+
+  ASSERT_EQ(12, (int)a(v0));
+  ASSERT_EQ(1u, objects.size());
+}
+
+TEST_F(VertexFunction, printObject) {
+  if (simit::kBackend != "cpu") {
+    return;
+  }
+  simit::Program program;
+  ASSERT_EQ(0, program.loadString(source));
+  simit::Function function = program.compile("main");
+
+  std::stringstream object;
+  function.printObject(object);
+  ASSERT_FALSE(object.str().empty());
+
+  std::stringstream header;
+  function.printHeader(header);
+  std::string declarations = header.str();
+  ASSERT_NE(std::string::npos,
+            declarations.find("extern struct __attribute__((packed)) "
+                              "{ int32_t size; int32_t* a; } V;"));
+  for (std::string name : {"main_init", "main", "main_deinit"}) {
+    ASSERT_NE(std::string::npos,
+              declarations.find("void " + name + "_harness(void);"));
+  }
+}
+
+TEST(Function, printObjectRuntimeCall) {
+  if (simit::kBackend != "cpu") {
+    return;
+  }
+  // atan2 is implemented in the Simit runtime
+  std::string source =
+      "element Vertex\n"
+      "  b : float;\n"
+      "end\n"
+      "extern V : set{Vertex};\n"
+      "func f(inout v : Vertex)\n"
+      "  v.b = atan2(v.b, 1.0);\n"
+      "end\n"
+      "export func main()\n"
+      "  apply f to V;\n"
+      "end\n";
+
+  simit::Program program;
+  ASSERT_EQ(0, program.loadString(source));
+  simit::Function function = program.compile("main");
+
+  std::stringstream object;
+  ASSERT_THROW(function.printObject(object), simit::SimitException);
+}
+
+TEST(Function, fieldAliasMetadata) {
+  if (simit::kBackend == "gpu") {
+    return;
+  }
+  RestoreSettings restoreSettings;
+  simit::Settings settings = simit::getSettings();
+  settings.backend = "cpu-parallel";
+  simit::init(settings);
+
+  // The apply is an independent kernel that reads a and writes b
+  std::string source =
+      "element Vertex\n"
+      "  a : float;\n"
+      "  b : float;\n"
+      "end\n"
+      "extern V : set{Vertex};\n"
+      "func f(inout v : Vertex)\n"
+      "  v.b = 2.0 * v.a;\n"
+      "end\n"
+      "export func main()\n"
+      "  apply f to V;\n"
+      "end\n";
+
+  simit::Program program;
+  ASSERT_EQ(0, program.loadString(source));
+  simit::Function function = program.compile("main");
+
+  std::stringstream ir;
+  function.print(ir);
+  std::string module = ir.str();
+  ASSERT_NE(std::string::npos, module.find("!alias.scope"));
+  ASSERT_NE(std::string::npos, module.find("!noalias"));
+  ASSERT_NE(std::string::npos, module.find("!llvm.mem.parallel_loop_access"));
+  ASSERT_NE(std::string::npos, module.find("!llvm.loop"));
+}
+
+TEST_F(VertexFunction, specialize) {
+  simit::Program program;
+  ASSERT_EQ(0, program.loadString(source));
+  simit::Function function = program.compile("main");
+
+  simit::Set V;
+  auto a = V.addField<int>("a");
+  for (int i=0; i < 3; ++i) {
+    a(V.add()) = i;
+  }
+  function.bind("V", &V);
+  function.specialize();
+  function.runSafe();
+
+  // Binding a set of another size falls back to the generic function
+  simit::Set W;
+  auto b = W.addField<int>("a");
+  for (int i=0; i < 5; ++i) {
+    b(W.add()) = i;
+  }
+  function.bind("V", &W);
+  function.runSafe();
+
+  int i = 0;
+  for (simit::ElementRef v : V) {
+    ASSERT_EQ(2*i, (int)a(v));
+    ++i;
+  }
+  i = 0;
+  for (simit::ElementRef w : W) {
+    ASSERT_EQ(2*i, (int)b(w));
+    ++i;
+  }
+
+  // Resizing a set bound to a specialized function also falls back to the
+  // generic function
+  function.bind("V", &V);
+  function.specialize();
+  a(V.add()) = 3;
+  function.runSafe();
+  i = 0;
+  for (simit::ElementRef v : V) {
+    ASSERT_EQ((i < 3) ? 4*i : 2*i, (int)a(v));
+    ++i;
+  }
+  ASSERT_EQ(4, i);
+}
+
+TEST_F(VertexFunction, compileProfile) {
+  RestoreSettings restoreSettings;
+  simit::Settings settings = simit::getSettings();
+  settings.profileCompilation = true;
+  simit::init(settings);
+
+  simit::Program program;
+  ASSERT_EQ(0, program.loadString(source));
+  simit::Function function = program.compile("main");
+
+  settings.profileCompilation = false;
+  simit::init(settings);
+  ASSERT_EQ(nullptr, program.compile("main").getCompileProfile());
+
+  const simit::CompileProfile* profile = function.getCompileProfile();
+  ASSERT_NE(nullptr, profile);
+  ASSERT_EQ("main", profile->getFunctionName());
+  std::set<std::string> passes;
+  for (const simit::PassProfile& pass : profile->getPasses()) {
+    ASSERT_GE(pass.seconds, 0.0);
+    passes.insert(pass.name);
+  }
+  ASSERT_EQ(1u, passes.count("Inline Function Calls"));
+  ASSERT_EQ(1u, passes.count("Lower Maps"));
+  if (simit::kBackend != "gpu") {
+    ASSERT_EQ(1u, passes.count("LLVM IR Generation"));
+  }
+  ASSERT_GT(profile->getPasses().front().irSize, 0u);
+  ASSERT_GT(profile->getTotalSeconds(), 0.0);
+}
+
+TEST_F(VertexFunction, compileAll) {
+  std::string thrice =
+      "func g(inout v : Vertex)\n"
+      "  v.a = 3 * v.a;\n"
+      "end\n"
+      "export func thrice()\n"
+      "  apply g to V;\n"
+      "end\n";
+
+  simit::Program program;
+  ASSERT_EQ(0, program.loadString(source + thrice));
+  std::vector<simit::Function> functions =
+      program.compileAll({"main", "thrice", "main", "thrice"});
+  ASSERT_EQ(4u, functions.size());
+
+  simit::Set V;
+  auto a = V.addField<int>("a");
+  for (int i=0; i < 3; ++i) {
+    a(V.add()) = i;
+  }
+  for (simit::Function& function : functions) {
+    function.bind("V", &V);
+    function.runSafe();
+  }
+
+  int i = 0;
+  for (simit::ElementRef v : V) {
+    ASSERT_EQ(36*i, (int)a(v));
+    ++i;
+  }
+}
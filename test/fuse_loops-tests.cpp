@@ -0,0 +1,128 @@
+#include "simit-test.h"
+
+#include "graph.h"
+#include "ir.h"
+#include "program.h"
+#include "lower/fuse_loops.h"
+
+using namespace simit::ir;
+
+/// Returns the statements of the body of `func`, looking through the scopes
+/// that For::make adds.
+static std::vector<Stmt> getStmts(const Func& func) {
+  std::vector<Stmt> stmts;
+  std::vector<Stmt> worklist = {func.getBody()};
+  while (!worklist.empty()) {
+    Stmt stmt = worklist.back();
+    worklist.pop_back();
+    if (isa<Block>(stmt)) {
+      if (to<Block>(stmt)->rest.defined()) {
+        worklist.push_back(to<Block>(stmt)->rest);
+      }
+      worklist.push_back(to<Block>(stmt)->first);
+    }
+    else if (isa<Scope>(stmt)) {
+      worklist.push_back(to<Scope>(stmt)->scopedStmt);
+    }
+    else {
+      stmts.push_back(stmt);
+    }
+  }
+  return stmts;
+}
+
+TEST(FuseLoops, ownedAccesses) {
+  Type vertexType = ElementType::make("Vertex", {Field("x", Vec3f),
+                                                 Field("v", Vec3f)});
+  Type vertexSetType = UnstructuredSetType::make(vertexType, {});
+  Var V("V", vertexSetType);
+  Var p("p", Int);
+  Var q("q", Int);
+  Var i("i", Int);
+  Var j("j", Int);
+  Expr x = FieldRead::make(V, "x");
+  Expr v = FieldRead::make(V, "v");
+
+  // V.v = 2*V.v; V.x = V.x + V.v;
+  Expr ploc = Add::make(Mul::make(p, 3), i);
+  Expr qloc = Add::make(Mul::make(q, 3), j);
+  Stmt scale = For::make(p, ForDomain(IndexSet(V)),
+      ForRange::make(i, 0, 3,
+                     Store::make(v, ploc, Mul::make(Load::make(v, ploc),
+                                                    Literal::make(2.0)))));
+  Stmt move = For::make(q, ForDomain(IndexSet(V)),
+      ForRange::make(j, 0, 3,
+                     Store::make(x, qloc, Load::make(v, qloc),
+                                 CompoundOperator::Add)));
+  Func func("f", {V}, {}, Block::make(scale, move));
+
+  std::vector<Stmt> stmts = getStmts(fuseLoops(func));
+  ASSERT_EQ(1u, stmts.size());
+  ASSERT_TRUE(isa<For>(stmts[0]));
+}
+
+TEST(FuseLoops, crossIterationAccesses) {
+  Type vertexType = ElementType::make("Vertex", {Field("a", Int),
+                                                 Field("b", Int)});
+  Type vertexSetType = UnstructuredSetType::make(vertexType, {});
+  Var V("V", vertexSetType);
+  Var p("p", Int);
+  Var q("q", Int);
+  Var sum("sum", Int);
+  Expr a = FieldRead::make(V, "a");
+  Expr b = FieldRead::make(V, "b");
+
+  // The second loop reads a location the first writes in the next iteration
+  Stmt write = For::make(p, ForDomain(IndexSet(V)),
+                         Store::make(a, p, Load::make(b, p)));
+  Stmt shift = For::make(q, ForDomain(IndexSet(V)),
+                         Store::make(b, q, Load::make(a, q+1)));
+  Func shiftFunc("f", {V}, {}, Block::make(write, shift));
+  ASSERT_EQ(2u, getStmts(fuseLoops(shiftFunc)).size());
+
+  // The second loop reads a reduction computed by the first
+  Stmt reduce = For::make(p, ForDomain(IndexSet(V)),
+                          AssignStmt::make(sum, Load::make(a, p),
+                                           CompoundOperator::Add));
+  Stmt scatter = For::make(q, ForDomain(IndexSet(V)),
+                           Store::make(b, q, sum));
+  Func reduceFunc("f", {V}, {sum}, Block::make(reduce, scatter));
+  ASSERT_EQ(2u, getStmts(fuseLoops(reduceFunc)).size());
+}
+
+TEST(FuseLoops, elementwiseStatements) {
+  std::string source =
+      "element Point\n"
+      "  x : vector[3](float);\n"
+      "  v : vector[3](float);\n"
+      "end\n"
+      "extern points : set{Point};\n"
+      "export func step()\n"
+      "  points.v = 0.5 * points.v;\n"
+      "  points.x = points.x + points.v;\n"
+      "end\n";
+
+  simit::Program program;
+  ASSERT_EQ(0, program.loadString(source));
+  simit::Function step = program.compile("step");
+
+  simit::Set points;
+  auto x = points.addField<simit_float,3>("x");
+  auto v = points.addField<simit_float,3>("v");
+  for (int i = 0; i < 4; ++i) {
+    simit::ElementRef p = points.add();
+    x.set(p, {simit_float(i), 0.0, 1.0});
+    v.set(p, {2.0, simit_float(2*i), 0.0});
+  }
+  step.bind("points", &points);
+  step.runSafe();
+
+  int i = 0;
+  for (simit::ElementRef p : points) {
+    ASSERT_EQ(simit_float(i + 1.0), x.get(p)(0));
+    ASSERT_EQ(simit_float(i),       x.get(p)(1));
+    ASSERT_EQ(simit_float(1.0),     x.get(p)(2));
+    ASSERT_EQ(simit_float(1.0),     v.get(p)(0));
+    ++i;
+  }
+}
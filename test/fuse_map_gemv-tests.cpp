@@ -0,0 +1,140 @@
+#include "simit-test.h"
+
+#include "ir.h"
+#include "ir_builder.h"
+#include "ir_visitor.h"
+#include "inline.h"
+#include "program_context.h"
+#include "frontend/frontend.h"
+#include "lower/fuse_map_gemv.h"
+
+using namespace simit::ir;
+
+/// Returns the maps in the body of `func`.
+static std::vector<const Map*> getMaps(const Func& func) {
+  std::vector<const Map*> maps;
+  match(func.getBody(), std::function<void(const Map*)>([&](const Map* op) {
+    maps.push_back(op);
+  }));
+  return maps;
+}
+
+/// Returns `A = map dist_a to springs reduce +`, where dist_a writes `s.a` to
+/// the four blocks of `A` at the spring's endpoints.
+static Stmt assemble(const Var& A, const Var& springs) {
+  Type springType = springs.getType().toUnstructuredSet()->elementType;
+  Type pointType =
+      to<VarExpr>(*springs.getType().toUnstructuredSet()->endpointSets[0])
+          ->var.getType().toUnstructuredSet()->elementType;
+  Var s("s", springType);
+  Var p("p", UnnamedTupleType::make(pointType, 2));
+  Var result("A", A.getType());
+
+  Expr a = FieldRead::make(s, "a");
+  std::vector<Stmt> writes;
+  for (int i = 0; i < 2; ++i) {
+    for (int j = 0; j < 2; ++j) {
+      writes.push_back(TensorWrite::make(result,
+                                         {UnnamedTupleRead::make(p, i),
+                                          UnnamedTupleRead::make(p, j)}, a));
+    }
+  }
+  Func distA("dist_a", {s, p}, {result}, Block::make(writes));
+
+  std::vector<Expr> endpoints =
+      {*springs.getType().toUnstructuredSet()->endpointSets[0],
+       *springs.getType().toUnstructuredSet()->endpointSets[1]};
+  return Map::make({A}, distA, {}, springs, endpoints, Expr(),
+                   ReductionOperator::Sum);
+}
+
+TEST(FuseMapGemv, fieldProduct) {
+  Type pointType = ElementType::make("Point", {Field("b", Float),
+                                               Field("c", Float)});
+  Type springType = ElementType::make("Spring", {Field("a", Float)});
+  Var points("points", UnstructuredSetType::make(pointType, {}));
+  Var springs("springs", UnstructuredSetType::make(springType,
+                                                   {points, points}));
+  Var A("A", TensorType::make(ScalarType::Float,
+                              {IndexDomain(IndexSet(points)),
+                               IndexDomain(IndexSet(points))}));
+
+  // A = map dist_a to springs reduce +; points.c = A * points.b;
+  Expr product = IRBuilder().gemv(A, FieldRead::make(points, "b"));
+  Stmt body = Block::make({VarDecl::make(A), assemble(A, springs),
+                           FieldWrite::make(points, "c", product)});
+  Func func("main", {points, springs}, {}, body);
+
+  std::vector<const Map*> maps = getMaps(fuseMapGemv(func));
+  ASSERT_EQ(1u, maps.size());
+  ASSERT_EQ(1u, maps[0]->vars[0].getType().toTensor()->order());
+  ASSERT_EQ(1u,
+            maps[0]->function.getResults()[0].getType().toTensor()->order());
+}
+
+TEST(FuseMapGemv, matrixUsedTwice) {
+  Type pointType = ElementType::make("Point", {Field("b", Float),
+                                               Field("c", Float)});
+  Type springType = ElementType::make("Spring", {Field("a", Float)});
+  Var points("points", UnstructuredSetType::make(pointType, {}));
+  Var springs("springs", UnstructuredSetType::make(springType,
+                                                   {points, points}));
+  Type matrixType = TensorType::make(ScalarType::Float,
+                                     {IndexDomain(IndexSet(points)),
+                                      IndexDomain(IndexSet(points))});
+  Var A("A", matrixType);
+  Var B("B", matrixType);
+
+  // The matrix is kept if it is used again after the product
+  Expr product = IRBuilder().gemv(A, FieldRead::make(points, "b"));
+  Stmt body = Block::make({VarDecl::make(A), assemble(A, springs),
+                           FieldWrite::make(points, "c", product),
+                           AssignStmt::make(B, A)});
+  Func func("main", {points, springs}, {B}, body);
+
+  std::vector<const Map*> maps = getMaps(fuseMapGemv(func));
+  ASSERT_EQ(1u, maps.size());
+  ASSERT_EQ(2u, maps[0]->vars[0].getType().toTensor()->order());
+}
+
+TEST(FuseMapGemv, otherSetField) {
+  Type pointType = ElementType::make("Point", {Field("b", Float),
+                                               Field("c", Float)});
+  Type springType = ElementType::make("Spring", {Field("a", Float)});
+  Var points("points", UnstructuredSetType::make(pointType, {}));
+  Var others("others", UnstructuredSetType::make(pointType, {}));
+  Var springs("springs", UnstructuredSetType::make(springType,
+                                                   {points, points}));
+  Var A("A", TensorType::make(ScalarType::Float,
+                              {IndexDomain(IndexSet(points)),
+                               IndexDomain(IndexSet(points))}));
+
+  // The product is not fused into a field of another set than A's rows
+  Expr product = IRBuilder().gemv(A, FieldRead::make(points, "b"));
+  Stmt body = Block::make({VarDecl::make(A), assemble(A, springs),
+                           FieldWrite::make(others, "c", product)});
+  Func func("main", {points, others, springs}, {}, body);
+
+  std::vector<const Map*> maps = getMaps(fuseMapGemv(func));
+  ASSERT_EQ(1u, maps.size());
+  ASSERT_EQ(2u, maps[0]->vars[0].getType().toTensor()->order());
+}
+
+TEST(FuseMapGemv, program) {
+  // The functions that system.gemv_fused compares
+  simit::internal::ProgramContext ctx;
+  std::vector<simit::ParseError> errors;
+  simit::internal::Frontend().parseFile(
+      std::string(TEST_INPUT_DIR) + "/system/gemv_fused.sim", &ctx, &errors);
+  ASSERT_TRUE(errors.empty());
+
+  std::vector<const Map*> fused =
+      getMaps(fuseMapGemv(inlineCalls(ctx.getFunction("fused"))));
+  ASSERT_EQ(1u, fused.size());
+  ASSERT_EQ(1u, fused[0]->vars[0].getType().toTensor()->order());
+
+  std::vector<const Map*> unfused =
+      getMaps(fuseMapGemv(inlineCalls(ctx.getFunction("unfused"))));
+  ASSERT_EQ(1u, unfused.size());
+  ASSERT_EQ(2u, unfused[0]->vars[0].getType().toTensor()->order());
+}
@@ -61,6 +61,79 @@ TEST(Set, IncreaseCapacity) {
   ASSERT_EQ(count, 1029);
 }
 
+TEST(Set, AddN) {
+  Set myset;
+  auto fld = myset.addField<int>("foo");
+
+  myset.reserve(5000);
+  ASSERT_GE(myset.getCapacity(), 5000);
+  ElementRef first = myset.add();
+  fld.set(first, 42);
+  myset.remove(first);
+
+  // Bulk-added elements start out zeroed, also where elements were removed
+  ElementRef item = myset.addN(5000);
+  ASSERT_EQ(myset.getSize(), 5000);
+  ASSERT_EQ(myset.getCapacity(), 5000);
+  ASSERT_EQ(fld.get(item), 0);
+  int count = 0;
+  for (auto it : myset) {
+    ASSERT_EQ(fld.get(it), 0);
+    fld.set(it, count++);
+  }
+
+  // Adding past the capacity keeps the values of existing elements
+  myset.addN(10);
+  ASSERT_EQ(myset.getSize(), 5010);
+  ASSERT_GE(myset.getCapacity(), 7500);
+  count = 0;
+  for (auto it : myset) {
+    ASSERT_EQ(fld.get(it), (count < 5000) ? count : 0);
+    count++;
+  }
+  ASSERT_EQ(count, 5010);
+}
+
+TEST(Set, FieldBlocks) {
+  RestoreSettings restoreSettings;
+  Settings settings = getSettings();
+  settings.fieldBlockSize = 4;
+  init(settings);
+  Set myset;
+  ASSERT_EQ(myset.getFieldBlockSize(), 4);
+
+  auto x = myset.addField<int,2>("x");
+  auto y = myset.addField<int>("y");
+  vector<ElementRef> elems;
+  for (int i=0; i < 6; ++i) {
+    elems.push_back(myset.add());
+    x.set(elems[i], {i, 10*i});
+    y.set(elems[i], 100*i);
+  }
+
+  // Vector fields store the first components of a block, then the second
+  const int* xData = static_cast<int*>(x.getData());
+  const int expected[] = {0,1,2,3, 0,10,20,30, 4,5};
+  for (int i=0; i < 10; ++i) {
+    ASSERT_EQ(expected[i], xData[i]);
+  }
+  ASSERT_EQ(50, xData[13]);
+  ASSERT_EQ(500, static_cast<int*>(y.getData())[5]);
+
+  // Removing an element moves every component of the last element
+  myset.remove(elems[1]);
+  ASSERT_EQ(5, x.get(elems[1])(0));
+  ASSERT_EQ(50, x.get(elems[1])(1));
+  ASSERT_EQ(500, (int)y.get(elems[1]));
+
+  // Growing the set keeps the blocks
+  myset.addN(2000);
+  ASSERT_EQ(0, myset.getCapacity() % 4);
+  ASSERT_EQ(4, x.get(elems[4])(0));
+  ASSERT_EQ(40, x.get(elems[4])(1));
+  ASSERT_EQ(0, x.get(elems[5])(1));
+}
+
 TEST(Set, FieldAccessByName) {
   Set myset;
   
@@ -287,6 +360,116 @@ TEST(EdgeSet, EdgeIteratorTest) {
   ASSERT_EQ(count, 4);
 }
 
+TEST(EdgeSet, AddN) {
+  Set points;
+  FieldRef<simit_float> x = points.addField<simit_float>("x");
+  ElementRef p = points.addN(3);
+  ASSERT_EQ(points.getSize(), 3);
+  simit_float value = 0.0;
+  for (auto point : points) {
+    x.set(point, value);
+    value += 1.0;
+  }
+
+  Set edges(points, points);
+  FieldRef<int> y = edges.addField<int>("y");
+  const int endpoints[] = {0,1, 1,2, 2,0};
+  ElementRef e = edges.addN(endpoints, 3);
+  ASSERT_EQ(edges.getSize(), 3);
+
+  int count = 0;
+  for (auto edge : edges) {
+    ASSERT_EQ(y.get(edge), 0);
+    SIMIT_ASSERT_FLOAT_EQ(x.get(edges.getEndpoint(edge,0)),
+                          endpoints[2*count]);
+    SIMIT_ASSERT_FLOAT_EQ(x.get(edges.getEndpoint(edge,1)),
+                          endpoints[2*count+1]);
+    count++;
+  }
+  ASSERT_EQ(count, 3);
+  ASSERT_EQ(edges.getEndpoint(e,0), p);
+
+  // Edges need endpoints, unless none are added
+  ASSERT_THROW(edges.addN(nullptr, 1), simit::SimitException);
+  ASSERT_THROW(edges.addN(2), simit::SimitException);
+  edges.addN(nullptr, 0);
+  ASSERT_EQ(edges.getSize(), 3);
+}
+
+TEST(EdgeSet, ExternalData) {
+  simit_float xs[] = {0.0, 1.0, 2.0, 3.0};
+  int endpoints[] = {0,1, 1,2, 2,3};
+  simit_float ks[] = {10.0, 20.0, 30.0, 0.0};
+
+  Set points;
+  points.addN(4);
+  FieldRef<simit_float> x = points.addField<simit_float>("x", xs, 4);
+  ASSERT_EQ(points.getCapacity(), 4);
+  ASSERT_EQ(points.getFieldData("x"), (void*)xs);
+
+  Set springs(points, points);
+  springs.setEndpoints(endpoints, 3);
+  FieldRef<simit_float> k = springs.addField<simit_float>("k", ks, 4);
+  ASSERT_EQ(springs.getSize(), 3);
+  ASSERT_EQ(springs.getEndpointsData(), endpoints);
+
+  // Reads and writes go to the caller's buffers
+  simit_float sum = 0.0;
+  for (auto spring : springs) {
+    sum += k.get(spring) * x.get(springs.getEndpoint(spring,1));
+    x.set(springs.getEndpoint(spring,0), -1.0);
+  }
+  SIMIT_ASSERT_FLOAT_EQ(sum, 140.0);
+  SIMIT_ASSERT_FLOAT_EQ(xs[0], -1.0);
+  SIMIT_ASSERT_FLOAT_EQ(xs[2], -1.0);
+  SIMIT_ASSERT_FLOAT_EQ(xs[3], 3.0);
+
+  // Removing and adding elements updates the caller's buffers in place
+  vector<ElementRef> pts;
+  for (auto point : points) {
+    pts.push_back(point);
+  }
+  springs.remove(*springs.begin());
+  springs.add(pts[3], pts[0]);
+  ASSERT_EQ(springs.getSize(), 3);
+  ASSERT_EQ(endpoints[0], 2);
+  ASSERT_EQ(endpoints[1], 3);
+  ASSERT_EQ(endpoints[4], 3);
+  ASSERT_EQ(endpoints[5], 0);
+  SIMIT_ASSERT_FLOAT_EQ(ks[0], 30.0);
+}
+
+TEST(EdgeSet, ExternalDataOverlap) {
+  simit_float xs[8] = {};
+  Set points;
+  points.addN(4);
+  points.addField<simit_float>("x", xs, 4);
+
+  // Compiled functions assume that distinct fields do not overlap
+  ASSERT_THROW(points.addField<simit_float>("y", xs, 4),
+               simit::SimitException);
+  ASSERT_THROW(points.addField<simit_float>("y", xs + 2, 4),
+               simit::SimitException);
+  points.addField<simit_float>("y", xs + 4, 4);
+  ASSERT_EQ(points.getFieldData("y"), (void*)(xs + 4));
+}
+
+TEST(Set, FieldAlignment) {
+  Set points;
+  points.addField<char>("c");
+  points.addField<simit_float,3>("x");
+  points.addField<int>("i");
+  for (int n : {0, 1, 17, 1000}) {
+    while (points.getSize() < n) {
+      points.add();
+    }
+    for (const char* field : {"c", "x", "i"}) {
+      ASSERT_EQ(0u, (uintptr_t)points.getFieldData(field) %
+                    util::kBufferAlignment);
+    }
+  }
+}
+
 TEST(GraphGenerator, createBox) {
   Set points;
   Set edges(points, points);
@@ -0,0 +1,305 @@
+#include "simit-test.h"
+
+#include <thread>
+
+#include "graph.h"
+#include "edge_coloring.h"
+#include "ir.h"
+#include "path_expressions.h"
+#include "tensor_index.h"
+#include "lower/lower_parallel_loops.h"
+
+using namespace simit::ir;
+
+/// Returns the loop in the body of `func`, which For::make puts in a scope
+static Stmt getLoop(const Func& func) {
+  Stmt body = func.getBody();
+  return isa<Scope>(body) ? to<Scope>(body)->scopedStmt : body;
+}
+
+TEST(ParallelLoops, kernel) {
+  Type vertexType = ElementType::make("Vertex", {Field("field", Int)});
+  Type vertexSetType = UnstructuredSetType::make(vertexType, {});
+  Var V("V", vertexSetType);
+  Var v("v", Int);
+  Var tmp("tmp", Int);
+  Expr field = FieldRead::make(V, "field");
+  Stmt body = Block::make({VarDecl::make(tmp),
+                           AssignStmt::make(tmp, Load::make(field, v)),
+                           Store::make(field, v, -(tmp * 2))});
+  Stmt kernel = Kernel::make(v, IndexDomain(IndexSet(V)), body);
+
+  // Create environment and compile
+  Environment env;
+  env.addExtern(V);
+  simit::Function function = getTestBackend()->compile(kernel, env);
+
+  // Create and bind arguments. Use enough elements to be split across threads.
+  const int numElements = 10000;
+  simit::Set VArg;
+  auto fieldRef = VArg.addField<int>("field");
+  std::vector<simit::ElementRef> elements;
+  for (int i = 0; i < numElements; ++i) {
+    elements.push_back(VArg.add());
+    fieldRef(elements.back()) = i;
+  }
+  function.bind("V", &VArg);
+
+  // Run and check output
+  function.runSafe();
+  for (int i = 0; i < numElements; ++i) {
+    ASSERT_EQ(-2*i, fieldRef(elements[i]));
+  }
+}
+
+TEST(ParallelLoops, lowerOwnedStores) {
+  Type vertexType = ElementType::make("Vertex", {Field("x", Vec3f)});
+  Type vertexSetType = UnstructuredSetType::make(vertexType, {});
+  Var V("V", vertexSetType);
+  Var v("v", Int);
+  Var i("i", Int);
+  Expr x = FieldRead::make(V, "x");
+  Expr loc = Add::make(Mul::make(v, 3), i);
+  Stmt loop = For::make(v, ForDomain(IndexSet(V)),
+                        ForRange::make(i, 0, 3,
+                                       Store::make(x, loc, Load::make(x, loc),
+                                                   CompoundOperator::Add)));
+  Func func("f", {V}, {}, loop);
+
+  Func parallel = lowerParallelLoops(func);
+  ASSERT_TRUE(isa<Kernel>(getLoop(parallel)));
+}
+
+TEST(ParallelLoops, lowerCrossIterationAccesses) {
+  Type vertexType = ElementType::make("Vertex", {Field("a", Int)});
+  Type vertexSetType = UnstructuredSetType::make(vertexType, {});
+  Var V("V", vertexSetType);
+  Var v("v", Int);
+  Var sum("sum", Int);
+  Expr a = FieldRead::make(V, "a");
+
+  // Reductions into variables declared outside the loop are not parallel
+  Stmt reduction = For::make(v, ForDomain(IndexSet(V)),
+                             AssignStmt::make(sum, Load::make(a, v),
+                                              CompoundOperator::Add));
+  Func reductionFunc("f", {V}, {sum}, reduction);
+  ASSERT_TRUE(isa<For>(getLoop(lowerParallelLoops(reductionFunc))));
+
+  // Reading a location written by another iteration is not parallel
+  Stmt shift = For::make(v, ForDomain(IndexSet(V)),
+                         Store::make(a, v, Load::make(a, v+1)));
+  Func shiftFunc("f", {V}, {}, shift);
+  ASSERT_TRUE(isa<For>(getLoop(lowerParallelLoops(shiftFunc))));
+}
+
+TEST(ParallelLoops, lowerEndpointStores) {
+  Type vertexType = ElementType::make("Vertex", {Field("x", Int)});
+  Type vertexSetType = UnstructuredSetType::make(vertexType, {});
+  Var V("V", vertexSetType);
+  Type edgeType = ElementType::make("Edge", {Field("w", Int)});
+  Type edgeSetType = UnstructuredSetType::make(edgeType, {V, V});
+  Var E("E", edgeSetType);
+  Var e("e", Int);
+  Var i("i", Int);
+  Var ep("ep", Int);
+  Expr x = FieldRead::make(V, "x");
+  Expr w = FieldRead::make(E, "w");
+  Expr endpoints = IndexRead::make(E, IndexRead::Endpoints);
+
+  // Scattering edge values to the endpoints requires a coloring of the edges
+  Stmt body = ForRange::make(i, 0, 2, Block::make(
+      AssignStmt::make(ep, Load::make(endpoints, Add::make(Mul::make(e,2), i))),
+      Store::make(x, ep, Load::make(w, e), CompoundOperator::Add)));
+  Stmt loop = For::make(e, ForDomain(IndexSet(E)),
+                        Block::make(VarDecl::make(ep), body));
+  Func func("f", {V, E}, {}, loop);
+
+  Func parallel = lowerParallelLoops(func);
+  ASSERT_TRUE(isa<Kernel>(getLoop(parallel)));
+  ASSERT_EQ(Kernel::Adaptive, to<Kernel>(getLoop(parallel))->schedule);
+  ASSERT_EQ(1u, to<Kernel>(getLoop(parallel))->reductions.size());
+
+  Func colored = lowerParallelLoops(func, "coloring");
+  ASSERT_TRUE(isa<Kernel>(getLoop(colored)));
+  ASSERT_EQ(Kernel::Colored, to<Kernel>(getLoop(colored))->schedule);
+
+  Func privatized = lowerParallelLoops(func, "privatization");
+  ASSERT_TRUE(isa<Kernel>(getLoop(privatized)));
+  ASSERT_EQ(Kernel::Privatized, to<Kernel>(getLoop(privatized))->schedule);
+}
+
+TEST(ParallelLoops, lowerLocationTableStores) {
+  Type vertexType = ElementType::make("Vertex", {Field("a", Int)});
+  Type vertexSetType = UnstructuredSetType::make(vertexType, {});
+  Var V("V", vertexSetType);
+  Type edgeType = ElementType::make("Edge", {});
+  Type edgeSetType = UnstructuredSetType::make(edgeType, {V, V});
+  Var E("E", edgeSetType);
+  Var A("A", Int);
+  Expr a = FieldRead::make(V, "a");
+  Var e("e", Int);
+  Var i("i", Int);
+  Var j("j", Int);
+
+  simit::pe::Var pv("v", simit::pe::Set("V"));
+  simit::pe::Var pe("e", simit::pe::Set("E"));
+  simit::pe::PathExpression ve = simit::pe::Link::make(pv, pe,
+                                                       simit::pe::Link::ve);
+  Environment env;
+  env.addTensorIndex(ve, A);
+  TensorIndex index = env.getTensorIndex(ve);
+
+  // Adds to locations read from the location table of E
+  Expr loc = Load::make(index.getLocationTableArray(), e*4 + i*2 + j);
+  Stmt loop = For::make(e, ForDomain(IndexSet(E)),
+                        ForRange::make(i, 0, 2, ForRange::make(j, 0, 2,
+                            Store::make(a, loc, 1, CompoundOperator::Add))));
+  Func func("f", {V, E}, {}, loop, env);
+  Func privatized = lowerParallelLoops(func, "coloring");
+  ASSERT_TRUE(isa<Kernel>(getLoop(privatized)));
+  ASSERT_EQ(Kernel::Privatized, to<Kernel>(getLoop(privatized))->schedule);
+
+  index.setLocationTableSet(E);
+  Func colored = lowerParallelLoops(func, "coloring");
+  ASSERT_TRUE(isa<Kernel>(getLoop(colored)));
+  ASSERT_EQ(Kernel::Colored, to<Kernel>(getLoop(colored))->schedule);
+}
+
+TEST(ParallelLoops, lowerScatteredAdds) {
+  Type vertexType = ElementType::make("Vertex", {Field("a", Int),
+                                                 Field("b", Int)});
+  Type vertexSetType = UnstructuredSetType::make(vertexType, {});
+  Var V("V", vertexSetType);
+  Var v("v", Int);
+  Expr a = FieldRead::make(V, "a");
+  Expr b = FieldRead::make(V, "b");
+
+  // Adds to locations computed from data can only be privatized
+  Stmt scatter = For::make(v, ForDomain(IndexSet(V)),
+                           Store::make(a, Load::make(b, v), Literal::make(1),
+                                       CompoundOperator::Add));
+  Func scatterFunc("f", {V}, {}, scatter);
+  Func parallel = lowerParallelLoops(scatterFunc, "coloring");
+  ASSERT_TRUE(isa<Kernel>(getLoop(parallel)));
+  ASSERT_EQ(Kernel::Privatized, to<Kernel>(getLoop(parallel))->schedule);
+
+  // Reading a buffer that is added to prevents privatization
+  Stmt readScatter = For::make(v, ForDomain(IndexSet(V)),
+                               Store::make(a, Load::make(b, v),
+                                           Load::make(a, v),
+                                           CompoundOperator::Add));
+  Func readScatterFunc("f", {V}, {}, readScatter);
+  ASSERT_TRUE(isa<For>(getLoop(lowerParallelLoops(readScatterFunc))));
+}
+
+TEST(ParallelLoops, edgeColoring) {
+  // A 10x10 grid of vertices connected by horizontal and vertical edges
+  simit::Set V;
+  simit::Set E(V,V);
+  std::vector<simit::ElementRef> vertices;
+  for (int i = 0; i < 100; ++i) {
+    vertices.push_back(V.add());
+  }
+  for (int i = 0; i < 10; ++i) {
+    for (int j = 0; j < 10; ++j) {
+      if (j+1 < 10) E.add(vertices[i*10+j], vertices[i*10+j+1]);
+      if (i+1 < 10) E.add(vertices[i*10+j], vertices[(i+1)*10+j]);
+    }
+  }
+
+  const simit::internal::EdgeColoring& coloring = E.getEdgeColoring();
+  ASSERT_LE(coloring.getNumColors(), 7);
+
+  // Every edge has exactly one color, and edges of the same color share no
+  // endpoints
+  const int* endpoints = E.getEndpointsData();
+  std::vector<int> edgeColors(E.getSize(), -1);
+  for (int c = 0; c < coloring.getNumColors(); ++c) {
+    std::vector<bool> touched(V.getSize(), false);
+    for (int k = 0; k < coloring.getNumEdges(c); ++k) {
+      int edge = coloring.getEdges(c)[k];
+      ASSERT_EQ(-1, edgeColors[edge]);
+      edgeColors[edge] = c;
+      for (int ep = 0; ep < 2; ++ep) {
+        ASSERT_FALSE(touched[endpoints[edge*2+ep]]);
+        touched[endpoints[edge*2+ep]] = true;
+      }
+    }
+  }
+  for (int color : edgeColors) {
+    ASSERT_NE(-1, color);
+  }
+
+  // Modifying the set discards the coloring
+  E.add(vertices[0], vertices[11]);
+  int numColoredEdges = 0;
+  for (int c = 0; c < E.getEdgeColoring().getNumColors(); ++c) {
+    numColoredEdges += E.getEdgeColoring().getNumEdges(c);
+  }
+  ASSERT_EQ(E.getSize(), numColoredEdges);
+}
+
+TEST(ParallelLoops, edgeColoringSharedUse) {
+  simit::Set V;
+  simit::Set E(V,V);
+  std::vector<simit::ElementRef> vertices;
+  for (int i = 0; i < 100; ++i) {
+    vertices.push_back(V.add());
+  }
+  for (int i = 0; i+1 < 100; ++i) {
+    E.add(vertices[i], vertices[i+1]);
+  }
+
+  // Threads that request the coloring at the same time share one coloring
+  std::vector<const simit::internal::EdgeColoring*> colorings(4, nullptr);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < colorings.size(); ++t) {
+    threads.push_back(std::thread([&E, &colorings, t]() {
+      colorings[t] = &E.getEdgeColoring();
+    }));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (auto coloring : colorings) {
+    ASSERT_EQ(colorings[0], coloring);
+  }
+  ASSERT_EQ(2, colorings[0]->getNumColors());
+
+  // Writing the endpoints discards the coloring. Three edges now share
+  // vertex 0, so they need three colors.
+  int* endpoints = E.getEndpointsPtr();
+  endpoints[2] = 0;
+  endpoints[4] = 0;
+  ASSERT_EQ(3, E.getEdgeColoring().getNumColors());
+}
+
+extern "C" void simit_parallel_for_privatized(int, void*, int, const int*, int,
+                                              void (*)(int,int,const int*,void*,
+                                                       void**),
+                                              void*, int, void**, const int*,
+                                              const int*);
+
+static void histogram(int begin, int end, const int*, void*,
+                      void** reductions) {
+  int* bins = static_cast<int*>(reductions[0]);
+  for (int i = begin; i < end; ++i) {
+    bins[i % 10] += i;
+  }
+}
+
+TEST(ParallelLoops, privatizedReduction) {
+  const int n = 10000;
+  std::vector<int> bins(10, 1);
+  void* reductions[] = {bins.data()};
+  int lens[] = {10};
+  int kinds[] = {ScalarType::Int};
+  simit_parallel_for_privatized(0, nullptr, n, nullptr, 0, histogram, nullptr,
+                                1, reductions, lens, kinds);
+
+  std::vector<int> expected(10, 1);
+  for (int i = 0; i < n; ++i) {
+    expected[i % 10] += i;
+  }
+  ASSERT_EQ(expected, bins);
+}
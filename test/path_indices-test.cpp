@@ -232,6 +232,36 @@ TEST(pathindex, exist_and) {
   VERIFY_INDEX(vevgvIndex, nbrs({{0,2}, {0,2}, {0,2}}));
 }
 
+TEST(pathindex, exist_and_large) {
+  PathIndexBuilder builder;
+
+  // A chain long enough that its rows are built by several threads
+  const unsigned n = 10000;
+  simit::Set V;
+  simit::Set E(V,V);
+  createBox(&V, &E, n, 1, 1);
+
+  PathExpression ve = makeVE();
+  PathExpression ev = makeEV();
+  builder.bind("V", &V);
+  builder.bind("E", &E);
+
+  Var vi("vi");
+  Var e("e");
+  Var vj("vj");
+  PathExpression vev = And::make({vi,vj}, {{QuantifiedVar::Exist,e}},
+                                 ve(vi, e), ev(e, vj));
+  PathIndex vevIndex = builder.buildSegmented(vev, 0);
+
+  nbrs expected(n);
+  for (unsigned v=0; v < n; ++v) {
+    for (unsigned u=(v > 0) ? v-1 : 0; u <= v+1 && u < n; ++u) {
+      expected[v].push_back(u);
+    }
+  }
+  VERIFY_INDEX(vevIndex, expected);
+}
+
 TEST(pathindex, exist_or) {
   PathIndexBuilder builder;
 
@@ -306,6 +336,150 @@ TEST(pathindex, exist_or) {
                                  {3,4}, {3,4}}));
 }
 
+TEST(pathindex, cache) {
+  simit::Set V;
+  simit::Set E(V,V);
+  Box box = createBox(&V, &E, 3, 1, 1);  // v-e-v-e-v
+
+  PathExpression ve = makeVE();
+  PathExpression ev = makeEV();
+  Var vi("vi");
+  Var e("e");
+  Var vj("vj");
+  PathExpression vev = And::make({vi,vj}, {{QuantifiedVar::Exist,e}},
+                                 ve(vi, e), ev(e, vj));
+
+  // Check that a second builder over the same sets reuses the index
+  PathIndexBuilder builder;
+  builder.bind("V", &V);
+  builder.bind("E", &E);
+  PathIndex vevIndex = builder.buildSegmented(vev, 0);
+  VERIFY_INDEX(vevIndex, nbrs({{0,1}, {0,1,2}, {1,2}}));
+
+  PathIndexBuilder builder2;
+  builder2.bind("V", &V);
+  builder2.bind("E", &E);
+  ASSERT_EQ(vevIndex, builder2.buildSegmented(vev, 0));
+
+  // Check that changing the edges invalidates the index
+  E.add(box(0,0,0), box(2,0,0));
+  PathIndexBuilder builder3;
+  builder3.bind("V", &V);
+  builder3.bind("E", &E);
+  PathIndex vevIndex3 = builder3.buildSegmented(vev, 0);
+  ASSERT_NE(vevIndex, vevIndex3);
+  VERIFY_INDEX(vevIndex3, nbrs({{0,1,2}, {0,1,2}, {0,1,2}}));
+
+  // Check that the index is not shared with other sets
+  simit::Set U;
+  simit::Set F(U,U);
+  createBox(&U, &F, 3, 1, 1);
+  PathIndexBuilder builder4;
+  builder4.bind("V", &U);
+  builder4.bind("E", &F);
+  PathIndex vevIndex4 = builder4.buildSegmented(vev, 0);
+  ASSERT_NE(vevIndex3, vevIndex4);
+  VERIFY_INDEX(vevIndex4, nbrs({{0,1}, {0,1,2}, {1,2}}));
+}
+
+TEST(pathindex, cache_eviction) {
+  PathExpression ve = makeVE();
+  PathExpression ev = makeEV();
+  Var vi("vi");
+  Var e("e");
+  Var vj("vj");
+  PathExpression vev = And::make({vi,vj}, {{QuantifiedVar::Exist,e}},
+                                 ve(vi, e), ev(e, vj));
+
+  // Check that destroying the sets evicts the indices built over them
+  size_t size = PathIndexCache::getInstance().size();
+  for (int i = 0; i < 4; ++i) {
+    simit::Set V;
+    simit::Set E(V,V);
+    createBox(&V, &E, 3, 1, 1);
+    PathIndexBuilder builder;
+    builder.bind("V", &V);
+    builder.bind("E", &E);
+    builder.buildSegmented(vev, 0);
+    ASSERT_LT(size, PathIndexCache::getInstance().size());
+  }
+  ASSERT_EQ(size, PathIndexCache::getInstance().size());
+}
+
+static nbrs getNeighbors(const PathIndex& index) {
+  nbrs neighbors;
+  for (auto e : index) {
+    neighbors.push_back(std::vector<unsigned>());
+    for (auto n : index.neighbors(e)) {
+      neighbors.back().push_back(n);
+    }
+  }
+  return neighbors;
+}
+
+TEST(pathindex, update) {
+  simit::Set V;
+  simit::Set E(V,V);
+  Box box = createBox(&V, &E, 8, 1, 1);  // v-e-v-e-v-e-v-e-v-e-v-e-v-e-v
+
+  PathExpression ve = makeVE();
+  PathExpression ev = makeEV();
+  Var vi("vi");
+  Var e("e");
+  Var vj("vj");
+  PathExpression vev = And::make({vi,vj}, {{QuantifiedVar::Exist,e}},
+                                 ve(vi, e), ev(e, vj));
+  PathExpression vevOrVe = Or::make({vi,vj}, {}, vev(vi,vj), vev(vj,vi));
+
+  auto build = [&](const PathExpression& pe) {
+    PathIndexBuilder builder;
+    builder.bind("V", &V);
+    builder.bind("E", &E);
+    return builder.buildSegmented(pe, 0);
+  };
+  auto edge = [&](int i) {
+    auto it = E.begin();
+    for (int j=0; j < i; ++j) {
+      ++it;
+    }
+    return *it;
+  };
+
+  build(ve);
+  build(ev);
+  build(vev);
+  build(vevOrVe);
+
+  // Add and remove edges and vertices, and check that the updated indices
+  // match indices built from scratch
+  ElementRef v8 = V.add();
+  E.add(box(0,0,0), box(7,0,0));
+  E.add(box(3,0,0), v8);
+  E.remove(edge(2));
+  E.remove(edge(E.getSize()-1));
+  E.add(v8, box(5,0,0));
+
+  std::vector<PathExpression> pes = {ve, ev, vev, vevOrVe};
+  std::vector<PathIndex> updatedIndices;
+  for (const PathExpression& pe : pes) {
+    updatedIndices.push_back(build(pe));
+  }
+  PathIndexCache::getInstance().clear();
+  for (size_t k=0; k < pes.size(); ++k) {
+    SCOPED_TRACE(pes[k]);
+    PathIndex updated = updatedIndices[k];
+    VERIFY_INDEX(updated, getNeighbors(build(pes[k])));
+  }
+
+  // Check that removing vertices rebuilds the indices
+  E.remove(edge(E.getSize()-1));
+  E.remove(edge(2));
+  V.remove(v8);
+  PathIndex rebuilt = build(vev);
+  PathIndexCache::getInstance().clear();
+  VERIFY_INDEX(rebuilt, getNeighbors(build(vev)));
+}
+
 TEST(pathindex, alias) {
   simit::Set V;
   simit::Set E(V,V);
@@ -367,3 +541,58 @@ TEST(pathindex, hypergraph) {
   PathIndex pidx = builder.buildSegmented(vevORvfv, 0);
   VERIFY_INDEX(pidx, nbrs({{0,1,2}, {0,1,2,3}, {0,1,2,3}, {1,2,3}}));
 }
+
+TEST(pathindex, location_table) {
+  Var vi("vi");
+  Var vj("vj");
+  Var e("e");
+  PathExpression ve = makeVE("v","V", "e","E");
+  PathExpression ev = makeEV("e","E", "v","V");
+  PathExpression vev = And::make({vi,vj}, {{QuantifiedVar::Exist,e}},
+                                 ve(vi, e), ev(e, vj));
+
+  simit::Set V;
+  simit::Set E(V,V,V);
+  ElementRef v0 = V.add();
+  ElementRef v1 = V.add();
+  ElementRef v2 = V.add();
+  ElementRef v3 = V.add();
+  E.add(v0, v1, v2);
+  E.add(v3, v2, v1);
+
+  PathIndexBuilder builder;
+  builder.bind("V", &V);
+  builder.bind("E", &E);
+  PathIndex pidx = builder.buildSegmented(vev, 0);
+  VERIFY_INDEX(pidx, nbrs({{0,1,2}, {0,1,2,3}, {0,1,2,3}, {1,2,3}}));
+
+  std::vector<int> table = builder.buildLocationTable(pidx, E);
+  ASSERT_EQ(2u*3*3, table.size());
+  const SegmentedPathIndex* spidx = to<SegmentedPathIndex>(pidx);
+  for (auto edge : E) {
+    for (int i=0; i < 3; ++i) {
+      for (int j=0; j < 3; ++j) {
+        int epi = E.getEndpoint(edge, i).getIdent();
+        int epj = E.getEndpoint(edge, j).getIdent();
+        int loc = table[edge.getIdent()*9 + i*3 + j];
+        ASSERT_GE(loc, (int)spidx->getCoordData()[epi]);
+        ASSERT_LT(loc, (int)spidx->getCoordData()[epi+1]);
+        ASSERT_EQ(epj, (int)spidx->getSinkData()[loc]);
+      }
+    }
+  }
+}
+
+extern "C" int loc_sorted(int, int, int*, int*);
+
+TEST(pathindex, loc_sorted) {
+  // Row 0 is sorted, row 1 is not (as ev and stencil rows may be)
+  int neighborsStart[] = {0, 4, 7};
+  int neighbors[] = {0, 2, 5, 7,  6, 1, 3};
+  ASSERT_EQ(0, loc_sorted(0, 0, neighborsStart, neighbors));
+  ASSERT_EQ(2, loc_sorted(0, 5, neighborsStart, neighbors));
+  ASSERT_EQ(3, loc_sorted(0, 7, neighborsStart, neighbors));
+  ASSERT_EQ(4, loc_sorted(1, 6, neighborsStart, neighbors));
+  ASSERT_EQ(5, loc_sorted(1, 1, neighborsStart, neighbors));
+  ASSERT_EQ(6, loc_sorted(1, 3, neighborsStart, neighbors));
+}
@@ -6,6 +6,7 @@
 #include "program.h"
 #include "error.h"
 #include "mesh.h"
+#include "init.h"
 
 using namespace std;
 using namespace simit;
@@ -469,3 +470,66 @@ TEST(Program, reorderFemTest) {
   unsigned int nSteps = 10;
   femTest(filename, prefix, nSteps);
 }
+
+/// Builds a line of points, shuffled along the x axis, connected by springs.
+static void makeSprings(Set& points, Set& springs) {
+  FieldRef<simit_float,3> x = points.addField<simit_float,3>("x");
+  FieldRef<simit_float,2> k = springs.addField<simit_float,2>("k");
+  vector<ElementRef> refs;
+  for (int i = 0; i < 11; ++i) {
+    refs.push_back(points.add());
+    simit_float pos = (i*7) % 11;
+    x.set(refs[i], {pos, 2*pos, 1.0});
+  }
+  for (int i = 0; i+1 < 11; ++i) {
+    ElementRef s = springs.add(refs[i], refs[i+1]);
+    k.set(s, {simit_float(i), simit_float(10*i)});
+  }
+  points.setSpatialField("x");
+}
+
+TEST(Program, reorderBlocked) {
+  Set points;
+  Set springs(points,points);
+  makeSprings(points, springs);
+
+  RestoreSettings restoreSettings;
+  Settings settings = getSettings();
+  settings.fieldBlockSize = 4;
+  init(settings);
+  Set blockedPoints;
+  Set blockedSprings(blockedPoints,blockedPoints);
+  makeSprings(blockedPoints, blockedSprings);
+  ASSERT_EQ(4, blockedPoints.getFieldBlockSize());
+
+  vector<int> vertexOrdering, edgeOrdering;
+  reorder(springs, points, edgeOrdering, vertexOrdering);
+  vector<int> blockedVertexOrdering, blockedEdgeOrdering;
+  reorder(blockedSprings, blockedPoints, blockedEdgeOrdering,
+          blockedVertexOrdering);
+  ASSERT_EQ(vertexOrdering, blockedVertexOrdering);
+  ASSERT_EQ(edgeOrdering, blockedEdgeOrdering);
+
+  // Blocked fields must end up where the interleaved fields end up
+  FieldRef<simit_float,3> x = points.getField<simit_float,3>("x");
+  FieldRef<simit_float,3> bx = blockedPoints.getField<simit_float,3>("x");
+  auto bp = blockedPoints.begin();
+  for (ElementRef p : points) {
+    for (int c = 0; c < 3; ++c) {
+      ASSERT_EQ(x.get(p)(c), bx.get(*bp)(c));
+    }
+    ++bp;
+  }
+
+  FieldRef<simit_float,2> k = springs.getField<simit_float,2>("k");
+  FieldRef<simit_float,2> bk = blockedSprings.getField<simit_float,2>("k");
+  auto bs = blockedSprings.begin();
+  for (ElementRef s : springs) {
+    for (int c = 0; c < 2; ++c) {
+      ASSERT_EQ(k.get(s)(c), bk.get(*bs)(c));
+    }
+    ASSERT_EQ(springs.getEndpoint(s, 0).getIdent(),
+              blockedSprings.getEndpoint(*bs, 0).getIdent());
+    ++bs;
+  }
+}
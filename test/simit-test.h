@@ -9,6 +9,7 @@
 #include "function.h"
 #include "backend/backend.h"
 #include "error.h"
+#include "init.h"
 
 namespace simit {
 namespace backend {
@@ -49,6 +50,18 @@ inline std::string toLower(std::string str) {
 
 std::unique_ptr<simit::backend::Backend> getTestBackend();
 
+/// Restores the settings that were in effect when it was created, so that a
+/// test that changes the settings does not affect later tests, even if it
+/// fails.
+class RestoreSettings {
+public:
+  RestoreSettings() : settings(simit::getSettings()) {}
+  ~RestoreSettings() {simit::init(settings);}
+
+private:
+  simit::Settings settings;
+};
+
 simit::Function loadFunction(std::string fileName, std::string funcName="main");
 simit::Function loadFunctionWithTimers(std::string fileName, std::string 
     funcName="main");
@@ -14,6 +14,8 @@
 
 #include "runtime.h"
 
+#include <tuple>
+
 using namespace std;
 using namespace simit;
 using namespace simit::ir;
@@ -136,6 +138,40 @@ TEST(solver, triangular) {
   SIMIT_ASSERT_FLOAT_EQ(13.125, x(v2));
 }
 
+extern "C" int dtriangularSolve(int An,  int Am,  int* Arowptr, int* Acolidx,
+                                int Ann, int Amm, double* Avals,
+                                int nb, double *bvals, int nx, double *xvals);
+
+TEST(solver, triangular_unsorted) {
+  // Lower triangular [[2,0,0],[1,4,0],[3,2,5]] with the rows' column indices
+  // stored out of order, as assembly may leave them
+  int rowptr[] = {0, 1, 3, 6};
+  int colidx[] = {0, 1, 0, 2, 0, 1};
+  double vals[] = {2.0, 4.0, 1.0, 5.0, 3.0, 2.0};
+  ASSERT_FALSE(hasSortedRows(3, rowptr, colidx));
+
+  double b[] = {2.0, 9.0, 18.0};
+  double x[3] = {0.0, 0.0, 0.0};
+  dtriangularSolve(3, 3, rowptr, colidx, 1, 1, vals, 3, b, 3, x);
+  SIMIT_ASSERT_FLOAT_EQ(1.0, x[0]);
+  SIMIT_ASSERT_FLOAT_EQ(2.0, x[1]);
+  SIMIT_ASSERT_FLOAT_EQ(2.2, x[2]);
+
+  // Blocked [[A,0],[A,A]] with A=[[2,0],[1,4]], the second block row stored
+  // out of order
+  int browptr[] = {0, 1, 3};
+  int bcolidx[] = {0, 1, 0};
+  double bvals[] = {2.0, 0.0, 1.0, 4.0,
+                    2.0, 0.0, 1.0, 4.0,
+                    2.0, 0.0, 1.0, 4.0};
+  double bb[] = {2.0, 5.0, 4.0, 10.0};
+  double bx[4] = {0.0, 0.0, 0.0, 0.0};
+  dtriangularSolve(4, 4, browptr, bcolidx, 2, 2, bvals, 4, bb, 4, bx);
+  for (int i=0; i<4; ++i) {
+    SIMIT_ASSERT_FLOAT_EQ(1.0, bx[i]);
+  }
+}
+
 TEST(DISABLED_solver, lu_blocked) {
   Set V;
   auto b = V.addField<simit_float,2>("b");
@@ -223,6 +259,225 @@ TEST(solver, chol) {
   SIMIT_ASSERT_FLOAT_EQ( 60.0, x(v2));
 }
 
+TEST(solver, pcg) {
+  Set V;
+  FieldRef<simit_float> b = V.addField<simit_float>("b");
+  FieldRef<simit_float> x = V.addField<simit_float>("x");
+  FieldRef<bool> fixed = V.addField<bool>("fixed");
+  ElementRef v0 = V.add();
+  ElementRef v1 = V.add();
+  ElementRef v2 = V.add();
+  b(v0) = 10.0;
+  b(v1) = 20.0;
+  b(v2) = 30.0;
+  fixed(v0) = true;
+
+  Set E(V,V);
+  E.add(v0,v1);
+  E.add(v1,v2);
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("V", &V);
+  func.bind("E", &E);
+  func.runSafe();
+
+  SIMIT_ASSERT_FLOAT_EQ( 20.0, x(v0));
+  SIMIT_ASSERT_FLOAT_EQ(-30.0, x(v1));
+  SIMIT_ASSERT_FLOAT_EQ( 60.0, x(v2));
+}
+
+extern "C" int dpcg(int An,  int Am,  int* Arowptr, int* Acolidx,
+                    int Ann, int Amm, double* Avals,
+                    int nb, double* bvals, int nx0, double* x0vals,
+                    double tol, int maxiters, const char* precond,
+                    int nx, double* xvals);
+
+/// Solves Ax=b from x0=0 with pcg, for an n x n CSR matrix with bs x bs blocks.
+static vector<double> runPCG(int n, int bs, vector<int> rowptr,
+                             vector<int> colidx, vector<double> vals,
+                             vector<double> b, int maxiters,
+                             const char* precond) {
+  vector<double> x0(n, 0.0);
+  vector<double> x(n, 0.0);
+  dpcg(n, n, rowptr.data(), colidx.data(), bs, bs, vals.data(),
+       n, b.data(), n, x0.data(), 1.0e-24, maxiters, precond, n, x.data());
+  return x;
+}
+
+TEST(solver, pcg_preconditioners) {
+  // Block tridiagonal [[D,C,0],[C',D,C],[0,C',D]], which is diagonally
+  // dominant, with D=[[4,1],[1,4]] and C=[[-1,0],[0.5,-1]], and b=Ax for
+  // x=(1,2,-1,0.5,3,-2)
+  vector<int> rowptr = {0, 2, 5, 7};
+  vector<int> colidx = {0, 1, 0, 1, 2, 1, 2};
+  vector<double> vals = {4, 1, 1, 4,   -1, 0, 0.5, -1,
+                         -1, 0.5, 0, -1,   4, 1, 1, 4,   -1, 0, 0.5, -1,
+                         -1, 0.5, 0, -1,   4, 1, 1, 4};
+  vector<double> b = {7.0, 8.0, -6.5, 2.5, 11.25, -5.5};
+  vector<double> expected = {1.0, 2.0, -1.0, 0.5, 3.0, -2.0};
+
+  // Conjugate gradients converge in at most n iterations
+  for (const char* precond : {"none", "jacobi", "blockjacobi", "ic0"}) {
+    SCOPED_TRACE(precond);
+    vector<double> x = runPCG(6, 2, rowptr, colidx, vals, b, 6, precond);
+    for (int i=0; i < 6; ++i) {
+      ASSERT_NEAR(expected[i], x[i], 1e-10);
+    }
+  }
+}
+
+TEST(solver, pcg_none) {
+  // One steepest descent step for diag(1,2) and b=(1,1): alpha = r'r/r'Ar = 2/3
+  vector<double> x = runPCG(2, 1, {0, 1, 2}, {0, 1}, {1.0, 2.0}, {1.0, 1.0},
+                            1, "none");
+  SIMIT_ASSERT_FLOAT_EQ(2.0/3.0, x[0]);
+  SIMIT_ASSERT_FLOAT_EQ(2.0/3.0, x[1]);
+
+  // The Jacobi preconditioner is exact for a diagonal matrix
+  x = runPCG(2, 1, {0, 1, 2}, {0, 1}, {1.0, 2.0}, {1.0, 1.0}, 1, "jacobi");
+  SIMIT_ASSERT_FLOAT_EQ(1.0, x[0]);
+  SIMIT_ASSERT_FLOAT_EQ(0.5, x[1]);
+}
+
+TEST(solver, pcg_blockjacobi) {
+  // The block-Jacobi preconditioner is exact for the block diagonal matrix
+  // [[4,1],[1,4]] (+) [[2,1],[1,3]], so one iteration solves it; b=Ax for
+  // x=(1,-1,2,1)
+  vector<double> x = runPCG(4, 2, {0, 1, 2}, {0, 1},
+                            {4, 1, 1, 4,   2, 1, 1, 3}, {3, -3, 5, 5},
+                            1, "blockjacobi");
+  SIMIT_ASSERT_FLOAT_EQ( 1.0, x[0]);
+  SIMIT_ASSERT_FLOAT_EQ(-1.0, x[1]);
+  SIMIT_ASSERT_FLOAT_EQ( 2.0, x[2]);
+  SIMIT_ASSERT_FLOAT_EQ( 1.0, x[3]);
+
+  // Jacobi ignores the off-diagonal entries and needs more iterations
+  x = runPCG(4, 2, {0, 1, 2}, {0, 1}, {4, 1, 1, 4,   2, 1, 1, 3},
+             {3, -3, 5, 5}, 1, "jacobi");
+  ASSERT_GT(std::abs(x[3] - 1.0), 1e-3);
+}
+
+TEST(solver, pcg_ic0) {
+  // IC(0) of a tridiagonal matrix has no dropped fill-in, so it is the exact
+  // Cholesky factor and one iteration solves tridiag(-1,4,-1)x=b for
+  // x=(1,2,3,4). The third row's columns are stored out of order.
+  vector<double> x = runPCG(4, 1, {0, 2, 5, 8, 10},
+                            {0, 1,   0, 1, 2,   3, 1, 2,   2, 3},
+                            {4, -1,  -1, 4, -1,  -1, -1, 4,  -1, 4},
+                            {2, 4, 6, 13}, 1, "ic0");
+  SIMIT_ASSERT_FLOAT_EQ(1.0, x[0]);
+  SIMIT_ASSERT_FLOAT_EQ(2.0, x[1]);
+  SIMIT_ASSERT_FLOAT_EQ(3.0, x[2]);
+  SIMIT_ASSERT_FLOAT_EQ(4.0, x[3]);
+
+  // Missing diagonal entries cannot be factorized
+  ASSERT_THROW(runPCG(2, 1, {0, 1, 2}, {1, 0}, {1.0, 1.0}, {1.0, 1.0},
+                      1, "ic0"),
+               simit::SimitException);
+}
+
+TEST(solver, pcg_unknown_preconditioner) {
+  ASSERT_THROW(runPCG(2, 1, {0, 1, 2}, {0, 1}, {1.0, 2.0}, {1.0, 1.0},
+                      1, "ilu"),
+               simit::SimitException);
+}
+
+extern "C" int dchol(int An,  int Am,  int* Arowptr, int* Acolidx,
+                     int Ann, int Amm, double* Avals, void** solver);
+extern "C" int dcholfree(void** solverPtr);
+extern "C" int dlltsolve(void** solverPtr, int bn, double *bvals,
+                         int xn, double *xvals);
+extern "C" int dlu(int An,  int Am,  int* Arowptr, int* Acolidx,
+                   int Ann, int Amm, double* Avals, void** solver);
+extern "C" int dlufree(void** solverPtr);
+extern "C" int dlusolve(void** solverPtr, int bn, double *bvals,
+                        int xn, double *xvals);
+
+typedef int (*FactorizeFunc)(int, int, int*, int*, int, int, double*, void**);
+typedef int (*SolveFunc)(void**, int, double*, int, double*);
+typedef int (*FreeFunc)(void**);
+
+/// Factorizes the CSR matrix [[4,1,0],[1,3,1],[0,1,2]] with `scale*I` blocks of
+/// size `bs` twice, the second time with doubled values, and checks that both
+/// solutions of Ax=b for x=1 are right and that the second factorization
+/// reuses the freed first one. Returns the (freed) factorization.
+static void* factorizeTwice(FactorizeFunc factorize, SolveFunc solve,
+                            FreeFunc release, int bs, int* rowptr, int* colidx) {
+  const double scalars[] = {4, 1, 1, 3, 1, 1, 2};
+  const int n = 3*bs;
+  vector<double> vals;
+  for (double scalar : scalars) {
+    for (int bi=0; bi < bs; ++bi) {
+      for (int bj=0; bj < bs; ++bj) {
+        vals.push_back((bi == bj) ? scalar : 0.0);
+      }
+    }
+  }
+  vector<double> b;
+  for (double rowSum : {5.0, 5.0, 3.0}) {
+    b.insert(b.end(), bs, rowSum);
+  }
+
+  void* first = nullptr;
+  for (double scale : {1.0, 2.0}) {
+    vector<double> scaled(vals);
+    for (double& val : scaled) {
+      val *= scale;
+    }
+    void* solver = nullptr;
+    factorize(n, n, rowptr, colidx, bs, bs, scaled.data(), &solver);
+    if (first == nullptr) {
+      first = solver;
+    }
+    else {
+      EXPECT_EQ(first, solver);
+    }
+    vector<double> x(n, 0.0);
+    solve(&solver, n, b.data(), n, x.data());
+    release(&solver);
+    for (int i=0; i < n; ++i) {
+      EXPECT_NEAR(1.0/scale, x[i], 1e-12);
+    }
+  }
+  return first;
+}
+
+TEST(solver, factorization_reuse) {
+  int rowptr[] = {0, 2, 5, 7};
+  int colidx[] = {0, 1, 0, 1, 2, 1, 2};
+  int diagRowptr[] = {0, 1, 2, 3};
+  int diagColidx[] = {0, 1, 2};
+
+  for (auto f : {std::make_tuple(FactorizeFunc(dchol), SolveFunc(dlltsolve),
+                                 FreeFunc(dcholfree)),
+                 std::make_tuple(FactorizeFunc(dlu), SolveFunc(dlusolve),
+                                 FreeFunc(dlufree))}) {
+    FactorizeFunc factorize = std::get<0>(f);
+    SolveFunc solve = std::get<1>(f);
+    FreeFunc release = std::get<2>(f);
+    void* cached = factorizeTwice(factorize, solve, release, 1, rowptr, colidx);
+
+    // Another pattern, and the same pattern with 2x2 blocks, are not matched
+    // to the cached analysis
+    void* diagonal = nullptr;
+    double diag[] = {2.0, 4.0, 8.0};
+    factorize(3, 3, diagRowptr, diagColidx, 1, 1, diag, &diagonal);
+    EXPECT_NE(cached, diagonal);
+    double ones[] = {1.0, 1.0, 1.0};
+    double x[3];
+    solve(&diagonal, 3, ones, 3, x);
+    release(&diagonal);
+    EXPECT_NEAR(0.5, x[0], 1e-12);
+    EXPECT_NEAR(0.25, x[1], 1e-12);
+    EXPECT_NEAR(0.125, x[2], 1e-12);
+
+    void* blocked = factorizeTwice(factorize, solve, release, 2, rowptr, colidx);
+    EXPECT_NE(cached, blocked);
+    EXPECT_NE(diagonal, blocked);
+  }
+}
+
 TEST(solver, cholmat) {
   Set V;
   FieldRef<simit_float> x = V.addField<simit_float>("x");
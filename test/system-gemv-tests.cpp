@@ -5,6 +5,12 @@
 #include "tensor.h"
 #include "program.h"
 #include "error.h"
+#include "runtime.h"
+#include "ir.h"
+#include "ir_visitor.h"
+#include "program_context.h"
+#include "frontend/frontend.h"
+#include "lower/lower.h"
 
 using namespace std;
 using namespace simit;
@@ -903,6 +909,397 @@ TEST(system, gemv_blocked) {
   ASSERT_EQ(136.0, c2(1));
 }
 
+TEST(system, gemv_fused) {
+  Set points;
+  FieldRef<simit_float,2> b = points.addField<simit_float,2>("b");
+  FieldRef<simit_float,2> c = points.addField<simit_float,2>("c");
+  FieldRef<simit_float,2> d = points.addField<simit_float,2>("d");
+  FieldRef<simit_float,2> e = points.addField<simit_float,2>("e");
+  vector<ElementRef> p;
+  for (int i = 0; i < 7; ++i) {
+    p.push_back(points.add());
+    b.set(p[i], {simit_float(i+1), simit_float(0.5*i - 1.0)});
+  }
+
+  // Points have different numbers of springs, and p1 and p4 are connected
+  // by two springs
+  Set springs(points,points);
+  FieldRef<simit_float,2,2> a = springs.addField<simit_float,2,2>("a");
+  vector<pair<int,int>> endpoints = {{0,1}, {1,2}, {2,3}, {1,4}, {4,1},
+                                     {5,0}, {3,5}, {1,6}};
+  vector<ElementRef> s;
+  for (size_t j = 0; j < endpoints.size(); ++j) {
+    s.push_back(springs.add(p[endpoints[j].first], p[endpoints[j].second]));
+    a.set(s[j], {simit_float(j+1), simit_float(-(int)j),
+                 simit_float(0.25*j), 2.0});
+  }
+
+  Function fused = loadFunction(TEST_FILE_NAME, "fused");
+  if (!fused.defined()) FAIL();
+  fused.bind("points", &points);
+  fused.bind("springs", &springs);
+  fused.runSafe();
+
+  Function unfused = loadFunction(TEST_FILE_NAME, "unfused");
+  if (!unfused.defined()) FAIL();
+  unfused.bind("points", &points);
+  unfused.bind("springs", &springs);
+  unfused.runSafe();
+
+  // Compute the product of the matrix that dist_a assembles
+  vector<simit_float> expected(2*p.size(), 0.0);
+  for (size_t j = 0; j < endpoints.size(); ++j) {
+    int u = endpoints[j].first;
+    int v = endpoints[j].second;
+    for (int r = 0; r < 2; ++r) {
+      for (int k = 0; k < 2; ++k) {
+        simit_float ark = a.get(s[j])(r,k);
+        expected[2*u+r] += ark * b.get(p[u])(k) + 2.0 * ark * b.get(p[v])(k);
+        expected[2*v+r] += 3.0 * ark * b.get(p[u])(k) - ark * b.get(p[v])(k);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < p.size(); ++i) {
+    for (int r = 0; r < 2; ++r) {
+      SIMIT_ASSERT_FLOAT_NEAR_EQ(expected[2*i+r], c.get(p[i])(r));
+      SIMIT_ASSERT_FLOAT_NEAR_EQ(expected[2*i+r], d.get(p[i])(r));
+      SIMIT_ASSERT_FLOAT_NEAR_EQ(expected[2*i+r], e.get(p[i])(r));
+    }
+  }
+}
+
+TEST(system, gemv_blocked_local) {
+  // Points
+  Set points;
+  FieldRef<simit_float,3> b = points.addField<simit_float,3>("b");
+  FieldRef<simit_float,3> c = points.addField<simit_float,3>("c");
+  FieldRef<simit_float,3> d = points.addField<simit_float,3>("d");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+
+  b.set(p0, {1.0, 2.0, 3.0});
+  b.set(p1, {4.0, 5.0, 6.0});
+  b.set(p2, {7.0, 8.0, 9.0});
+
+  // Springs
+  Set springs(points,points);
+  FieldRef<simit_float,3,3> a = springs.addField<simit_float,3,3>("a");
+
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+
+  a.set(s0, {1.0, 2.0, 0.0, 0.0, 1.0, 0.0, 3.0, 0.0, 1.0});
+  a.set(s1, {2.0, 0.0, 1.0, 1.0, 1.0, 0.0, 0.0, 0.0, 2.0});
+
+  // Compile program and bind arguments
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+
+  func.runSafe();
+
+  // Check that outputs are correct
+  TensorRef<simit_float,3> c0 = c.get(p0);
+  ASSERT_EQ(19.0, c0(0));
+  ASSERT_EQ(7.0,  c0(1));
+  ASSERT_EQ(24.0, c0(2));
+
+  TensorRef<simit_float,3> c1 = c.get(p1);
+  ASSERT_EQ(51.0, c1(0));
+  ASSERT_EQ(29.0, c1(1));
+  ASSERT_EQ(48.0, c1(2));
+
+  TensorRef<simit_float,3> c2 = c.get(p2);
+  ASSERT_EQ(23.0, c2(0));
+  ASSERT_EQ(15.0, c2(1));
+  ASSERT_EQ(18.0, c2(2));
+
+  TensorRef<simit_float,3> d0 = d.get(p0);
+  ASSERT_EQ(10.0, d0(0));
+  ASSERT_EQ(4.0,  d0(1));
+  ASSERT_EQ(3.0,  d0(2));
+
+  TensorRef<simit_float,3> d1 = d.get(p1);
+  ASSERT_EQ(45.0, d1(0));
+  ASSERT_EQ(22.0, d1(1));
+  ASSERT_EQ(25.0, d1(2));
+
+  TensorRef<simit_float,3> d2 = d.get(p2);
+  ASSERT_EQ(35.0, d2(0));
+  ASSERT_EQ(13.0, d2(1));
+  ASSERT_EQ(41.0, d2(2));
+}
+
+extern "C" int dsellpack(int An,  int Am,  int* Arowptr, int* Acolidx,
+                         int Ann, int Amm, double* Avals, int C, int sigma);
+extern "C" int dsellmv(int An,  int Am,  int* Arowptr, int* Acolidx,
+                       int Ann, int Amm, double* Avals,
+                       int nx, double* xvals, int ny, double* yvals);
+
+TEST(sellmv, slices_and_release) {
+  // 20 block rows of 2x2 blocks with 1 to 6 blocks each, so rows are sorted
+  // within the windows of 8 rows and the slices of 4 rows are padded
+  const int rows = 20;
+  std::vector<int> rowptr(1, 0);
+  std::vector<int> colidx;
+  for (int i=0; i < rows; ++i) {
+    int len = 1 + (i*7) % 6;
+    for (int k=0; k < len; ++k) {
+      colidx.push_back((i + 3*k) % rows);
+    }
+    rowptr.push_back(colidx.size());
+  }
+  std::vector<double> vals(colidx.size()*4);
+  for (size_t k=0; k < vals.size(); ++k) {
+    vals[k] = (int)(k % 7) - 3 + 0.5*(k % 4);
+  }
+  std::vector<double> x(rows*2);
+  for (int i=0; i < rows*2; ++i) {
+    x[i] = 1 + i % 5;
+  }
+
+  // y = A*x from the CSR values
+  auto multiply = [&]() {
+    std::vector<double> y(rows*2, 0.0);
+    for (int i=0; i < rows; ++i) {
+      for (int ij=rowptr[i]; ij < rowptr[i+1]; ++ij) {
+        for (int bi=0; bi < 2; ++bi) {
+          for (int bj=0; bj < 2; ++bj) {
+            y[i*2 + bi] += vals[ij*4 + bi*2 + bj] * x[colidx[ij]*2 + bj];
+          }
+        }
+      }
+    }
+    return y;
+  };
+  auto sellmv = [&]() {
+    std::vector<double> y(rows*2, 42.0);
+    dsellmv(rows*2, rows*2, rowptr.data(), colidx.data(), 2, 2, vals.data(),
+            rows*2, x.data(), rows*2, y.data());
+    return y;
+  };
+
+  dsellpack(rows*2, rows*2, rowptr.data(), colidx.data(), 2, 2, vals.data(),
+            4, 8);
+  std::vector<double> packed = multiply();
+  ASSERT_EQ(packed, sellmv());
+
+  // The sliced copy is not repacked, so it still holds the old values
+  for (double& val : vals) {
+    val *= 2;
+  }
+  ASSERT_EQ(packed, sellmv());
+
+  // Packing many other matrices does not release the copy
+  std::vector<std::vector<double>> others(16, vals);
+  for (auto& other : others) {
+    dsellpack(rows*2, rows*2, rowptr.data(), colidx.data(), 2, 2,
+              other.data(), 4, 8);
+  }
+  ASSERT_EQ(packed, sellmv());
+
+  // Once the copy is released the product falls back to the current CSR values
+  simit::freeSellCopy(vals.data());
+  ASSERT_EQ(multiply(), sellmv());
+  ASSERT_NE(packed, sellmv());
+  for (auto& other : others) {
+    simit::freeSellCopy(other.data());
+  }
+}
+
+/// Fills a chain of springs, plus springs from a hub and springs that skip
+/// ahead, between 21 points whose fields (added by the caller) have B-vectors
+/// and BxB blocks, so that the matrix's row lengths vary. Runs
+/// TEST_FILE_NAME's main with the given settings, which computes c = A*b and
+/// d = b'*A (stored as a column vector), and compares the results to products
+/// with the assembled matrix computed here.
+template <int B>
+static void checkSpMV(const std::string& filename,
+                      Set* points, Set* springs, const Settings& settings) {
+  RestoreSettings restoreSettings;
+  init(settings);
+
+  const int n = 21;
+  std::vector<ElementRef> p;
+  for (int i=0; i < n; ++i) {
+    p.push_back(points->add());
+  }
+  std::vector<std::pair<int,int>> endpoints;
+  for (int i=0; i+1 < n; ++i) {
+    endpoints.push_back({i, i+1});
+  }
+  for (int i=2; i < n; i += 4) {
+    endpoints.push_back({0, i});
+  }
+  for (int i=0; i < n; i += 3) {
+    endpoints.push_back({i, (i*5 + 7) % n});
+  }
+  for (auto& e : endpoints) {
+    springs->add(p[e.first], p[e.second]);
+  }
+
+  // Unsymmetric blocks and values that are exact in single precision
+  simit_float* a = static_cast<simit_float*>(springs->getFieldData("a"));
+  for (size_t s=0; s < endpoints.size(); ++s) {
+    for (int r=0; r < B; ++r) {
+      for (int k=0; k < B; ++k) {
+        a[(s*B + r)*B + k] = s + 1 + 0.5*r - 0.25*k;
+      }
+    }
+  }
+  simit_float* b = static_cast<simit_float*>(points->getFieldData("b"));
+  for (int i=0; i < n*B; ++i) {
+    b[i] = 1 + (i % 7) - 0.5*(i % B);
+  }
+
+  // M(u,u) += a, M(u,v) += a and M(v,v) += a for each spring (u,v)
+  std::vector<simit_float> M(n*B*n*B, 0.0);
+  for (size_t s=0; s < endpoints.size(); ++s) {
+    int u = endpoints[s].first;
+    int v = endpoints[s].second;
+    for (auto& block : {std::make_pair(u,u), std::make_pair(u,v),
+                        std::make_pair(v,v)}) {
+      for (int r=0; r < B; ++r) {
+        for (int k=0; k < B; ++k) {
+          M[(block.first*B + r)*n*B + block.second*B + k] +=
+              a[(s*B + r)*B + k];
+        }
+      }
+    }
+  }
+
+  Function func = loadFunction(filename, "main");
+  if (!func.defined()) FAIL();
+  func.bind("points", points);
+  func.bind("springs", springs);
+  func.runSafe();
+
+  simit_float* c = static_cast<simit_float*>(points->getFieldData("c"));
+  simit_float* d = static_cast<simit_float*>(points->getFieldData("d"));
+  for (int i=0; i < n*B; ++i) {
+    simit_float ci = 0;
+    simit_float di = 0;
+    for (int j=0; j < n*B; ++j) {
+      ci += M[i*n*B + j] * b[j];
+      di += M[j*n*B + i] * b[j];
+    }
+    SIMIT_ASSERT_FLOAT_EQ(ci, c[i]);
+    SIMIT_ASSERT_FLOAT_EQ(di, d[i]);
+  }
+}
+
+/// Returns the functions called by the lowered main of the named system test
+/// program, in order.
+static std::vector<std::string> getMainCalls(const std::string& name) {
+  simit::internal::ProgramContext ctx;
+  std::vector<ParseError> errors;
+  simit::internal::Frontend().parseFile(
+      std::string(TEST_INPUT_DIR) + "/system/" + name + ".sim",
+      &ctx, &errors);
+  EXPECT_TRUE(errors.empty());
+
+  std::vector<std::string> calls;
+  ir::Func func = ir::lower(ctx.getFunction("main"));
+  ir::match(func.getBody(),
+    std::function<void(const ir::CallStmt*)>([&](const ir::CallStmt* op) {
+      calls.push_back(op->callee.getName());
+    }));
+  return calls;
+}
+
+/// Returns the settings that store assembled matrices as sliced ELLPACK, with
+/// slices of 4 rows sorted within windows of 8 rows.
+static Settings getSlicedSettings() {
+  Settings settings = getSettings();
+  settings.matrixStorage = "sell";
+  settings.sellSliceHeight = 4;
+  settings.sellSortWindow = 8;
+  return settings;
+}
+
+TEST(system, gemv_spmv_calls) {
+  // The products in these tests lower to the blocked kernels
+  for (std::string name : {"gemv_spmv_1", "gemv_spmv_2", "gemv_spmv_4",
+                           "gemv_spmv_6", "gemv_blocked_local"}) {
+    SCOPED_TRACE(name);
+    std::vector<std::string> calls = getMainCalls(name);
+    ASSERT_EQ(1, std::count(calls.begin(), calls.end(), "spmv"));
+    ASSERT_EQ(1, std::count(calls.begin(), calls.end(), "spmvt"));
+  }
+}
+
+TEST(system, gemv_sliced_calls) {
+  // The sliced matrix is packed once after assembly and A*b reads the sliced
+  // copy, while b'*A still reads the CSR values
+  RestoreSettings restoreSettings;
+  init(getSlicedSettings());
+  std::vector<std::string> calls = getMainCalls("gemv_blocked_sliced");
+  ASSERT_EQ(1, std::count(calls.begin(), calls.end(), "sellpack"));
+  ASSERT_EQ(1, std::count(calls.begin(), calls.end(), "sellmv"));
+  ASSERT_EQ(0, std::count(calls.begin(), calls.end(), "spmv"));
+  ASSERT_EQ(1, std::count(calls.begin(), calls.end(), "spmvt"));
+  ASSERT_LT(std::find(calls.begin(), calls.end(), "sellpack"),
+            std::find(calls.begin(), calls.end(), "sellmv"));
+}
+
+TEST(system, gemv_spmv_1) {
+  Set points;
+  points.addField<simit_float>("b");
+  points.addField<simit_float>("c");
+  points.addField<simit_float>("d");
+  Set springs(points,points);
+  springs.addField<simit_float>("a");
+  checkSpMV<1>(TEST_FILE_NAME, &points, &springs, getSettings());
+}
+
+TEST(system, gemv_spmv_2) {
+  Set points;
+  points.addField<simit_float,2>("b");
+  points.addField<simit_float,2>("c");
+  points.addField<simit_float,2>("d");
+  Set springs(points,points);
+  springs.addField<simit_float,2,2>("a");
+  checkSpMV<2>(TEST_FILE_NAME, &points, &springs, getSettings());
+}
+
+TEST(system, gemv_spmv_4) {
+  Set points;
+  points.addField<simit_float,4>("b");
+  points.addField<simit_float,4>("c");
+  points.addField<simit_float,4>("d");
+  Set springs(points,points);
+  springs.addField<simit_float,4,4>("a");
+  checkSpMV<4>(TEST_FILE_NAME, &points, &springs, getSettings());
+}
+
+TEST(system, gemv_spmv_6) {
+  Set points;
+  points.addField<simit_float,6>("b");
+  points.addField<simit_float,6>("c");
+  points.addField<simit_float,6>("d");
+  Set springs(points,points);
+  springs.addField<simit_float,6,6>("a");
+  checkSpMV<6>(TEST_FILE_NAME, &points, &springs, getSettings());
+}
+
+TEST(system, gemv_blocked_sliced) {
+  if (kBackend != "cpu") {
+    return;
+  }
+  Set points;
+  points.addField<simit_float,3>("b");
+  points.addField<simit_float,3>("c");
+  points.addField<simit_float,3>("d");
+  Set springs(points,points);
+  springs.addField<simit_float,3,3>("a");
+  checkSpMV<3>(TEST_FILE_NAME, &points, &springs, getSlicedSettings());
+}
+
 TEST(system, gemv_blocked_nw) {
   // Points
   Set points;
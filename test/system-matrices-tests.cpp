@@ -1,5 +1,8 @@
 #include "simit-test.h"
 
+#include <algorithm>
+#include <cstdlib>
+
 #include "init.h"
 #include "graph.h"
 
@@ -707,6 +710,129 @@ TEST(system, gemm) {
   ASSERT_EQ(25276.0, (double)c.get(p2));
 }
 
+extern "C" int dspmm(int Bn,  int Bm,  int* Browptr, int* Bcolidx,
+                     int Bnn, int Bmm, double* Bvals,
+                     int Cn,  int Cm,  int* Crowptr, int* Ccolidx,
+                     int Cnn, int Cmm, double* Cvals,
+                     int An,  int Am,  int** Arowptr, int** Acolidx,
+                     int Ann, int Amm, double** Avals);
+
+/// A blocked CSR matrix of rows x cols blocks, each with n x m values.
+struct BlockedCSR {
+  int rows, cols, n, m;
+  vector<int> rowptr, colidx;
+  vector<double> vals;
+};
+
+/// Returns a matrix whose pattern and values depend on `seed`. Every block row
+/// has the diagonal block (if it exists) and a seed-dependent set of others.
+static BlockedCSR makeBlockedCSR(int rows, int cols, int n, int m, int seed) {
+  BlockedCSR A = {rows, cols, n, m, {0}, {}, {}};
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < cols; ++j) {
+      if (i == j || (i*7 + j*3 + seed) % 5 == 0) {
+        A.colidx.push_back(j);
+        for (int k = 0; k < n*m; ++k) {
+          A.vals.push_back(0.25*(i+1) - 0.5*j + k + seed);
+        }
+      }
+    }
+    A.rowptr.push_back(A.colidx.size());
+  }
+  return A;
+}
+
+static vector<double> toDense(const BlockedCSR& A) {
+  int width = A.cols*A.m;
+  vector<double> dense(A.rows*A.n * width, 0.0);
+  for (int i = 0; i < A.rows; ++i) {
+    for (int ij = A.rowptr[i]; ij < A.rowptr[i+1]; ++ij) {
+      for (int bi = 0; bi < A.n; ++bi) {
+        for (int bj = 0; bj < A.m; ++bj) {
+          dense[(i*A.n+bi)*width + A.colidx[ij]*A.m+bj] =
+              A.vals[(ij*A.n + bi)*A.m + bj];
+        }
+      }
+    }
+  }
+  return dense;
+}
+
+/// Multiplies B and C with dspmm and checks the product against a dense
+/// product.
+static void checkSpmm(BlockedCSR B, BlockedCSR C) {
+  int* Arowptr;
+  int* Acolidx;
+  double* Avals;
+  dspmm(B.rows*B.n, B.cols*B.m, B.rowptr.data(), B.colidx.data(),
+        B.n, B.m, B.vals.data(),
+        C.rows*C.n, C.cols*C.m, C.rowptr.data(), C.colidx.data(),
+        C.n, C.m, C.vals.data(),
+        B.rows*B.n, C.cols*C.m, &Arowptr, &Acolidx,
+        B.n, C.m, &Avals);
+  int nnz = Arowptr[B.rows];
+  BlockedCSR A = {B.rows, C.cols, B.n, C.m,
+                  vector<int>(Arowptr, Arowptr + B.rows+1),
+                  vector<int>(Acolidx, Acolidx + nnz),
+                  vector<double>(Avals, Avals + nnz*B.n*C.m)};
+  free(Arowptr);
+  free(Acolidx);
+  free(Avals);
+
+  for (int i = 0; i < A.rows; ++i) {
+    ASSERT_TRUE(std::is_sorted(A.colidx.begin() + A.rowptr[i],
+                               A.colidx.begin() + A.rowptr[i+1]));
+  }
+
+  vector<double> b = toDense(B);
+  vector<double> c = toDense(C);
+  vector<double> a = toDense(A);
+  int inner = B.cols*B.m;
+  int width = C.cols*C.m;
+  for (int i = 0; i < B.rows*B.n; ++i) {
+    for (int j = 0; j < width; ++j) {
+      double expected = 0.0;
+      for (int k = 0; k < inner; ++k) {
+        expected += b[i*inner + k] * c[k*width + j];
+      }
+      ASSERT_DOUBLE_EQ(expected, a[i*width + j]) << i << "," << j;
+    }
+  }
+}
+
+TEST(spmm, cached_pattern) {
+  BlockedCSR B = makeBlockedCSR(6, 5, 2, 2, 1);
+  BlockedCSR C = makeBlockedCSR(5, 7, 2, 2, 2);
+  checkSpmm(B, C);
+
+  // The second product has the same patterns (in other arrays), so it reuses
+  // the cached product pattern with new values
+  for (double& val : B.vals) {
+    val = 2.0*val + 1.0;
+  }
+  for (double& val : C.vals) {
+    val = -val;
+  }
+  checkSpmm(B, C);
+}
+
+TEST(spmm, cache_eviction) {
+  // More operand patterns (of B's with different numbers of rows) than the
+  // cache holds, so that each pattern is evicted before it is used again
+  for (int round = 0; round < 2; ++round) {
+    for (int rows = 1; rows <= 20; ++rows) {
+      checkSpmm(makeBlockedCSR(rows, 6, 1, 1, rows),
+                makeBlockedCSR(6, 8, 1, 1, 0));
+    }
+  }
+}
+
+TEST(spmm, nonsquare_blocks) {
+  // 2x3 blocks times 3x4 blocks gives 2x4 blocks
+  checkSpmm(makeBlockedCSR(5, 4, 2, 3, 3), makeBlockedCSR(4, 6, 3, 4, 4));
+  checkSpmm(makeBlockedCSR(3, 6, 1, 3, 5), makeBlockedCSR(6, 2, 3, 1, 6));
+}
+
 TEST(DISABLED_system, gemm_blocked) {
   // Points
   Set points;
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+
+#include "program.h"
+#include "error.h"
+#include "util/util.h"
+
+using namespace std;
+using namespace simit;
+
+static void printUsage() {
+  cerr << "Usage: simit-compile [options] <simit-source> " << endl << endl
+       << "Options:"            << endl
+       << "-emit-obj"           << endl
+       << "-emit-so"            << endl
+       << "-single-float"       << endl
+       << "-compile=<function>" << endl
+       << "-cpu=<cpu>"          << endl
+       << "-o=<output>"         << endl << endl
+       << "Writes the compiled function to <output> (default <function>.o or "
+       << "<function>.so)" << endl
+       << "and a C header that declares it next to it. The code runs on any "
+       << "CPU of the" << endl
+       << "target architecture unless -cpu names a CPU (or native)." << endl;
+}
+
+static string removeExtension(string filename) {
+  size_t dot = filename.find_last_of('.');
+  size_t slash = filename.find_last_of('/');
+  if (dot != string::npos && (slash == string::npos || dot > slash)) {
+    filename = filename.substr(0, dot);
+  }
+  return filename;
+}
+
+/// Quote the argument for the shell, so that paths with spaces or shell
+/// metacharacters reach the command unchanged.
+static string shellQuote(const string& arg) {
+  string quoted = "'";
+  for (char c : arg) {
+    if (c == '\'') {
+      quoted += "'\\''";
+    }
+    else {
+      quoted += c;
+    }
+  }
+  return quoted + "'";
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2) {
+    printUsage();
+    return 3;
+  }
+
+  bool singleFloat = false;
+  bool sharedObject = false;
+
+  string function;
+  string cpu = "generic";
+  string output;
+  string sourceFile;
+
+  // Parse Arguments
+  for (int i=1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg[0] == '-') {
+      std::vector<std::string> keyValPair = simit::util::split(arg, "=");
+      if (keyValPair.size() == 1) {
+        if (arg == "-emit-obj") {
+          sharedObject = false;
+        }
+        else if (arg == "-emit-so") {
+          sharedObject = true;
+        }
+        else if (arg == "-single-float") {
+          singleFloat = true;
+        }
+        else {
+          printUsage();
+          return 3;
+        }
+      }
+      else if (keyValPair.size() == 2) {
+        if (keyValPair[0] == "-compile") {
+          function = keyValPair[1];
+        }
+        else if (keyValPair[0] == "-cpu") {
+          cpu = keyValPair[1];
+        }
+        else if (keyValPair[0] == "-o") {
+          output = keyValPair[1];
+        }
+        else {
+          printUsage();
+          return 3;
+        }
+      }
+      else {
+        printUsage();
+        return 3;
+      }
+    }
+    else {
+      if (sourceFile != "") {
+        printUsage();
+        return 3;
+      }
+      else {
+        sourceFile = arg;
+      }
+    }
+  }
+  if (sourceFile == "") {
+    printUsage();
+    return 3;
+  }
+
+  Settings settings;
+  settings.floatSize = singleFloat ? sizeof(float) : sizeof(double);
+  settings.targetCPU = cpu;
+  simit::init(settings);
+
+  Program program;
+  int status = program.loadFile(sourceFile);
+  if (status != 0) {
+    cerr << program.getDiagnostics() << endl;
+    return 1;
+  }
+
+  if (function == "") {
+    vector<string> functions = program.getFunctionNames();
+    if (functions.size() != 1) {
+      cerr << "Error: choose which function to compile using "
+           << "-compile=<function>" << endl;
+      return 5;
+    }
+    function = functions[0];
+  }
+  else {
+    vector<string> functions = program.getFunctionNames();
+    if (find(functions.begin(), functions.end(), function) == functions.end()) {
+      cerr << "Error: Could not find function " << function << " in "
+           << sourceFile << endl;
+      return 4;
+    }
+  }
+
+  if (output == "") {
+    output = function + (sharedObject ? ".so" : ".o");
+  }
+  string objectFile = sharedObject ? removeExtension(output) + ".o" : output;
+  string headerFile = removeExtension(output) + ".h";
+
+  Function func = program.compile(function);
+
+  ofstream objectStream(objectFile, ios_base::trunc | ios_base::binary);
+  func.printObject(objectStream);
+  objectStream.close();
+
+  ofstream headerStream(headerFile, ios_base::trunc);
+  func.printHeader(headerStream);
+  headerStream.close();
+
+  // Link the object into a shared library with the system compiler
+  if (sharedObject) {
+    string command = "cc -shared -o " + shellQuote(output) + " " +
+                     shellQuote(objectFile);
+    status = std::system(command.c_str());
+    std::remove(objectFile.c_str());
+    if (status != 0) {
+      cerr << "Error: Could not link " << output << endl;
+      return 6;
+    }
+  }
+
+  return 0;
+}
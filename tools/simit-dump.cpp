@@ -14,6 +14,7 @@
 #include "error.h"
 #include "util/util.h"
 #include "storage.h"
+#include "compile_profile.h"
 
 #include "backend/backend.h"
 #include "backend/backend_function.h"
@@ -32,6 +33,7 @@ static void printUsage() {
        << "-single-float"       << endl
        << "-compile=<function>" << endl
        << "-section=<section>"  << endl
+       << "-time-passes"        << endl
        << "-gpu";
 }
 const ios_base::openmode outputMode = ios_base::trunc;
@@ -51,6 +53,7 @@ int main(int argc, const char* argv[]) {
   bool compile = false;
   bool fileoutput = false;
   bool gpu = false;
+  bool timePasses = false;
 
   ostream* simitos = nullptr;
   ostream* llvmos  = nullptr;
@@ -97,6 +100,9 @@ int main(int argc, const char* argv[]) {
           singleFloat = true;
           gpu = true;
         }
+        else if (arg == "-time-passes") {
+          timePasses = true;
+        }
         else {
           printUsage();
           return 3;
@@ -251,11 +257,15 @@ int main(int argc, const char* argv[]) {
       *simitos << "% Compile " << function << endl;
     }
 
+    // Profile the passes that compile the function
+    CompileProfile profile(func.getName());
+    CompileProfileScope profileScope(timePasses ? &profile : nullptr);
+
     func = lower(func, simitos);
 
     // Emit and print llvm code
     // NB: The LLVM code gets further optimized at init time (OSR, etc.)
-    if (llvmos || asmos) {
+    if (llvmos || asmos || (timePasses && !gpu)) {
       backend::Backend backend("cpu");
       simit::Function  llvmFunc(backend.compile(func));
 
@@ -282,6 +292,10 @@ int main(int argc, const char* argv[]) {
       }
       cout << util::trim(util::toString(llvmFunc)) << endl;
     }
+
+    if (timePasses) {
+      cerr << profile;
+    }
   }
 
   return 0;